@@ -31,6 +31,8 @@
 #ifndef DESKTOP_MAILER_ACCOUNT_H
 # define DESKTOP_MAILER_ACCOUNT_H
 
+# include <stdint.h>
+# include <netdb.h>
 # include <openssl/ssl.h>
 # include "folder.h"
 # include "message.h"
@@ -105,15 +107,26 @@ typedef union _AccountEvent
 } AccountEvent;
 
 
+/* AccountLookup */
+typedef void (*AccountLookupCallback)(struct addrinfo const * ai,
+		char const * error, void * data);
+
+
 /* AccountPlugin */
 typedef struct _AccountPluginHelper
 {
 	Account * account;
 	/* accessors */
 	SSL_CTX * (*get_ssl_context)(Account * account);
+	SSL_SESSION * (*get_ssl_session)(Account * account,
+			char const * key);	/* "host:port" */
 	/* useful */
 	int (*error)(Account * account, char const * message, int ret);
 	void (*event)(Account * account, AccountEvent * event);
+	unsigned int (*lookup)(Account * account, char const * hostname,
+			uint16_t port, AccountLookupCallback callback,
+			void * data);
+	void (*lookup_cancel)(Account * account, unsigned int id);
 	/* authentication */
 	char * (*authenticate)(Account * account, char const * message);
 	int (*confirm)(Account * account, char const * message);
@@ -121,15 +134,21 @@ typedef struct _AccountPluginHelper
 	Folder * (*folder_new)(Account * account, AccountFolder * folder,
 			Folder * parent, FolderType type, char const * name);
 	void (*folder_delete)(Folder * folder);
+	void (*folder_set_count)(Folder * folder, unsigned int total,
+			unsigned int unread);
 	/* messages */
 	Message * (*message_new)(Account * account, Folder * folder,
 			AccountMessage * message);
+	int (*messages_add)(Account * account, Folder * folder,
+			Message ** messages, size_t cnt);
 	void (*message_delete)(Message * message);
+	void (*message_set_match)(Message * message, int match);
 	void (*message_set_flag)(MailerMessage * message,
 			MailerMessageFlag flag);
 	int (*message_set_header)(Message * message, char const * header);
 	int (*message_set_body)(Message * message, char const * buf, size_t cnt,
 			int append);
+	void (*message_set_body_complete)(Message * message);
 } AccountPluginHelper;
 
 typedef struct _AccountPlugin AccountPlugin;
@@ -150,6 +169,11 @@ typedef const struct _AccountPluginDefinition
 	void (*stop)(AccountPlugin * plugin);
 	int (*refresh)(AccountPlugin * plugin, AccountFolder * folder,
 			AccountMessage * message);
+	int (*search)(AccountPlugin * plugin, AccountFolder * folder,
+			char const * text);
+	int (*set_flag)(AccountPlugin * plugin, AccountFolder * folder,
+			AccountMessage * message, MailerMessageFlag flag,
+			int set);
 } AccountPluginDefinition;
 
 #endif /* !DESKTOP_MAILER_ACCOUNT_H */
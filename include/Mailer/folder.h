@@ -56,7 +56,12 @@ typedef enum _MailerFolderType
 /* functions */
 /* accessors */
 char const * folder_get_name(MailerFolder * folder);
+unsigned int folder_get_total(MailerFolder * folder);
 FolderType folder_get_type(MailerFolder * folder);
+unsigned int folder_get_unread(MailerFolder * folder);
+
+void folder_set_count(MailerFolder * folder, unsigned int total,
+		unsigned int unread);
 void folder_set_type(MailerFolder * folder, FolderType type);
 
 #endif /* !DESKTOP_MAILER_FOLDER_H */
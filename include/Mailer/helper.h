@@ -31,11 +31,27 @@
 #ifndef DESKTOP_MAILER_HELPER_H
 # define DESKTOP_MAILER_HELPER_H
 
+# include <sys/types.h>
 # include <time.h>
 
 
 /* public */
+/* types */
+/* spans of an address, pointing within the header parsed */
+typedef struct _MailerHelperAddress
+{
+	char const * name;
+	size_t name_len;
+	char const * email;
+	size_t email_len;
+} MailerHelperAddress;
+
+
 /* functions */
+char const * mailer_helper_get_address(char const * header,
+		MailerHelperAddress * address);
+size_t mailer_helper_get_address_name(MailerHelperAddress const * address,
+		char * buf, size_t size);
 time_t mailer_helper_get_date(char const * date, struct tm * tm);
 
 char * mailer_helper_get_email(char const * header);
@@ -43,4 +59,6 @@ char * mailer_helper_get_name(char const * header);
 
 int mailer_helper_is_email(char const * email);
 
+int mailer_helper_parse_date(char const * date, struct tm * tm, time_t * t);
+
 #endif /* DESKTOP_MAILER_HELPER_H */
@@ -47,9 +47,9 @@ typedef enum _MailerHeaderColumn
 {
 	MHC_ACCOUNT = 0, MHC_FOLDER, MHC_MESSAGE, MHC_ICON, MHC_SUBJECT,
 	MHC_FROM, MHC_FROM_EMAIL, MHC_TO, MHC_TO_EMAIL, MHC_DATE,
-	MHC_DATE_DISPLAY, MHC_READ, MHC_WEIGHT
+	MHC_DATE_DISPLAY, MHC_READ, MHC_WEIGHT, MHC_MATCH
 } MailerHeaderColumn;
-# define MHC_LAST MHC_WEIGHT
+# define MHC_LAST MHC_MATCH
 # define MHC_COUNT (MHC_LAST + 1)
 
 /* folders */
@@ -53,6 +53,11 @@ typedef struct _AccountMessage AccountMessage;
 
 /* functions */
 /* accessors */
+/* attachments */
+char const * message_get_attachment_name(MailerMessage * message,
+		size_t index);
+size_t message_get_attachments_count(MailerMessage * message);
+
 /* flags */
 int message_get_flags(MailerMessage * message);
 void message_set_flag(MailerMessage * message, MailerMessageFlag flag);
@@ -63,5 +68,7 @@ char const * message_get_header(MailerMessage * message, char const * header);
 
 /* useful */
 int message_save(MailerMessage * message, char const * filename);
+int message_save_attachment(MailerMessage * message, size_t index,
+		char const * filename);
 
 #endif /* !DESKTOP_MAILER_MESSAGE_H */
@@ -41,6 +41,7 @@ typedef struct _MailerPluginHelper
 {
 	Mailer * mailer;
 	int (*error)(Mailer * mailer, char const * message, int ret);
+	int (*search)(Mailer * mailer, char const * text);
 } MailerPluginHelper;
 
 typedef struct _MailerPlugin MailerPlugin;
@@ -80,11 +80,17 @@ struct _Account
 /* accessors */
 static gboolean _account_get_iter(Account * account, GtkTreeIter * iter);
 static SSL_CTX * _account_helper_get_ssl_context(Account * account);
+static SSL_SESSION * _account_helper_get_ssl_session(Account * account,
+		char const * key);
 
 /* useful */
 static int _account_helper_error(Account * account, char const * message,
 		int ret);
 static void _account_helper_event(Account * account, AccountEvent * event);
+static unsigned int _account_helper_lookup(Account * account,
+		char const * hostname, uint16_t port,
+		AccountLookupCallback callback, void * data);
+static void _account_helper_lookup_cancel(Account * account, unsigned int id);
 static char * _account_helper_authenticate(Account * account,
 		char const * message);
 static int _account_helper_confirm(Account * account, char const * message);
@@ -94,7 +100,10 @@ static Folder * _account_helper_folder_new(Account * account,
 static void _account_helper_folder_delete(Folder * folder);
 static Message * _account_helper_message_new(Account * account, Folder * folder,
 		AccountMessage * message);
+static int _account_helper_messages_add(Account * account, Folder * folder,
+		Message ** messages, size_t cnt);
 static void _account_helper_message_delete(Message * message);
+static void _account_helper_message_set_match(Message * message, int match);
 static int _account_helper_message_set_body(Message * message, char const * buf,
 		size_t cnt, int append);
 
@@ -104,17 +113,24 @@ static const AccountPluginHelper _account_plugin_helper =
 {
 	NULL,
 	_account_helper_get_ssl_context,
+	_account_helper_get_ssl_session,
 	_account_helper_error,
 	_account_helper_event,
+	_account_helper_lookup,
+	_account_helper_lookup_cancel,
 	_account_helper_authenticate,
 	_account_helper_confirm,
 	_account_helper_folder_new,
 	_account_helper_folder_delete,
+	folder_set_count,
 	_account_helper_message_new,
+	_account_helper_messages_add,
 	_account_helper_message_delete,
+	_account_helper_message_set_match,
 	message_set_flag,
 	message_set_header,
-	_account_helper_message_set_body
+	_account_helper_message_set_body,
+	message_set_body_complete
 };
 
 
@@ -375,6 +391,72 @@ void account_refresh(Account * account)
 }
 
 
+/* account_search */
+static gboolean _search_foreach(GtkTreeModel * model, GtkTreePath * path,
+		GtkTreeIter * iter, gpointer data);
+
+int account_search(Account * account, Folder * folder, char const * text)
+{
+	GtkTreeModel * model;
+	AccountFolder * af;
+	gchar * p;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s(\"%s\", \"%s\", \"%s\")\n", __func__,
+			account_get_name(account), folder_get_name(folder),
+			text);
+#endif
+	if((model = GTK_TREE_MODEL(folder_get_messages(folder))) == NULL)
+		return -1;
+	/* clear the previous results */
+	gtk_tree_model_foreach(model, _search_foreach, NULL);
+	if(text == NULL || text[0] == '\0')
+		return 0;
+	/* let the server search inside the messages if possible */
+	if(account->definition->search != NULL
+			&& (af = folder_get_data(folder)) != NULL
+			&& account->definition->search(account->account, af,
+				text) == 0)
+		return 0;
+	/* otherwise only match the headers known locally */
+	if((p = g_utf8_casefold(text, -1)) == NULL)
+		return -1;
+	gtk_tree_model_foreach(model, _search_foreach, p);
+	g_free(p);
+	return 0;
+}
+
+static gboolean _search_foreach(GtkTreeModel * model, GtkTreePath * path,
+		GtkTreeIter * iter, gpointer data)
+{
+	gchar const * text = data;
+	MailerHeaderColumn columns[] = { MHC_SUBJECT, MHC_FROM, MHC_FROM_EMAIL,
+		MHC_TO, MHC_TO_EMAIL };
+	gboolean match = FALSE;
+	size_t i;
+	Message * message;
+	gchar * p;
+	gchar * q;
+
+	for(i = 0; text != NULL && match == FALSE
+			&& i < sizeof(columns) / sizeof(*columns); i++)
+	{
+		gtk_tree_model_get(model, iter, columns[i], &p, -1);
+		if(p == NULL)
+			continue;
+		q = g_utf8_casefold(p, -1);
+		g_free(p);
+		if(q != NULL && strstr(q, text) != NULL)
+			match = TRUE;
+		g_free(q);
+	}
+	gtk_tree_model_get(model, iter, MHC_MESSAGE, &message, -1);
+	if(message != NULL)
+		message_set_match(message, match);
+	return FALSE;
+}
+
+
 /* account_select */
 GtkTextBuffer * account_select(Account * account, Folder * folder,
 		Message * message)
@@ -391,6 +473,9 @@ GtkTextBuffer * account_select(Account * account, Folder * folder,
 		return NULL;
 	if(message != NULL && (am = message_get_data(message)) == NULL)
 		return NULL;
+	/* the body is only obtained again once released from the cache */
+	if(message != NULL && message_cache_lookup(message) == TRUE)
+		return message_get_body(message);
 	if(account->definition->refresh != NULL
 			&& account->definition->refresh(account->account, af,
 				am) != 0)
@@ -424,6 +509,25 @@ GtkTextBuffer * account_select_source(Account * account, Folder * folder,
 }
 
 
+/* account_set_read */
+int account_set_read(Account * account, Folder * folder, Message * message,
+		gboolean read)
+{
+	AccountFolder * af;
+	AccountMessage * am;
+
+	/* update the interface first */
+	message_set_read(message, read);
+	if(account->definition->set_flag == NULL || account->account == NULL)
+		return 0;
+	if((af = folder_get_data(folder)) == NULL
+			|| (am = message_get_data(message)) == NULL)
+		return -1;
+	return account->definition->set_flag(account->account, af, am,
+			MMF_READ, read ? 1 : 0);
+}
+
+
 /* account_start */
 int account_start(Account * account)
 {
@@ -494,6 +598,14 @@ static SSL_CTX * _account_helper_get_ssl_context(Account * account)
 }
 
 
+/* account_helper_get_ssl_session */
+static SSL_SESSION * _account_helper_get_ssl_session(Account * account,
+		char const * key)
+{
+	return mailer_get_ssl_session(account->mailer, key);
+}
+
+
 /* useful */
 /* account_helper_error */
 static int _account_helper_error(Account * account, char const * message,
@@ -555,6 +667,32 @@ static void _helper_event_status(Account * account, AccountEvent * event)
 }
 
 
+/* account_helper_lookup */
+static unsigned int _account_helper_lookup(Account * account,
+		char const * hostname, uint16_t port,
+		AccountLookupCallback callback, void * data)
+{
+	Lookup * lookup;
+
+	if((lookup = mailer_get_lookup(account->mailer)) == NULL)
+	{
+		error_set_code(1, "%s", strerror(ENOSYS));
+		return 0;
+	}
+	return lookup_resolve(lookup, hostname, port, callback, data);
+}
+
+
+/* account_helper_lookup_cancel */
+static void _account_helper_lookup_cancel(Account * account, unsigned int id)
+{
+	Lookup * lookup;
+
+	if((lookup = mailer_get_lookup(account->mailer)) != NULL)
+		lookup_cancel(lookup, id);
+}
+
+
 /* account_helper_authenticate */
 static char * _account_helper_authenticate(Account * account,
 		char const * message)
@@ -682,25 +820,42 @@ static Message * _account_helper_message_new(Account * account, Folder * folder,
 		AccountMessage * message)
 {
 	Message * ret;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s()\n", __func__);
+#endif
+	if((ret = message_new(message, NULL, NULL)) == NULL || folder == NULL)
+		return ret;
+	_account_helper_messages_add(account, folder, &ret, 1);
+	return ret;
+}
+
+
+/* account_helper_messages_add */
+static int _account_helper_messages_add(Account * account, Folder * folder,
+		Message ** messages, size_t cnt)
+{
 	GtkTreeStore * store;
 	GtkTreeIter iter;
+	size_t i;
 
 #ifdef DEBUG
-	fprintf(stderr, "DEBUG: %s()\n", __func__);
+	fprintf(stderr, "DEBUG: %s(%lu)\n", __func__, (unsigned long)cnt);
 #endif
-	if(folder == NULL)
-		return message_new(message, NULL, NULL);
+	if(cnt == 0)
+		return 0;
 	store = folder_get_messages(folder);
-	gtk_tree_store_append(store, &iter, NULL);
-	if((ret = message_new(message, store, &iter)) == NULL)
-		gtk_tree_store_remove(store, &iter);
-	else
+	/* the rows are sorted once the messages are all added */
+	folder_sort_suspend(folder);
+	for(i = 0; i < cnt; i++)
 	{
-		gtk_tree_store_set(store, &iter, MHC_ACCOUNT, account,
-				MHC_FOLDER, folder, -1);
-		mailer_set_status(account->mailer, NULL);
+		/* prepending is faster and the order does not matter yet */
+		gtk_tree_store_insert_with_values(store, &iter, NULL, 0,
+				MHC_ACCOUNT, account, MHC_FOLDER, folder, -1);
+		message_set_store(messages[i], store, &iter);
 	}
-	return ret;
+	mailer_set_status(account->mailer, NULL);
+	return 0;
 }
 
 
@@ -709,14 +864,31 @@ static void _account_helper_message_delete(Message * message)
 {
 	GtkTreeStore * store;
 	GtkTreeIter iter;
+	Folder * folder = NULL;
 
 	if((store = message_get_store(message)) != NULL
 			&& message_get_iter(message, &iter) != FALSE)
+	{
+		gtk_tree_model_get(GTK_TREE_MODEL(store), &iter, MHC_FOLDER,
+				&folder, -1);
+		/* move the rows of the replies out of this one first */
+		if(folder != NULL)
+			threads_remove(folder_get_threads(folder), message);
 		gtk_tree_store_remove(store, &iter);
+		if(folder != NULL)
+			folder_intern_release(folder);
+	}
 	message_delete(message);
 }
 
 
+/* account_helper_message_set_match */
+static void _account_helper_message_set_match(Message * message, int match)
+{
+	message_set_match(message, (match != 0) ? TRUE : FALSE);
+}
+
+
 /* account_helper_message_set_body */
 static int _account_helper_message_set_body(Message * message, char const * buf,
 		size_t cnt, int append)
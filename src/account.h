@@ -62,6 +62,7 @@ int account_init(Account * account);
 int account_quit(Account * account);
 
 void account_refresh(Account * account);
+int account_search(Account * account, Folder * folder, char const * text);
 int account_start(Account * account);
 void account_stop(Account * account);
 
@@ -72,4 +73,7 @@ GtkTextBuffer * account_select(Account * account, Folder * folder,
 GtkTextBuffer * account_select_source(Account * account, Folder * folder,
 		Message * message);
 
+int account_set_read(Account * account, Folder * folder, Message * message,
+		gboolean read);
+
 #endif /* !MAILER_ACCOUNT_H */
@@ -28,37 +28,646 @@
 
 
 
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <utime.h>
+#include <errno.h>
 #include <netdb.h>
 
 
+/* private */
+/* types */
+typedef struct _CommonCacheEntry
+{
+	char name[17];
+	size_t size;
+	time_t atime;
+} CommonCacheEntry;
+
+typedef struct _CommonCache
+{
+	char * path;
+	size_t size;
+	size_t limit;
+
+	CommonCacheEntry * entries;
+	size_t entries_cnt;
+} CommonCache;
+
+typedef void (*CommonConnectCallback)(int fd, struct addrinfo * ai, int error,
+		void * data);
+
+typedef struct _CommonConnect CommonConnect;
+
+typedef struct _CommonConnectAttempt
+{
+	CommonConnect * connect;
+	struct addrinfo * ai;
+	int fd;
+	GIOChannel * channel;
+	guint source;
+} CommonConnectAttempt;
+
+struct _CommonConnect
+{
+	CommonConnectAttempt * attempts;
+	size_t attempts_cnt;
+	size_t next;
+	size_t pending;
+	guint source;
+	int error;
+
+	CommonConnectCallback callback;
+	void * data;
+};
+
+
+/* constants */
+#define COMMON_CACHE_DIRECTORY	"Mailer"
+#define COMMON_CONNECT_DELAY	250
+#define COMMON_HASH_INIT	0xcbf29ce484222325ULL
+
+
 /* prototypes */
-static int _common_lookup(char const * hostname, uint16_t port,
-		struct addrinfo ** ai);
+/* cache */
+static CommonCache * _common_cache_new(char const * type,
+		char const * account, size_t limit);
+static void _common_cache_delete(CommonCache * cache);
+
+static char * _common_cache_get(CommonCache * cache, char const * key,
+		size_t * len);
+static int _common_cache_set(CommonCache * cache, char const * key,
+		char const * buf, size_t len);
+
+static int _common_cache_message(AccountPluginHelper * helper,
+		Message * message, char const * buf, size_t len);
+
+/* connect */
+static CommonConnect * _common_connect_new(struct addrinfo * ai,
+		CommonConnectCallback callback, void * data);
+static void _common_connect_delete(CommonConnect * connect);
+
+/* hash */
+static uint64_t _common_hash(uint64_t hash, char const * buf, size_t len);
+
+/* lookup */
+static struct addrinfo * _common_lookup_copy(struct addrinfo const * ai);
+static void _common_lookup_free(struct addrinfo * ai);
+static char * _common_lookup_print(struct addrinfo * ai);
+
+/* ssl */
+static int _common_ssl_setup(AccountPluginHelper * helper, SSL * ssl,
+		char const * hostname, unsigned short port);
+static void _common_ssl_status(SSL * ssl, char const * hostname,
+		gint64 start, char * buf, size_t size);
 
 
 /* functions */
-/* common_lookup */
-static int _common_lookup(char const * hostname, uint16_t port,
-		struct addrinfo ** ai)
+/* cache */
+/* common_cache_new */
+static CommonCache * _common_cache_new(char const * type,
+		char const * account, size_t limit)
+{
+	CommonCache * cache;
+	char name[17];
+	GDir * dir;
+	char const * p;
+	gchar * filename;
+	struct stat st;
+	CommonCacheEntry * q;
+
+	if(limit == 0)
+		return NULL;
+	if((cache = object_new(sizeof(*cache))) == NULL)
+		return NULL;
+	/* every account gets its own directory */
+	snprintf(name, sizeof(name), "%016llx", (unsigned long long)
+			_common_hash(COMMON_HASH_INIT, account,
+				strlen(account)));
+	cache->path = g_build_filename(g_get_user_cache_dir(),
+			COMMON_CACHE_DIRECTORY, type, name, NULL);
+	cache->size = 0;
+	cache->limit = limit;
+	cache->entries = NULL;
+	cache->entries_cnt = 0;
+	if(g_mkdir_with_parents(cache->path, 0700) != 0
+			|| (dir = g_dir_open(cache->path, 0, NULL)) == NULL)
+	{
+		error_set_code(1, "%s: %s", cache->path, strerror(errno));
+		_common_cache_delete(cache);
+		return NULL;
+	}
+	/* index the current contents */
+	while((p = g_dir_read_name(dir)) != NULL)
+	{
+		filename = g_build_filename(cache->path, p, NULL);
+		if(strncmp(p, ".tmp", 4) == 0)
+			/* left over from an interrupted write */
+			unlink(filename);
+		else if(strlen(p) == sizeof(name) - 1
+				&& strspn(p, "0123456789abcdef") == strlen(p)
+				&& stat(filename, &st) == 0
+				&& (q = realloc(cache->entries, sizeof(*q)
+						* (cache->entries_cnt + 1)))
+				!= NULL)
+		{
+			cache->entries = q;
+			q = &cache->entries[cache->entries_cnt++];
+			strcpy(q->name, p);
+			q->size = st.st_size;
+			q->atime = st.st_mtime;
+			cache->size += q->size;
+		}
+		g_free(filename);
+	}
+	g_dir_close(dir);
+	return cache;
+}
+
+
+/* common_cache_delete */
+static void _common_cache_delete(CommonCache * cache)
 {
-	struct addrinfo hints;
+	free(cache->entries);
+	g_free(cache->path);
+	object_delete(cache);
+}
+
+
+/* common_cache_get */
+static CommonCacheEntry * _cache_lookup(CommonCache * cache, char const * key,
+		char * name);
+
+static char * _common_cache_get(CommonCache * cache, char const * key,
+		size_t * len)
+{
+	CommonCacheEntry * entry;
+	char name[17];
+	gchar * filename;
+	FILE * fp;
+	char * buf = NULL;
+	size_t size;
+	size_t keylen = strlen(key);
+	char * p;
+	unsigned long l;
+
+	if(cache == NULL || (entry = _cache_lookup(cache, key, name)) == NULL)
+		return NULL;
+	filename = g_build_filename(cache->path, name, NULL);
+	if((fp = fopen(filename, "r")) != NULL)
+	{
+		if((buf = malloc(entry->size + 1)) != NULL
+				&& (size = fread(buf, sizeof(*buf), entry->size,
+						fp)) == entry->size)
+		{
+			/* check the key and the length of the contents */
+			buf[size] = '\0';
+			l = strtoul(buf, &p, 10);
+			if(*p != ' ' || strncmp(++p, key, keylen) != 0
+					|| p[keylen] != '\n'
+					|| (size_t)(&buf[size] - (p += keylen
+							+ 1)) != l)
+			{
+				free(buf);
+				buf = NULL;
+			}
+			else
+			{
+				memmove(buf, p, l + 1);
+				*len = l;
+			}
+		}
+		else
+		{
+			free(buf);
+			buf = NULL;
+		}
+		fclose(fp);
+	}
+	if(buf != NULL)
+	{
+		/* the modification time tracks the last access */
+		entry->atime = time(NULL);
+		utime(filename, NULL);
+	}
+	g_free(filename);
+	return buf;
+}
+
+static CommonCacheEntry * _cache_lookup(CommonCache * cache, char const * key,
+		char * name)
+{
+	size_t i;
+
+	snprintf(name, 17, "%016llx", (unsigned long long)_common_hash(
+				COMMON_HASH_INIT, key, strlen(key)));
+	for(i = 0; i < cache->entries_cnt; i++)
+		if(strcmp(cache->entries[i].name, name) == 0)
+			return &cache->entries[i];
+	return NULL;
+}
+
+
+/* common_cache_set */
+static void _cache_evict(CommonCache * cache, CommonCacheEntry * keep);
+
+static int _common_cache_set(CommonCache * cache, char const * key,
+		char const * buf, size_t len)
+{
+	CommonCacheEntry * entry;
+	char name[17];
+	gchar * tmp;
+	gchar * filename;
+	int fd;
+	FILE * fp;
 	int res;
-	char buf[6];
 
-	if(hostname == NULL)
+	if(cache == NULL || len > cache->limit)
+		return 0;
+	entry = _cache_lookup(cache, key, name);
+	/* write to a temporary file first */
+	tmp = g_build_filename(cache->path, ".tmpXXXXXX", NULL);
+	if((fd = mkstemp(tmp)) < 0)
+	{
+		g_free(tmp);
+		return -error_set_code(1, "%s: %s", cache->path,
+				strerror(errno));
+	}
+	if((fp = fdopen(fd, "w")) == NULL)
+	{
+		close(fd);
+		unlink(tmp);
+		g_free(tmp);
+		return -error_set_code(1, "%s: %s", cache->path,
+				strerror(errno));
+	}
+	res = (fprintf(fp, "%lu %s\n", (unsigned long)len, key) < 0
+			|| fwrite(buf, sizeof(*buf), len, fp) != len) ? -1 : 0;
+	if(fclose(fp) != 0)
+		res = -1;
+	/* then move it in place */
+	filename = g_build_filename(cache->path, name, NULL);
+	if(res != 0 || rename(tmp, filename) != 0)
+	{
+		error_set_code(1, "%s: %s", filename, strerror(errno));
+		unlink(tmp);
+		g_free(filename);
+		g_free(tmp);
+		return -1;
+	}
+	g_free(filename);
+	g_free(tmp);
+	/* update the index */
+	len += snprintf(NULL, 0, "%lu %s\n", (unsigned long)len, key);
+	if(entry != NULL)
+		cache->size -= entry->size;
+	else if((entry = realloc(cache->entries, sizeof(*entry)
+					* (cache->entries_cnt + 1))) == NULL)
 		return -error_set_code(1, "%s", strerror(errno));
-	memset(&hints, 0, sizeof(hints));
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_protocol = IPPROTO_TCP;
-	hints.ai_flags = AI_NUMERICSERV;
-	snprintf(buf, sizeof(buf), "%hu", port);
-	if((res = getaddrinfo(hostname, buf, &hints, ai)) != 0)
-		return -error_set_code(1, "%s", gai_strerror(res));
+	else
+	{
+		cache->entries = entry;
+		entry = &cache->entries[cache->entries_cnt++];
+		strcpy(entry->name, name);
+	}
+	entry->size = len;
+	entry->atime = time(NULL);
+	cache->size += len;
+	_cache_evict(cache, entry);
 	return 0;
 }
 
+static void _cache_evict(CommonCache * cache, CommonCacheEntry * keep)
+{
+	CommonCacheEntry * oldest;
+	size_t i;
+	gchar * filename;
+
+	/* remove the least recently used entries until below the limit */
+	while(cache->size > cache->limit && cache->entries_cnt > 1)
+	{
+		for(oldest = NULL, i = 0; i < cache->entries_cnt; i++)
+			if(&cache->entries[i] != keep && (oldest == NULL
+						|| cache->entries[i].atime
+						< oldest->atime))
+				oldest = &cache->entries[i];
+#ifdef DEBUG
+		fprintf(stderr, "DEBUG: %s() evicting %s\n", __func__,
+				oldest->name);
+#endif
+		filename = g_build_filename(cache->path, oldest->name, NULL);
+		unlink(filename);
+		g_free(filename);
+		cache->size -= oldest->size;
+		if(&cache->entries[cache->entries_cnt - 1] == keep)
+			keep = oldest;
+		*oldest = cache->entries[--cache->entries_cnt];
+	}
+}
+
+
+/* common_cache_message */
+static int _common_cache_message(AccountPluginHelper * helper,
+		Message * message, char const * buf, size_t len)
+{
+	size_t i;
+	size_t j;
+	gchar * header;
+
+	/* headers first, up to the first empty line */
+	for(i = 0; i < len; i = j + 1)
+	{
+		for(j = i; j < len && buf[j] != '\n'; j++);
+		if(j == len || j == i || (j == i + 1 && buf[i] == '\r'))
+			break;
+		header = g_strndup(&buf[i], (buf[j - 1] == '\r')
+				? j - i - 1 : j - i);
+		helper->message_set_header(message, header);
+		g_free(header);
+	}
+	/* then the body */
+	helper->message_set_body(message, NULL, 0, 0);
+	if(j < len)
+		helper->message_set_body(message, &buf[j + 1], len - j - 1, 1);
+	helper->message_set_body_complete(message);
+	return 0;
+}
+
+
+/* connect */
+/* common_connect_new */
+static int _connect_start(CommonConnect * connect);
+static int _connect_start_attempt(CommonConnectAttempt * attempt);
+static void _connect_close(CommonConnectAttempt * attempt);
+static void _connect_report(CommonConnect * connect, int fd,
+		struct addrinfo * ai, int error);
+/* callbacks */
+static gboolean _connect_on_delay(gpointer data);
+static gboolean _connect_on_watch(GIOChannel * source, GIOCondition condition,
+		gpointer data);
+
+static CommonConnect * _common_connect_new(struct addrinfo * ai,
+		CommonConnectCallback callback, void * data)
+{
+	CommonConnect * connect;
+	CommonConnectAttempt * attempt;
+	struct addrinfo * p;
+	size_t cnt;
+	size_t first = 0;
+	size_t other = 0;
+	size_t i = 0;
+	size_t j = 0;
+
+	for(p = ai; p != NULL; p = p->ai_next)
+		if(p->ai_family == ai->ai_family)
+			first++;
+		else
+			other++;
+	if((cnt = first + other) == 0)
+	{
+		error_set_code(1, "%s", strerror(EADDRNOTAVAIL));
+		return NULL;
+	}
+	if((connect = malloc(sizeof(*connect))) == NULL
+			|| (connect->attempts = malloc(sizeof(
+						*connect->attempts) * cnt))
+			== NULL)
+	{
+		error_set_code(1, "%s", strerror(errno));
+		free(connect);
+		return NULL;
+	}
+	connect->attempts_cnt = cnt;
+	connect->next = 0;
+	connect->pending = 0;
+	connect->source = 0;
+	connect->error = 0;
+	connect->callback = callback;
+	connect->data = data;
+	/* alternate between the address families (RFC 8305) */
+	for(p = ai; p != NULL; p = p->ai_next)
+	{
+		if(p->ai_family == ai->ai_family)
+		{
+			attempt = &connect->attempts[(i < other) ? 2 * i
+				: other + i];
+			i++;
+		}
+		else
+		{
+			attempt = &connect->attempts[(j < first) ? 2 * j + 1
+				: first + j];
+			j++;
+		}
+		attempt->connect = connect;
+		attempt->ai = p;
+		attempt->fd = -1;
+		attempt->channel = NULL;
+		attempt->source = 0;
+	}
+	if(_connect_start(connect) != 0)
+	{
+		error_set_code(1, "%s", strerror(connect->error));
+		_common_connect_delete(connect);
+		return NULL;
+	}
+	return connect;
+}
+
+static int _connect_start(CommonConnect * connect)
+{
+	CommonConnectAttempt * attempt;
+
+	while(connect->next < connect->attempts_cnt)
+	{
+		attempt = &connect->attempts[connect->next++];
+		if(_connect_start_attempt(attempt) != 0)
+		{
+			connect->error = errno;
+			continue;
+		}
+		connect->pending++;
+		/* try the next address if this one is too slow */
+		if(connect->source != 0)
+			g_source_remove(connect->source);
+		connect->source = 0;
+		if(connect->next < connect->attempts_cnt)
+			connect->source = g_timeout_add(COMMON_CONNECT_DELAY,
+					_connect_on_delay, connect);
+		return 0;
+	}
+	return -1;
+}
+
+static int _connect_start_attempt(CommonConnectAttempt * attempt)
+{
+	struct addrinfo * ai = attempt->ai;
+	int res;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s() family %d\n", __func__, ai->ai_family);
+#endif
+	if((attempt->fd = socket(ai->ai_family, ai->ai_socktype,
+					ai->ai_protocol)) == -1)
+		return -1;
+	if((res = fcntl(attempt->fd, F_GETFL)) < 0
+			|| fcntl(attempt->fd, F_SETFL, res | O_NONBLOCK) == -1
+			|| (connect(attempt->fd, ai->ai_addr, ai->ai_addrlen)
+				!= 0 && errno != EINPROGRESS
+				&& errno != EINTR))
+	{
+		res = errno;
+		close(attempt->fd);
+		attempt->fd = -1;
+		errno = res;
+		return -1;
+	}
+	attempt->channel = g_io_channel_unix_new(attempt->fd);
+	attempt->source = g_io_add_watch(attempt->channel,
+			G_IO_OUT | G_IO_ERR | G_IO_HUP, _connect_on_watch,
+			attempt);
+	return 0;
+}
+
+static void _connect_close(CommonConnectAttempt * attempt)
+{
+	if(attempt->source != 0)
+		g_source_remove(attempt->source);
+	attempt->source = 0;
+	if(attempt->channel != NULL)
+		g_io_channel_unref(attempt->channel);
+	attempt->channel = NULL;
+	if(attempt->fd >= 0)
+		close(attempt->fd);
+	attempt->fd = -1;
+}
+
+static void _connect_report(CommonConnect * connect, int fd,
+		struct addrinfo * ai, int error)
+{
+	connect->callback(fd, ai, error, connect->data);
+	_common_connect_delete(connect);
+}
+
+static gboolean _connect_on_delay(gpointer data)
+{
+	CommonConnect * connect = data;
+
+	connect->source = 0;
+	/* keep waiting for the pending attempts otherwise */
+	_connect_start(connect);
+	return FALSE;
+}
+
+static gboolean _connect_on_watch(GIOChannel * source, GIOCondition condition,
+		gpointer data)
+{
+	CommonConnectAttempt * attempt = data;
+	CommonConnect * connect = attempt->connect;
+	int fd;
+	int res;
+	socklen_t s = sizeof(res);
+
+	attempt->source = 0;
+	if(getsockopt(attempt->fd, SOL_SOCKET, SO_ERROR, &res, &s) != 0)
+		res = errno;
+	if(res != 0)
+	{
+#ifdef DEBUG
+		fprintf(stderr, "DEBUG: %s() %s\n", __func__, strerror(res));
+#endif
+		_connect_close(attempt);
+		connect->pending--;
+		connect->error = res;
+		/* try the next address immediately, even if others are still
+		 * pending: this also staggers the one after it again */
+		if(_connect_start(connect) != 0 && connect->pending == 0)
+			_connect_report(connect, -1, NULL, connect->error);
+		return FALSE;
+	}
+	/* the first connection established wins */
+	fd = attempt->fd;
+	g_io_channel_unref(attempt->channel);
+	attempt->channel = NULL;
+	attempt->fd = -1;
+	_connect_report(connect, fd, attempt->ai, 0);
+	return FALSE;
+}
+
+
+/* common_connect_delete */
+static void _common_connect_delete(CommonConnect * connect)
+{
+	size_t i;
+
+	for(i = 0; i < connect->attempts_cnt; i++)
+		_connect_close(&connect->attempts[i]);
+	if(connect->source != 0)
+		g_source_remove(connect->source);
+	free(connect->attempts);
+	free(connect);
+}
+
+
+/* hash */
+/* common_hash */
+static uint64_t _common_hash(uint64_t hash, char const * buf, size_t len)
+{
+	size_t i;
+
+	/* FNV-1a */
+	for(i = 0; i < len; i++)
+	{
+		hash ^= (unsigned char)buf[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+
+/* lookup */
+/* common_lookup_copy */
+static struct addrinfo * _common_lookup_copy(struct addrinfo const * ai)
+{
+	struct addrinfo * ret = NULL;
+	struct addrinfo ** p = &ret;
+
+	/* the results are owned by the resolver */
+	for(; ai != NULL; ai = ai->ai_next)
+	{
+		if((*p = malloc(sizeof(**p) + ai->ai_addrlen)) == NULL)
+		{
+			_common_lookup_free(ret);
+			return NULL;
+		}
+		memcpy(*p, ai, sizeof(**p));
+		(*p)->ai_addr = (struct sockaddr *)(*p + 1);
+		memcpy((*p)->ai_addr, ai->ai_addr, ai->ai_addrlen);
+		(*p)->ai_canonname = NULL;
+		(*p)->ai_next = NULL;
+		p = &(*p)->ai_next;
+	}
+	return ret;
+}
+
+
+/* common_lookup_free */
+static void _common_lookup_free(struct addrinfo * ai)
+{
+	struct addrinfo * next;
+
+	for(; ai != NULL; ai = next)
+	{
+		next = ai->ai_next;
+		free(ai);
+	}
+}
+
 
 /* common_lookup_print */
 static char * _common_lookup_print(struct addrinfo * ai)
@@ -91,3 +700,51 @@ static char * _common_lookup_print(struct addrinfo * ai)
 	}
 	return strdup(buf2);
 }
+
+
+/* ssl */
+/* common_ssl_setup */
+static int _common_ssl_setup(AccountPluginHelper * helper, SSL * ssl,
+		char const * hostname, unsigned short port)
+{
+	struct in6_addr addr;
+	char buf[INET6_ADDRSTRLEN];
+	char key[280];
+	SSL_SESSION * session;
+
+	if(hostname == NULL)
+		return 0;
+	/* IP addresses are not allowed for SNI */
+	if(inet_pton(AF_INET, hostname, &addr) == 1)
+		snprintf(key, sizeof(key), "%s:%hu", inet_ntop(AF_INET, &addr,
+					buf, sizeof(buf)), port);
+	else if(inet_pton(AF_INET6, hostname, &addr) == 1)
+		snprintf(key, sizeof(key), "[%s]:%hu", inet_ntop(AF_INET6,
+					&addr, buf, sizeof(buf)), port);
+	else if(SSL_set_tlsext_host_name(ssl, hostname) != 1)
+		return -1;
+	else
+		snprintf(key, sizeof(key), "%s:%hu", hostname, port);
+	/* resume the last session with this host and port if possible */
+	if(helper->get_ssl_session != NULL
+			&& (session = helper->get_ssl_session(helper->account,
+					key)) != NULL
+			&& SSL_set_session(ssl, session) != 1)
+		/* not fatal, perform a full handshake instead */
+		ERR_clear_error();
+	return 0;
+}
+
+
+/* common_ssl_status */
+static void _common_ssl_status(SSL * ssl, char const * hostname,
+		gint64 start, char * buf, size_t size)
+{
+	gint64 elapsed;
+
+	elapsed = (g_get_monotonic_time() - start) / 1000;
+	snprintf(buf, size, "Connected to %s (%s, handshake in %lu ms%s)",
+			hostname, SSL_get_version(ssl),
+			(unsigned long)elapsed, SSL_session_reused(ssl)
+			? ", resumed" : "");
+}
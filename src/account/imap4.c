@@ -61,9 +61,13 @@ struct _AccountFolder
 	Folder * folder;
 
 	char * name;
+	unsigned int uidvalidity;
+	unsigned int total;
+	unsigned int unseen;
 
 	AccountMessage ** messages;
 	size_t messages_cnt;
+	size_t messages_added;
 
 	AccountFolder ** folders;
 	size_t folders_cnt;
@@ -74,8 +78,19 @@ struct _AccountMessage
 	Message * message;
 
 	unsigned int id;
+	unsigned int uid;
+	unsigned int size;
+	int flags;
 };
 
+typedef enum _IMAP4Capability
+{
+	I4CAP_NONE = 0x0,
+	I4CAP_LIST_STATUS = 0x1,
+	I4CAP_ESEARCH = 0x2,
+	I4CAP_LITERALPLUS = 0x4
+} IMAP4Capability;
+
 typedef enum _IMAP4CommandStatus
 {
 	I4CS_QUEUED = 0,
@@ -93,20 +108,24 @@ typedef enum _IMAP4ConfigValue
 	I4CV_PORT,
 	I4CV_SSL,
 	I4CV_PADDING0,
-	I4CV_PREFIX
+	I4CV_PREFIX,
+	I4CV_CACHE
 } IMAP4Config;
-#define I4CV_LAST I4CV_PREFIX
+#define I4CV_LAST I4CV_CACHE
 #define I4CV_COUNT (I4CV_LAST + 1)
 
 typedef enum _IMAP4Context
 {
 	I4C_INIT = 0,
+	I4C_CAPABILITY,
 	I4C_FETCH,
 	I4C_LIST,
 	I4C_LOGIN,
 	I4C_NOOP,
+	I4C_SEARCH,
 	I4C_SELECT,
-	I4C_STATUS
+	I4C_STATUS,
+	I4C_STORE
 } IMAP4Context;
 
 typedef enum _IMAP4FetchStatus
@@ -118,6 +137,15 @@ typedef enum _IMAP4FetchStatus
 	I4FS_BODY
 } IMAP4FetchStatus;
 
+typedef struct _IMAP4JournalEntry
+{
+	AccountFolder * folder;
+	unsigned int uid;
+	MailerMessageFlag flag;
+	gboolean set;
+	size_t serial;
+} IMAP4JournalEntry;
+
 typedef struct _IMAP4Command
 {
 	uint16_t id;
@@ -125,6 +153,9 @@ typedef struct _IMAP4Command
 	IMAP4Context context;
 	char * buf;
 	size_t buf_cnt;
+	/* sent once the server is ready for it */
+	char * literal;
+	size_t literal_cnt;
 
 	union
 	{
@@ -135,6 +166,12 @@ typedef struct _IMAP4Command
 			unsigned int id;
 			IMAP4FetchStatus status;
 			unsigned int size;
+			GString * contents;
+			/* partial fetch */
+			unsigned int offset;
+			unsigned int length;
+			unsigned int consumed;
+			gboolean body;
 		} fetch;
 
 		struct
@@ -142,16 +179,29 @@ typedef struct _IMAP4Command
 			AccountFolder * parent;
 		} list;
 
+		struct
+		{
+			AccountFolder * folder;
+		} search;
+
 		struct
 		{
 			AccountFolder * folder;
 			AccountMessage * message;
+			gboolean fetch;
+			gboolean writable;
 		} select;
 
 		struct
 		{
 			AccountFolder * folder;
 		} status;
+
+		struct
+		{
+			IMAP4JournalEntry * entries;
+			size_t entries_cnt;
+		} store;
 	} data;
 } IMAP4Command;
 
@@ -161,10 +211,15 @@ typedef struct _AccountPlugin
 
 	AccountConfig * config;
 
+	CommonCache * cache;
+
+	unsigned int lookup;
+	CommonConnect * connect;
 	struct addrinfo * ai;
 	struct addrinfo * aip;
 	int fd;
 	SSL * ssl;
+	gint64 ssl_start;
 	guint source;
 
 	GIOChannel * channel;
@@ -177,10 +232,27 @@ typedef struct _AccountPlugin
 	size_t queue_cnt;
 	uint16_t queue_id;
 
+	IMAP4Capability capabilities;
+
 	AccountFolder folders;
+	AccountFolder * selected;
+	gboolean selected_writable;
+	AccountMessage * partial;
+
+	/* pending changes to the flags */
+	IMAP4JournalEntry * journal;
+	size_t journal_cnt;
+	guint journal_source;
 } IMAP4;
 
 
+/* constants */
+#define IMAP4_FETCH_RANGE_MIN	32768
+#define IMAP4_FETCH_RANGE_MAX	1048576
+#define IMAP4_JOURNAL_LENGTH	1024
+#define IMAP4_JOURNAL_TIMEOUT	500
+
+
 /* variables */
 static char const _imap4_type[] = "IMAP4";
 static char const _imap4_name[] = "IMAP4 server";
@@ -198,9 +270,25 @@ AccountConfig const _imap4_config[I4CV_COUNT + 1] =
 #endif
 	{ NULL,		NULL,			ACT_SEPARATOR,	NULL	},
 	{ "prefix",	"Prefix",		ACT_STRING,	NULL	},
+	{ "cache",	"Offline cache (MB)",	ACT_UINT16,	(void *)64 },
 	{ NULL,		NULL,			ACT_NONE,	NULL	}
 };
 
+static const struct
+{
+	char const * name;
+	MailerMessageFlag flag;
+} _imap4_message_flags[] =
+{
+	{ "\\Answered",	MMF_ANSWERED	},
+	{ "\\Deleted",	MMF_DELETED	},
+	{ "\\Draft",	MMF_DRAFT	},
+	{ "\\Flagged",	MMF_URGENT	},
+	{ "\\Seen",	MMF_READ	}
+};
+static const size_t _imap4_message_flags_cnt = sizeof(_imap4_message_flags)
+	/ sizeof(*_imap4_message_flags);
+
 
 /* prototypes */
 /* plug-in */
@@ -211,11 +299,37 @@ static int _imap4_start(IMAP4 * imap4);
 static void _imap4_stop(IMAP4 * imap4);
 static int _imap4_refresh(IMAP4 * imap4, AccountFolder * folder,
 		AccountMessage * message);
+static int _imap4_search(IMAP4 * imap4, AccountFolder * folder,
+		char const * text);
+static int _imap4_set_flag(IMAP4 * imap4, AccountFolder * folder,
+		AccountMessage * message, MailerMessageFlag flag, int set);
 
 /* useful */
+static gchar * _imap4_cache_key(IMAP4 * imap4, AccountFolder * folder,
+		AccountMessage * message);
 static IMAP4Command * _imap4_command(IMAP4 * imap4, IMAP4Context context,
 		char const * command);
+static IMAP4Command * _imap4_command_literal(IMAP4 * imap4,
+		IMAP4Context context, char const * command,
+		char const * literal);
+static IMAP4Command * _imap4_list_folders(IMAP4 * imap4,
+		AccountFolder * parent, char const * pattern);
 static int _imap4_parse(IMAP4 * imap4);
+static void _imap4_set_capabilities(IMAP4 * imap4, char const * capabilities);
+
+/* queue */
+static IMAP4Command * _imap4_queue_next(IMAP4 * imap4);
+static void _imap4_queue_pop(IMAP4 * imap4);
+static void _imap4_queue_schedule(IMAP4 * imap4);
+static AccountFolder * _imap4_queue_selected(IMAP4 * imap4,
+		gboolean * writable);
+
+/* journal */
+static int _imap4_journal_flush(IMAP4 * imap4);
+static int _imap4_journal_restore(IMAP4 * imap4, IMAP4JournalEntry * entries,
+		size_t cnt);
+static void _imap4_journal_revert(IMAP4 * imap4, IMAP4JournalEntry * entries,
+		size_t cnt);
 
 /* events */
 static void _imap4_event(IMAP4 * imap4, AccountEventType type);
@@ -227,22 +341,31 @@ static AccountFolder * _imap4_folder_new(IMAP4 * imap4, AccountFolder * parent,
 		char const * name);
 static void _imap4_folder_delete(IMAP4 * imap4,
 		AccountFolder * folder);
+static AccountFolder * _imap4_folder_find(IMAP4 * imap4,
+		AccountFolder * folder, char const * name);
 static AccountFolder * _imap4_folder_get_folder(IMAP4 * imap4,
 		AccountFolder * folder, char const * name);
 static AccountMessage * _imap4_folder_get_message(IMAP4 * imap4,
 		AccountFolder * folder, unsigned int id);
+static AccountMessage * _imap4_folder_get_message_uid(IMAP4 * imap4,
+		AccountFolder * folder, unsigned int uid);
+static void _imap4_folder_messages_add(IMAP4 * imap4,
+		AccountFolder * folder);
 
 /* messages */
 static AccountMessage * _imap4_message_new(IMAP4 * imap4,
 		AccountFolder * folder, unsigned int id);
 static void _imap4_message_delete(IMAP4 * imap4,
 		AccountMessage * message);
+static void _imap4_message_cancel(IMAP4 * imap4);
 
 /* callbacks */
 static gboolean _on_connect(gpointer data);
+static void _on_connected(int fd, struct addrinfo * ai, int error, void * data);
+static gboolean _on_journal(gpointer data);
+static void _on_lookup(struct addrinfo const * ai, char const * error,
+		void * data);
 static gboolean _on_noop(gpointer data);
-static gboolean _on_watch_can_connect(GIOChannel * source,
-		GIOCondition condition, gpointer data);
 static gboolean _on_watch_can_handshake(GIOChannel * source,
 		GIOCondition condition, gpointer data);
 static gboolean _on_watch_can_read(GIOChannel * source, GIOCondition condition,
@@ -270,7 +393,9 @@ AccountPluginDefinition account_plugin =
 	NULL,
 	_imap4_start,
 	_imap4_stop,
-	_imap4_refresh
+	_imap4_refresh,
+	_imap4_search,
+	_imap4_set_flag
 };
 
 
@@ -292,6 +417,8 @@ static IMAP4 * _imap4_init(AccountPluginHelper * helper)
 		return NULL;
 	}
 	memcpy(imap4->config, &_imap4_config, sizeof(_imap4_config));
+	imap4->lookup = 0;
+	imap4->connect = NULL;
 	imap4->ai = NULL;
 	imap4->aip = NULL;
 	imap4->fd = -1;
@@ -310,9 +437,12 @@ static int _imap4_destroy(IMAP4 * imap4)
 	if(imap4 == NULL) /* XXX _imap4_destroy() may be called uninitialized */
 		return 0;
 	_imap4_stop(imap4);
+	free(imap4->journal);
 #if 1 /* XXX anything wrong here? */
 	_imap4_folder_delete(imap4, &imap4->folders);
 #endif
+	if(imap4->cache != NULL)
+		_common_cache_delete(imap4->cache);
 	for(i = 0; i < sizeof(_imap4_config) / sizeof(*_imap4_config); i++)
 		if(_imap4_config[i].type == ACT_STRING
 				|| _imap4_config[i].type == ACT_PASSWORD)
@@ -345,6 +475,7 @@ static int _imap4_start(IMAP4 * imap4)
 /* imap4_stop */
 static void _imap4_stop(IMAP4 * imap4)
 {
+	AccountPluginHelper * helper = imap4->helper;
 	size_t i;
 
 	if(imap4->ssl != NULL)
@@ -366,17 +497,35 @@ static void _imap4_stop(IMAP4 * imap4)
 		imap4->fd = -1;
 	}
 	imap4->channel = NULL;
-	for(i = 0; i < imap4->queue_cnt; i++)
-		free(imap4->queue[i].buf);
+	/* the changes not confirmed yet are sent again later */
+	for(i = imap4->queue_cnt; i > 0; i--)
+		if(imap4->queue[i - 1].context == I4C_STORE)
+			_imap4_journal_restore(imap4,
+					imap4->queue[i - 1].data.store.entries,
+					imap4->queue[i - 1].data.store.entries_cnt);
+	while(imap4->queue_cnt > 0)
+		_imap4_queue_pop(imap4);
 	free(imap4->queue);
 	imap4->queue = NULL;
-	imap4->queue_cnt = 0;
+	imap4->capabilities = I4CAP_NONE;
+	imap4->selected = NULL;
+	imap4->selected_writable = FALSE;
+	_imap4_message_cancel(imap4);
+	/* pending changes to the flags are kept until the next selection */
+	if(imap4->journal_source != 0)
+		g_source_remove(imap4->journal_source);
+	imap4->journal_source = 0;
 	if(imap4->fd >= 0)
 		close(imap4->fd);
 	imap4->fd = -1;
+	if(imap4->lookup != 0)
+		helper->lookup_cancel(helper->account, imap4->lookup);
+	imap4->lookup = 0;
+	if(imap4->connect != NULL)
+		_common_connect_delete(imap4->connect);
+	imap4->connect = NULL;
 	imap4->aip = NULL;
-	if(imap4->ai != NULL)
-		freeaddrinfo(imap4->ai);
+	_common_lookup_free(imap4->ai);
 	imap4->ai = NULL;
 	_imap4_event(imap4, AET_STOPPED);
 }
@@ -389,11 +538,29 @@ static int _imap4_refresh(IMAP4 * imap4, AccountFolder * folder,
 	IMAP4Command * cmd;
 	int len;
 	char * buf;
+	gchar * key;
+	size_t size;
 
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s() %u\n", __func__, (message != NULL)
 			? message->id : 0);
 #endif
+	/* cancel the transfer of the previous message */
+	_imap4_message_cancel(imap4);
+	/* look for the message in the cache first */
+	if(message != NULL && (key = _imap4_cache_key(imap4, folder, message))
+			!= NULL)
+	{
+		buf = _common_cache_get(imap4->cache, key, &size);
+		g_free(key);
+		if(buf != NULL)
+		{
+			_common_cache_message(imap4->helper, message->message,
+					buf, size);
+			free(buf);
+			return 0;
+		}
+	}
 	if((len = snprintf(NULL, 0, "EXAMINE \"%s\"", folder->name)) < 0
 			|| (buf = malloc(++len)) == NULL)
 		return -1;
@@ -404,6 +571,119 @@ static int _imap4_refresh(IMAP4 * imap4, AccountFolder * folder,
 		return -1;
 	cmd->data.select.folder = folder;
 	cmd->data.select.message = message;
+	cmd->data.select.fetch = TRUE;
+	return 0;
+}
+
+
+/* imap4_search */
+static int _imap4_search(IMAP4 * imap4, AccountFolder * folder,
+		char const * text)
+{
+	IMAP4Command * cmd;
+	GString * str;
+	gchar * q;
+	size_t i;
+	char const * p;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s(\"%s\", \"%s\")\n", __func__,
+			folder->name, text);
+#endif
+	if(imap4->channel == NULL)
+		return -1;
+	for(i = 0; i < imap4->queue_cnt; i++)
+		if(imap4->queue[i].context == I4C_SEARCH)
+			/* ignore the results of the previous searches */
+			imap4->queue[i].data.search.folder = NULL;
+	/* select the folder unless it is already */
+	if(_imap4_queue_selected(imap4, NULL) != folder)
+	{
+		_imap4_message_cancel(imap4);
+		if((q = g_strdup_printf("%s \"%s\"", "EXAMINE", folder->name))
+				== NULL)
+			return -1;
+		cmd = _imap4_command(imap4, I4C_SELECT, q);
+		g_free(q);
+		if(cmd == NULL)
+			return -1;
+		cmd->data.select.folder = folder;
+	}
+	str = g_string_new("UID SEARCH ");
+	if(imap4->capabilities & I4CAP_ESEARCH)
+		/* obtain the results as a sequence set (RFC 4731) */
+		g_string_append(str, "RETURN (ALL) ");
+	for(p = text; *p != '\0'; p++)
+		if((unsigned char)*p >= 0x80)
+			break;
+	if(*p != '\0')
+	{
+		/* quoted strings are limited to 7-bit characters */
+		g_string_append(str, "CHARSET UTF-8 TEXT ");
+		cmd = _imap4_command_literal(imap4, I4C_SEARCH, str->str,
+				text);
+	}
+	else
+	{
+		g_string_append(str, "TEXT \"");
+		for(p = text; *p != '\0'; p++)
+			if(*p == '\r' || *p == '\n')
+				/* not allowed in quoted strings */
+				g_string_append_c(str, ' ');
+			else
+			{
+				if(*p == '\"' || *p == '\\')
+					g_string_append_c(str, '\\');
+				g_string_append_c(str, *p);
+			}
+		g_string_append_c(str, '\"');
+		cmd = _imap4_command(imap4, I4C_SEARCH, str->str);
+	}
+	g_string_free(str, TRUE);
+	if(cmd == NULL)
+		return -1;
+	cmd->data.search.folder = folder;
+	return 0;
+}
+
+
+/* imap4_set_flag */
+static int _imap4_set_flag(IMAP4 * imap4, AccountFolder * folder,
+		AccountMessage * message, MailerMessageFlag flag, int set)
+{
+	IMAP4JournalEntry * p;
+	size_t i;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s(\"%s\", %u, %u, %d)\n", __func__,
+			folder->name, message->uid, flag, set);
+#endif
+	for(i = 0; i < _imap4_message_flags_cnt; i++)
+		if(_imap4_message_flags[i].flag == flag)
+			break;
+	if(i == _imap4_message_flags_cnt || message->uid == 0)
+		return -1;
+	if(((message->flags & flag) != 0) == (set != 0))
+		/* nothing to do */
+		return 0;
+	/* record the change for later */
+	if((p = realloc(imap4->journal, sizeof(*p) * (imap4->journal_cnt + 1)))
+			== NULL)
+		return -1;
+	imap4->journal = p;
+	p = &imap4->journal[imap4->journal_cnt];
+	p->folder = folder;
+	p->uid = message->uid;
+	p->flag = flag;
+	p->set = (set != 0) ? TRUE : FALSE;
+	p->serial = imap4->journal_cnt++;
+	if(set)
+		message->flags |= flag;
+	else
+		message->flags &= ~flag;
+	if(imap4->journal_source == 0)
+		imap4->journal_source = g_timeout_add(IMAP4_JOURNAL_TIMEOUT,
+				_on_journal, imap4);
 	return 0;
 }
 
@@ -411,6 +691,24 @@ static int _imap4_refresh(IMAP4 * imap4, AccountFolder * folder,
 /* private */
 /* functions */
 /* useful */
+/* imap4_cache_key */
+static gchar * _imap4_cache_key(IMAP4 * imap4, AccountFolder * folder,
+		AccountMessage * message)
+{
+	char const * username = imap4->config[I4CV_USERNAME].value;
+
+	if(imap4->cache == NULL || folder->uidvalidity == 0
+			|| message->uid == 0)
+		return NULL;
+	/* similar to IMAP URLs (RFC 5092) */
+	return g_strdup_printf("imap://%s@%s:%lu/%s;UIDVALIDITY=%u/;UID=%u",
+			(username != NULL) ? username : "",
+			(char const *)imap4->config[I4CV_HOSTNAME].value,
+			(unsigned long)imap4->config[I4CV_PORT].value,
+			folder->name, folder->uidvalidity, message->uid);
+}
+
+
 /* imap4_command */
 static IMAP4Command * _imap4_command(IMAP4 * imap4, IMAP4Context context,
 		char const * command)
@@ -441,36 +739,107 @@ static IMAP4Command * _imap4_command(IMAP4 * imap4, IMAP4Context context,
 	if((p->buf = malloc(len)) == NULL)
 		return NULL;
 	p->buf_cnt = snprintf(p->buf, len, "a%04x %s\r\n", p->id, command);
+	p->literal = NULL;
+	p->literal_cnt = 0;
 	memset(&p->data, 0, sizeof(p->data));
-	if(imap4->queue_cnt++ == 0)
+	if(imap4->queue_cnt++ == 0 && imap4->source != 0)
 	{
-		if(imap4->source != 0)
-		{
-			/* cancel the pending NOOP operation */
-			g_source_remove(imap4->source);
-			imap4->source = 0;
-		}
-		imap4->wr_source = g_io_add_watch(imap4->channel, G_IO_OUT,
-				(imap4->ssl != NULL) ? _on_watch_can_write_ssl
-				: _on_watch_can_write, imap4);
+		/* cancel the pending NOOP operation */
+		g_source_remove(imap4->source);
+		imap4->source = 0;
 	}
+	_imap4_queue_schedule(imap4);
 	return p;
 }
 
 
+/* imap4_command_literal */
+static IMAP4Command * _imap4_command_literal(IMAP4 * imap4,
+		IMAP4Context context, char const * command,
+		char const * literal)
+{
+	IMAP4Command * cmd;
+	size_t len = strlen(literal);
+	gchar * q;
+	char * p;
+
+	if(imap4->capabilities & I4CAP_LITERALPLUS)
+	{
+		/* send the literal right away (RFC 7888) */
+		if((q = g_strdup_printf("%s{%lu+}\r\n%s", command,
+						(unsigned long)len, literal))
+				== NULL)
+			return NULL;
+		cmd = _imap4_command(imap4, context, q);
+		g_free(q);
+		return cmd;
+	}
+	/* wait for the server to be ready for the literal (RFC 3501) */
+	if((p = malloc(len + 2)) == NULL)
+		return NULL;
+	memcpy(p, literal, len);
+	memcpy(&p[len], "\r\n", 2);
+	if((q = g_strdup_printf("%s{%lu}", command, (unsigned long)len))
+			== NULL)
+	{
+		free(p);
+		return NULL;
+	}
+	cmd = _imap4_command(imap4, context, q);
+	g_free(q);
+	if(cmd == NULL)
+	{
+		free(p);
+		return NULL;
+	}
+	cmd->literal = p;
+	cmd->literal_cnt = len + 2;
+	return cmd;
+}
+
+
+/* imap4_list_folders */
+static IMAP4Command * _imap4_list_folders(IMAP4 * imap4,
+		AccountFolder * parent, char const * pattern)
+{
+	IMAP4Command * cmd;
+	gchar * q;
+
+	if(imap4->capabilities & I4CAP_LIST_STATUS)
+		/* obtain the counters along with the folders (RFC 5819) */
+		q = g_strdup_printf("%s \"\" \"%s\" %s", "LIST", pattern,
+				"RETURN (STATUS (MESSAGES UNSEEN))");
+	else
+		q = g_strdup_printf("%s \"\" \"%s\"", "LIST", pattern);
+	if(q == NULL)
+		return NULL;
+	if((cmd = _imap4_command(imap4, I4C_LIST, q)) != NULL)
+		cmd->data.list.parent = parent;
+	g_free(q);
+	return cmd;
+}
+
+
 /* imap4_parse */
 static int _parse_context(IMAP4 * imap4, char const * answer);
+static int _parse_untagged(IMAP4 * imap4, char const * answer);
+static int _context_capability(IMAP4 * imap4);
 static int _context_fetch(IMAP4 * imap4, char const * answer);
 static int _context_fetch_body(IMAP4 * imap4, char const * answer);
 static int _context_fetch_command(IMAP4 * imap4, char const * answer);
 static int _context_fetch_flags(IMAP4 * imap4, char const * answer);
 static int _context_fetch_headers(IMAP4 * imap4, char const * answer);
 static int _context_fetch_id(IMAP4 * imap4, char const * answer);
+static int _context_fetch_range(IMAP4 * imap4);
 static int _context_init(IMAP4 * imap4);
 static int _context_list(IMAP4 * imap4, char const * answer);
 static int _context_login(IMAP4 * imap4, char const * answer);
-static int _context_select(IMAP4 * imap4);
+static int _context_search(IMAP4 * imap4, char const * answer);
+static void _context_search_match(IMAP4 * imap4, AccountFolder * folder,
+		unsigned long first, unsigned long last);
+static int _context_select(IMAP4 * imap4, char const * answer);
 static int _context_status(IMAP4 * imap4, char const * answer);
+static int _context_store(IMAP4 * imap4, char const * answer);
 
 static int _imap4_parse(IMAP4 * imap4)
 {
@@ -478,6 +847,7 @@ static int _imap4_parse(IMAP4 * imap4)
 	size_t i;
 	size_t j;
 	IMAP4Command * cmd;
+	int tagged;
 	char buf[8];
 
 #ifdef DEBUG
@@ -498,35 +868,61 @@ static int _imap4_parse(IMAP4 * imap4)
 			continue;
 		imap4->rd_buf[i - 1] = '\0';
 		cmd = &imap4->queue[0];
-		/* if we have just sent a command match the answer */
-		if(cmd->status == I4CS_SENT)
+		tagged = 0;
+		/* if we have sent a command match the answer */
+		if(cmd->status != I4CS_QUEUED)
 		{
 			snprintf(buf, sizeof(buf), "a%04x ", cmd->id);
 #ifdef DEBUG
 			fprintf(stderr, "DEBUG: %s() expecting \"%s\"\n",
 					__func__, buf);
 #endif
+			if(imap4->rd_buf[j] == '+' && cmd->literal != NULL)
+			{
+				/* the server is ready for the literal */
+				free(cmd->buf);
+				cmd->buf = cmd->literal;
+				cmd->buf_cnt = cmd->literal_cnt;
+				cmd->literal = NULL;
+				cmd->literal_cnt = 0;
+				cmd->status = I4CS_QUEUED;
+				_imap4_queue_schedule(imap4);
+				continue;
+			}
 			if(strncmp(&imap4->rd_buf[j], "* ", 2) == 0)
+			{
 				j += 2;
+				if(_parse_untagged(imap4, &imap4->rd_buf[j])
+						== 0)
+					continue;
+			}
 			else if(strncmp(&imap4->rd_buf[j], buf, 6) == 0)
 			{
 				j += 6;
+				tagged = 1;
 				cmd->status = I4CS_PARSING;
 				if(strncmp("BAD ", &imap4->rd_buf[j], 4) == 0)
-					/* FIXME report and pop queue instead */
 					helper->error(NULL,
 							&imap4->rd_buf[j + 4],
 							1);
 			}
 		}
 		if(_parse_context(imap4, &imap4->rd_buf[j]) != 0)
-			cmd->status = I4CS_ERROR;
+			imap4->queue[0].status = I4CS_ERROR;
+		/* the queue may have been re-allocated meanwhile */
+		cmd = &imap4->queue[0];
+		/* the current command is completed */
+		if(tagged || (cmd->context == I4C_INIT
+					&& cmd->status == I4CS_OK))
+			_imap4_queue_pop(imap4);
 	}
 	if(j != 0)
 	{
 		imap4->rd_buf_cnt -= j;
 		memmove(imap4->rd_buf, &imap4->rd_buf[j], imap4->rd_buf_cnt);
 	}
+	/* list the messages obtained meanwhile */
+	_imap4_folder_messages_add(imap4, &imap4->folders);
 	return 0;
 }
 
@@ -541,6 +937,8 @@ static int _parse_context(IMAP4 * imap4, char const * answer)
 #endif
 	switch(cmd->context)
 	{
+		case I4C_CAPABILITY:
+			return _context_capability(imap4);
 		case I4C_FETCH:
 			return _context_fetch(imap4, answer);
 		case I4C_INIT:
@@ -554,17 +952,66 @@ static int _parse_context(IMAP4 * imap4, char const * answer)
 				return 0;
 			cmd->status = I4CS_OK;
 			return 0;
+		case I4C_SEARCH:
+			return _context_search(imap4, answer);
 		case I4C_SELECT:
-			return _context_select(imap4);
+			return _context_select(imap4, answer);
 		case I4C_STATUS:
 			return _context_status(imap4, answer);
+		case I4C_STORE:
+			return _context_store(imap4, answer);
 	}
 	return ret;
 }
 
+static int _parse_untagged(IMAP4 * imap4, char const * answer)
+{
+	char const capability[] = "CAPABILITY ";
+	char const ok_capability[] = "OK [CAPABILITY ";
+	char const status[] = "STATUS ";
+
+	/* these answers may be received at any time */
+	if(strncmp(answer, capability, sizeof(capability) - 1) == 0)
+	{
+		_imap4_set_capabilities(imap4,
+				&answer[sizeof(capability) - 1]);
+		return 0;
+	}
+	if(strncmp(answer, status, sizeof(status) - 1) == 0)
+	{
+		_context_status(imap4, answer);
+		return 0;
+	}
+	/* this one is also relevant to the current context */
+	if(strncmp(answer, ok_capability, sizeof(ok_capability) - 1) == 0)
+		_imap4_set_capabilities(imap4,
+				&answer[sizeof(ok_capability) - 1]);
+	return 1;
+}
+
+static int _context_capability(IMAP4 * imap4)
+{
+	IMAP4Command * cmd = &imap4->queue[0];
+	char const * prefix = imap4->config[I4CV_PREFIX].value;
+	gchar * q;
+
+	if(cmd->status != I4CS_PARSING)
+		return 0;
+	cmd->status = I4CS_OK;
+	if((q = g_strdup_printf("%s%%", (prefix != NULL) ? prefix : ""))
+			== NULL)
+		return -1;
+	cmd = _imap4_list_folders(imap4, &imap4->folders, q);
+	g_free(q);
+	return (cmd != NULL) ? 0 : -1;
+}
+
 static int _context_fetch(IMAP4 * imap4, char const * answer)
 {
 	IMAP4Command * cmd = &imap4->queue[0];
+	GString * contents = cmd->data.fetch.contents;
+	gchar * key;
+	int ret;
 
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s(\"%s\")\n", __func__, answer);
@@ -572,6 +1019,33 @@ static int _context_fetch(IMAP4 * imap4, char const * answer)
 	if(cmd->status == I4CS_PARSING)
 	{
 		cmd->status = I4CS_OK;
+		/* obtain the next range of the message if relevant */
+		if(strncmp("OK", answer, 2) == 0 && cmd->data.fetch.length != 0
+				&& (ret = _context_fetch_range(imap4)) != 0)
+			return (ret > 0) ? 0 : -1;
+		/* the queue may have been re-allocated meanwhile */
+		cmd = &imap4->queue[0];
+		contents = cmd->data.fetch.contents;
+		if(strncmp("OK", answer, 2) == 0 && cmd->data.fetch.body
+				&& cmd->data.fetch.message != NULL)
+			/* the body of the message was received entirely */
+			imap4->helper->message_set_body_complete(
+					cmd->data.fetch.message->message);
+		if(contents == NULL)
+			return 0;
+		/* store the message in the cache */
+		if(strncmp("OK", answer, 2) == 0 && (key = _imap4_cache_key(
+						imap4, cmd->data.fetch.folder,
+						cmd->data.fetch.message))
+				!= NULL)
+		{
+			if(_common_cache_set(imap4->cache, key, contents->str,
+						contents->len) != 0)
+				imap4->helper->error(NULL, error_get(NULL), 1);
+			g_free(key);
+		}
+		g_string_free(contents, TRUE);
+		cmd->data.fetch.contents = NULL;
 		return 0;
 	}
 	switch(cmd->data.fetch.status)
@@ -595,7 +1069,9 @@ static int _context_fetch_body(IMAP4 * imap4, char const * answer)
 	AccountPluginHelper * helper = imap4->helper;
 	IMAP4Command * cmd = &imap4->queue[0];
 	AccountMessage * message = cmd->data.fetch.message;
+	size_t len;
 	size_t i;
+	gboolean eol = TRUE;
 
 	/* check the size */
 	if(cmd->data.fetch.size == 0)
@@ -612,11 +1088,37 @@ static int _context_fetch_body(IMAP4 * imap4, char const * answer)
 			return _context_fetch(imap4, answer);
 		}
 	}
-	if((i = strlen(answer) + 2) <= cmd->data.fetch.size)
+	if((i = (len = strlen(answer)) + 2) <= cmd->data.fetch.size)
 		cmd->data.fetch.size -= i;
-	helper->message_set_body(message->message, answer, strlen(answer), 1);
-	helper->message_set_body(message->message, "\r\n", 2, 1);
-	return 0;
+	else
+	{
+		/* the literal ends within this line */
+		eol = FALSE;
+		i = cmd->data.fetch.size;
+		cmd->data.fetch.size = 0;
+		/* incomplete lines are obtained again with the next range */
+		len = (cmd->data.fetch.length != 0
+				&& cmd->data.fetch.consumed != 0
+				&& cmd->data.fetch.offset
+				+ cmd->data.fetch.length < message->size)
+			? 0 : i;
+	}
+	cmd->data.fetch.consumed += eol ? len + 2 : len;
+	if(len > 0)
+		helper->message_set_body(message->message, answer, len, 1);
+	if(eol)
+		helper->message_set_body(message->message, "\r\n", 2, 1);
+	if(cmd->data.fetch.contents != NULL)
+	{
+		g_string_append_len(cmd->data.fetch.contents, answer, len);
+		if(eol)
+			g_string_append_len(cmd->data.fetch.contents, "\r\n",
+					2);
+	}
+	if(eol || answer[i] == '\0')
+		return 0;
+	/* parse the rest of the answer */
+	return _context_fetch_body(imap4, &answer[i]);
 }
 
 static int _context_fetch_command(IMAP4 * imap4, char const * answer)
@@ -627,9 +1129,31 @@ static int _context_fetch_command(IMAP4 * imap4, char const * answer)
 	unsigned int id = cmd->data.fetch.id;
 	char * p;
 	size_t i;
+	unsigned long uid;
+	unsigned long size;
 
 	/* skip spaces */
 	for(i = 0; answer[i] == ' '; i++);
+	if(strncmp(&answer[i], "UID ", 4) == 0)
+	{
+		uid = strtoul(&answer[i + 4], &p, 10);
+		if(uid == 0 || (message = _imap4_folder_get_message(imap4,
+						folder, id)) == NULL)
+			return -1;
+		message->uid = uid;
+		cmd->data.fetch.message = message;
+		return _context_fetch_command(imap4, p);
+	}
+	if(strncmp(&answer[i], "RFC822.SIZE ", 12) == 0)
+	{
+		size = strtoul(&answer[i + 12], &p, 10);
+		if((message = _imap4_folder_get_message(imap4, folder, id))
+				== NULL)
+			return -1;
+		message->size = size;
+		cmd->data.fetch.message = message;
+		return _context_fetch_command(imap4, p);
+	}
 	if(strncmp(&answer[i], "FLAGS ", 6) == 0)
 	{
 		cmd->data.fetch.status = I4FS_FLAGS;
@@ -648,8 +1172,12 @@ static int _context_fetch_command(IMAP4 * imap4, char const * answer)
 		return -1;
 	if((message = _imap4_folder_get_message(imap4, folder, id)) != NULL)
 	{
-		cmd->data.fetch.status = I4FS_HEADERS;
+		/* ranges may start after the headers */
+		cmd->data.fetch.status = cmd->data.fetch.body ? I4FS_BODY
+			: I4FS_HEADERS;
 		cmd->data.fetch.message = message;
+		if(cmd->data.fetch.length != 0)
+			cmd->data.fetch.length = cmd->data.fetch.size;
 	}
 	return (message != NULL) ? 0 : -1;
 }
@@ -662,14 +1190,8 @@ static int _context_fetch_flags(IMAP4 * imap4, char const * answer)
 	size_t i;
 	size_t j;
 	size_t k;
-	struct
-	{
-		char const * name;
-		MailerMessageFlag flag;
-	} flags[] = {
-		{ "\\Answered",	MMF_ANSWERED	},
-		{ "\\Draft",	MMF_DRAFT	}
-	};
+	char const * name;
+	int flags = 0;
 
 	/* skip spaces */
 	for(i = 0; answer[i] == ' '; i++);
@@ -693,20 +1215,33 @@ static int _context_fetch_flags(IMAP4 * imap4, char const * answer)
 			break;
 		}
 		/* apply the flag */
-		for(k = 0; k < sizeof(flags) / sizeof(*flags); k++)
-			if(strncmp(&answer[i], flags[k].name, j - i) == 0)
+		for(k = 0; k < _imap4_message_flags_cnt; k++)
+		{
+			name = _imap4_message_flags[k].name;
+			if(strlen(name) == j - i
+					&& strncmp(&answer[i], name, j - i) == 0)
 			{
+				flags |= _imap4_message_flags[k].flag;
 				/* FIXME make sure message != NULL */
 				if(message == NULL)
 					continue;
 				helper->message_set_flag(message->message,
-						flags[k].flag);
+						_imap4_message_flags[k].flag);
 			}
+		}
 		/* skip spaces */
 		for(i = j; answer[i] == ' '; i++);
 	}
 	if(answer[i] != ')')
 		return -1;
+	if(message != NULL)
+	{
+		/* keep track of the flags known to the server */
+		message->flags = flags;
+		helper->message_set_header(message->message,
+				(flags & MMF_READ) ? "Status: RO"
+				: "Status: O");
+	}
 	/* skip spaces */
 	for(i++; answer[i] == ' '; i++);
 	if(answer[i] == ')')
@@ -727,19 +1262,34 @@ static int _context_fetch_headers(IMAP4 * imap4, char const * answer)
 	size_t i;
 
 	/* check the size */
-	if((i = strlen(answer) + 2) <= cmd->data.fetch.size)
-		cmd->data.fetch.size -= i;
+	if((i = strlen(answer) + 2) > cmd->data.fetch.size)
+	{
+		if(cmd->data.fetch.length == 0)
+			return 0;
+		/* the range ends within this header: it is obtained again
+		 * with the next range, which is larger if nothing was
+		 * consumed yet */
+		i = cmd->data.fetch.size;
+		cmd->data.fetch.size = 0;
+		return (answer[i] != '\0') ? _context_fetch_body(imap4,
+				&answer[i]) : 0;
+	}
+	cmd->data.fetch.size -= i;
+	cmd->data.fetch.consumed += i;
 	if(strcmp(answer, "") == 0)
 	{
 		/* beginning of the body */
 		cmd->data.fetch.status = I4FS_BODY;
+		cmd->data.fetch.body = TRUE;
 		helper->message_set_body(message->message, NULL, 0, 0);
 	}
-	/* XXX check this before parsing anything */
-	else if(cmd->data.fetch.size == 0 || i > cmd->data.fetch.size)
-		return 0;
 	else
 		helper->message_set_header(message->message, answer);
+	if(cmd->data.fetch.contents != NULL)
+	{
+		g_string_append(cmd->data.fetch.contents, answer);
+		g_string_append_len(cmd->data.fetch.contents, "\r\n", 2);
+	}
 	return 0;
 }
 
@@ -754,6 +1304,9 @@ static int _context_fetch_id(IMAP4 * imap4, char const * answer)
 	if(answer[0] == '\0' || *p != ' ')
 		return 0;
 	cmd->data.fetch.id = id;
+	if(cmd->data.fetch.message != NULL
+			&& cmd->data.fetch.message->id != id)
+		cmd->data.fetch.message = NULL;
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s() id=%u\n", __func__, id);
 #endif
@@ -770,6 +1323,57 @@ static int _context_fetch_id(IMAP4 * imap4, char const * answer)
 	return _context_fetch_command(imap4, answer);
 }
 
+static int _context_fetch_range(IMAP4 * imap4)
+{
+	IMAP4Command * cmd = &imap4->queue[0];
+	AccountFolder * folder = cmd->data.fetch.folder;
+	AccountMessage * message = imap4->partial;
+	GString * contents = cmd->data.fetch.contents;
+	unsigned int offset = cmd->data.fetch.offset + cmd->data.fetch.consumed;
+	unsigned int length = cmd->data.fetch.length;
+	gboolean body = cmd->data.fetch.body;
+	char buf[64];
+
+	if(message == NULL)
+		/* the transfer was cancelled */
+		return 1;
+	if(offset >= message->size || (cmd->data.fetch.consumed == 0
+				&& offset + length >= message->size))
+	{
+		/* the message is complete */
+		imap4->partial = NULL;
+		return 0;
+	}
+	/* request larger ranges as the transfer goes */
+	if(cmd->data.fetch.consumed == 0)
+		/* the range was too short for a single line */
+		length = (length < message->size - offset)
+			? length * 2 : message->size - offset;
+	else
+		length = (length < IMAP4_FETCH_RANGE_MAX / 2) ? length * 2
+			: IMAP4_FETCH_RANGE_MAX;
+	snprintf(buf, sizeof(buf), "%s %u %s<%u.%u>", "FETCH", message->id,
+			"BODY.PEEK[]", offset, length);
+	/* the contents are now handled by the next command */
+	cmd->data.fetch.contents = NULL;
+	if((cmd = _imap4_command(imap4, I4C_FETCH, buf)) == NULL)
+	{
+		if(contents != NULL)
+			g_string_free(contents, TRUE);
+		_imap4_message_cancel(imap4);
+		return -1;
+	}
+	cmd->data.fetch.folder = folder;
+	cmd->data.fetch.message = message;
+	cmd->data.fetch.id = message->id;
+	cmd->data.fetch.status = I4FS_ID;
+	cmd->data.fetch.contents = contents;
+	cmd->data.fetch.offset = offset;
+	cmd->data.fetch.length = length;
+	cmd->data.fetch.body = body;
+	return 1;
+}
+
 static int _context_init(IMAP4 * imap4)
 {
 	IMAP4Command * cmd = &imap4->queue[0];
@@ -796,7 +1400,9 @@ static int _context_list(IMAP4 * imap4, char const * answer)
 	char const * p = answer;
 	gchar * q;
 	char const haschildren[] = "\\HasChildren";
+	char const noselect[] = "\\Noselect";
 	int recurse = 0;
+	int select = 1;
 	char reference = '\0';
 	char buf[64];
 
@@ -825,6 +1431,12 @@ static int _context_list(IMAP4 * imap4, char const * answer)
 				p += sizeof(haschildren) - 1;
 				recurse = 1;
 			}
+			else if(strncasecmp(p, noselect, sizeof(noselect) - 1)
+					== 0)
+			{
+				p += sizeof(noselect) - 1;
+				select = 0;
+			}
 			else
 				/* skip until end of flag */
 				for(p++; isalnum((unsigned char)*p); p++);
@@ -859,17 +1471,20 @@ static int _context_list(IMAP4 * imap4, char const * answer)
 			/* FIXME escape the mailbox' name instead */
 			&& strchr(buf, '"') == NULL)
 	{
-		q = g_strdup_printf("%s \"%s\" (%s)", "STATUS", buf,
-				"MESSAGES RECENT UNSEEN");
-		if((cmd = _imap4_command(imap4, I4C_STATUS, q)) != NULL)
-			cmd->data.status.folder = folder;
-		g_free(q);
+		/* obtain the counters unless already provided */
+		if(select && (imap4->capabilities & I4CAP_LIST_STATUS) == 0)
+		{
+			q = g_strdup_printf("%s \"%s\" (%s)", "STATUS", buf,
+					"MESSAGES UNSEEN");
+			if((cmd = _imap4_command(imap4, I4C_STATUS, q))
+					!= NULL)
+				cmd->data.status.folder = folder;
+			g_free(q);
+		}
 		if(cmd != NULL && recurse == 1 && reference != '\0')
 		{
-			q = g_strdup_printf("%s \"\" \"%s%c%%\"", "LIST", buf,
-					reference);
-			if((cmd = _imap4_command(imap4, I4C_LIST, q)) != NULL)
-				cmd->data.list.parent = folder;
+			q = g_strdup_printf("%s%c%%", buf, reference);
+			cmd = _imap4_list_folders(imap4, folder, q);
 			g_free(q);
 		}
 	}
@@ -889,33 +1504,143 @@ static int _context_login(IMAP4 * imap4, char const * answer)
 		return -helper->error(helper->account, "Authentication failed",
 				1);
 	cmd->status = I4CS_OK;
-	if((q = g_strdup_printf("%s \"\" \"%s%%\"", "LIST", (prefix != NULL)
-					? prefix : "")) == NULL)
+	/* the capabilities may have changed once authenticated */
+	if(strncmp("OK [CAPABILITY ", answer, 15) == 0)
+		_imap4_set_capabilities(imap4, &answer[15]);
+	else
+		return (_imap4_command(imap4, I4C_CAPABILITY, "CAPABILITY")
+				!= NULL) ? 0 : -1;
+	if((q = g_strdup_printf("%s%%", (prefix != NULL) ? prefix : ""))
+			== NULL)
 		return -1;
-	cmd = _imap4_command(imap4, I4C_LIST, q);
+	cmd = _imap4_list_folders(imap4, &imap4->folders, q);
 	g_free(q);
-	if(cmd == NULL)
-		return -1;
-	cmd->data.list.parent = &imap4->folders;
+	return (cmd != NULL) ? 0 : -1;
+}
+
+static int _context_search(IMAP4 * imap4, char const * answer)
+{
+	IMAP4Command * cmd = &imap4->queue[0];
+	AccountFolder * folder = cmd->data.search.folder;
+	char const search[] = "SEARCH";
+	char const esearch[] = "ESEARCH ";
+	char const all[] = " ALL ";
+	char const * p;
+	char * q;
+	unsigned long first;
+	unsigned long last;
+
+	if(cmd->status == I4CS_PARSING)
+	{
+		cmd->status = (strncmp("OK", answer, 2) == 0) ? I4CS_OK
+			: I4CS_ERROR;
+		return 0;
+	}
+	if(folder == NULL)
+		/* this search was cancelled */
+		return 0;
+	/* highlight the results as soon as they are received */
+	if(strncmp(answer, search, sizeof(search) - 1) == 0)
+		/* the UIDs are listed one by one */
+		for(p = &answer[sizeof(search) - 1]; *p == ' '; p = q)
+		{
+			first = strtoul(++p, &q, 10);
+			if(q == p)
+				break;
+			_context_search_match(imap4, folder, first, first);
+		}
+	else if(strncmp(answer, esearch, sizeof(esearch) - 1) == 0
+			&& (p = strstr(answer, all)) != NULL)
+		/* the UIDs are listed as a sequence set (RFC 4731) */
+		for(p += sizeof(all) - 1;; p = q + 1)
+		{
+			first = strtoul(p, &q, 10);
+			if(q == p)
+				break;
+			last = first;
+			if(*q == ':')
+			{
+				p = q + 1;
+				last = strtoul(p, &q, 10);
+				if(q == p)
+					break;
+			}
+			if(first <= last)
+				_context_search_match(imap4, folder, first,
+						last);
+			else
+				_context_search_match(imap4, folder, last,
+						first);
+			if(*q != ',')
+				break;
+		}
 	return 0;
 }
 
-static int _context_select(IMAP4 * imap4)
+static void _context_search_match(IMAP4 * imap4, AccountFolder * folder,
+		unsigned long first, unsigned long last)
+{
+	AccountPluginHelper * helper = imap4->helper;
+	AccountMessage * message;
+	unsigned long u;
+	size_t i;
+
+	if(last - first >= folder->messages_cnt)
+	{
+		/* the range is larger than the folder */
+		for(i = 0; i < folder->messages_cnt; i++)
+			if((message = folder->messages[i])->uid >= first
+					&& message->uid <= last
+					&& message->message != NULL)
+				helper->message_set_match(message->message, 1);
+		return;
+	}
+	for(u = first; u <= last; u++)
+		if((message = _imap4_folder_get_message_uid(imap4, folder, u))
+				!= NULL && message->message != NULL)
+			helper->message_set_match(message->message, 1);
+}
+
+static int _context_select(IMAP4 * imap4, char const * answer)
 {
 	IMAP4Command * cmd = &imap4->queue[0];
 	AccountFolder * folder;
 	AccountMessage * message;
 	char buf[64];
+	char const uidvalidity[] = "OK [UIDVALIDITY ";
 
 	if(cmd->status != I4CS_PARSING)
+	{
+		if((folder = cmd->data.select.folder) != NULL
+				&& strncmp(answer, uidvalidity,
+					sizeof(uidvalidity) - 1) == 0)
+			folder->uidvalidity = strtoul(
+					&answer[sizeof(uidvalidity) - 1], NULL,
+					10);
 		return 0;
+	}
 	cmd->status = I4CS_OK;
-	if((folder = cmd->data.select.folder) == NULL)
+	folder = cmd->data.select.folder;
+	imap4->selected = (strncmp("OK", answer, 2) == 0) ? folder : NULL;
+	imap4->selected_writable = cmd->data.select.writable;
+	/* send the changes left from a previous connection */
+	if(imap4->selected != NULL && imap4->journal_cnt > 0
+			&& imap4->journal_source == 0)
+		imap4->journal_source = g_timeout_add(IMAP4_JOURNAL_TIMEOUT,
+				_on_journal, imap4);
+	if(folder == NULL)
 		return 0; /* XXX really is an error */
+	if(cmd->data.select.fetch == FALSE)
+		return 0;
 	if((message = cmd->data.select.message) == NULL)
 		/* FIXME queue commands in batches instead */
 		snprintf(buf, sizeof(buf), "%s %s %s", "FETCH", "1:*",
-				"(FLAGS BODY.PEEK[HEADER])");
+				"(UID FLAGS RFC822.SIZE BODY.PEEK[HEADER])");
+	else if(message->size > IMAP4_FETCH_RANGE_MIN)
+		/* obtain large messages progressively */
+		snprintf(buf, sizeof(buf), "%s %u %s<%u.%u>", "FETCH",
+				message->id, "BODY.PEEK[]", 0,
+				IMAP4_FETCH_RANGE_MIN);
 	else
 		snprintf(buf, sizeof(buf), "%s %u %s", "FETCH", message->id,
 				"BODY.PEEK[]");
@@ -926,17 +1651,28 @@ static int _context_select(IMAP4 * imap4)
 	cmd->data.fetch.id = (message != NULL) ? message->id : 0;
 	cmd->data.fetch.status = I4FS_ID;
 	cmd->data.fetch.size = 0;
+	if(message != NULL && imap4->cache != NULL && folder->uidvalidity != 0
+			&& message->uid != 0)
+		cmd->data.fetch.contents = g_string_new(NULL);
+	if(message != NULL && message->size > IMAP4_FETCH_RANGE_MIN)
+	{
+		cmd->data.fetch.length = IMAP4_FETCH_RANGE_MIN;
+		imap4->partial = message;
+	}
 	return 0;
 }
 
 static int _context_status(IMAP4 * imap4, char const * answer)
 {
+	AccountPluginHelper * helper = imap4->helper;
 	IMAP4Command * cmd = &imap4->queue[0];
+	AccountFolder * folder;
 	char const * p;
 	char const messages[] = "MESSAGES";
 	char const recent[] = "RECENT";
 	char const unseen[] = "UNSEEN";
 	unsigned int u;
+	char buf[64];
 
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s(\"%s\")\n", __func__, answer);
@@ -955,9 +1691,21 @@ static int _context_status(IMAP4 * imap4, char const * answer)
 	if(strncmp("STATUS ", p, 7) != 0)
 		return 0;
 	p += 7;
-	if(*p == '\"') /* skip reference */
-		for(p++; *p != '\0' && *p++ != '\"';);
-	if(*p == ' ') /* skip spaces */
+	/* read the folder name */
+	buf[0] = '\0';
+	if(*p == '\"')
+	{
+		sscanf(++p, "%63[^\"]", buf);
+		for(; *p != '\0' && *p++ != '\"';);
+	}
+	else
+	{
+		sscanf(p, "%63[^ ]", buf);
+		for(; *p != '\0' && *p != ' '; p++);
+	}
+	buf[63] = '\0';
+	folder = _imap4_folder_find(imap4, &imap4->folders, buf);
+	if(*p == ' ') /* skip spaces */
 		for(p++; *p != '\0' && *p == ' '; p++);
 	if(*p == '(')
 		/* parse the data items */
@@ -968,36 +1716,20 @@ static int _context_status(IMAP4 * imap4, char const * answer)
 			{
 				/* number of messages in the mailbox */
 				p += sizeof(messages);
-				sscanf(p, "%u", &u);
-				/* FIXME really implement */
-#ifdef DEBUG
-				fprintf(stderr, "DEBUG: %s() %u messages\n",
-						__func__, u);
-#endif
+				if(sscanf(p, "%u", &u) == 1 && folder != NULL)
+					folder->total = u;
 			}
 			else if(strncmp(p, recent, sizeof(recent) - 1) == 0
 					&& p[sizeof(recent) - 1] == ' ')
-			{
 				/* number of recent messages in the mailbox */
 				p += sizeof(recent);
-				sscanf(p, "%u", &u);
-				/* FIXME really implement */
-#ifdef DEBUG
-				fprintf(stderr, "DEBUG: %s() %u recent\n",
-						__func__, u);
-#endif
-			}
 			else if(strncmp(p, unseen, sizeof(unseen) - 1) == 0
 					&& p[sizeof(unseen) - 1] == ' ')
 			{
 				/* number of unseen messages in the mailbox */
 				p += sizeof(unseen);
-				sscanf(p, "%u", &u);
-				/* FIXME really implement */
-#ifdef DEBUG
-				fprintf(stderr, "DEBUG: %s() %u unseen\n",
-						__func__, u);
-#endif
+				if(sscanf(p, "%u", &u) == 1 && folder != NULL)
+					folder->unseen = u;
 			}
 			else
 				/* skip until the next space */
@@ -1006,10 +1738,392 @@ static int _context_status(IMAP4 * imap4, char const * answer)
 			/* skip until the next space */
 			for(; *p != '\0' && *p != ' ' && *p != ')'; p++);
 		}
+	if(folder != NULL && folder->folder != NULL)
+		helper->folder_set_count(folder->folder, folder->total,
+				folder->unseen);
+	return 0;
+}
+
+static int _context_store(IMAP4 * imap4, char const * answer)
+{
+	IMAP4Command * cmd = &imap4->queue[0];
+
+	if(cmd->status != I4CS_PARSING)
+		return 0;
+	if(strncmp("OK", answer, 2) == 0)
+	{
+		cmd->status = I4CS_OK;
+		return 0;
+	}
+	cmd->status = I4CS_ERROR;
+	/* the changes were not applied */
+	_imap4_journal_revert(imap4, cmd->data.store.entries,
+			cmd->data.store.entries_cnt);
+	if(strncmp("NO ", answer, 3) == 0)
+		imap4->helper->error(NULL, &answer[3], 1);
 	return 0;
 }
 
 
+/* imap4_set_capabilities */
+static void _imap4_set_capabilities(IMAP4 * imap4, char const * capabilities)
+{
+	char const * p;
+	size_t i;
+	size_t len;
+	struct
+	{
+		char const * name;
+		IMAP4Capability capability;
+	} names[] =
+	{
+		{ "ESEARCH",		I4CAP_ESEARCH		},
+		{ "LIST-STATUS",	I4CAP_LIST_STATUS	},
+		{ "LITERAL+",		I4CAP_LITERALPLUS	}
+	};
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s(\"%s\")\n", __func__, capabilities);
+#endif
+	imap4->capabilities = I4CAP_NONE;
+	for(p = capabilities; *p != '\0' && *p != ']'; p += len)
+	{
+		/* skip spaces */
+		for(; *p == ' '; p++);
+		for(len = 0; p[len] != '\0' && p[len] != ' ' && p[len] != ']';
+				len++);
+		for(i = 0; i < sizeof(names) / sizeof(*names); i++)
+			if(strlen(names[i].name) == len
+					&& strncasecmp(names[i].name, p, len)
+					== 0)
+				imap4->capabilities |= names[i].capability;
+	}
+}
+
+
+/* queue */
+/* imap4_queue_next */
+static gboolean _queue_next_pipelining(IMAP4Context context);
+
+static IMAP4Command * _imap4_queue_next(IMAP4 * imap4)
+{
+	size_t i;
+	size_t j;
+
+	/* look for the first command not sent yet */
+	for(i = 0; i < imap4->queue_cnt; i++)
+		if(imap4->queue[i].status == I4CS_QUEUED)
+			break;
+	if(i == imap4->queue_cnt)
+		return NULL;
+	/* it may only be sent along commands able to be pipelined */
+	for(j = 0; i > 0 && j <= i; j++)
+		if(!_queue_next_pipelining(imap4->queue[j].context))
+			return NULL;
+	return &imap4->queue[i];
+}
+
+static gboolean _queue_next_pipelining(IMAP4Context context)
+{
+	switch(context)
+	{
+		case I4C_LIST:
+		case I4C_NOOP:
+		case I4C_STATUS:
+		case I4C_STORE:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+
+/* imap4_queue_pop */
+static void _imap4_queue_pop(IMAP4 * imap4)
+{
+	IMAP4Command * cmd = &imap4->queue[0];
+
+	if(cmd->context == I4C_FETCH && cmd->data.fetch.contents != NULL)
+		g_string_free(cmd->data.fetch.contents, TRUE);
+	else if(cmd->context == I4C_STORE)
+		free(cmd->data.store.entries);
+	free(cmd->buf);
+	free(cmd->literal);
+	memmove(cmd, &imap4->queue[1], sizeof(*cmd) * --imap4->queue_cnt);
+}
+
+
+/* imap4_queue_schedule */
+static void _imap4_queue_schedule(IMAP4 * imap4)
+{
+	if(imap4->channel == NULL || imap4->wr_source != 0
+			|| _imap4_queue_next(imap4) == NULL)
+		return;
+	imap4->wr_source = g_io_add_watch(imap4->channel, G_IO_OUT,
+			(imap4->ssl != NULL) ? _on_watch_can_write_ssl
+			: _on_watch_can_write, imap4);
+}
+
+
+/* imap4_queue_selected */
+static AccountFolder * _imap4_queue_selected(IMAP4 * imap4,
+		gboolean * writable)
+{
+	AccountFolder * ret = imap4->selected;
+	gboolean w = imap4->selected_writable;
+	size_t i;
+
+	/* obtain the folder selected once the queue is processed */
+	for(i = 0; i < imap4->queue_cnt; i++)
+		if(imap4->queue[i].context == I4C_SELECT
+				&& imap4->queue[i].status == I4CS_QUEUED)
+		{
+			ret = imap4->queue[i].data.select.folder;
+			w = imap4->queue[i].data.select.writable;
+		}
+	if(writable != NULL)
+		*writable = w;
+	return ret;
+}
+
+
+/* journal */
+/* imap4_journal_flush */
+static int _journal_flush_compare(void const * a, void const * b);
+static int _journal_flush_compare_set(void const * a, void const * b);
+static int _journal_flush_compare_uid(void const * a, void const * b);
+static int _journal_flush_select(IMAP4 * imap4, AccountFolder * folder);
+static int _journal_flush_store(IMAP4 * imap4, IMAP4JournalEntry * entries,
+		size_t cnt);
+
+static int _imap4_journal_flush(IMAP4 * imap4)
+{
+	int ret = 0;
+	IMAP4JournalEntry * journal = imap4->journal;
+	size_t cnt = imap4->journal_cnt;
+	AccountFolder * folder = NULL;
+	gboolean writable;
+	size_t i;
+	size_t j;
+	size_t k;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s() %lu\n", __func__, (unsigned long)cnt);
+#endif
+	if(imap4->channel == NULL)
+		/* wait for the connection */
+		return 0;
+	imap4->journal = NULL;
+	imap4->journal_cnt = 0;
+	/* only keep the last change to every flag of every message */
+	qsort(journal, cnt, sizeof(*journal), _journal_flush_compare);
+	for(i = 0, j = 0; i < cnt; i = k)
+	{
+		for(k = i + 1; k < cnt && _journal_flush_compare_uid(
+					&journal[i], &journal[k]) == 0; k++);
+		/* the changes are only recorded when the flag toggles, so
+		 * the first one tells the original state of the flag */
+		if(journal[k - 1].set == journal[i].set)
+			journal[j++] = journal[k - 1];
+	}
+	/* group the changes by folder, flag and value */
+	qsort(journal, j, sizeof(*journal), _journal_flush_compare_set);
+	for(cnt = j, i = 0; i < cnt; i = j)
+	{
+		for(j = i + 1; j < cnt && journal[j].folder == journal[i].folder
+				&& journal[j].flag == journal[i].flag
+				&& journal[j].set == journal[i].set; j++);
+		if(journal[i].folder != folder)
+		{
+			folder = journal[i].folder;
+			/* unless already selected and not read-only */
+			if((_imap4_queue_selected(imap4, &writable) != folder
+						|| writable != TRUE)
+					&& _journal_flush_select(imap4, folder)
+					!= 0)
+			{
+				ret = -1;
+				break;
+			}
+		}
+		if(_journal_flush_store(imap4, &journal[i], j - i) != 0)
+			ret = -1;
+	}
+	free(journal);
+	return ret;
+}
+
+static int _journal_flush_compare(void const * a, void const * b)
+{
+	IMAP4JournalEntry const * ea = a;
+	IMAP4JournalEntry const * eb = b;
+	int ret;
+
+	if((ret = _journal_flush_compare_uid(a, b)) != 0)
+		return ret;
+	/* the latest change comes last */
+	return (ea->serial < eb->serial) ? -1 : 1;
+}
+
+static int _journal_flush_compare_set(void const * a, void const * b)
+{
+	IMAP4JournalEntry const * ea = a;
+	IMAP4JournalEntry const * eb = b;
+
+	if(ea->folder != eb->folder)
+		return ((uintptr_t)ea->folder < (uintptr_t)eb->folder) ? -1 : 1;
+	if(ea->flag != eb->flag)
+		return (ea->flag < eb->flag) ? -1 : 1;
+	if(ea->set != eb->set)
+		return (ea->set < eb->set) ? -1 : 1;
+	return _journal_flush_compare_uid(a, b);
+}
+
+static int _journal_flush_compare_uid(void const * a, void const * b)
+{
+	IMAP4JournalEntry const * ea = a;
+	IMAP4JournalEntry const * eb = b;
+
+	if(ea->folder != eb->folder)
+		return ((uintptr_t)ea->folder < (uintptr_t)eb->folder) ? -1 : 1;
+	if(ea->flag != eb->flag)
+		return (ea->flag < eb->flag) ? -1 : 1;
+	if(ea->uid != eb->uid)
+		return (ea->uid < eb->uid) ? -1 : 1;
+	return 0;
+}
+
+static int _journal_flush_select(IMAP4 * imap4, AccountFolder * folder)
+{
+	IMAP4Command * cmd;
+	gchar * q;
+
+	_imap4_message_cancel(imap4);
+	/* the folder must not be read-only */
+	if((q = g_strdup_printf("%s \"%s\"", "SELECT", folder->name))
+			== NULL)
+		return -1;
+	cmd = _imap4_command(imap4, I4C_SELECT, q);
+	g_free(q);
+	if(cmd == NULL)
+		return -1;
+	cmd->data.select.folder = folder;
+	cmd->data.select.writable = TRUE;
+	return 0;
+}
+
+static int _journal_flush_store(IMAP4 * imap4, IMAP4JournalEntry * entries,
+		size_t cnt)
+{
+	int ret = 0;
+	char const * name = NULL;
+	GString * str;
+	gchar * q;
+	IMAP4Command * cmd;
+	char buf[24];
+	size_t i;
+	size_t j;
+	size_t k;
+
+	for(i = 0; i < _imap4_message_flags_cnt; i++)
+		if(_imap4_message_flags[i].flag == entries[0].flag)
+			name = _imap4_message_flags[i].name;
+	if(name == NULL)
+		return -1;
+	str = g_string_new(NULL);
+	for(i = 0, k = 0; i < cnt; i = j)
+	{
+		/* compress consecutive UIDs into ranges */
+		for(j = i + 1; j < cnt && entries[j].uid == entries[j - 1].uid
+				+ 1; j++);
+		if(j - i == 1)
+			snprintf(buf, sizeof(buf), "%s%u", (str->len > 0)
+					? "," : "", entries[i].uid);
+		else
+			snprintf(buf, sizeof(buf), "%s%u:%u", (str->len > 0)
+					? "," : "", entries[i].uid,
+					entries[j - 1].uid);
+		g_string_append(str, buf);
+		if(j < cnt && str->len < IMAP4_JOURNAL_LENGTH)
+			continue;
+		q = g_strdup_printf("%s %s %cFLAGS.SILENT (%s)", "UID STORE",
+				str->str, entries[i].set ? '+' : '-', name);
+		if(q == NULL || (cmd = _imap4_command(imap4, I4C_STORE, q))
+				== NULL)
+			ret = -1;
+		/* remember the changes until they are confirmed */
+		else if((cmd->data.store.entries = malloc(sizeof(*entries)
+						* (j - k))) != NULL)
+		{
+			memcpy(cmd->data.store.entries, &entries[k],
+					sizeof(*entries) * (j - k));
+			cmd->data.store.entries_cnt = j - k;
+		}
+		g_free(q);
+		g_string_truncate(str, 0);
+		k = j;
+	}
+	g_string_free(str, TRUE);
+	return ret;
+}
+
+
+/* imap4_journal_restore */
+static int _imap4_journal_restore(IMAP4 * imap4, IMAP4JournalEntry * entries,
+		size_t cnt)
+{
+	IMAP4JournalEntry * p;
+	size_t i;
+
+	if(cnt == 0)
+		return 0;
+	if((p = realloc(imap4->journal, sizeof(*p) * (imap4->journal_cnt
+						+ cnt))) == NULL)
+		return -1;
+	imap4->journal = p;
+	/* these changes are older than the ones already recorded */
+	memmove(&p[cnt], p, sizeof(*p) * imap4->journal_cnt);
+	memcpy(p, entries, sizeof(*p) * cnt);
+	imap4->journal_cnt += cnt;
+	for(i = 0; i < imap4->journal_cnt; i++)
+		p[i].serial = i;
+	return 0;
+}
+
+
+/* imap4_journal_revert */
+static void _imap4_journal_revert(IMAP4 * imap4, IMAP4JournalEntry * entries,
+		size_t cnt)
+{
+	AccountPluginHelper * helper = imap4->helper;
+	AccountMessage * message;
+	size_t i;
+	size_t j;
+
+	for(i = 0; i < cnt; i++)
+	{
+		/* keep the changes recorded meanwhile */
+		for(j = 0; j < imap4->journal_cnt; j++)
+			if(_journal_flush_compare_uid(&imap4->journal[j],
+						&entries[i]) == 0)
+				break;
+		if(j < imap4->journal_cnt || (message
+					= _imap4_folder_get_message_uid(imap4,
+						entries[i].folder,
+						entries[i].uid)) == NULL)
+			continue;
+		if(entries[i].set)
+			message->flags &= ~entries[i].flag;
+		else
+			message->flags |= entries[i].flag;
+		if(entries[i].flag == MMF_READ)
+			helper->message_set_header(message->message,
+					(message->flags & MMF_READ)
+					? "Status: RO" : "Status: O");
+	}
+}
+
+
 /* imap4_event */
 static void _imap4_event(IMAP4 * imap4, AccountEventType type)
 {
@@ -1090,6 +2204,7 @@ static AccountFolder * _imap4_folder_new(IMAP4 * imap4, AccountFolder * parent,
 			parent->folder, type, name);
 	folder->messages = NULL;
 	folder->messages_cnt = 0;
+	folder->messages_added = 0;
 	folder->folders = NULL;
 	folder->folders_cnt = 0;
 	if(folder->folder == NULL || folder->name == NULL)
@@ -1122,6 +2237,23 @@ static void _imap4_folder_delete(IMAP4 * imap4, AccountFolder * folder)
 }
 
 
+/* imap4_folder_find */
+static AccountFolder * _imap4_folder_find(IMAP4 * imap4,
+		AccountFolder * folder, char const * name)
+{
+	AccountFolder * ret;
+	size_t i;
+
+	for(i = 0; i < folder->folders_cnt; i++)
+		if(strcmp(folder->folders[i]->name, name) == 0)
+			return folder->folders[i];
+		else if((ret = _imap4_folder_find(imap4, folder->folders[i],
+						name)) != NULL)
+			return ret;
+	return NULL;
+}
+
+
 /* imap4_folder_get_folder */
 static AccountFolder * _imap4_folder_get_folder(IMAP4 * imap4,
 		AccountFolder * folder, char const * name)
@@ -1155,6 +2287,60 @@ static AccountMessage * _imap4_folder_get_message(IMAP4 * imap4,
 }
 
 
+/* imap4_folder_get_message_uid */
+static AccountMessage * _imap4_folder_get_message_uid(IMAP4 * imap4,
+		AccountFolder * folder, unsigned int uid)
+{
+	AccountMessage * message;
+	size_t i;
+	size_t lo = 0;
+	size_t hi = folder->messages_cnt;
+
+	if(uid == 0)
+		return NULL;
+	/* the messages are usually sorted by UID already */
+	while(lo < hi)
+	{
+		i = lo + (hi - lo) / 2;
+		if((message = folder->messages[i])->uid == uid)
+			return message;
+		else if(message->uid < uid)
+			lo = i + 1;
+		else
+			hi = i;
+	}
+	for(i = 0; i < folder->messages_cnt; i++)
+		if(folder->messages[i]->uid == uid)
+			return folder->messages[i];
+	return NULL;
+}
+
+
+/* imap4_folder_messages_add */
+static void _imap4_folder_messages_add(IMAP4 * imap4,
+		AccountFolder * folder)
+{
+	AccountPluginHelper * helper = imap4->helper;
+	Message ** messages;
+	size_t cnt = folder->messages_cnt - folder->messages_added;
+	size_t i;
+
+	for(i = 0; i < folder->folders_cnt; i++)
+		_imap4_folder_messages_add(imap4, folder->folders[i]);
+	if(cnt == 0 || folder->folder == NULL)
+		return;
+	if((messages = malloc(sizeof(*messages) * cnt)) == NULL)
+		return;
+	for(i = 0; i < cnt; i++)
+		messages[i] = folder->messages[folder->messages_added + i]
+			->message;
+	if(helper->messages_add(helper->account, folder->folder, messages,
+				cnt) == 0)
+		folder->messages_added = folder->messages_cnt;
+	free(messages);
+}
+
+
 /* imap4_message_new */
 static AccountMessage * _imap4_message_new(IMAP4 * imap4,
 		AccountFolder * folder, unsigned int id)
@@ -1170,8 +2356,9 @@ static AccountMessage * _imap4_message_new(IMAP4 * imap4,
 	if((message = object_new(sizeof(*message))) == NULL)
 		return NULL;
 	message->id = id;
-	if((message->message = helper->message_new(helper->account,
-					folder->folder, message)) == NULL)
+	/* the message is listed with the others parsed at the same time */
+	if((message->message = helper->message_new(helper->account, NULL,
+					message)) == NULL)
 	{
 		_imap4_message_delete(imap4, message);
 		return NULL;
@@ -1185,16 +2372,29 @@ static AccountMessage * _imap4_message_new(IMAP4 * imap4,
 static void _imap4_message_delete(IMAP4 * imap4,
 		AccountMessage * message)
 {
+	if(imap4->partial == message)
+		imap4->partial = NULL;
 	if(message->message != NULL)
 		imap4->helper->message_delete(message->message);
 	object_delete(message);
 }
 
 
+/* imap4_message_cancel */
+static void _imap4_message_cancel(IMAP4 * imap4)
+{
+	AccountPluginHelper * helper = imap4->helper;
+
+	if(imap4->partial == NULL)
+		return;
+	/* incomplete bodies must not be kept */
+	helper->message_set_body(imap4->partial->message, NULL, 0, 0);
+	imap4->partial = NULL;
+}
+
+
 /* callbacks */
 /* on_idle */
-static int _connect_address(IMAP4 * imap4, char const * hostname,
-		struct addrinfo * ai);
 static int _connect_channel(IMAP4 * imap4);
 
 static gboolean _on_connect(gpointer data)
@@ -1203,6 +2403,7 @@ static gboolean _on_connect(gpointer data)
 	AccountPluginHelper * helper = imap4->helper;
 	char const * hostname;
 	char const * p;
+	gchar * q;
 	uint16_t port;
 
 #ifdef DEBUG
@@ -1218,58 +2419,28 @@ static gboolean _on_connect(gpointer data)
 	if((p = imap4->config[I4CV_PORT].value) == NULL)
 		return FALSE;
 	port = (unsigned long)p;
-	/* lookup the address */
-	if(_common_lookup(hostname, port, &imap4->ai) != 0)
+	/* open the cache */
+	if(imap4->cache == NULL && (p = imap4->config[I4CV_CACHE].value)
+			!= NULL)
 	{
-		helper->error(helper->account, error_get(NULL), 1);
-		return FALSE;
+		q = g_strdup_printf("%s@%s:%hu",
+				(imap4->config[I4CV_USERNAME].value != NULL)
+				? (char const *)imap4->config[
+				I4CV_USERNAME].value : "", hostname, port);
+		if((imap4->cache = _common_cache_new("imap4", q,
+						(unsigned long)p * 1024 * 1024))
+				== NULL)
+			helper->error(NULL, error_get(NULL), 1);
+		g_free(q);
 	}
-	for(imap4->aip = imap4->ai; imap4->aip != NULL;
-			imap4->aip = imap4->aip->ai_next)
-		if(_connect_address(imap4, hostname, imap4->aip) == 0)
-			break;
-	if(imap4->aip == NULL)
-		_imap4_stop(imap4);
-	return FALSE;
-}
-
-static int _connect_address(IMAP4 * imap4, char const * hostname,
-		struct addrinfo * ai)
-{
-	AccountPluginHelper * helper = imap4->helper;
-	int res;
-	char * q;
-	char buf[128];
-
-	/* create the socket */
-	if((imap4->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol))
-			== -1)
-		return -helper->error(helper->account, strerror(errno), 1);
-	if((res = fcntl(imap4->fd, F_GETFL)) >= 0
-			&& fcntl(imap4->fd, F_SETFL, res | O_NONBLOCK) == -1)
-		/* ignore this error */
-		/* FIXME report properly as a warning instead */
-		helper->error(NULL, strerror(errno), 1);
-	/* report the current status */
-	if((q = _common_lookup_print(ai)) != NULL)
-		snprintf(buf, sizeof(buf), "Connecting to %s (%s)", hostname,
-				q);
-	else
-		snprintf(buf, sizeof(buf), "Connecting to %s", hostname);
-	free(q);
-	_imap4_event_status(imap4, AS_CONNECTING, buf);
-	/* connect to the remote host */
-	if((connect(imap4->fd, ai->ai_addr, ai->ai_addrlen) != 0
-				&& errno != EINPROGRESS && errno != EINTR)
-			|| _connect_channel(imap4) != 0)
+	/* lookup the address without blocking */
+	if((imap4->lookup = helper->lookup(helper->account, hostname, port,
+					_on_lookup, imap4)) == 0)
 	{
-		snprintf(buf, sizeof(buf), "%s (%s)", "Connection failed",
-				strerror(errno));
-		return -helper->error(helper->account, buf, 1);
+		helper->error(helper->account, error_get(NULL), 1);
+		_imap4_stop(imap4);
 	}
-	imap4->wr_source = g_io_add_watch(imap4->channel, G_IO_OUT,
-			_on_watch_can_connect, imap4);
-	return 0;
+	return FALSE;
 }
 
 static int _connect_channel(IMAP4 * imap4)
@@ -1298,6 +2469,53 @@ static int _connect_channel(IMAP4 * imap4)
 }
 
 
+/* on_journal */
+static gboolean _on_journal(gpointer data)
+{
+	IMAP4 * imap4 = data;
+
+	imap4->journal_source = 0;
+	_imap4_journal_flush(imap4);
+	return FALSE;
+}
+
+
+/* on_lookup */
+static void _on_lookup(struct addrinfo const * ai, char const * error,
+		void * data)
+{
+	IMAP4 * imap4 = data;
+	AccountPluginHelper * helper = imap4->helper;
+	char const * hostname = imap4->config[I4CV_HOSTNAME].value;
+	char buf[128];
+
+	imap4->lookup = 0;
+	if(error != NULL)
+	{
+		helper->error(helper->account, error, 1);
+		_imap4_stop(imap4);
+		return;
+	}
+	if((imap4->ai = _common_lookup_copy(ai)) == NULL)
+	{
+		helper->error(helper->account, strerror(errno), 1);
+		_imap4_stop(imap4);
+		return;
+	}
+	snprintf(buf, sizeof(buf), "Connecting to %s", hostname);
+	_imap4_event_status(imap4, AS_CONNECTING, buf);
+	/* connect to the first address available */
+	if((imap4->connect = _common_connect_new(imap4->ai, _on_connected,
+					imap4)) == NULL)
+	{
+		snprintf(buf, sizeof(buf), "%s (%s)", "Connection failed",
+				error_get(NULL));
+		helper->error(helper->account, buf, 1);
+		_imap4_stop(imap4);
+	}
+}
+
+
 /* on_noop */
 static gboolean _on_noop(gpointer data)
 {
@@ -1309,33 +2527,34 @@ static gboolean _on_noop(gpointer data)
 }
 
 
-/* on_watch_can_connect */
-static gboolean _on_watch_can_connect(GIOChannel * source,
-		GIOCondition condition, gpointer data)
+/* on_connected */
+static void _on_connected(int fd, struct addrinfo * ai, int error, void * data)
 {
 	IMAP4 * imap4 = data;
 	AccountPluginHelper * helper = imap4->helper;
-	int res;
-	socklen_t s = sizeof(res);
 	char const * hostname = imap4->config[I4CV_HOSTNAME].value;
 	SSL_CTX * ssl_ctx;
 	char buf[128];
 	char * q;
 
-	if(condition != G_IO_OUT || source != imap4->channel)
-		return FALSE; /* should not happen */
+	imap4->connect = NULL;
+	if(error != 0)
+	{
+		snprintf(buf, sizeof(buf), "%s (%s)", "Connection failed",
+				strerror(error));
+		helper->error(helper->account, buf, 1);
+		_imap4_stop(imap4);
+		return;
+	}
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s() connected\n", __func__);
 #endif
-	if(getsockopt(imap4->fd, SOL_SOCKET, SO_ERROR, &res, &s) != 0
-			|| res != 0)
+	imap4->fd = fd;
+	imap4->aip = ai;
+	if(_connect_channel(imap4) != 0)
 	{
-		snprintf(buf, sizeof(buf), "%s (%s)", "Connection failed",
-				strerror(res));
-		helper->error(helper->account, buf, 1);
-		/* FIXME try the next address instead */
 		_imap4_stop(imap4);
-		return FALSE;
+		return;
 	}
 	if(imap4->aip != NULL && (q = _common_lookup_print(imap4->aip)) != NULL)
 	{
@@ -1346,37 +2565,39 @@ static gboolean _on_watch_can_connect(GIOChannel * source,
 	else
 		snprintf(buf, sizeof(buf), "Connected to %s", hostname);
 	_imap4_event_status(imap4, AS_CONNECTED, buf);
-	imap4->wr_source = 0;
 	/* setup SSL */
 	if(imap4->config[I4CV_SSL].value != NULL)
 	{
 		if((ssl_ctx = helper->get_ssl_context(helper->account)) == NULL)
 			/* FIXME report error */
-			return FALSE;
+			return;
 		if((imap4->ssl = SSL_new(ssl_ctx)) == NULL)
 		{
 			helper->error(helper->account, ERR_error_string(
 						ERR_get_error(), buf), 1);
-			return FALSE;
+			return;
 		}
-		if(SSL_set_fd(imap4->ssl, imap4->fd) != 1)
+		if(SSL_set_fd(imap4->ssl, imap4->fd) != 1
+				|| _common_ssl_setup(helper, imap4->ssl,
+					hostname, (unsigned long)imap4->config[
+					I4CV_PORT].value) != 0)
 		{
 			ERR_error_string(ERR_get_error(), buf);
 			SSL_free(imap4->ssl);
 			imap4->ssl = NULL;
 			helper->error(helper->account, buf, 1);
-			return FALSE;
+			return;
 		}
 		SSL_set_connect_state(imap4->ssl);
 		/* perform initial handshake */
+		imap4->ssl_start = g_get_monotonic_time();
 		imap4->wr_source = g_io_add_watch(imap4->channel, G_IO_OUT,
 				_on_watch_can_handshake, imap4);
-		return FALSE;
+		return;
 	}
 	/* wait for the server's banner */
 	imap4->rd_source = g_io_add_watch(imap4->channel, G_IO_IN,
 			_on_watch_can_read, imap4);
-	return FALSE;
 }
 
 
@@ -1407,6 +2628,10 @@ static gboolean _on_watch_can_handshake(GIOChannel * source,
 			_imap4_stop(imap4);
 			return FALSE;
 		}
+		_common_ssl_status(imap4->ssl,
+				imap4->config[I4CV_HOSTNAME].value,
+				imap4->ssl_start, buf, sizeof(buf));
+		_imap4_event_status(imap4, AS_CONNECTED, buf);
 		/* wait for the server's banner */
 		imap4->rd_source = g_io_add_watch(imap4->channel, G_IO_IN,
 				_on_watch_can_read_ssl, imap4);
@@ -1464,7 +2689,6 @@ static gboolean _on_watch_can_read(GIOChannel * source, GIOCondition condition,
 	gsize cnt = 0;
 	GError * error = NULL;
 	GIOStatus status;
-	IMAP4Command * cmd;
 	const int inc = 256;
 
 #ifdef DEBUG
@@ -1502,27 +2726,14 @@ static gboolean _on_watch_can_read(GIOChannel * source, GIOCondition condition,
 		_imap4_stop(imap4);
 		return FALSE;
 	}
-	if(imap4->queue_cnt == 0)
-		return TRUE;
-	cmd = &imap4->queue[0];
-	if(cmd->buf_cnt == 0)
-	{
-		if(cmd->status == I4CS_SENT || cmd->status == I4CS_PARSING)
-			/* begin or keep parsing */
-			return TRUE;
-		else if(cmd->status == I4CS_OK || cmd->status == I4CS_ERROR)
-			/* the current command is completed */
-			memmove(cmd, &imap4->queue[1], sizeof(*cmd)
-					* --imap4->queue_cnt);
-	}
-	if(imap4->queue_cnt == 0)
+	if(imap4->queue_cnt > 0)
+		/* send the next commands if possible */
+		_imap4_queue_schedule(imap4);
+	else if(imap4->source == 0)
 	{
 		_imap4_event_status(imap4, AS_IDLE, NULL);
 		imap4->source = g_timeout_add(30000, _on_noop, imap4);
 	}
-	else
-		imap4->wr_source = g_io_add_watch(imap4->channel, G_IO_OUT,
-				_on_watch_can_write, imap4);
 	return TRUE;
 }
 
@@ -1534,7 +2745,6 @@ static gboolean _on_watch_can_read_ssl(GIOChannel * source,
 	IMAP4 * imap4 = data;
 	char * p;
 	int cnt;
-	IMAP4Command * cmd;
 	char buf[128];
 	const int inc = 16384; /* XXX not reliable with a smaller value */
 
@@ -1579,27 +2789,14 @@ static gboolean _on_watch_can_read_ssl(GIOChannel * source,
 		_imap4_stop(imap4);
 		return FALSE;
 	}
-	if(imap4->queue_cnt == 0)
-		return TRUE;
-	cmd = &imap4->queue[0];
-	if(cmd->buf_cnt == 0)
-	{
-		if(cmd->status == I4CS_SENT || cmd->status == I4CS_PARSING)
-			/* begin or keep parsing */
-			return TRUE;
-		else if(cmd->status == I4CS_OK || cmd->status == I4CS_ERROR)
-			/* the current command is completed */
-			memmove(cmd, &imap4->queue[1], sizeof(*cmd)
-					* --imap4->queue_cnt);
-	}
-	if(imap4->queue_cnt == 0)
+	if(imap4->queue_cnt > 0)
+		/* send the next commands if possible */
+		_imap4_queue_schedule(imap4);
+	else if(imap4->source == 0)
 	{
 		_imap4_event_status(imap4, AS_IDLE, NULL);
 		imap4->source = g_timeout_add(30000, _on_noop, imap4);
 	}
-	else
-		imap4->wr_source = g_io_add_watch(imap4->channel, G_IO_OUT,
-				_on_watch_can_write_ssl, imap4);
 	return TRUE;
 }
 
@@ -1610,7 +2807,7 @@ static gboolean _on_watch_can_write(GIOChannel * source, GIOCondition condition,
 {
 	IMAP4 * imap4 = data;
 	AccountPluginHelper * helper = imap4->helper;
-	IMAP4Command * cmd = &imap4->queue[0];
+	IMAP4Command * cmd = _imap4_queue_next(imap4);
 	gsize cnt = 0;
 	GError * error = NULL;
 	GIOStatus status;
@@ -1619,9 +2816,12 @@ static gboolean _on_watch_can_write(GIOChannel * source, GIOCondition condition,
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s()\n", __func__);
 #endif
-	if(condition != G_IO_OUT || source != imap4->channel
-			|| imap4->queue_cnt == 0 || cmd->buf_cnt == 0)
+	if(condition != G_IO_OUT || source != imap4->channel || cmd == NULL
+			|| cmd->buf_cnt == 0)
+	{
+		imap4->wr_source = 0;
 		return FALSE; /* should not happen */
+	}
 	status = g_io_channel_write_chars(source, cmd->buf, cmd->buf_cnt, &cnt,
 			&error);
 #ifdef DEBUG
@@ -1655,11 +2855,14 @@ static gboolean _on_watch_can_write(GIOChannel * source, GIOCondition condition,
 	if(cmd->buf_cnt > 0)
 		return TRUE;
 	cmd->status = I4CS_SENT;
-	imap4->wr_source = 0;
 	if(imap4->rd_source == 0)
 		/* XXX should not happen */
 		imap4->rd_source = g_io_add_watch(imap4->channel, G_IO_IN,
 				_on_watch_can_read, imap4);
+	/* keep sending while pipelining */
+	if(_imap4_queue_next(imap4) != NULL)
+		return TRUE;
+	imap4->wr_source = 0;
 	return FALSE;
 }
 
@@ -1669,7 +2872,7 @@ static gboolean _on_watch_can_write_ssl(GIOChannel * source,
 		GIOCondition condition, gpointer data)
 {
 	IMAP4 * imap4 = data;
-	IMAP4Command * cmd = &imap4->queue[0];
+	IMAP4Command * cmd = _imap4_queue_next(imap4);
 	int cnt;
 	char * p;
 	char buf[128];
@@ -1678,9 +2881,12 @@ static gboolean _on_watch_can_write_ssl(GIOChannel * source,
 	fprintf(stderr, "DEBUG: %s()\n", __func__);
 #endif
 	if((condition != G_IO_IN && condition != G_IO_OUT)
-			|| source != imap4->channel || imap4->queue_cnt == 0
+			|| source != imap4->channel || cmd == NULL
 			|| cmd->buf_cnt == 0)
+	{
+		imap4->wr_source = 0;
 		return FALSE; /* should not happen */
+	}
 	if((cnt = SSL_write(imap4->ssl, cmd->buf, cmd->buf_cnt)) <= 0)
 	{
 		if(SSL_get_error(imap4->ssl, cnt) == SSL_ERROR_WANT_READ)
@@ -1712,10 +2918,13 @@ static gboolean _on_watch_can_write_ssl(GIOChannel * source,
 	if(cmd->buf_cnt > 0)
 		return TRUE;
 	cmd->status = I4CS_SENT;
-	imap4->wr_source = 0;
 	if(imap4->rd_source == 0)
 		/* XXX should not happen */
 		imap4->rd_source = g_io_add_watch(imap4->channel, G_IO_IN,
 				_on_watch_can_read_ssl, imap4);
+	/* keep sending while pipelining */
+	if(_imap4_queue_next(imap4) != NULL)
+		return TRUE;
+	imap4->wr_source = 0;
 	return FALSE;
 }
@@ -79,6 +79,7 @@ struct _AccountFolder
 	AccountConfig * config;
 	AccountMessage ** messages;
 	size_t messages_cnt;
+	size_t messages_added;
 
 	/* refresh */
 	time_t mtime;
@@ -110,6 +111,7 @@ struct _AccountPlugin
 
 
 /* constants */
+#define MBOX_MESSAGES_BATCH	256
 #define MBOX_REFRESH_TIMEOUT	5000
 
 static AccountConfig const _mbox_config[] =
@@ -161,7 +163,9 @@ AccountPluginDefinition account_plugin =
 	_mbox_get_source,
 	_mbox_start,
 	_mbox_stop,
-	_mbox_refresh
+	_mbox_refresh,
+	NULL,
+	NULL
 };
 
 
@@ -176,7 +180,7 @@ static gboolean _folder_watch(GIOChannel * source, GIOCondition condition,
 /* private */
 /* prototypes */
 static AccountMessage * _message_new(AccountPluginHelper * helper,
-		Folder * folder, off_t offset);
+		off_t offset);
 static void _message_delete(AccountMessage * message);
 
 static int _message_set_body(AccountMessage * message, off_t offset,
@@ -229,6 +233,7 @@ static int _mbox_destroy(Mbox * mbox)
 		free(mf->messages);
 		mf->messages = NULL;
 		mf->messages_cnt = 0;
+		mf->messages_added = 0;
 	}
 	free(mbox);
 	return 0;
@@ -347,7 +352,15 @@ static int _mbox_refresh(Mbox * mbox, AccountFolder * folder,
 			&& fseek(fp, message->body_offset, SEEK_SET) == 0
 			&& (buf = malloc(message->body_length)) != NULL)
 	{
-		if((size = fread(buf, 1, message->body_length, fp)) > 0)
+		if((size = fread(buf, 1, message->body_length, fp))
+				== message->body_length)
+		{
+			mbox->helper->message_set_body(message->message, buf,
+					size, 1);
+			mbox->helper->message_set_body_complete(
+					message->message);
+		}
+		else if(size > 0)
 			mbox->helper->message_set_body(message->message, buf,
 					size, 1);
 		free(buf);
@@ -361,7 +374,7 @@ static int _mbox_refresh(Mbox * mbox, AccountFolder * folder,
 /* functions */
 /* message_new */
 static AccountMessage * _message_new(AccountPluginHelper * helper,
-		Folder * folder, off_t offset)
+		off_t offset)
 {
 	AccountMessage * message;
 
@@ -371,7 +384,9 @@ static AccountMessage * _message_new(AccountPluginHelper * helper,
 		return NULL;
 	}
 	message->helper = helper;
-	message->message = helper->message_new(helper->account, folder,
+	/* the message is listed along with the others, once at least
+	 * MBOX_MESSAGES_BATCH of them are parsed or the file is read */
+	message->message = helper->message_new(helper->account, NULL,
 			message);
 	message->offset = offset;
 	message->body_offset = 0;
@@ -474,6 +489,7 @@ static void _parse_body(AccountFolder * folder, char const buf[], size_t read,
 		size_t * i);
 static AccountMessage * _folder_message_add(AccountFolder * folder,
 		off_t offset);
+static void _folder_messages_add(AccountFolder * folder);
 
 static gboolean _folder_watch(GIOChannel * source, GIOCondition condition,
 		gpointer data)
@@ -490,12 +506,17 @@ static gboolean _folder_watch(GIOChannel * source, GIOCondition condition,
 			(char const *)folder->config->value);
 #endif
 	if(condition != G_IO_IN)
+	{
+		/* list the messages parsed so far */
+		_folder_messages_add(folder);
 		return FALSE; /* FIXME implement message deletion */
+	}
 	status = g_io_channel_read_chars(source, buf, sizeof(buf), &read,
 			&error);
 	switch(status)
 	{
 		case G_IO_STATUS_ERROR:
+			_folder_messages_add(folder);
 			mbox->helper->error(NULL, error->message, 1);
 			g_error_free(error);
 			/* FIXME new timeout 1000 function after invalidating
@@ -508,6 +529,9 @@ static gboolean _folder_watch(GIOChannel * source, GIOCondition condition,
 			break;
 	}
 	_watch_parse(folder, buf, read);
+	if(folder->messages_cnt - folder->messages_added
+			>= MBOX_MESSAGES_BATCH)
+		_folder_messages_add(folder);
 	if(status == G_IO_STATUS_EOF)
 	{
 		/* XXX should not be necessary here */
@@ -516,6 +540,7 @@ static gboolean _folder_watch(GIOChannel * source, GIOCondition condition,
 					folder->message->body_offset,
 					folder->offset
 					- folder->message->body_offset);
+		_folder_messages_add(folder);
 		if(g_io_channel_shutdown(source, TRUE, &error)
 				!= G_IO_STATUS_NORMAL && error != NULL)
 		{
@@ -675,8 +700,7 @@ static AccountMessage * _folder_message_add(AccountFolder * folder,
 		return NULL;
 	}
 	folder->messages = p;
-	if((message = _message_new(folder->mbox->helper, folder->folder,
-					offset)) == NULL)
+	if((message = _message_new(folder->mbox->helper, offset)) == NULL)
 	{
 		/* FIXME track error */
 		return NULL;
@@ -684,3 +708,27 @@ static AccountMessage * _folder_message_add(AccountFolder * folder,
 	folder->messages[folder->messages_cnt++] = message;
 	return message;
 }
+
+static void _folder_messages_add(AccountFolder * folder)
+{
+	AccountPluginHelper * helper = folder->mbox->helper;
+	Message ** messages;
+	size_t cnt = folder->messages_cnt - folder->messages_added;
+	size_t i;
+
+	if(cnt == 0 || folder->folder == NULL)
+		return;
+	/* list the new messages at once */
+	if((messages = malloc(sizeof(*messages) * cnt)) == NULL)
+	{
+		/* FIXME track error */
+		return;
+	}
+	for(i = 0; i < cnt; i++)
+		messages[i] = folder->messages[folder->messages_added + i]
+			->message;
+	if(helper->messages_add(helper->account, folder->folder, messages,
+				cnt) == 0)
+		folder->messages_added = folder->messages_cnt;
+	free(messages);
+}
@@ -63,5 +63,7 @@ AccountPluginDefinition account_plugin =
 	NULL,
 	NULL,
 	NULL,
+	NULL,
+	NULL,
 	NULL
 };
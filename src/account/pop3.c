@@ -39,6 +39,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <errno.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -59,6 +60,7 @@ struct _AccountFolder
 
 	AccountMessage ** messages;
 	size_t messages_cnt;
+	size_t messages_added;
 };
 
 struct _AccountMessage
@@ -66,8 +68,16 @@ struct _AccountMessage
 	Message * message;
 
 	unsigned int id;
+	char * uid;
+	uint64_t hash;
 };
 
+typedef enum _POP3Capability
+{
+	P3CAP_NONE = 0x0,
+	P3CAP_PIPELINING = 0x1
+} POP3Capability;
+
 typedef enum _POP3CommandStatus
 {
 	P3CS_QUEUED = 0,
@@ -84,9 +94,12 @@ typedef enum _POP3ConfigValue
 	P3CV_HOSTNAME,
 	P3CV_PORT,
 	P3CV_SSL,
-	P3CV_DELETE
+	P3CV_DELETE,
+	P3CV_CACHE,
+	P3CV_STORE,
+	P3CV_KEEP
 } POP3ConfigValue;
-#define P3CV_LAST P3CV_DELETE
+#define P3CV_LAST P3CV_KEEP
 #define P3CV_COUNT (P3CV_LAST + 1)
 
 typedef enum _POP3Context
@@ -94,11 +107,14 @@ typedef enum _POP3Context
 	P3C_INIT = 0,
 	P3C_AUTHORIZATION_USER,
 	P3C_AUTHORIZATION_PASS,
+	P3C_CAPA,
 	P3C_NOOP,
+	P3C_TRANSACTION_DELE,
 	P3C_TRANSACTION_LIST,
 	P3C_TRANSACTION_RETR,
 	P3C_TRANSACTION_STAT,
-	P3C_TRANSACTION_TOP
+	P3C_TRANSACTION_TOP,
+	P3C_TRANSACTION_UIDL
 } POP3Context;
 
 typedef struct _POP3Command
@@ -113,22 +129,49 @@ typedef struct _POP3Command
 		struct
 		{
 			unsigned int id;
+			char * uid;
 			gboolean body;
 			AccountMessage * message;
+			GString * contents;
+
+			/* local store */
+			FILE * fp;
+			off_t offset;
+			gchar * filename;
+			gchar * location;
 		} transaction_retr, transaction_top;
+
+		struct
+		{
+			unsigned int id;
+			AccountMessage * message;
+		} transaction_dele;
 	} data;
 } POP3Command;
 
+typedef struct _POP3State
+{
+	uint64_t hash;
+	char * headers;
+	time_t stored;
+	char * location;
+} POP3State;
+
 typedef struct _AccountPlugin
 {
 	AccountPluginHelper * helper;
 
 	AccountConfig * config;
 
+	CommonCache * cache;
+
+	unsigned int lookup;
+	CommonConnect * connect;
 	struct addrinfo * ai;
 	struct addrinfo * aip;
 	int fd;
 	SSL * ssl;
+	gint64 ssl_start;
 	guint source;
 
 	AccountFolder inbox;
@@ -142,9 +185,32 @@ typedef struct _AccountPlugin
 
 	POP3Command * queue;
 	size_t queue_cnt;
+
+	POP3Capability capabilities;
+
+	/* messages of the inbox, by UID */
+	GHashTable * uids;
+
+	/* headers of the messages already known, by UID */
+	gchar * state_filename;
+	GHashTable * state;
+	size_t state_pending;
+	gboolean state_listed;
+	gboolean state_dirty;
+
+	/* waiting for the lock of the local store */
+	guint store_source;
+
+	/* deletions are only committed at the end of the session */
+	size_t deleted;
 } POP3;
 
 
+/* constants */
+#define POP3_STATE_EXTENSION	".uidl"
+#define POP3_STORE_TIMEOUT	1000
+
+
 /* variables */
 static char const _pop3_type[] = "POP3";
 static char const _pop3_name[] = "POP3 server";
@@ -158,6 +224,11 @@ static AccountConfig _pop3_config[P3CV_COUNT + 1] =
 	{ "ssl",	"Use SSL",		ACT_BOOLEAN,	NULL },
 	{ "delete",	"Delete read mails on server",
 						ACT_BOOLEAN,	NULL },
+	{ "cache",	"Offline cache (MB)",	ACT_UINT16,	(void *)64 },
+	{ "store",	"Download to (mbox or Maildir)",
+						ACT_FILE,	NULL },
+	{ "keep",	"Days to leave mails on server",
+						ACT_UINT16,	NULL },
 	{ NULL,		NULL,			ACT_NONE,	NULL }
 };
 
@@ -173,9 +244,33 @@ static int _pop3_refresh(POP3 * pop3, AccountFolder * folder,
 		AccountMessage * message);
 
 /* useful */
+static gchar * _pop3_cache_key(POP3 * pop3, AccountMessage * message);
 static POP3Command * _pop3_command(POP3 * pop3, POP3Context context,
 		char const * command);
 static int _pop3_parse(POP3 * pop3);
+static void _pop3_quit(POP3 * pop3);
+static void _pop3_set_capability(POP3 * pop3, char const * capability);
+
+/* queue */
+static POP3Command * _pop3_queue_next(POP3 * pop3);
+static void _pop3_queue_pop(POP3 * pop3);
+static void _pop3_queue_schedule(POP3 * pop3);
+
+/* state */
+static int _pop3_state_load(POP3 * pop3, char const * account);
+static int _pop3_state_save(POP3 * pop3);
+static int _pop3_state_set(POP3 * pop3, char const * uid, uint64_t hash,
+		char const * headers, time_t stored, char const * location);
+static void _pop3_state_delete(POP3State * state);
+
+/* store */
+static int _pop3_store_open(POP3 * pop3, POP3Command * cmd);
+static int _pop3_store_read(POP3 * pop3, AccountMessage * message,
+		char const * location);
+static int _pop3_store_write(POP3 * pop3, POP3Command * cmd,
+		char const * buf, size_t len);
+static int _pop3_store_close(POP3 * pop3, POP3Command * cmd,
+		gboolean commit);
 
 /* events */
 static void _pop3_event(POP3 * pop3, AccountEventType type);
@@ -184,16 +279,21 @@ static void _pop3_event_status(POP3 * pop3, AccountStatus status,
 
 static AccountMessage * _pop3_message_get(POP3 * pop3,
 		AccountFolder * folder, unsigned int id);
+static AccountMessage * _pop3_message_get_uid(POP3 * pop3,
+		char const * uid);
 static AccountMessage * _pop3_message_new(POP3 * pop3,
 		AccountFolder * folder, unsigned int id);
 static void _pop3_message_delete(POP3 * pop3,
 		AccountMessage * message);
+static void _pop3_messages_add(POP3 * pop3, AccountFolder * folder);
 
 /* callbacks */
 static gboolean _on_connect(gpointer data);
+static void _on_connected(int fd, struct addrinfo * ai, int error, void * data);
+static void _on_lookup(struct addrinfo const * ai, char const * error,
+		void * data);
 static gboolean _on_noop(gpointer data);
-static gboolean _on_watch_can_connect(GIOChannel * source,
-		GIOCondition condition, gpointer data);
+static gboolean _on_store(gpointer data);
 static gboolean _on_watch_can_handshake(GIOChannel * source,
 		GIOCondition condition, gpointer data);
 static gboolean _on_watch_can_read(GIOChannel * source, GIOCondition condition,
@@ -221,7 +321,9 @@ AccountPluginDefinition account_plugin =
 	NULL,
 	_pop3_start,
 	_pop3_stop,
-	_pop3_refresh
+	_pop3_refresh,
+	NULL,
+	NULL
 };
 
 
@@ -243,9 +345,12 @@ static POP3 * _pop3_init(AccountPluginHelper * helper)
 		return NULL;
 	}
 	memcpy(pop3->config, &_pop3_config, sizeof(_pop3_config));
+	pop3->lookup = 0;
+	pop3->connect = NULL;
 	pop3->ai = NULL;
 	pop3->aip = NULL;
 	pop3->fd = -1;
+	pop3->uids = g_hash_table_new(g_str_hash, g_str_equal);
 	pop3->inbox.folder = pop3->helper->folder_new(pop3->helper->account,
 			&pop3->inbox, NULL, FT_INBOX, "Inbox");
 	pop3->trash.folder = pop3->helper->folder_new(pop3->helper->account,
@@ -258,6 +363,8 @@ static POP3 * _pop3_init(AccountPluginHelper * helper)
 /* pop3_destroy */
 static int _pop3_destroy(POP3 * pop3)
 {
+	size_t i;
+
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s()\n", __func__);
 #endif
@@ -265,6 +372,16 @@ static int _pop3_destroy(POP3 * pop3)
 	if(pop3 == NULL) /* XXX _pop3_destroy() may be called uninitialized */
 		return 0;
 	_pop3_stop(pop3);
+	if(pop3->cache != NULL)
+		_common_cache_delete(pop3->cache);
+	g_hash_table_destroy(pop3->uids);
+	/* the messages own their UID */
+	for(i = 0; i < pop3->inbox.messages_cnt; i++)
+		_pop3_message_delete(pop3, pop3->inbox.messages[i]);
+	free(pop3->inbox.messages);
+	if(pop3->state != NULL)
+		g_hash_table_destroy(pop3->state);
+	g_free(pop3->state_filename);
 	free(pop3);
 	return 0;
 }
@@ -292,33 +409,63 @@ static int _pop3_start(POP3 * pop3)
 /* pop3_stop */
 static void _pop3_stop(POP3 * pop3)
 {
+	AccountPluginHelper * helper = pop3->helper;
 	size_t i;
 
+	/* commit the deletions */
+	for(i = 0; pop3->deleted == 0 && i < pop3->queue_cnt; i++)
+		if(pop3->queue[i].context == P3C_TRANSACTION_DELE
+				&& pop3->queue[i].status != P3CS_QUEUED)
+			pop3->deleted++;
+	if(pop3->deleted > 0)
+		_pop3_quit(pop3);
+	pop3->deleted = 0;
 	if(pop3->ssl != NULL)
 		SSL_free(pop3->ssl);
 	pop3->ssl = NULL;
 	if(pop3->rd_source != 0)
 		g_source_remove(pop3->rd_source);
+	pop3->rd_source = 0;
 	free(pop3->rd_buf);
+	pop3->rd_buf = NULL;
+	pop3->rd_buf_cnt = 0;
 	if(pop3->wr_source != 0)
 		g_source_remove(pop3->wr_source);
+	pop3->wr_source = 0;
 	if(pop3->source != 0)
 		g_source_remove(pop3->source);
+	pop3->source = 0;
+	if(pop3->store_source != 0)
+		g_source_remove(pop3->store_source);
+	pop3->store_source = 0;
 	if(pop3->channel != NULL)
 	{
 		g_io_channel_shutdown(pop3->channel, TRUE, NULL);
 		g_io_channel_unref(pop3->channel);
 		pop3->fd = -1;
 	}
-	for(i = 0; i < pop3->queue_cnt; i++)
-		free(pop3->queue[i].buf);
+	pop3->channel = NULL;
+	while(pop3->queue_cnt > 0)
+		_pop3_queue_pop(pop3);
 	free(pop3->queue);
+	pop3->queue = NULL;
+	pop3->capabilities = P3CAP_NONE;
+	/* remember the messages obtained so far */
+	if(pop3->state_listed && pop3->state_dirty)
+		_pop3_state_save(pop3);
+	pop3->state_pending = 0;
+	pop3->state_listed = FALSE;
 	if(pop3->fd >= 0)
 		close(pop3->fd);
 	pop3->fd = -1;
+	if(pop3->lookup != 0)
+		helper->lookup_cancel(helper->account, pop3->lookup);
+	pop3->lookup = 0;
+	if(pop3->connect != NULL)
+		_common_connect_delete(pop3->connect);
+	pop3->connect = NULL;
 	pop3->aip = NULL;
-	if(pop3->ai != NULL)
-		freeaddrinfo(pop3->ai);
+	_common_lookup_free(pop3->ai);
 	pop3->ai = NULL;
 	_pop3_event(pop3, AET_STOPPED);
 }
@@ -328,8 +475,13 @@ static void _pop3_stop(POP3 * pop3)
 static int _pop3_refresh(POP3 * pop3, AccountFolder * folder,
 		AccountMessage * message)
 {
+	AccountPluginHelper * helper = pop3->helper;
 	POP3Command * cmd;
+	POP3State * state;
 	char buf[32];
+	gchar * key;
+	char * p;
+	size_t size;
 	(void) folder;
 
 #ifdef DEBUG
@@ -338,10 +490,38 @@ static int _pop3_refresh(POP3 * pop3, AccountFolder * folder,
 #endif
 	if(message == NULL)
 		return 0;
+	/* look for the message in the cache first */
+	if((key = _pop3_cache_key(pop3, message)) != NULL)
+	{
+		p = _common_cache_get(pop3->cache, key, &size);
+		g_free(key);
+		if(p != NULL)
+		{
+			_common_cache_message(helper, message->message, p,
+					size);
+			free(p);
+			return 0;
+		}
+	}
+	/* the messages downloaded are read back from the local store */
+	if(message->uid != NULL && pop3->state != NULL
+			&& (state = g_hash_table_lookup(pop3->state,
+					message->uid)) != NULL
+			&& state->location != NULL)
+	{
+		if(_pop3_store_read(pop3, message, state->location) == 0)
+			return 0;
+		helper->error(NULL, error_get(NULL), 1);
+	}
+	/* the message was deleted from the server */
+	if(message->id == 0)
+		return 0;
 	snprintf(buf, sizeof(buf), "%s %u", "RETR", message->id);
 	if((cmd = _pop3_command(pop3, P3C_TRANSACTION_RETR, buf)) == NULL)
 		return -1;
 	cmd->data.transaction_retr.id = message->id;
+	if(pop3->cache != NULL && message->hash != 0)
+		cmd->data.transaction_retr.contents = g_string_new(NULL);
 	return 0;
 }
 
@@ -349,6 +529,22 @@ static int _pop3_refresh(POP3 * pop3, AccountFolder * folder,
 /* private */
 /* functions */
 /* useful */
+/* pop3_cache_key */
+static gchar * _pop3_cache_key(POP3 * pop3, AccountMessage * message)
+{
+	char const * username = pop3->config[P3CV_USERNAME].value;
+
+	if(pop3->cache == NULL || message->hash == 0)
+		return NULL;
+	/* messages are identified by a hash of their headers */
+	return g_strdup_printf("pop://%s@%s:%lu/;HASH=%016llx",
+			(username != NULL) ? username : "",
+			(char const *)pop3->config[P3CV_HOSTNAME].value,
+			(unsigned long)pop3->config[P3CV_PORT].value,
+			(unsigned long long)message->hash);
+}
+
+
 /* pop3_command */
 static POP3Command * _pop3_command(POP3 * pop3, POP3Context context,
 		char const * command)
@@ -379,18 +575,13 @@ static POP3Command * _pop3_command(POP3 * pop3, POP3Context context,
 		return NULL;
 	p->buf_cnt = snprintf(p->buf, len, "%s\r\n", command);
 	memset(&p->data, 0, sizeof(p->data));
-	if(pop3->queue_cnt++ == 0)
+	if(pop3->queue_cnt++ == 0 && pop3->source != 0)
 	{
-		if(pop3->source != 0)
-		{
-			/* cancel the pending NOOP operation */
-			g_source_remove(pop3->source);
-			pop3->source = 0;
-		}
-		pop3->wr_source = g_io_add_watch(pop3->channel, G_IO_OUT,
-				(pop3->ssl != NULL) ? _on_watch_can_write_ssl
-				: _on_watch_can_write, pop3);
+		/* cancel the pending NOOP operation */
+		g_source_remove(pop3->source);
+		pop3->source = 0;
 	}
+	_pop3_queue_schedule(pop3);
 	return p;
 }
 
@@ -399,6 +590,11 @@ static POP3Command * _pop3_command(POP3 * pop3, POP3Context context,
 static int _parse_context(POP3 * pop3, char const * answer);
 static int _parse_context_transaction_retr(POP3 * pop3,
 		char const * answer);
+static int _parse_context_transaction_uidl(POP3 * pop3,
+		char const * answer);
+static int _parse_body(POP3 * pop3, char * buf, size_t cnt,
+		size_t * consumed);
+static int _parse_body_append(POP3 * pop3, char const * buf, size_t cnt);
 
 static int _pop3_parse(POP3 * pop3)
 {
@@ -406,12 +602,23 @@ static int _pop3_parse(POP3 * pop3)
 	AccountPluginHelper * helper = pop3->helper;
 	size_t i;
 	size_t j;
+	size_t k;
+	int res;
 
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s()\n", __func__);
 #endif
 	for(i = 0, j = 0;; j = ++i)
 	{
+		/* obtain the body of messages in bulk */
+		if(_parse_body(pop3, &pop3->rd_buf[j], pop3->rd_buf_cnt - j,
+					&k) != 0)
+		{
+			pop3->queue[0].status = P3CS_ERROR;
+			ret = -1;
+			break;
+		}
+		i = (j += k);
 		/* look for carriage return sequences */
 		for(; i < pop3->rd_buf_cnt; i++)
 			if(pop3->rd_buf[i] == '\r' && i + 1 < pop3->rd_buf_cnt
@@ -428,25 +635,110 @@ static int _pop3_parse(POP3 * pop3)
 				&& strncmp("-ERR", &pop3->rd_buf[j], 4) == 0)
 		{
 			pop3->queue[0].status = P3CS_ERROR;
-			helper->error(helper->account, &pop3->rd_buf[j + 4], 1);
+			/* extensions are allowed to fail */
+			if(pop3->queue[0].context != P3C_CAPA
+					&& pop3->queue[0].context
+					!= P3C_TRANSACTION_UIDL)
+				helper->error(helper->account,
+						&pop3->rd_buf[j + 4], 1);
 		}
 		else if(pop3->queue[0].status == P3CS_SENT
 				&& strncmp("+OK", &pop3->rd_buf[j], 3) == 0)
 			pop3->queue[0].status = P3CS_PARSING;
-		if(_parse_context(pop3, &pop3->rd_buf[j]) != 0)
+		if((res = _parse_context(pop3, &pop3->rd_buf[j])) > 0)
+		{
+			/* this answer is parsed again later */
+			pop3->rd_buf[i - 1] = '\r';
+			break;
+		}
+		else if(res != 0)
 		{
 			pop3->queue[0].status = P3CS_ERROR;
 			ret = -1;
 		}
+		/* the current command is completed; with pipelining, the next
+		 * answers are already meant for the following commands */
+		if(pop3->queue[0].status == P3CS_OK
+				|| pop3->queue[0].status == P3CS_ERROR)
+			_pop3_queue_pop(pop3);
 	}
 	if(j != 0)
 	{
 		pop3->rd_buf_cnt -= j;
 		memmove(pop3->rd_buf, &pop3->rd_buf[j], pop3->rd_buf_cnt);
 	}
+	/* list the messages obtained meanwhile */
+	_pop3_messages_add(pop3, &pop3->inbox);
 	return ret;
 }
 
+static int _parse_body(POP3 * pop3, char * buf, size_t cnt,
+		size_t * consumed)
+{
+	POP3Command * cmd = &pop3->queue[0];
+	char const * p;
+	size_t i;
+	size_t j;
+	size_t k;
+	size_t w;
+
+	*consumed = 0;
+	if(pop3->queue_cnt == 0 || (cmd->context != P3C_TRANSACTION_RETR
+				&& cmd->context != P3C_TRANSACTION_TOP)
+			|| cmd->status != P3CS_PARSING
+			|| cmd->data.transaction_retr.message == NULL
+			|| cmd->data.transaction_retr.body != TRUE)
+		return 0;
+	/* i is the current line, j the data not moved yet, and w the end of
+	 * the data already unstuffed in place */
+	for(i = 0, j = 0, k = 0, w = 0;
+			(p = memchr(&buf[k], '\n', cnt - k)) != NULL;)
+	{
+		k = p - buf + 1;
+		/* lines are only terminated by CRLF */
+		if(p == buf || p[-1] != '\r')
+			continue;
+		if(buf[i] == '.')
+		{
+			/* the terminator is left to _parse_context() */
+			if(k - i == 3)
+				break;
+			/* remove the byte-stuffing */
+			memmove(&buf[w], &buf[j], i - j);
+			w += i - j;
+			j = i + 1;
+		}
+		i = k;
+	}
+	memmove(&buf[w], &buf[j], i - j);
+	w += i - j;
+	*consumed = i;
+	/* deliver everything at once */
+	return _parse_body_append(pop3, buf, w);
+}
+
+static int _parse_body_append(POP3 * pop3, char const * buf, size_t cnt)
+{
+	AccountPluginHelper * helper = pop3->helper;
+	POP3Command * cmd = &pop3->queue[0];
+	GString * contents = cmd->data.transaction_retr.contents;
+
+	if(cnt == 0)
+		return 0;
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s() %lu\n", __func__, (unsigned long)cnt);
+#endif
+	/* the local store keeps the body instead */
+	if(cmd->data.transaction_retr.fp != NULL)
+		return (_pop3_store_write(pop3, cmd, buf, cnt) == 0) ? 0
+			: -helper->error(NULL, error_get(NULL), 1);
+	if(contents != NULL && cmd->context == P3C_TRANSACTION_RETR)
+		g_string_append_len(contents, buf, cnt);
+	helper->message_set_body(cmd->data.transaction_retr.message->message,
+			buf, cnt, 1);
+	return 0;
+}
+
 static int _parse_context(POP3 * pop3, char const * answer)
 {
 	int ret = -1;
@@ -486,12 +778,36 @@ static int _parse_context(POP3 * pop3, char const * answer)
 			if(cmd->status != P3CS_PARSING)
 				return 0;
 			cmd->status = P3CS_OK;
-			return (_pop3_command(pop3, P3C_TRANSACTION_STAT,
-						"STAT") != NULL) ? 0 : -1;
+			/* the capabilities may differ once authenticated */
+			return (_pop3_command(pop3, P3C_CAPA, "CAPA") != NULL
+					&& _pop3_command(pop3,
+						P3C_TRANSACTION_STAT, "STAT")
+					!= NULL) ? 0 : -1;
+		case P3C_CAPA:
+			if(cmd->status != P3CS_PARSING)
+				return 0;
+			if(strcmp(answer, ".") == 0)
+				cmd->status = P3CS_OK;
+			else if(strncmp(answer, "+OK", 3) != 0)
+				_pop3_set_capability(pop3, answer);
+			return 0;
 		case P3C_NOOP:
 			if(strncmp(answer, "+OK", 3) == 0)
 				cmd->status = P3CS_OK;
 			return 0;
+		case P3C_TRANSACTION_DELE:
+			if(cmd->status == P3CS_ERROR
+					&& cmd->data.transaction_dele.message
+					!= NULL)
+				/* the message is still on the server, and the
+				 * deletion is attempted again next session */
+				cmd->data.transaction_dele.message->id
+					= cmd->data.transaction_dele.id;
+			if(cmd->status != P3CS_PARSING)
+				return 0;
+			cmd->status = P3CS_OK;
+			pop3->deleted++;
+			return 0;
 		case P3C_TRANSACTION_LIST:
 			if(cmd->status != P3CS_PARSING)
 				return 0;
@@ -507,9 +823,11 @@ static int _parse_context(POP3 * pop3, char const * answer)
 			/* FIXME may not be supported by the server */
 			q = g_strdup_printf("%s %u 0", "TOP", u);
 			cmd = _pop3_command(pop3, P3C_TRANSACTION_TOP, q);
-			free(q);
+			g_free(q);
+			if(cmd == NULL)
+				return -1;
 			cmd->data.transaction_top.id = u;
-			return (cmd != NULL) ? 0 : -1;
+			return 0;
 		case P3C_TRANSACTION_RETR:
 		case P3C_TRANSACTION_TOP: /* same as RETR without the body */
 			return _parse_context_transaction_retr(pop3, answer);
@@ -519,8 +837,11 @@ static int _parse_context(POP3 * pop3, char const * answer)
 			if(sscanf(answer, "+OK %u %u", &u, &v) != 2)
 				return -1;
 			cmd->status = P3CS_OK;
-			return (_pop3_command(pop3, P3C_TRANSACTION_LIST,
-						"LIST") != NULL) ? 0 : -1;
+			/* only obtain the headers of the new messages */
+			return (_pop3_command(pop3, P3C_TRANSACTION_UIDL,
+						"UIDL") != NULL) ? 0 : -1;
+		case P3C_TRANSACTION_UIDL:
+			return _parse_context_transaction_uidl(pop3, answer);
 	}
 	return ret;
 }
@@ -531,40 +852,875 @@ static int _parse_context_transaction_retr(POP3 * pop3,
 	AccountPluginHelper * helper = pop3->helper;
 	POP3Command * cmd = &pop3->queue[0];
 	AccountMessage * message;
+	GString * contents = cmd->data.transaction_retr.contents;
+	gboolean listing;
+	gchar * key;
+	int res;
 
+	if(cmd->status == P3CS_ERROR && cmd->data.transaction_top.uid != NULL
+			&& pop3->state_pending > 0)
+	{
+		/* the message is not listed, but the others may be saved */
+		if(--pop3->state_pending == 0 && pop3->state_listed)
+			_pop3_state_save(pop3);
+		return 0;
+	}
 	if(cmd->status != P3CS_PARSING)
 		return 0;
 	if((message = cmd->data.transaction_retr.message) == NULL
 			&& strncmp(answer, "+OK", 3) == 0)
 	{
 		cmd->data.transaction_retr.body = FALSE;
-		message = _pop3_message_get(pop3, &pop3->inbox,
+		/* new messages may be downloaded to the local store */
+		if(cmd->context == P3C_TRANSACTION_RETR
+				&& cmd->data.transaction_retr.uid != NULL
+				&& (res = _pop3_store_open(pop3, cmd)) != 0)
+		{
+			if(res < 0)
+				return -helper->error(NULL, error_get(NULL),
+						1);
+			/* the store is locked: try again later */
+			if(pop3->store_source == 0)
+				pop3->store_source = g_timeout_add(
+						POP3_STORE_TIMEOUT, _on_store,
+						pop3);
+			return 1;
+		}
+		if(cmd->data.transaction_top.uid != NULL)
+		{
+			/* a new message */
+			if((message = _pop3_message_new(pop3, &pop3->inbox,
+							cmd->data.transaction_top
+							.id)) != NULL)
+			{
+				message->uid = cmd->data.transaction_top.uid;
+				cmd->data.transaction_top.uid = NULL;
+				g_hash_table_insert(pop3->uids, message->uid,
+						message);
+			}
+		}
+		else
+			message = _pop3_message_get(pop3, &pop3->inbox,
 					cmd->data.transaction_retr.id);
 		cmd->data.transaction_retr.message = message;
+		if(message != NULL && (cmd->context == P3C_TRANSACTION_TOP
+					|| cmd->data.transaction_retr.fp
+					!= NULL))
+			message->hash = COMMON_HASH_INIT;
 		return 0;
 	}
+	if(message == NULL)
+		return -1;
+	/* the message is new to the listing */
+	listing = (cmd->context == P3C_TRANSACTION_TOP
+			|| cmd->data.transaction_retr.fp != NULL);
 	if(strcmp(answer, ".") == 0)
 	{
 		cmd->status = P3CS_OK;
+		if(cmd->context == P3C_TRANSACTION_RETR
+				&& cmd->data.transaction_retr.fp == NULL)
+			helper->message_set_body_complete(message->message);
+		if(contents == NULL)
+			return 0;
+		if(listing)
+		{
+			/* complete the delivery to the local store */
+			if(cmd->data.transaction_retr.fp != NULL
+					&& _pop3_store_close(pop3, cmd, TRUE)
+					!= 0)
+				return -helper->error(NULL, error_get(NULL), 1);
+			/* remember the headers of this message */
+			if(_pop3_state_set(pop3, message->uid, message->hash,
+						contents->str,
+						(cmd->context
+						 == P3C_TRANSACTION_RETR)
+						? time(NULL) : 0,
+						cmd->data.transaction_retr
+						.location) != 0)
+				helper->error(NULL, error_get(NULL), 1);
+			if(pop3->state_pending > 0 && --pop3->state_pending == 0
+					&& pop3->state_listed)
+				_pop3_state_save(pop3);
+		}
+		/* store the message in the cache */
+		else if((key = _pop3_cache_key(pop3, message)) != NULL)
+		{
+			if(_common_cache_set(pop3->cache, key, contents->str,
+						contents->len) != 0)
+				helper->error(NULL, error_get(NULL), 1);
+			g_free(key);
+		}
+		g_string_free(contents, TRUE);
+		cmd->data.transaction_retr.contents = NULL;
 		return 0;
 	}
+	/* the body is obtained in bulk by _parse_body() */
+	if(answer[0] == '.')
+		answer++; /* remove the byte-stuffing */
+	if(cmd->data.transaction_retr.fp != NULL
+			&& _pop3_store_write(pop3, cmd, answer, strlen(answer))
+			!= 0)
+		return -helper->error(NULL, error_get(NULL), 1);
+	if(contents != NULL && !listing)
+	{
+		g_string_append(contents, answer);
+		g_string_append_len(contents, "\r\n", 2);
+	}
 	if(answer[0] == '\0')
 	{
 		cmd->data.transaction_retr.body = TRUE;
-		helper->message_set_body(message->message, NULL, 0, 0);
+		if(cmd->data.transaction_retr.fp == NULL)
+			helper->message_set_body(message->message, NULL, 0, 0);
+	}
+	else
+	{
+		if(listing)
+		{
+			/* identify the message for the cache */
+			message->hash = _common_hash(message->hash, answer,
+					strlen(answer));
+			message->hash = _common_hash(message->hash, "\r\n",
+					2);
+			if(contents != NULL)
+			{
+				g_string_append(contents, answer);
+				g_string_append_c(contents, '\n');
+			}
+		}
+		helper->message_set_header(message->message, answer);
+	}
+	return 0;
+}
+
+static int _parse_context_transaction_uidl(POP3 * pop3,
+		char const * answer)
+{
+	AccountPluginHelper * helper = pop3->helper;
+	POP3Command * cmd = &pop3->queue[0];
+	AccountMessage * message;
+	POP3State * state;
+	char const * store = pop3->config[P3CV_STORE].value;
+	unsigned long keep = (unsigned long)pop3->config[P3CV_KEEP].value;
+	unsigned int id;
+	char uid[71];
+	char buf[32];
+	char * p;
+	char * q;
+
+	if(cmd->status == P3CS_ERROR)
+	{
+		/* not supported by the server */
+		cmd->status = P3CS_OK;
+		return (_pop3_command(pop3, P3C_TRANSACTION_LIST, "LIST")
+				!= NULL) ? 0 : -1;
+	}
+	if(cmd->status != P3CS_PARSING)
+		return 0;
+	if(strncmp(answer, "+OK", 3) == 0)
+		return 0;
+	if(strcmp(answer, ".") == 0)
+	{
+		cmd->status = P3CS_OK;
+		pop3->state_listed = TRUE;
+		if(pop3->state_pending == 0 && pop3->state_dirty)
+			_pop3_state_save(pop3);
 		return 0;
 	}
-	if(cmd->data.transaction_retr.body)
+	if(sscanf(answer, "%u %70s", &id, uid) != 2)
+		return -1;
+	state = (pop3->state != NULL) ? g_hash_table_lookup(pop3->state, uid)
+		: NULL;
+	/* the message may already be known from a previous connection */
+	if((message = _pop3_message_get_uid(pop3, uid)) != NULL)
+		message->id = id;
+	/* the messages not stored yet are downloaded again */
+	else if(state != NULL && (store == NULL || state->stored != 0))
 	{
-		helper->message_set_body(message->message, answer,
-				strlen(answer), 1);
-		helper->message_set_body(message->message, "\r\n", 2, 1);
+		if((message = _pop3_message_new(pop3, &pop3->inbox, id))
+				== NULL)
+			return -1;
+		if((message->uid = strdup(uid)) != NULL)
+			g_hash_table_insert(pop3->uids, message->uid, message);
+		message->hash = state->hash;
+		for(p = state->headers; (q = strchr(p, '\n')) != NULL;
+				p = q + 1)
+		{
+			*q = '\0';
+			helper->message_set_header(message->message, p);
+			*q = '\n';
+		}
 	}
 	else
-		helper->message_set_header(message->message, answer);
+	{
+		if(store != NULL)
+			snprintf(buf, sizeof(buf), "%s %u", "RETR", id);
+		else
+			/* FIXME may not be supported by the server */
+			snprintf(buf, sizeof(buf), "%s %u 0", "TOP", id);
+		if((cmd = _pop3_command(pop3, (store != NULL)
+						? P3C_TRANSACTION_RETR
+						: P3C_TRANSACTION_TOP, buf))
+				== NULL)
+			return -1;
+		cmd->data.transaction_top.id = id;
+		cmd->data.transaction_top.uid = strdup(uid);
+		cmd->data.transaction_top.contents = g_string_new(NULL);
+		pop3->state_pending++;
+		return 0;
+	}
+	/* the message was stored locally long enough */
+	if(store == NULL || keep == 0 || state == NULL || state->stored == 0
+			|| time(NULL) - state->stored
+			< (time_t)keep * 24 * 60 * 60)
+		return 0;
+	snprintf(buf, sizeof(buf), "%s %u", "DELE", id);
+	if((cmd = _pop3_command(pop3, P3C_TRANSACTION_DELE, buf)) == NULL)
+		return -1;
+	cmd->data.transaction_dele.id = id;
+	cmd->data.transaction_dele.message = message;
+	/* the identifier will not be valid anymore */
+	message->id = 0;
+	return 0;
+}
+
+
+/* pop3_quit */
+static void _pop3_quit(POP3 * pop3)
+{
+	char const quit[] = "QUIT\r\n";
+	gsize cnt;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s()\n", __func__);
+#endif
+	if(pop3->channel == NULL)
+		return;
+	/* the answer is not awaited; the server commits the deletions once
+	 * the command is received */
+	if(pop3->ssl != NULL)
+		SSL_write(pop3->ssl, quit, sizeof(quit) - 1);
+	else
+		g_io_channel_write_chars(pop3->channel, quit, sizeof(quit) - 1,
+				&cnt, NULL);
+}
+
+
+/* pop3_set_capability */
+static void _pop3_set_capability(POP3 * pop3, char const * capability)
+{
+	size_t i;
+	size_t len;
+	struct
+	{
+		char const * name;
+		POP3Capability capability;
+	} names[] =
+	{
+		{ "PIPELINING",		P3CAP_PIPELINING	}
+	};
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s(\"%s\")\n", __func__, capability);
+#endif
+	/* capabilities may be followed by arguments */
+	for(len = 0; capability[len] != '\0' && capability[len] != ' '; len++);
+	for(i = 0; i < sizeof(names) / sizeof(*names); i++)
+		if(strlen(names[i].name) == len
+				&& strncasecmp(names[i].name, capability, len)
+				== 0)
+			pop3->capabilities |= names[i].capability;
+}
+
+
+/* queue */
+/* pop3_queue_next */
+static gboolean _queue_next_pipelining(POP3Context context);
+
+static POP3Command * _pop3_queue_next(POP3 * pop3)
+{
+	size_t i;
+	size_t j;
+
+	/* look for the first command not sent yet */
+	for(i = 0; i < pop3->queue_cnt; i++)
+		if(pop3->queue[i].status == P3CS_QUEUED)
+			break;
+	if(i == pop3->queue_cnt)
+		return NULL;
+	if(i == 0)
+		return &pop3->queue[i];
+	/* it may only be sent along commands able to be pipelined */
+	if((pop3->capabilities & P3CAP_PIPELINING) == 0)
+		return NULL;
+	for(j = 0; j <= i; j++)
+		if(!_queue_next_pipelining(pop3->queue[j].context))
+			return NULL;
+	return &pop3->queue[i];
+}
+
+static gboolean _queue_next_pipelining(POP3Context context)
+{
+	switch(context)
+	{
+		case P3C_NOOP:
+		case P3C_TRANSACTION_DELE:
+		case P3C_TRANSACTION_RETR:
+		case P3C_TRANSACTION_TOP:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+
+/* pop3_queue_pop */
+static void _pop3_queue_pop(POP3 * pop3)
+{
+	POP3Command * cmd = &pop3->queue[0];
+
+	if((cmd->context == P3C_TRANSACTION_RETR
+				|| cmd->context == P3C_TRANSACTION_TOP)
+			&& cmd->data.transaction_retr.contents != NULL)
+		g_string_free(cmd->data.transaction_retr.contents, TRUE);
+	if((cmd->context == P3C_TRANSACTION_RETR
+				|| cmd->context == P3C_TRANSACTION_TOP)
+			&& cmd->data.transaction_retr.fp != NULL)
+		/* the delivery was interrupted */
+		_pop3_store_close(pop3, cmd, FALSE);
+	if(cmd->context == P3C_TRANSACTION_RETR
+			|| cmd->context == P3C_TRANSACTION_TOP)
+	{
+		free(cmd->data.transaction_top.uid);
+		g_free(cmd->data.transaction_retr.location);
+	}
+	free(cmd->buf);
+	memmove(cmd, &pop3->queue[1], sizeof(*cmd) * --pop3->queue_cnt);
+}
+
+
+/* pop3_queue_schedule */
+static void _pop3_queue_schedule(POP3 * pop3)
+{
+	if(pop3->channel == NULL || pop3->wr_source != 0
+			|| _pop3_queue_next(pop3) == NULL)
+		return;
+	pop3->wr_source = g_io_add_watch(pop3->channel, G_IO_OUT,
+			(pop3->ssl != NULL) ? _on_watch_can_write_ssl
+			: _on_watch_can_write, pop3);
+}
+
+
+/* state */
+/* pop3_state_load */
+static int _pop3_state_load(POP3 * pop3, char const * account)
+{
+	int ret = 0;
+	char name[17];
+	gchar * filename;
+	gchar * contents;
+	GError * error = NULL;
+	char * p;
+	char * q;
+	char * r;
+	char uid[71];
+	unsigned long long hash;
+	long long stored;
+	char location[256];
+
+	pop3->state = g_hash_table_new_full(g_str_hash, g_str_equal, free,
+			(GDestroyNotify)_pop3_state_delete);
+	/* every account gets its own file */
+	snprintf(name, sizeof(name), "%016llx", (unsigned long long)
+			_common_hash(COMMON_HASH_INIT, account,
+				strlen(account)));
+	filename = g_build_filename(g_get_user_cache_dir(),
+			COMMON_CACHE_DIRECTORY, "pop3", name, NULL);
+	pop3->state_filename = g_strconcat(filename, POP3_STATE_EXTENSION,
+			NULL);
+	g_free(filename);
+	if(g_file_get_contents(pop3->state_filename, &contents, NULL, &error)
+			!= TRUE)
+	{
+		if(error->code != G_FILE_ERROR_NOENT)
+			ret = -error_set_code(1, "%s", error->message);
+		g_error_free(error);
+		return ret;
+	}
+	/* every record is the UID and hash of the message, optionally when
+	 * and where it was stored locally, followed by its headers and an
+	 * empty line */
+	for(p = contents; (q = strchr(p, '\n')) != NULL; p = r)
+	{
+		*(q++) = '\0';
+		if(*q == '\n')
+			r = q;
+		else if((r = strstr(q, "\n\n")) != NULL)
+			r++;
+		else
+			break;
+		*(r++) = '\0';
+		stored = 0;
+		location[0] = '\0';
+		if(sscanf(p, "%70s %16llx %lld %255s", uid, &hash, &stored,
+					location) < 2
+				|| _pop3_state_set(pop3, uid, hash, q, stored,
+					(location[0] != '\0') ? location
+					: NULL) != 0)
+			break;
+	}
+	g_free(contents);
+	pop3->state_dirty = FALSE;
+	return 0;
+}
+
+
+/* pop3_state_save */
+static int _pop3_state_save(POP3 * pop3)
+{
+	AccountPluginHelper * helper = pop3->helper;
+	AccountFolder * folder = &pop3->inbox;
+	AccountMessage * message;
+	POP3State * state;
+	gchar * filename;
+	gchar * dirname;
+	FILE * fp;
+	size_t i;
+
+	if(pop3->state == NULL || pop3->state_filename == NULL)
+		return 0;
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s() \"%s\"\n", __func__,
+			pop3->state_filename);
+#endif
+	dirname = g_path_get_dirname(pop3->state_filename);
+	g_mkdir_with_parents(dirname, 0700);
+	g_free(dirname);
+	/* replace the previous state atomically */
+	filename = g_strconcat(pop3->state_filename, ".tmp", NULL);
+	if((fp = fopen(filename, "w")) == NULL)
+	{
+		error_set_code(1, "%s: %s", filename, strerror(errno));
+		g_free(filename);
+		return -helper->error(NULL, error_get(NULL), 1);
+	}
+	/* only keep the messages still on the server */
+	for(i = 0; i < folder->messages_cnt; i++)
+	{
+		message = folder->messages[i];
+		if(message->uid == NULL || (state = g_hash_table_lookup(
+						pop3->state, message->uid))
+				== NULL)
+			continue;
+		fprintf(fp, "%s %016llx %lld%s%s\n%s\n", message->uid,
+				(unsigned long long)state->hash,
+				(long long)state->stored,
+				(state->location != NULL) ? " " : "",
+				(state->location != NULL) ? state->location
+				: "", state->headers);
+	}
+	if(fclose(fp) != 0 || rename(filename, pop3->state_filename) != 0)
+	{
+		error_set_code(1, "%s: %s", pop3->state_filename,
+				strerror(errno));
+		unlink(filename);
+		g_free(filename);
+		return -helper->error(NULL, error_get(NULL), 1);
+	}
+	g_free(filename);
+	pop3->state_dirty = FALSE;
+	return 0;
+}
+
+
+/* pop3_state_set */
+static int _pop3_state_set(POP3 * pop3, char const * uid, uint64_t hash,
+		char const * headers, time_t stored, char const * location)
+{
+	POP3State * state;
+	char * p;
+
+	if(pop3->state == NULL || uid == NULL)
+		return 0;
+	if((state = malloc(sizeof(*state))) == NULL)
+		return -error_set_code(1, "%s", strerror(errno));
+	state->hash = hash;
+	state->stored = stored;
+	state->location = NULL;
+	if((state->headers = strdup(headers)) == NULL
+			|| (location != NULL
+				&& (state->location = strdup(location)) == NULL)
+			|| (p = strdup(uid)) == NULL)
+	{
+		_pop3_state_delete(state);
+		return -error_set_code(1, "%s", strerror(errno));
+	}
+	g_hash_table_replace(pop3->state, p, state);
+	pop3->state_dirty = TRUE;
+	return 0;
+}
+
+
+/* pop3_state_delete */
+static void _pop3_state_delete(POP3State * state)
+{
+	free(state->location);
+	free(state->headers);
+	free(state);
+}
+
+
+/* store */
+/* pop3_store_open */
+static int _store_open_maildir(POP3Command * cmd, char const * store);
+static int _store_open_mbox(POP3Command * cmd, char const * store);
+
+static int _pop3_store_open(POP3 * pop3, POP3Command * cmd)
+{
+	char const * store = pop3->config[P3CV_STORE].value;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s() \"%s\"\n", __func__, store);
+#endif
+	if(store == NULL)
+		return -error_set_code(1, "%s", strerror(EINVAL));
+	/* directories are considered as Maildir */
+	if(g_file_test(store, G_FILE_TEST_IS_DIR))
+		return _store_open_maildir(cmd, store);
+	return _store_open_mbox(cmd, store);
+}
+
+static int _store_open_maildir(POP3Command * cmd, char const * store)
+{
+	static unsigned int count = 0;
+	char const * subdirs[] = { "tmp", "new", "cur" };
+	gchar * filename;
+	char hostname[64];
+	char * p;
+	size_t i;
+
+	for(i = 0; i < sizeof(subdirs) / sizeof(*subdirs); i++)
+	{
+		filename = g_build_filename(store, subdirs[i], NULL);
+		if(g_mkdir_with_parents(filename, 0700) != 0)
+		{
+			error_set_code(1, "%s: %s", filename, strerror(errno));
+			g_free(filename);
+			return -1;
+		}
+		g_free(filename);
+	}
+	if(gethostname(hostname, sizeof(hostname)) != 0)
+		snprintf(hostname, sizeof(hostname), "%s", "localhost");
+	hostname[sizeof(hostname) - 1] = '\0';
+	for(p = hostname; *p != '\0'; p++)
+		if(*p == '/' || *p == ':')
+			*p = '_';
+	/* deliver to tmp first, then move to new once complete */
+	p = g_strdup_printf("%lu.P%dQ%u.%s", (unsigned long)time(NULL),
+			(int)getpid(), ++count, hostname);
+	filename = g_build_filename(store, "tmp", p, NULL);
+	g_free(p);
+	if((cmd->data.transaction_retr.fp = fopen(filename, "w")) == NULL)
+	{
+		error_set_code(1, "%s: %s", filename, strerror(errno));
+		g_free(filename);
+		return -1;
+	}
+	cmd->data.transaction_retr.filename = filename;
+	return 0;
+}
+
+static int _store_open_mbox(POP3Command * cmd, char const * store)
+{
+	int ret;
+	FILE * fp;
+	struct flock lock;
+	off_t offset;
+	time_t t;
+
+	if((fp = fopen(store, "a")) == NULL)
+		return -error_set_code(1, "%s: %s", store, strerror(errno));
+	memset(&lock, 0, sizeof(lock));
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	t = time(NULL);
+	if(fcntl(fileno(fp), F_SETLK, &lock) != 0)
+	{
+		/* another program may be using the mbox file: do not block,
+		 * but let the caller try again later */
+		ret = (errno == EACCES || errno == EAGAIN) ? 1 : -1;
+		error_set_code(1, "%s: %s", store, strerror(errno));
+		fclose(fp);
+		return ret;
+	}
+	if(fseeko(fp, 0, SEEK_END) != 0
+			|| (offset = ftello(fp)) < 0
+			|| fprintf(fp, "From MAILER-DAEMON %s", ctime(&t)) < 0)
+	{
+		error_set_code(1, "%s: %s", store, strerror(errno));
+		fclose(fp);
+		return -1;
+	}
+	cmd->data.transaction_retr.fp = fp;
+	cmd->data.transaction_retr.offset = offset;
+	return 0;
+}
+
+
+/* pop3_store_read */
+static char * _store_read_maildir(char const * store, char const * location,
+		size_t * len);
+static char * _store_read_mbox(char const * store, char const * location,
+		size_t * len);
+
+static int _pop3_store_read(POP3 * pop3, AccountMessage * message,
+		char const * location)
+{
+	char const * store = pop3->config[P3CV_STORE].value;
+	char * buf;
+	size_t len;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s(\"%s\") \"%s\"\n", __func__, location,
+			store);
+#endif
+	if(store == NULL)
+		return -error_set_code(1, "%s", strerror(EINVAL));
+	if(g_file_test(store, G_FILE_TEST_IS_DIR))
+		buf = _store_read_maildir(store, location, &len);
+	else
+		buf = _store_read_mbox(store, location, &len);
+	if(buf == NULL)
+		return -1;
+	_common_cache_message(pop3->helper, message->message, buf, len);
+	g_free(buf);
 	return 0;
 }
 
+static char * _store_read_maildir(char const * store, char const * location,
+		size_t * len)
+{
+	char * ret = NULL;
+	size_t llen = strlen(location);
+	gchar * filename;
+	gchar * dirname;
+	GDir * dir;
+	char const * p;
+	GError * error = NULL;
+
+	/* the message may have been moved to cur, with flags appended */
+	filename = g_build_filename(store, "new", location, NULL);
+	if(g_file_test(filename, G_FILE_TEST_EXISTS) == FALSE)
+	{
+		g_free(filename);
+		filename = NULL;
+		dirname = g_build_filename(store, "cur", NULL);
+		if((dir = g_dir_open(dirname, 0, NULL)) != NULL)
+		{
+			while((p = g_dir_read_name(dir)) != NULL)
+				if(strncmp(p, location, llen) == 0
+						&& (p[llen] == '\0'
+							|| p[llen] == ':'))
+				{
+					filename = g_build_filename(dirname, p,
+							NULL);
+					break;
+				}
+			g_dir_close(dir);
+		}
+		g_free(dirname);
+	}
+	if(filename == NULL)
+	{
+		error_set_code(1, "%s: %s", location, strerror(ENOENT));
+		return NULL;
+	}
+	if(g_file_get_contents(filename, &ret, len, &error) != TRUE)
+	{
+		error_set_code(1, "%s", error->message);
+		g_error_free(error);
+	}
+	g_free(filename);
+	return ret;
+}
+
+static char * _store_read_mbox(char const * store, char const * location,
+		size_t * len)
+{
+	char * ret;
+	FILE * fp;
+	long long offset;
+	long long size;
+	size_t i;
+	size_t j;
+	size_t k;
+
+	if(sscanf(location, "%lld+%lld", &offset, &size) != 2 || offset < 0
+			|| size <= 0)
+	{
+		error_set_code(1, "%s: %s", location, strerror(EINVAL));
+		return NULL;
+	}
+	if((ret = g_try_malloc(size)) == NULL)
+	{
+		error_set_code(1, "%s", strerror(ENOMEM));
+		return NULL;
+	}
+	if((fp = fopen(store, "r")) == NULL
+			|| fseeko(fp, offset, SEEK_SET) != 0
+			|| fread(ret, sizeof(*ret), size, fp) != (size_t)size)
+	{
+		error_set_code(1, "%s: %s", store, (fp != NULL && !ferror(fp))
+				? "Message not found" : strerror(errno));
+		if(fp != NULL)
+			fclose(fp);
+		g_free(ret);
+		return NULL;
+	}
+	fclose(fp);
+	/* the file may have been modified by another program meanwhile */
+	if(size < 5 || strncmp(ret, "From ", 5) != 0)
+	{
+		error_set_code(1, "%s: %s", store, "Message not found");
+		g_free(ret);
+		return NULL;
+	}
+	/* skip the separator, and unescape the lines looking like one */
+	for(i = 0; i < (size_t)size && ret[i] != '\n'; i++);
+	for(j = 0, i++; i < (size_t)size; i = k)
+	{
+		for(k = i; k < (size_t)size && ret[k] == '>'; k++);
+		if(k > i && size - k >= 5 && strncmp(&ret[k], "From ", 5) == 0)
+			i++;
+		for(k = i; k < (size_t)size && ret[k++] != '\n';);
+		memmove(&ret[j], &ret[i], k - i);
+		j += k - i;
+	}
+	/* remove the empty line separating messages */
+	if(j > 0 && ret[j - 1] == '\n')
+		j--;
+	*len = j;
+	return ret;
+}
+
+
+/* pop3_store_write */
+static int _pop3_store_write(POP3 * pop3, POP3Command * cmd,
+		char const * buf, size_t len)
+{
+	FILE * fp = cmd->data.transaction_retr.fp;
+	char const * p;
+	char const * q;
+	size_t i;
+	size_t n;
+	size_t l;
+
+	/* an empty line */
+	if(len == 0 && fputc('\n', fp) == EOF)
+		return -error_set_code(1, "%s: %s",
+				(char const *)pop3->config[P3CV_STORE].value,
+				strerror(errno));
+	/* lines are terminated by CRLF, except maybe the last one */
+	for(i = 0; i < len; i += n)
+	{
+		if((q = memchr(&buf[i], '\n', len - i)) != NULL)
+			n = q - &buf[i] + 1;
+		else
+			n = len - i;
+		l = (q != NULL) ? n - 1 : n;
+		if(l > 0 && buf[i + l - 1] == '\r')
+			l--;
+		/* escape the lines looking like separators in mbox files */
+		if(cmd->data.transaction_retr.filename == NULL)
+		{
+			for(p = &buf[i]; p < &buf[i + l] && *p == '>'; p++);
+			if((size_t)(&buf[i + l] - p) >= 5
+					&& strncmp(p, "From ", 5) == 0
+					&& fputc('>', fp) == EOF)
+				break;
+		}
+		if(fwrite(&buf[i], sizeof(*buf), l, fp) != l
+				|| fputc('\n', fp) == EOF)
+			break;
+	}
+	if(i < len)
+		return -error_set_code(1, "%s: %s",
+				(char const *)pop3->config[P3CV_STORE].value,
+				strerror(errno));
+	return 0;
+}
+
+
+/* pop3_store_close */
+static int _pop3_store_close(POP3 * pop3, POP3Command * cmd,
+		gboolean commit)
+{
+	int ret = 0;
+	char const * store = pop3->config[P3CV_STORE].value;
+	FILE * fp = cmd->data.transaction_retr.fp;
+	gchar * filename = cmd->data.transaction_retr.filename;
+	gchar * basename;
+	gchar * p;
+	off_t offset;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s(%s)\n", __func__, commit ? "TRUE" : "FALSE");
+#endif
+	cmd->data.transaction_retr.fp = NULL;
+	cmd->data.transaction_retr.filename = NULL;
+	/* the message must be safe before it can be deleted on the server */
+	if(commit && ((filename == NULL && fputc('\n', fp) == EOF)
+				|| fflush(fp) != 0 || fsync(fileno(fp)) != 0))
+	{
+		ret = -error_set_code(1, "%s: %s", store, strerror(errno));
+		commit = FALSE;
+	}
+	if(filename == NULL)
+	{
+		/* remember where the message is */
+		if(commit && (offset = ftello(fp)) >= 0)
+			cmd->data.transaction_retr.location = g_strdup_printf(
+					"%lld+%lld", (long long)cmd->data
+					.transaction_retr.offset,
+					(long long)(offset - cmd->data
+						.transaction_retr.offset));
+		/* remove the partial message from the mbox file */
+		if(!commit && (fflush(fp) != 0 || ftruncate(fileno(fp),
+						cmd->data.transaction_retr
+						.offset) != 0))
+			ret = -error_set_code(1, "%s: %s", store,
+					strerror(errno));
+		if(fclose(fp) != 0 && ret == 0)
+			ret = -error_set_code(1, "%s: %s", store,
+					strerror(errno));
+		return ret;
+	}
+	if(fclose(fp) != 0 && commit)
+	{
+		ret = -error_set_code(1, "%s: %s", filename, strerror(errno));
+		commit = FALSE;
+	}
+	if(commit)
+	{
+		basename = g_path_get_basename(filename);
+		p = g_build_filename(store, "new", basename, NULL);
+		if(rename(filename, p) != 0)
+		{
+			ret = -error_set_code(1, "%s: %s", p, strerror(errno));
+			commit = FALSE;
+			g_free(basename);
+		}
+		else
+			/* remember where the message is */
+			cmd->data.transaction_retr.location = basename;
+		g_free(p);
+	}
+	if(!commit)
+		unlink(filename);
+	g_free(filename);
+	return ret;
+}
+
 
 /* pop3_event */
 static void _pop3_event(POP3 * pop3, AccountEventType type)
@@ -617,6 +1773,14 @@ static AccountMessage * _pop3_message_get(POP3 * pop3,
 }
 
 
+/* pop3_message_get_uid */
+static AccountMessage * _pop3_message_get_uid(POP3 * pop3,
+		char const * uid)
+{
+	return g_hash_table_lookup(pop3->uids, uid);
+}
+
+
 /* pop3_message_new */
 static AccountMessage * _pop3_message_new(POP3 * pop3,
 		AccountFolder * folder, unsigned int id)
@@ -632,8 +1796,11 @@ static AccountMessage * _pop3_message_new(POP3 * pop3,
 	if((message = object_new(sizeof(*message))) == NULL)
 		return NULL;
 	message->id = id;
-	if((message->message = helper->message_new(helper->account,
-					folder->folder, message)) == NULL)
+	message->uid = NULL;
+	message->hash = 0;
+	/* the message is listed with the others parsed at the same time */
+	if((message->message = helper->message_new(helper->account, NULL,
+					message)) == NULL)
 	{
 		_pop3_message_delete(pop3, message);
 		return NULL;
@@ -649,14 +1816,35 @@ static void _pop3_message_delete(POP3 * pop3,
 {
 	if(message->message != NULL)
 		pop3->helper->message_delete(message->message);
+	free(message->uid);
 	object_delete(message);
 }
 
 
+/* pop3_messages_add */
+static void _pop3_messages_add(POP3 * pop3, AccountFolder * folder)
+{
+	AccountPluginHelper * helper = pop3->helper;
+	Message ** messages;
+	size_t cnt = folder->messages_cnt - folder->messages_added;
+	size_t i;
+
+	if(cnt == 0 || folder->folder == NULL)
+		return;
+	if((messages = malloc(sizeof(*messages) * cnt)) == NULL)
+		return;
+	for(i = 0; i < cnt; i++)
+		messages[i] = folder->messages[folder->messages_added + i]
+			->message;
+	if(helper->messages_add(helper->account, folder->folder, messages,
+				cnt) == 0)
+		folder->messages_added = folder->messages_cnt;
+	free(messages);
+}
+
+
 /* callbacks */
 /* on_idle */
-static int _connect_address(POP3 * pop3, char const * hostname,
-		struct addrinfo * ai);
 static int _connect_channel(POP3 * pop3);
 
 static gboolean _on_connect(gpointer data)
@@ -665,6 +1853,7 @@ static gboolean _on_connect(gpointer data)
 	AccountPluginHelper * helper = pop3->helper;
 	char const * hostname;
 	char const * p;
+	gchar * q;
 	uint16_t port;
 
 #ifdef DEBUG
@@ -680,58 +1869,27 @@ static gboolean _on_connect(gpointer data)
 	if((p = pop3->config[P3CV_PORT].value) == NULL)
 		return FALSE;
 	port = (unsigned long)p;
-	/* lookup the address */
-	if(_common_lookup(hostname, port, &pop3->ai) != 0)
+	q = g_strdup_printf("%s@%s:%hu",
+			(pop3->config[P3CV_USERNAME].value != NULL)
+			? (char const *)pop3->config[P3CV_USERNAME].value : "",
+			hostname, port);
+	/* open the cache */
+	if(pop3->cache == NULL && (p = pop3->config[P3CV_CACHE].value) != NULL
+			&& (pop3->cache = _common_cache_new("pop3", q,
+					(unsigned long)p * 1024 * 1024)) == NULL)
+		helper->error(NULL, error_get(NULL), 1);
+	/* load the messages already known */
+	if(pop3->state == NULL && _pop3_state_load(pop3, q) != 0)
+		helper->error(NULL, error_get(NULL), 1);
+	g_free(q);
+	/* lookup the address without blocking */
+	if((pop3->lookup = helper->lookup(helper->account, hostname, port,
+					_on_lookup, pop3)) == 0)
 	{
 		helper->error(helper->account, error_get(NULL), 1);
-		return FALSE;
-	}
-	for(pop3->aip = pop3->ai; pop3->aip != NULL;
-			pop3->aip = pop3->aip->ai_next)
-		if(_connect_address(pop3, hostname, pop3->aip) == 0)
-			break;
-	if(pop3->aip == NULL)
 		_pop3_stop(pop3);
-	return FALSE;
-}
-
-static int _connect_address(POP3 * pop3, char const * hostname,
-		struct addrinfo * ai)
-{
-	AccountPluginHelper * helper = pop3->helper;
-	int res;
-	char * q;
-	char buf[128];
-
-	/* create the socket */
-	if((pop3->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol))
-			== -1)
-		return -helper->error(helper->account, strerror(errno), 1);
-	if((res = fcntl(pop3->fd, F_GETFL)) >= 0
-			&& fcntl(pop3->fd, F_SETFL, res | O_NONBLOCK) == -1)
-		/* ignore this error */
-		/* FIXME report properly as a warning instead */
-		helper->error(NULL, strerror(errno), 1);
-	/* report the current status */
-	if((q = _common_lookup_print(ai)) != NULL)
-		snprintf(buf, sizeof(buf), "Connecting to %s (%s)", hostname,
-				q);
-	else
-		snprintf(buf, sizeof(buf), "Connecting to %s", hostname);
-	free(q);
-	_pop3_event_status(pop3, AS_CONNECTING, buf);
-	/* connect to the remote host */
-	if((connect(pop3->fd, ai->ai_addr, ai->ai_addrlen) != 0
-				&& errno != EINPROGRESS && errno != EINTR)
-			|| _connect_channel(pop3) != 0)
-	{
-		snprintf(buf, sizeof(buf), "%s (%s)", "Connection failed",
-				strerror(errno));
-		return -helper->error(helper->account, buf, 1);
 	}
-	pop3->wr_source = g_io_add_watch(pop3->channel, G_IO_OUT,
-			_on_watch_can_connect, pop3);
-	return 0;
+	return FALSE;
 }
 
 static int _connect_channel(POP3 * pop3)
@@ -758,6 +1916,42 @@ static int _connect_channel(POP3 * pop3)
 }
 
 
+/* on_lookup */
+static void _on_lookup(struct addrinfo const * ai, char const * error,
+		void * data)
+{
+	POP3 * pop3 = data;
+	AccountPluginHelper * helper = pop3->helper;
+	char const * hostname = pop3->config[P3CV_HOSTNAME].value;
+	char buf[128];
+
+	pop3->lookup = 0;
+	if(error != NULL)
+	{
+		helper->error(helper->account, error, 1);
+		_pop3_stop(pop3);
+		return;
+	}
+	if((pop3->ai = _common_lookup_copy(ai)) == NULL)
+	{
+		helper->error(helper->account, strerror(errno), 1);
+		_pop3_stop(pop3);
+		return;
+	}
+	snprintf(buf, sizeof(buf), "Connecting to %s", hostname);
+	_pop3_event_status(pop3, AS_CONNECTING, buf);
+	/* connect to the first address available */
+	if((pop3->connect = _common_connect_new(pop3->ai, _on_connected, pop3))
+			== NULL)
+	{
+		snprintf(buf, sizeof(buf), "%s (%s)", "Connection failed",
+				error_get(NULL));
+		helper->error(helper->account, buf, 1);
+		_pop3_stop(pop3);
+	}
+}
+
+
 /* on_noop */
 static gboolean _on_noop(gpointer data)
 {
@@ -769,33 +1963,49 @@ static gboolean _on_noop(gpointer data)
 }
 
 
-/* on_watch_can_connect */
-static gboolean _on_watch_can_connect(GIOChannel * source,
-		GIOCondition condition, gpointer data)
+/* on_store */
+static gboolean _on_store(gpointer data)
+{
+	POP3 * pop3 = data;
+
+	pop3->store_source = 0;
+	/* resume parsing the answers */
+	if(_pop3_parse(pop3) != 0)
+		_pop3_stop(pop3);
+	else if(pop3->queue_cnt > 0)
+		_pop3_queue_schedule(pop3);
+	return FALSE;
+}
+
+
+/* on_connected */
+static void _on_connected(int fd, struct addrinfo * ai, int error, void * data)
 {
 	POP3 * pop3 = data;
 	AccountPluginHelper * helper = pop3->helper;
-	int res;
-	socklen_t s = sizeof(res);
 	char const * hostname = pop3->config[P3CV_HOSTNAME].value;
 	SSL_CTX * ssl_ctx;
 	char buf[128];
 	char * q;
 
-	if(condition != G_IO_OUT || source != pop3->channel)
-		return FALSE; /* should not happen */
+	pop3->connect = NULL;
+	if(error != 0)
+	{
+		snprintf(buf, sizeof(buf), "%s (%s)", "Connection failed",
+				strerror(error));
+		helper->error(helper->account, buf, 1);
+		_pop3_stop(pop3);
+		return;
+	}
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s() connected\n", __func__);
 #endif
-	if(getsockopt(pop3->fd, SOL_SOCKET, SO_ERROR, &res, &s) != 0
-			|| res != 0)
+	pop3->fd = fd;
+	pop3->aip = ai;
+	if(_connect_channel(pop3) != 0)
 	{
-		snprintf(buf, sizeof(buf), "%s (%s)", "Connection failed",
-				strerror(res));
-		helper->error(helper->account, buf, 1);
-		/* FIXME try the next address instead */
 		_pop3_stop(pop3);
-		return FALSE;
+		return;
 	}
 	if(pop3->aip != NULL && (q = _common_lookup_print(pop3->aip)) != NULL)
 	{
@@ -806,37 +2016,39 @@ static gboolean _on_watch_can_connect(GIOChannel * source,
 	else
 		snprintf(buf, sizeof(buf), "Connected to %s", hostname);
 	_pop3_event_status(pop3, AS_CONNECTED, buf);
-	pop3->wr_source = 0;
 	/* setup SSL */
 	if(pop3->config[P3CV_SSL].value != NULL)
 	{
 		if((ssl_ctx = helper->get_ssl_context(helper->account)) == NULL)
 			/* FIXME report error */
-			return FALSE;
+			return;
 		if((pop3->ssl = SSL_new(ssl_ctx)) == NULL)
 		{
 			helper->error(helper->account, ERR_error_string(
 						ERR_get_error(), buf), 1);
-			return FALSE;
+			return;
 		}
-		if(SSL_set_fd(pop3->ssl, pop3->fd) != 1)
+		if(SSL_set_fd(pop3->ssl, pop3->fd) != 1
+				|| _common_ssl_setup(helper, pop3->ssl, hostname,
+					(unsigned long)pop3->config[
+					P3CV_PORT].value) != 0)
 		{
 			ERR_error_string(ERR_get_error(), buf);
 			SSL_free(pop3->ssl);
 			pop3->ssl = NULL;
 			helper->error(helper->account, buf, 1);
-			return FALSE;
+			return;
 		}
 		SSL_set_connect_state(pop3->ssl);
 		/* perform initial handshake */
+		pop3->ssl_start = g_get_monotonic_time();
 		pop3->wr_source = g_io_add_watch(pop3->channel, G_IO_OUT,
 				_on_watch_can_handshake, pop3);
-		return FALSE;
+		return;
 	}
 	/* wait for the server's banner */
 	pop3->rd_source = g_io_add_watch(pop3->channel, G_IO_IN,
 			_on_watch_can_read, pop3);
-	return FALSE;
 }
 
 
@@ -867,6 +2079,9 @@ static gboolean _on_watch_can_handshake(GIOChannel * source,
 			_pop3_stop(pop3);
 			return FALSE;
 		}
+		_common_ssl_status(pop3->ssl, pop3->config[P3CV_HOSTNAME].value,
+				pop3->ssl_start, buf, sizeof(buf));
+		_pop3_event_status(pop3, AS_CONNECTED, buf);
 		/* wait for the server's banner */
 		pop3->rd_source = g_io_add_watch(pop3->channel, G_IO_IN,
 				_on_watch_can_read_ssl, pop3);
@@ -924,8 +2139,7 @@ static gboolean _on_watch_can_read(GIOChannel * source, GIOCondition condition,
 	gsize cnt = 0;
 	GError * error = NULL;
 	GIOStatus status;
-	POP3Command * cmd;
-	const int inc = 256;
+	const int inc = 16384;
 
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s()\n", __func__);
@@ -962,27 +2176,14 @@ static gboolean _on_watch_can_read(GIOChannel * source, GIOCondition condition,
 		_pop3_stop(pop3);
 		return FALSE;
 	}
-	if(pop3->queue_cnt == 0)
-		return TRUE;
-	cmd = &pop3->queue[0];
-	if(cmd->buf_cnt == 0)
-	{
-		if(cmd->status == P3CS_SENT || cmd->status == P3CS_PARSING)
-			/* begin or keep parsing */
-			return TRUE;
-		else if(cmd->status == P3CS_OK || cmd->status == P3CS_ERROR)
-			/* the current command is completed */
-			memmove(cmd, &pop3->queue[1], sizeof(*cmd)
-					* --pop3->queue_cnt);
-	}
-	if(pop3->queue_cnt == 0)
+	if(pop3->queue_cnt > 0)
+		/* send the next commands if possible */
+		_pop3_queue_schedule(pop3);
+	else if(pop3->source == 0)
 	{
 		_pop3_event_status(pop3, AS_IDLE, NULL);
 		pop3->source = g_timeout_add(30000, _on_noop, pop3);
 	}
-	else
-		pop3->wr_source = g_io_add_watch(pop3->channel, G_IO_OUT,
-				_on_watch_can_write, pop3);
 	return TRUE;
 }
 
@@ -994,7 +2195,6 @@ static gboolean _on_watch_can_read_ssl(GIOChannel * source,
 	POP3 * pop3 = data;
 	char * p;
 	int cnt;
-	POP3Command * cmd;
 	char buf[128];
 	const int inc = 16384; /* XXX not reliable with a smaller value */
 
@@ -1038,27 +2238,14 @@ static gboolean _on_watch_can_read_ssl(GIOChannel * source,
 		_pop3_stop(pop3);
 		return FALSE;
 	}
-	if(pop3->queue_cnt == 0)
-		return TRUE;
-	cmd = &pop3->queue[0];
-	if(cmd->buf_cnt == 0)
-	{
-		if(cmd->status == P3CS_SENT || cmd->status == P3CS_PARSING)
-			/* begin or keep parsing */
-			return TRUE;
-		else if(cmd->status == P3CS_OK || cmd->status == P3CS_ERROR)
-			/* the current command is completed */
-			memmove(cmd, &pop3->queue[1], sizeof(*cmd)
-					* --pop3->queue_cnt);
-	}
-	if(pop3->queue_cnt == 0)
+	if(pop3->queue_cnt > 0)
+		/* send the next commands if possible */
+		_pop3_queue_schedule(pop3);
+	else if(pop3->source == 0)
 	{
 		_pop3_event_status(pop3, AS_IDLE, NULL);
 		pop3->source = g_timeout_add(30000, _on_noop, pop3);
 	}
-	else
-		pop3->wr_source = g_io_add_watch(pop3->channel, G_IO_OUT,
-				_on_watch_can_write_ssl, pop3);
 	return TRUE;
 }
 
@@ -1069,7 +2256,7 @@ static gboolean _on_watch_can_write(GIOChannel * source, GIOCondition condition,
 {
 	POP3 * pop3 = data;
 	AccountPluginHelper * helper = pop3->helper;
-	POP3Command * cmd = &pop3->queue[0];
+	POP3Command * cmd = _pop3_queue_next(pop3);
 	gsize cnt = 0;
 	GError * error = NULL;
 	GIOStatus status;
@@ -1078,9 +2265,12 @@ static gboolean _on_watch_can_write(GIOChannel * source, GIOCondition condition,
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s()\n", __func__);
 #endif
-	if(condition != G_IO_OUT || source != pop3->channel
-			|| pop3->queue_cnt == 0 || cmd->buf_cnt == 0)
+	if(condition != G_IO_OUT || source != pop3->channel || cmd == NULL
+			|| cmd->buf_cnt == 0)
+	{
+		pop3->wr_source = 0;
 		return FALSE; /* should not happen */
+	}
 	status = g_io_channel_write_chars(source, cmd->buf, cmd->buf_cnt, &cnt,
 			&error);
 #ifdef DEBUG
@@ -1114,11 +2304,14 @@ static gboolean _on_watch_can_write(GIOChannel * source, GIOCondition condition,
 	if(cmd->buf_cnt > 0)
 		return TRUE;
 	cmd->status = P3CS_SENT;
-	pop3->wr_source = 0;
 	if(pop3->rd_source == 0)
 		/* XXX should not happen */
 		pop3->rd_source = g_io_add_watch(pop3->channel, G_IO_IN,
 				_on_watch_can_read, pop3);
+	/* keep sending while pipelining */
+	if(_pop3_queue_next(pop3) != NULL)
+		return TRUE;
+	pop3->wr_source = 0;
 	return FALSE;
 }
 
@@ -1128,7 +2321,7 @@ static gboolean _on_watch_can_write_ssl(GIOChannel * source,
 		GIOCondition condition, gpointer data)
 {
 	POP3 * pop3 = data;
-	POP3Command * cmd = &pop3->queue[0];
+	POP3Command * cmd = _pop3_queue_next(pop3);
 	int cnt;
 	char * p;
 	char buf[128];
@@ -1137,9 +2330,12 @@ static gboolean _on_watch_can_write_ssl(GIOChannel * source,
 	fprintf(stderr, "DEBUG: %s()\n", __func__);
 #endif
 	if((condition != G_IO_OUT && condition != G_IO_IN)
-			|| source != pop3->channel || pop3->queue_cnt == 0
+			|| source != pop3->channel || cmd == NULL
 			|| cmd->buf_cnt == 0)
+	{
+		pop3->wr_source = 0;
 		return FALSE; /* should not happen */
+	}
 	if((cnt = SSL_write(pop3->ssl, cmd->buf, cmd->buf_cnt)) <= 0)
 	{
 		if(SSL_get_error(pop3->ssl, cnt) == SSL_ERROR_WANT_READ)
@@ -1170,10 +2366,13 @@ static gboolean _on_watch_can_write_ssl(GIOChannel * source,
 	if(cmd->buf_cnt > 0)
 		return TRUE;
 	cmd->status = P3CS_SENT;
-	pop3->wr_source = 0;
 	if(pop3->rd_source == 0)
 		/* XXX should not happen */
 		pop3->rd_source = g_io_add_watch(pop3->channel, G_IO_IN,
 				_on_watch_can_read_ssl, pop3);
+	/* keep sending while pipelining */
+	if(_pop3_queue_next(pop3) != NULL)
+		return TRUE;
+	pop3->wr_source = 0;
 	return FALSE;
 }
@@ -59,5 +59,7 @@ AccountPluginDefinition account_plugin =
 	NULL,
 	NULL,
 	NULL,
+	NULL,
+	NULL,
 	NULL
 };
@@ -0,0 +1,138 @@
+/* $Id$ */
+/* Copyright (c) 2024 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Desktop Mailer */
+/* All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <System.h>
+#include "body.h"
+
+
+/* Body */
+/* private */
+/* types */
+struct _Body
+{
+	char * data;
+	size_t size;
+	size_t alloc;
+};
+
+
+/* constants */
+#define BODY_ALLOC_MIN	1024
+
+
+/* public */
+/* functions */
+/* body_new */
+Body * body_new(void)
+{
+	Body * body;
+
+	if((body = object_new(sizeof(*body))) == NULL)
+		return NULL;
+	body->data = NULL;
+	body->size = 0;
+	body->alloc = 0;
+	return body;
+}
+
+
+/* body_delete */
+void body_delete(Body * body)
+{
+	body_reset(body);
+	object_delete(body);
+}
+
+
+/* accessors */
+/* body_get_data */
+char const * body_get_data(Body * body)
+{
+	if(body->data == NULL)
+		return "";
+	/* there is always room left for the terminator */
+	body->data[body->size] = '\0';
+	return body->data;
+}
+
+
+/* body_get_size */
+size_t body_get_size(Body * body)
+{
+	return body->size;
+}
+
+
+/* useful */
+/* body_append */
+int body_append(Body * body, char const * buf, size_t cnt)
+{
+	char * p;
+	size_t alloc;
+
+	if(cnt == 0)
+		return 0;
+	/* the allocation doubles to keep the appends linear overall */
+	if(body->size + cnt >= body->alloc)
+	{
+		alloc = (body->alloc > 0) ? body->alloc * 2 : BODY_ALLOC_MIN;
+		if(alloc <= body->size + cnt)
+			alloc = body->size + cnt + 1;
+		if((p = realloc(body->data, alloc)) == NULL)
+			return -1;
+		body->data = p;
+		body->alloc = alloc;
+	}
+	memcpy(&body->data[body->size], buf, cnt);
+	body->size += cnt;
+	return 0;
+}
+
+
+/* body_reset */
+void body_reset(Body * body)
+{
+	free(body->data);
+	body->data = NULL;
+	body->size = 0;
+	body->alloc = 0;
+}
+
+
+/* body_write */
+int body_write(Body * body, FILE * fp)
+{
+	if(body->size == 0)
+		return 0;
+	return (fwrite(body->data, sizeof(char), body->size, fp) == body->size)
+		? 0 : -1;
+}
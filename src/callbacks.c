@@ -154,6 +154,22 @@ void on_message_forward(gpointer data)
 }
 
 
+void on_message_mark_read(gpointer data)
+{
+	Mailer * mailer = data;
+
+	mailer_mark_selected_read(mailer, TRUE);
+}
+
+
+void on_message_mark_unread(gpointer data)
+{
+	Mailer * mailer = data;
+
+	mailer_mark_selected_read(mailer, FALSE);
+}
+
+
 void on_message_save_as(gpointer data)
 {
 	Mailer * mailer = data;
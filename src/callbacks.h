@@ -54,6 +54,8 @@ void on_edit_unselect_all(gpointer data);
 /* message menu */
 void on_message_delete(gpointer data);
 void on_message_forward(gpointer data);
+void on_message_mark_read(gpointer data);
+void on_message_mark_unread(gpointer data);
 void on_message_reply(gpointer data);
 void on_message_reply_to_all(gpointer data);
 void on_message_save_as(gpointer data);
@@ -0,0 +1,642 @@
+/* $Id$ */
+/* Copyright (c) 2024 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Desktop Mailer */
+/* All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+
+#include <string.h>
+#include "codec.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define CODEC_X86
+# include <immintrin.h>
+#endif
+
+
+/* Codec */
+/* private */
+/* types */
+typedef size_t CodecBase64Decode(CodecState * state, char const * buf,
+		size_t cnt, char * out);
+typedef size_t CodecBase64Encode(char const * buf, size_t cnt, char * out);
+
+
+/* constants */
+static const char _codec_base64[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* values of the base64 characters, 0xff otherwise */
+static const unsigned char _codec_base64_values[256] =
+{
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+	0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b,
+	0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+	0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+	0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
+	0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20,
+	0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30,
+	0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+static const char _codec_hex[] = "0123456789ABCDEF";
+
+/* 1 for literal characters, 2 for white-space except at the end of lines */
+static const unsigned char _codec_qp_literal[256] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	2, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+
+/* prototypes */
+static void _codec_init(void);
+static unsigned char _codec_hex_value(char c);
+
+static size_t _codec_base64_decode_scalar(CodecState * state,
+		char const * buf, size_t cnt, char * out);
+static size_t _codec_base64_encode_scalar(char const * buf, size_t cnt,
+		char * out);
+#ifdef CODEC_X86
+static size_t _codec_base64_decode_ssse3(CodecState * state,
+		char const * buf, size_t cnt, char * out);
+static size_t _codec_base64_decode_avx2(CodecState * state,
+		char const * buf, size_t cnt, char * out);
+static size_t _codec_base64_encode_ssse3(char const * buf, size_t cnt,
+		char * out);
+static size_t _codec_base64_encode_avx2(char const * buf, size_t cnt,
+		char * out);
+#endif
+
+
+/* variables */
+/* selected at run-time according to the processor */
+static CodecBase64Decode * _codec_base64_decode = NULL;
+static CodecBase64Encode * _codec_base64_encode = NULL;
+
+
+/* public */
+/* functions */
+/* base64 */
+/* codec_base64_decode */
+size_t codec_base64_decode(CodecState * state, char const * buf, size_t cnt,
+		char * out)
+{
+	if(_codec_base64_decode == NULL)
+		_codec_init();
+	return _codec_base64_decode(state, buf, cnt, out);
+}
+
+
+/* codec_base64_encode
+ * the output is split in lines, each terminated by CRLF */
+size_t codec_base64_encode(char const * buf, size_t cnt, char * out)
+{
+	if(_codec_base64_encode == NULL)
+		_codec_init();
+	return _codec_base64_encode(buf, cnt, out);
+}
+
+
+/* codec_base64_encode_size */
+size_t codec_base64_encode_size(size_t cnt)
+{
+	size_t ret;
+
+	ret = (cnt / CODEC_BASE64_LINE) * (CODEC_BASE64_LINE / 3 * 4 + 2);
+	if((cnt %= CODEC_BASE64_LINE) > 0)
+		ret += (cnt + 2) / 3 * 4 + 2;
+	return ret;
+}
+
+
+/* quoted-printable */
+/* codec_qp_decode */
+size_t codec_qp_decode(char const * buf, size_t cnt, char * out)
+{
+	size_t ret = 0;
+	char const * end = &buf[cnt];
+	char const * p;
+	unsigned char hi;
+	unsigned char lo;
+
+	while(buf < end)
+	{
+		/* copy everything up to the next escape at once */
+		if((p = memchr(buf, '=', end - buf)) == NULL)
+			p = end;
+		memcpy(&out[ret], buf, p - buf);
+		ret += p - buf;
+		if((buf = p) == end)
+			break;
+		if(end - buf >= 2 && buf[1] == '\n')
+			/* soft line break */
+			buf += 2;
+		else if(end - buf >= 3 && buf[1] == '\r' && buf[2] == '\n')
+			buf += 3;
+		else if(end - buf >= 3 && (hi = _codec_hex_value(buf[1])) < 16
+				&& (lo = _codec_hex_value(buf[2])) < 16)
+		{
+			out[ret++] = (hi << 4) | lo;
+			buf += 3;
+		}
+		else
+			out[ret++] = *(buf++);
+	}
+	return ret;
+}
+
+
+/* codec_qp_encode
+ * the input is considered text, ending lines with CRLF */
+static size_t _qp_encode_escape(unsigned char c, char * out);
+
+size_t codec_qp_encode(char const * buf, size_t cnt, char * out)
+{
+	size_t ret = 0;
+	size_t i;
+	size_t len = 0;				/* of the current line */
+	unsigned char c;
+	int eol;
+
+	for(i = 0; i < cnt; i++)
+	{
+		c = buf[i];
+		if(c == '\n' || (c == '\r' && i + 1 < cnt && buf[i + 1] == '\n'))
+		{
+			out[ret++] = '\r';
+			out[ret++] = '\n';
+			i += (c == '\r') ? 1 : 0;
+			len = 0;
+			continue;
+		}
+		eol = (i + 1 == cnt || buf[i + 1] == '\n' || (buf[i + 1] == '\r'
+					&& i + 2 < cnt && buf[i + 2] == '\n'));
+		/* keep lines within 76 characters, with the soft break */
+		if(len + ((_codec_qp_literal[c] == 1
+						|| (_codec_qp_literal[c] == 2
+							&& !eol)) ? 1 : 3)
+				> (eol ? 76 : 75))
+		{
+			memcpy(&out[ret], "=\r\n", 3);
+			ret += 3;
+			len = 0;
+		}
+		if(_codec_qp_literal[c] == 1
+				|| (_codec_qp_literal[c] == 2 && !eol))
+		{
+			out[ret++] = c;
+			len++;
+		}
+		else
+		{
+			ret += _qp_encode_escape(c, &out[ret]);
+			len += 3;
+		}
+	}
+	return ret;
+}
+
+static size_t _qp_encode_escape(unsigned char c, char * out)
+{
+	out[0] = '=';
+	out[1] = _codec_hex[c >> 4];
+	out[2] = _codec_hex[c & 0xf];
+	return 3;
+}
+
+
+/* codec_qp_encode_size */
+size_t codec_qp_encode_size(size_t cnt)
+{
+	/* at most 3 characters per byte, and a soft break every 25 bytes */
+	return cnt * 4 + 3;
+}
+
+
+/* private */
+/* functions */
+/* codec_init */
+static void _codec_init(void)
+{
+#ifdef CODEC_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+	{
+		_codec_base64_decode = _codec_base64_decode_avx2;
+		_codec_base64_encode = _codec_base64_encode_avx2;
+		return;
+	}
+	if(__builtin_cpu_supports("ssse3"))
+	{
+		_codec_base64_decode = _codec_base64_decode_ssse3;
+		_codec_base64_encode = _codec_base64_encode_ssse3;
+		return;
+	}
+#endif
+	_codec_base64_decode = _codec_base64_decode_scalar;
+	_codec_base64_encode = _codec_base64_encode_scalar;
+}
+
+
+/* codec_hex_value */
+static unsigned char _codec_hex_value(char c)
+{
+	if(c >= '0' && c <= '9')
+		return c - '0';
+	if(c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	if(c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return 0xff;
+}
+
+
+/* base64 */
+/* codec_base64_decode_scalar */
+static size_t _codec_base64_decode_scalar(CodecState * state,
+		char const * buf, size_t cnt, char * out)
+{
+	size_t ret = 0;
+	size_t i;
+	unsigned char v;
+
+	for(i = 0; i < cnt; i++)
+	{
+		/* padding and white-space are ignored */
+		if((v = _codec_base64_values[(unsigned char)buf[i]]) == 0xff)
+			continue;
+		state->bits = ((state->bits << 6) | v) & 0xffff;
+		if((state->bits_cnt += 6) >= 8)
+		{
+			state->bits_cnt -= 8;
+			out[ret++] = state->bits >> state->bits_cnt;
+		}
+	}
+	return ret;
+}
+
+
+/* codec_base64_encode_scalar */
+static size_t _encode_scalar(char const * buf, size_t cnt, char * out);
+static size_t _encode_lines(char const * buf, size_t cnt, char * out,
+		size_t (*block)(char const * buf, char * out), size_t block_cnt,
+		size_t block_size);
+
+static size_t _codec_base64_encode_scalar(char const * buf, size_t cnt,
+		char * out)
+{
+	return _encode_lines(buf, cnt, out, NULL, 0, 0);
+}
+
+static size_t _encode_scalar(char const * buf, size_t cnt, char * out)
+{
+	size_t ret = 0;
+	size_t i;
+	unsigned char const * p = (unsigned char const *)buf;
+
+	for(i = 0; i + 3 <= cnt; i += 3)
+	{
+		out[ret++] = _codec_base64[p[i] >> 2];
+		out[ret++] = _codec_base64[((p[i] & 0x03) << 4)
+			| (p[i + 1] >> 4)];
+		out[ret++] = _codec_base64[((p[i + 1] & 0x0f) << 2)
+			| (p[i + 2] >> 6)];
+		out[ret++] = _codec_base64[p[i + 2] & 0x3f];
+	}
+	if(i == cnt)
+		return ret;
+	out[ret++] = _codec_base64[p[i] >> 2];
+	if(i + 1 == cnt)
+	{
+		out[ret++] = _codec_base64[(p[i] & 0x03) << 4];
+		out[ret++] = '=';
+	}
+	else
+	{
+		out[ret++] = _codec_base64[((p[i] & 0x03) << 4)
+			| (p[i + 1] >> 4)];
+		out[ret++] = _codec_base64[(p[i + 1] & 0x0f) << 2];
+	}
+	out[ret++] = '=';
+	return ret;
+}
+
+/* block_cnt bytes are encoded at once, reading up to block_size bytes */
+static size_t _encode_lines(char const * buf, size_t cnt, char * out,
+		size_t (*block)(char const * buf, char * out), size_t block_cnt,
+		size_t block_size)
+{
+	size_t ret = 0;
+	size_t i;
+	size_t j;
+	size_t len;
+
+	for(i = 0; i < cnt; i += len)
+	{
+		len = (cnt - i < CODEC_BASE64_LINE) ? cnt - i
+			: CODEC_BASE64_LINE;
+		for(j = 0; block != NULL && j + block_cnt <= len
+				&& i + j + block_size <= cnt; j += block_cnt)
+			ret += block(&buf[i + j], &out[ret]);
+		ret += _encode_scalar(&buf[i + j], len - j, &out[ret]);
+		out[ret++] = '\r';
+		out[ret++] = '\n';
+	}
+	return ret;
+}
+
+
+#ifdef CODEC_X86
+/* codec_base64_decode_ssse3 */
+static size_t _decode_blocks(CodecState * state, char const * buf,
+		size_t cnt, char * out,
+		unsigned int (*block)(char const * buf, char * out),
+		size_t block_size);
+static unsigned int _decode_ssse3(char const * buf, char * out);
+
+static size_t _codec_base64_decode_ssse3(CodecState * state,
+		char const * buf, size_t cnt, char * out)
+{
+	return _decode_blocks(state, buf, cnt, out, _decode_ssse3, 16);
+}
+
+/* the blocks decode block_size characters into 3/4 as many bytes, but may
+ * write up to block_size bytes; the characters not in the alphabet are
+ * returned as a mask, and the groups following them are left to the scalar
+ * version */
+static size_t _decode_blocks(CodecState * state, char const * buf,
+		size_t cnt, char * out,
+		unsigned int (*block)(char const * buf, char * out),
+		size_t block_size)
+{
+	size_t ret = 0;
+	size_t i = 0;
+	size_t n;
+	unsigned int mask;
+
+	while(i < cnt)
+	{
+		mask = 0;
+		/* only complete groups of characters are decoded in blocks */
+		if(state->bits_cnt == 0)
+			for(; i + block_size <= cnt; i += block_size)
+			{
+				if((mask = block(&buf[i], &out[ret])) != 0)
+					break;
+				ret += block_size / 4 * 3;
+			}
+		if(mask != 0)
+		{
+			/* keep the groups before the first invalid character */
+			for(n = 0; (mask & 0x1) == 0; n++)
+				mask >>= 1;
+			ret += n / 4 * 3;
+			i += n / 4 * 4;
+			n = n % 4 + 1;
+		}
+		else if(i + block_size > cnt)
+			n = cnt - i;
+		else
+			n = 1;
+		ret += _codec_base64_decode_scalar(state, &buf[i], n,
+				&out[ret]);
+		i += n;
+	}
+	return ret;
+}
+
+__attribute__((target("ssse3")))
+static unsigned int _decode_ssse3(char const * buf, char * out)
+{
+	__m128i const lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11,
+			0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b,
+			0x1b, 0x1a);
+	__m128i const lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04,
+			0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+			0x10, 0x10);
+	__m128i const lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71,
+			-71, 0, 0, 0, 0, 0, 0, 0, 0);
+	__m128i in;
+	__m128i hi;
+	__m128i lo;
+	__m128i v;
+	unsigned int mask;
+
+	in = _mm_loadu_si128((__m128i const *)buf);
+	hi = _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0f));
+	lo = _mm_and_si128(in, _mm_set1_epi8(0x0f));
+	/* look for characters out of the alphabet */
+	v = _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo),
+			_mm_shuffle_epi8(lut_hi, hi));
+	mask = _mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_setzero_si128()));
+	/* translate to values */
+	v = _mm_add_epi8(in, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(
+					_mm_cmpeq_epi8(in, _mm_set1_epi8('/')),
+					hi)));
+	/* pack the groups of 4 values into 3 bytes */
+	v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+	v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+	v = _mm_shuffle_epi8(v, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14,
+				13, 12, -1, -1, -1, -1));
+	_mm_storeu_si128((__m128i *)out, v);
+	return mask;
+}
+
+
+/* codec_base64_decode_avx2 */
+static unsigned int _decode_avx2(char const * buf, char * out);
+
+static size_t _codec_base64_decode_avx2(CodecState * state,
+		char const * buf, size_t cnt, char * out)
+{
+	return _decode_blocks(state, buf, cnt, out, _decode_avx2, 32);
+}
+
+__attribute__((target("avx2")))
+static unsigned int _decode_avx2(char const * buf, char * out)
+{
+	__m256i const lut_lo = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+				0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+				0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b,
+				0x1a));
+	__m256i const lut_hi = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+				0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+				0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+				0x10));
+	__m256i const lut_roll = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+				0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0,
+				0, 0, 0));
+	__m256i in;
+	__m256i hi;
+	__m256i lo;
+	__m256i v;
+	unsigned int mask;
+
+	in = _mm256_loadu_si256((__m256i const *)buf);
+	hi = _mm256_and_si256(_mm256_srli_epi32(in, 4),
+			_mm256_set1_epi8(0x0f));
+	lo = _mm256_and_si256(in, _mm256_set1_epi8(0x0f));
+	v = _mm256_and_si256(_mm256_shuffle_epi8(lut_lo, lo),
+			_mm256_shuffle_epi8(lut_hi, hi));
+	mask = _mm256_movemask_epi8(_mm256_cmpgt_epi8(v,
+				_mm256_setzero_si256()));
+	v = _mm256_add_epi8(in, _mm256_shuffle_epi8(lut_roll,
+				_mm256_add_epi8(_mm256_cmpeq_epi8(in,
+						_mm256_set1_epi8('/')), hi)));
+	v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+	v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+	v = _mm256_shuffle_epi8(v, _mm256_broadcastsi128_si256(_mm_setr_epi8(
+					2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+					-1, -1, -1, -1)));
+	/* join the 12 bytes of both lanes */
+	v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6,
+				3, 7));
+	_mm256_storeu_si256((__m256i *)out, v);
+	return mask;
+}
+
+
+/* codec_base64_encode_ssse3 */
+static size_t _encode_ssse3(char const * buf, char * out);
+
+static size_t _codec_base64_encode_ssse3(char const * buf, size_t cnt,
+		char * out)
+{
+	return _encode_lines(buf, cnt, out, _encode_ssse3, 12, 16);
+}
+
+__attribute__((target("ssse3")))
+static size_t _encode_ssse3(char const * buf, char * out)
+{
+	__m128i const shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A',
+			0, 0);
+	__m128i in;
+	__m128i v;
+	__m128i r;
+
+	/* split each group of 3 bytes into 4 values */
+	in = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)buf),
+			_mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10,
+				9, 11, 10));
+	v = _mm_or_si128(_mm_mulhi_epu16(_mm_and_si128(in,
+					_mm_set1_epi32(0x0fc0fc00)),
+				_mm_set1_epi32(0x04000040)),
+			_mm_mullo_epi16(_mm_and_si128(in,
+					_mm_set1_epi32(0x003f03f0)),
+				_mm_set1_epi32(0x01000010)));
+	/* translate to characters */
+	r = _mm_subs_epu8(v, _mm_set1_epi8(51));
+	r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), v),
+				_mm_set1_epi8(13)));
+	r = _mm_add_epi8(v, _mm_shuffle_epi8(shift, r));
+	_mm_storeu_si128((__m128i *)out, r);
+	return 16;
+}
+
+
+/* codec_base64_encode_avx2 */
+static size_t _encode_avx2(char const * buf, char * out);
+
+static size_t _codec_base64_encode_avx2(char const * buf, size_t cnt,
+		char * out)
+{
+	return _encode_lines(buf, cnt, out, _encode_avx2, 24, 28);
+}
+
+__attribute__((target("avx2")))
+static size_t _encode_avx2(char const * buf, char * out)
+{
+	__m256i const shift = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+				'a' - 26, '0' - 52, '0' - 52, '0' - 52,
+				'0' - 52, '0' - 52, '0' - 52, '0' - 52,
+				'0' - 52, '0' - 52, '0' - 52, '+' - 62,
+				'/' - 63, 'A', 0, 0));
+	__m256i in;
+	__m256i v;
+	__m256i r;
+
+	/* 12 bytes in each lane */
+	in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(
+					(__m128i const *)buf)),
+			_mm_loadu_si128((__m128i const *)&buf[12]), 1);
+	in = _mm256_shuffle_epi8(in, _mm256_broadcastsi128_si256(
+				_mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8,
+					7, 10, 9, 11, 10)));
+	v = _mm256_or_si256(_mm256_mulhi_epu16(_mm256_and_si256(in,
+					_mm256_set1_epi32(0x0fc0fc00)),
+				_mm256_set1_epi32(0x04000040)),
+			_mm256_mullo_epi16(_mm256_and_si256(in,
+					_mm256_set1_epi32(0x003f03f0)),
+				_mm256_set1_epi32(0x01000010)));
+	r = _mm256_subs_epu8(v, _mm256_set1_epi8(51));
+	r = _mm256_or_si256(r, _mm256_and_si256(_mm256_cmpgt_epi8(
+					_mm256_set1_epi8(26), v),
+				_mm256_set1_epi8(13)));
+	r = _mm256_add_epi8(v, _mm256_shuffle_epi8(shift, r));
+	_mm256_storeu_si256((__m256i *)out, r);
+	return 32;
+}
+#endif
@@ -0,0 +1,64 @@
+/* $Id$ */
+/* Copyright (c) 2024 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Desktop Mailer */
+/* All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+
+#ifndef MAILER_SRC_CODEC_H
+# define MAILER_SRC_CODEC_H
+
+# include <stddef.h>
+
+
+/* Codec */
+/* types */
+typedef struct _CodecState
+{
+	unsigned int bits;
+	unsigned int bits_cnt;
+} CodecState;
+
+
+/* constants */
+# define CODEC_BASE64_LINE	57	/* bytes encoded per line */
+
+
+/* functions */
+/* base64
+ * the output buffers must hold at least as many bytes as the input when
+ * decoding, or as returned by the functions ending in _size when encoding */
+size_t codec_base64_decode(CodecState * state, char const * buf, size_t cnt,
+		char * out);
+size_t codec_base64_encode(char const * buf, size_t cnt, char * out);
+size_t codec_base64_encode_size(size_t cnt);
+
+/* quoted-printable */
+size_t codec_qp_decode(char const * buf, size_t cnt, char * out);
+size_t codec_qp_encode(char const * buf, size_t cnt, char * out);
+size_t codec_qp_encode_size(size_t cnt);
+
+#endif /* !MAILER_SRC_CODEC_H */
@@ -34,12 +34,14 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <libgen.h>
 #include <errno.h>
 #include <libintl.h>
 #include <gdk/gdkkeysyms.h>
 #include <Desktop.h>
 #include "mailer.h"
+#include "codec.h"
 #include "compose.h"
 #include "../config.h"
 #define _(string) gettext(string)
@@ -1061,6 +1063,11 @@ void compose_select_all(Compose * compose)
 /* compose_send */
 static char * _send_headers(Compose * compose);
 static char * _send_body(GtkWidget * view);
+static int _send_attachments(Compose * compose, char ** msg, char ** body);
+static int _send_attachment(Compose * compose, GString * str,
+		char const * boundary, char const * filename,
+		char const * name, FILE * fp);
+static void _send_attachment_filename(GString * str, char const * name);
 static int _send_mail(Compose * compose, char * msg, size_t msg_len);
 static int _mail_child(Compose * compose, int fd[2]);
 static gboolean _on_send_closex(gpointer data);
@@ -1083,6 +1090,14 @@ void compose_send(Compose * compose)
 		free(msg);
 		return;
 	}
+	if(gtk_tree_model_iter_n_children(GTK_TREE_MODEL(compose->a_store),
+				NULL) > 0
+			&& _send_attachments(compose, &msg, &body) != 0)
+	{
+		free(msg);
+		g_free(body);
+		return;
+	}
 	msg_len = strlen(msg);
 	body_len = strlen(body);
 	if((p = realloc(msg, msg_len + body_len + 8)) == NULL)
@@ -1247,6 +1262,126 @@ static char * _send_body(GtkWidget * view)
 			FALSE);
 }
 
+static int _send_attachments(Compose * compose, char ** msg, char ** body)
+{
+	GtkTreeModel * model = GTK_TREE_MODEL(compose->a_store);
+	GtkTreeIter iter;
+	gboolean valid;
+	gchar * boundary;
+	gchar * headers;
+	GString * str;
+	gchar * filename;
+	gchar * name;
+	FILE * fp;
+	int res = 0;
+
+	boundary = g_strdup_printf("=_%s-%u-%lu", PROGNAME_COMPOSE,
+			(unsigned int)getpid(), (unsigned long)time(NULL));
+	headers = g_strdup_printf("%sMIME-Version: 1.0\r\n"
+			"Content-Type: multipart/mixed; boundary=\"%s\"\r\n",
+			*msg, boundary);
+	/* the text comes first */
+	str = g_string_new(NULL);
+	g_string_append_printf(str, "--%s\r\n"
+			"Content-Type: text/plain; charset=UTF-8\r\n"
+			"Content-Transfer-Encoding: 8bit\r\n\r\n%s\r\n",
+			boundary, *body);
+	for(valid = gtk_tree_model_get_iter_first(model, &iter);
+			res == 0 && valid == TRUE;
+			valid = gtk_tree_model_iter_next(model, &iter))
+	{
+		gtk_tree_model_get(model, &iter, CAC_FILENAME, &filename,
+				CAC_BASENAME, &name, CAC_FILE_POINTER, &fp,
+				-1);
+		res = _send_attachment(compose, str, boundary, filename,
+				name, fp);
+		g_free(filename);
+		g_free(name);
+	}
+	g_string_append_printf(str, "--%s--\r\n", boundary);
+	g_free(boundary);
+	if(res != 0)
+	{
+		g_free(headers);
+		g_string_free(str, TRUE);
+		return res;
+	}
+	/* the headers were allocated with malloc() */
+	free(*msg);
+	if((*msg = strdup(headers)) == NULL)
+		res = -compose_error(compose, strerror(errno), 1);
+	g_free(headers);
+	g_free(*body);
+	*body = g_string_free(str, FALSE);
+	return res;
+}
+
+static int _send_attachment(Compose * compose, GString * str,
+		char const * boundary, char const * filename,
+		char const * name, FILE * fp)
+{
+	char buf[CODEC_BASE64_LINE * 64];
+	char * p;
+	size_t size;
+	char const * type;
+
+	if((type = mime_type(compose->mime, filename)) == NULL)
+		type = "application/octet-stream";
+	g_string_append_printf(str, "--%s\r\n"
+			"Content-Type: %s\r\n"
+			"Content-Disposition: attachment; ", boundary, type);
+	_send_attachment_filename(str, name);
+	g_string_append(str, "\r\nContent-Transfer-Encoding: base64\r\n\r\n");
+	if(fseek(fp, 0, SEEK_SET) != 0)
+		return -compose_error(compose, strerror(errno), 1);
+	if((p = malloc(codec_base64_encode_size(sizeof(buf)))) == NULL)
+		return -compose_error(compose, strerror(errno), 1);
+	/* the file is read in complete lines of base64 */
+	while((size = fread(buf, sizeof(*buf), sizeof(buf), fp)) > 0)
+	{
+		size = codec_base64_encode(buf, size, p);
+		g_string_append_len(str, p, size);
+	}
+	free(p);
+	if(ferror(fp))
+		return -compose_error(compose, strerror(errno), 1);
+	return 0;
+}
+
+static void _send_attachment_filename(GString * str, char const * name)
+{
+	char const hex[] = "0123456789ABCDEF";
+	unsigned char const * p;
+
+	for(p = (unsigned char const *)name; *p != '\0'; p++)
+		if(*p < 0x20 || *p > 0x7e)
+			break;
+	if(*p == '\0')
+	{
+		/* as a quoted-string */
+		g_string_append(str, "filename=\"");
+		for(p = (unsigned char const *)name; *p != '\0'; p++)
+		{
+			if(*p == '"' || *p == '\\')
+				g_string_append_c(str, '\\');
+			g_string_append_c(str, *p);
+		}
+		g_string_append_c(str, '"');
+		return;
+	}
+	/* otherwise encoded as in RFC 2231 */
+	g_string_append(str, "filename*=UTF-8''");
+	for(p = (unsigned char const *)name; *p != '\0'; p++)
+		if(g_ascii_isalnum(*p) || strchr("!#$&+-.^_`|~", *p) != NULL)
+			g_string_append_c(str, *p);
+		else
+		{
+			g_string_append_c(str, '%');
+			g_string_append_c(str, hex[*p >> 4]);
+			g_string_append_c(str, hex[*p & 0xf]);
+		}
+}
+
 static gboolean _on_send_closex(gpointer data)
 {
 	Compose * compose = data;
@@ -36,6 +36,7 @@
 #include <libintl.h>
 #include <System.h>
 #include "mailer.h"
+#include "message.h"
 #include "folder.h"
 #define _(string) gettext(string)
 #define N_(string) (string)
@@ -48,21 +49,58 @@ struct _MailerFolder
 {
 	FolderType type;
 	char * name;
+	unsigned int total;
+	unsigned int unread;
 	GtkTreeStore * store;
 	GtkTreeRowReference * row;
 
 	GtkTreeStore * messages;
+	GStringChunk * strings;
+	guint strings_source;
+	unsigned int strings_rows;
+	unsigned int strings_stale;
+	Threads * threads;
+
+	/* sorting is suspended while loading messages */
+	guint sort_source;
+	gint sort_column;
+	GtkSortType sort_order;
+
+	/* the keys of the column sorted are ranked beforehand */
+	gint ranks_column;
+	unsigned int ranks_serial;
 
 	AccountFolder * data;		/* for account plug-ins */
 };
 
 
+/* constants */
+#define FOLDER_SORT_DELAY	250
+#define FOLDER_STRINGS_SIZE	4096
+#define FOLDER_STRINGS_STALE	1024
+
+
 /* prototypes */
 static gboolean _folder_set(Folder * folder, MailerFolderColumn column,
 		void * value);
 
 static char const * _get_local_name(FolderType type, char const * name);
 
+static gint _folder_sort_rank(Folder * folder, MailerHeaderColumn column,
+		GtkTreeModel * model, GtkTreeIter * a, GtkTreeIter * b);
+
+/* callbacks */
+static gboolean _folder_on_intern_compact(gpointer data);
+static void _folder_on_sort_column_changed(GtkTreeSortable * sortable,
+		gpointer data);
+static gint _folder_on_sort_from(GtkTreeModel * model, GtkTreeIter * a,
+		GtkTreeIter * b, gpointer data);
+static gboolean _folder_on_sort_resume(gpointer data);
+static gint _folder_on_sort_subject(GtkTreeModel * model, GtkTreeIter * a,
+		GtkTreeIter * b, gpointer data);
+static gint _folder_on_sort_to(GtkTreeModel * model, GtkTreeIter * a,
+		GtkTreeIter * b, gpointer data);
+
 
 /* functions */
 /* folder_new */
@@ -71,6 +109,17 @@ Folder * folder_new(AccountFolder * folder, FolderType type, char const * name,
 {
 	Folder * ret;
 	GtkTreePath * path;
+	struct
+	{
+		MailerHeaderColumn column;
+		GtkTreeIterCompareFunc func;
+	} sorts[] =
+	{
+		{ MHC_SUBJECT,	_folder_on_sort_subject	},
+		{ MHC_FROM,	_folder_on_sort_from	},
+		{ MHC_TO,	_folder_on_sort_to	}
+	};
+	size_t i;
 
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s(\"%s\")\n", __func__, name);
@@ -79,6 +128,8 @@ Folder * folder_new(AccountFolder * folder, FolderType type, char const * name,
 		return NULL;
 	name = _get_local_name(type, name);
 	ret->name = string_new(name);
+	ret->total = 0;
+	ret->unread = 0;
 	ret->store = store;
 	path = gtk_tree_model_get_path(GTK_TREE_MODEL(store), iter);
 	ret->row = gtk_tree_row_reference_new(GTK_TREE_MODEL(store), path);
@@ -89,11 +140,27 @@ Folder * folder_new(AccountFolder * folder, FolderType type, char const * name,
 			G_TYPE_POINTER, G_TYPE_POINTER, GDK_TYPE_PIXBUF,
 			G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING,
 			G_TYPE_STRING, G_TYPE_STRING, G_TYPE_UINT,
-			G_TYPE_STRING, G_TYPE_BOOLEAN, G_TYPE_UINT);
+			G_TYPE_STRING, G_TYPE_BOOLEAN, G_TYPE_UINT,
+			G_TYPE_BOOLEAN);
+	/* the text columns are sorted with the keys interned in the folder */
+	ret->ranks_column = -1;
+	ret->ranks_serial = 0;
+	for(i = 0; i < sizeof(sorts) / sizeof(*sorts); i++)
+		gtk_tree_sortable_set_sort_func(GTK_TREE_SORTABLE(
+					ret->messages), sorts[i].column,
+				sorts[i].func, ret, NULL);
+	g_signal_connect(G_OBJECT(ret->messages), "sort-column-changed",
+			G_CALLBACK(_folder_on_sort_column_changed), ret);
 	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(ret->messages),
 			MHC_DATE, GTK_SORT_DESCENDING);
+	ret->strings = g_string_chunk_new(FOLDER_STRINGS_SIZE);
+	ret->strings_source = 0;
+	ret->strings_rows = 0;
+	ret->strings_stale = 0;
+	ret->sort_source = 0;
+	ret->threads = threads_new(ret->messages);
 	ret->data = folder;
-	if(ret->name == NULL)
+	if(ret->name == NULL || ret->threads == NULL)
 	{
 		folder_delete(ret);
 		return NULL;
@@ -105,6 +172,15 @@ Folder * folder_new(AccountFolder * folder, FolderType type, char const * name,
 /* folder_delete */
 void folder_delete(Folder * folder)
 {
+	if(folder->sort_source != 0)
+		g_source_remove(folder->sort_source);
+	if(folder->strings_source != 0)
+		g_source_remove(folder->strings_source);
+	if(folder->threads != NULL)
+		threads_delete(folder->threads);
+	g_signal_handlers_disconnect_by_func(G_OBJECT(folder->messages),
+			G_CALLBACK(_folder_on_sort_column_changed), folder);
+	g_string_chunk_free(folder->strings);
 	gtk_tree_row_reference_free(folder->row);
 	string_delete(folder->name);
 	object_delete(folder);
@@ -145,6 +221,20 @@ char const * folder_get_name(Folder * folder)
 }
 
 
+/* folder_get_threads */
+Threads * folder_get_threads(Folder * folder)
+{
+	return folder->threads;
+}
+
+
+/* folder_get_total */
+unsigned int folder_get_total(Folder * folder)
+{
+	return folder->total;
+}
+
+
 /* folder_get_type */
 FolderType folder_get_type(Folder * folder)
 {
@@ -152,6 +242,29 @@ FolderType folder_get_type(Folder * folder)
 }
 
 
+/* folder_get_unread */
+unsigned int folder_get_unread(Folder * folder)
+{
+	return folder->unread;
+}
+
+
+/* folder_set_count */
+void folder_set_count(Folder * folder, unsigned int total,
+		unsigned int unread)
+{
+	char * name;
+
+	folder->total = total;
+	folder->unread = unread;
+	if((name = g_strdup_printf("%s (%u/%u)", folder->name, unread, total))
+			== NULL)
+		return;
+	_folder_set(folder, MFC_NAME, name);
+	g_free(name);
+}
+
+
 /* folder_set_type */
 void folder_set_type(Folder * folder, FolderType type)
 {
@@ -188,6 +301,60 @@ void folder_set_type(Folder * folder, FolderType type)
 }
 
 
+/* useful */
+/* folder_intern */
+char const * folder_intern(Folder * folder, char const * string)
+{
+	/* identical strings are only stored once, until compacted */
+	return (string != NULL) ? g_string_chunk_insert_const(folder->strings,
+			string) : NULL;
+}
+
+
+/* folder_intern_release */
+void folder_intern_release(Folder * folder)
+{
+	/* the strings of the messages removed are only released once they
+	 * outnumber the others */
+	if(++folder->strings_stale < FOLDER_STRINGS_STALE
+			|| folder->strings_stale < folder->strings_rows
+			|| folder->strings_source != 0)
+		return;
+	folder->strings_source = g_idle_add(_folder_on_intern_compact,
+			folder);
+}
+
+
+/* folder_sort_suspend */
+void folder_sort_suspend(Folder * folder)
+{
+	GtkTreeSortable * sortable = GTK_TREE_SORTABLE(folder->messages);
+	gint column;
+	GtkSortType order;
+
+	/* sort the messages added only once, when done loading */
+	if(gtk_tree_sortable_get_sort_column_id(sortable, &column, &order)
+			== TRUE)
+	{
+		/* possibly sorted otherwise in the meantime */
+		folder->sort_column = column;
+		folder->sort_order = order;
+		gtk_tree_sortable_set_sort_column_id(sortable,
+				GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID,
+				order);
+	}
+	else if(folder->sort_source == 0)
+		/* not sorted */
+		return;
+	/* the loading is considered done once no message was added for a
+	 * while */
+	if(folder->sort_source != 0)
+		g_source_remove(folder->sort_source);
+	folder->sort_source = g_timeout_add(FOLDER_SORT_DELAY,
+			_folder_on_sort_resume, folder);
+}
+
+
 /* private */
 /* folder_set */
 static gboolean _folder_set(Folder * folder, MailerFolderColumn column,
@@ -202,6 +369,39 @@ static gboolean _folder_set(Folder * folder, MailerFolderColumn column,
 }
 
 
+/* folder_sort_rank */
+static gint _folder_sort_rank(Folder * folder, MailerHeaderColumn column,
+		GtkTreeModel * model, GtkTreeIter * a, GtkTreeIter * b)
+{
+	Message * m = NULL;
+	Message * n = NULL;
+	unsigned int r;
+	unsigned int s;
+	char const * p;
+	char const * q;
+
+	gtk_tree_model_get(model, a, MHC_MESSAGE, &m, -1);
+	gtk_tree_model_get(model, b, MHC_MESSAGE, &n, -1);
+	if(m == NULL || n == NULL)
+		return (m == n) ? 0 : ((m == NULL) ? -1 : 1);
+	/* compare the ranks unless the keys changed since ranked */
+	if(column == folder->ranks_column
+			&& (r = message_get_sort_rank(m, folder->ranks_serial))
+			!= 0 && (s = message_get_sort_rank(n,
+					folder->ranks_serial)) != 0)
+		return (r == s) ? 0 : ((r < s) ? -1 : 1);
+	p = message_get_sort_key(m, column);
+	q = message_get_sort_key(n, column);
+	if(p == q)
+		return 0;
+	if(p == NULL)
+		return -1;
+	if(q == NULL)
+		return 1;
+	return strcmp(p, q);
+}
+
+
 /* get_local_name */
 static char const * _get_local_name(FolderType type, char const * name)
 {
@@ -225,3 +425,166 @@ static char const * _get_local_name(FolderType type, char const * name)
 			return _(names[i].lname);
 	return name;
 }
+
+
+/* callbacks */
+/* folder_on_intern_compact */
+static gboolean _intern_compact_foreach(GtkTreeModel * model,
+		GtkTreePath * path, GtkTreeIter * iter, gpointer data);
+
+static gboolean _folder_on_intern_compact(gpointer data)
+{
+	Folder * folder = data;
+	GStringChunk * strings = folder->strings;
+
+	folder->strings_source = 0;
+	/* intern the strings still listed in a new chunk */
+	folder->strings = g_string_chunk_new(FOLDER_STRINGS_SIZE);
+	folder->strings_rows = 0;
+	folder->strings_stale = 0;
+	gtk_tree_model_foreach(GTK_TREE_MODEL(folder->messages),
+			_intern_compact_foreach, folder);
+	g_string_chunk_free(strings);
+	return FALSE;
+}
+
+static gboolean _intern_compact_foreach(GtkTreeModel * model,
+		GtkTreePath * path, GtkTreeIter * iter, gpointer data)
+{
+	Folder * folder = data;
+	Message * message;
+
+	gtk_tree_model_get(model, iter, MHC_MESSAGE, &message, -1);
+	if(message != NULL)
+		message_intern(message, folder);
+	folder->strings_rows++;
+	return FALSE;
+}
+
+
+/* folder_on_sort_column_changed */
+static gboolean _sort_column_changed_foreach(GtkTreeModel * model,
+		GtkTreePath * path, GtkTreeIter * iter, gpointer data);
+static gint _sort_column_changed_compare(gconstpointer a, gconstpointer b);
+
+static void _folder_on_sort_column_changed(GtkTreeSortable * sortable,
+		gpointer data)
+{
+	Folder * folder = data;
+	gint column;
+	GtkSortType order;
+	GPtrArray * messages;
+	GPtrArray * keys;
+	GHashTable * ranks;
+	Message * message;
+	char const * key;
+	guint i;
+
+	/* emitted before sorting, the keys are ranked once for the
+	 * comparisons to be cheap */
+	if(gtk_tree_sortable_get_sort_column_id(sortable, &column, &order)
+			!= TRUE || (column != MHC_SUBJECT && column != MHC_FROM
+				&& column != MHC_TO))
+		return;
+	messages = g_ptr_array_new();
+	keys = g_ptr_array_new();
+	ranks = g_hash_table_new(g_direct_hash, g_direct_equal);
+	gtk_tree_model_foreach(GTK_TREE_MODEL(sortable),
+			_sort_column_changed_foreach, messages);
+	/* the keys are interned, identical keys are the same pointer */
+	for(i = 0; i < messages->len; i++)
+	{
+		key = message_get_sort_key(g_ptr_array_index(messages, i),
+				column);
+		if(g_hash_table_lookup_extended(ranks, key, NULL, NULL)
+				!= TRUE)
+		{
+			g_hash_table_insert(ranks, (gpointer)key, NULL);
+			g_ptr_array_add(keys, (gpointer)key);
+		}
+	}
+	g_ptr_array_sort(keys, _sort_column_changed_compare);
+	for(i = 0; i < keys->len; i++)
+		g_hash_table_insert(ranks, g_ptr_array_index(keys, i),
+				GUINT_TO_POINTER(i + 1));
+	/* the ranks of every message are valid again */
+	if(++folder->ranks_serial == 0)
+		folder->ranks_serial++;
+	folder->ranks_column = column;
+	for(i = 0; i < messages->len; i++)
+	{
+		message = g_ptr_array_index(messages, i);
+		message_set_sort_rank(message, folder->ranks_serial,
+				GPOINTER_TO_UINT(g_hash_table_lookup(ranks,
+						message_get_sort_key(message,
+							column))));
+	}
+	g_hash_table_destroy(ranks);
+	g_ptr_array_free(keys, TRUE);
+	g_ptr_array_free(messages, TRUE);
+}
+
+static gboolean _sort_column_changed_foreach(GtkTreeModel * model,
+		GtkTreePath * path, GtkTreeIter * iter, gpointer data)
+{
+	GPtrArray * messages = data;
+	Message * message;
+
+	gtk_tree_model_get(model, iter, MHC_MESSAGE, &message, -1);
+	if(message != NULL)
+		g_ptr_array_add(messages, message);
+	return FALSE;
+}
+
+static gint _sort_column_changed_compare(gconstpointer a, gconstpointer b)
+{
+	char const * p = *(char const * const *)a;
+	char const * q = *(char const * const *)b;
+
+	if(p == NULL || q == NULL)
+		return (p == q) ? 0 : ((p == NULL) ? -1 : 1);
+	return strcmp(p, q);
+}
+
+
+/* folder_on_sort_from */
+static gint _folder_on_sort_from(GtkTreeModel * model, GtkTreeIter * a,
+		GtkTreeIter * b, gpointer data)
+{
+	return _folder_sort_rank(data, MHC_FROM, model, a, b);
+}
+
+
+/* folder_on_sort_resume */
+static gboolean _folder_on_sort_resume(gpointer data)
+{
+	Folder * folder = data;
+	GtkTreeSortable * sortable = GTK_TREE_SORTABLE(folder->messages);
+	gint column;
+	GtkSortType order;
+
+	folder->sort_source = 0;
+	/* unless sorted otherwise in the meantime */
+	if(gtk_tree_sortable_get_sort_column_id(sortable, &column, &order)
+			!= TRUE && column
+			== GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID)
+		gtk_tree_sortable_set_sort_column_id(sortable,
+				folder->sort_column, folder->sort_order);
+	return FALSE;
+}
+
+
+/* folder_on_sort_subject */
+static gint _folder_on_sort_subject(GtkTreeModel * model, GtkTreeIter * a,
+		GtkTreeIter * b, gpointer data)
+{
+	return _folder_sort_rank(data, MHC_SUBJECT, model, a, b);
+}
+
+
+/* folder_on_sort_to */
+static gint _folder_on_sort_to(GtkTreeModel * model, GtkTreeIter * a,
+		GtkTreeIter * b, gpointer data)
+{
+	return _folder_sort_rank(data, MHC_TO, model, a, b);
+}
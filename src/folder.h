@@ -34,6 +34,7 @@
 # include <gtk/gtk.h>
 # include "../include/Mailer/plugin.h"
 # include "../include/Mailer/folder.h"
+# include "threads.h"
 
 
 /* Folder */
@@ -49,5 +50,11 @@ void folder_delete(Folder * folder);
 AccountFolder * folder_get_data(Folder * folder);
 gboolean folder_get_iter(Folder * folder, GtkTreeIter * iter);
 GtkTreeStore * folder_get_messages(Folder * folder);
+Threads * folder_get_threads(Folder * folder);
+
+/* useful */
+char const * folder_intern(Folder * folder, char const * string);
+void folder_intern_release(Folder * folder);
+void folder_sort_suspend(Folder * folder);
 
 #endif /* !MAILER_SRC_MAILER_H */
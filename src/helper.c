@@ -32,35 +32,179 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include "../include/Mailer/helper.h"
 
 
 /* public */
 /* functions */
+/* mailer_helper_get_address */
+static char const * _address_comment(char const * p, char const ** start,
+		size_t * len);
+static char const * _address_quoted(char const * p);
+
+char const * mailer_helper_get_address(char const * header,
+		MailerHelperAddress * address)
+{
+	char const * p;
+	char const * phrase = NULL;
+	char const * end = NULL;
+	char const * comment = NULL;
+	size_t comment_len = 0;
+	char const * angle = NULL;
+	size_t angle_len = 0;
+	char const * q;
+	size_t len;
+
+	/* parses a single address in one pass, up to the next separator */
+	for(p = header; *p != '\0' && *p != ',' && *p != ';';)
+		switch(*p)
+		{
+			case '(':
+				/* only the first comment is kept */
+				p = _address_comment(p, &q, &len);
+				if(comment == NULL)
+				{
+					comment = q;
+					comment_len = len;
+				}
+				break;
+			case '"':
+				if(phrase == NULL)
+					phrase = p;
+				end = p = _address_quoted(p);
+				break;
+			case ':':
+				/* the name of a group */
+				phrase = NULL;
+				end = NULL;
+				p++;
+				break;
+			case '<':
+				/* skip any source route */
+				if(*(angle = ++p) == '@'
+						&& (q = strchr(p, ':')) != NULL)
+					angle = q + 1;
+				for(; *p != '\0' && *p != '>'; p++)
+					if(*p == '"')
+						p = _address_quoted(p) - 1;
+				angle_len = p - angle;
+				if(*p == '>')
+					p++;
+				break;
+			default:
+				if(isspace((unsigned char)*p))
+				{
+					p++;
+					break;
+				}
+				if(phrase == NULL)
+					phrase = p;
+				end = ++p;
+				break;
+		}
+	if(phrase == NULL && angle == NULL && *p == '\0')
+		return NULL;
+	if(angle != NULL)
+	{
+		address->email = angle;
+		address->email_len = angle_len;
+		address->name = phrase;
+		address->name_len = (phrase != NULL) ? end - phrase : 0;
+	}
+	else
+	{
+		address->email = phrase;
+		address->email_len = (phrase != NULL) ? end - phrase : 0;
+		address->name = comment;
+		address->name_len = comment_len;
+	}
+	/* remove surrounding single quotes */
+	if(address->name_len >= 2 && address->name[0] == '\''
+			&& address->name[address->name_len - 1] == '\'')
+	{
+		address->name++;
+		address->name_len -= 2;
+	}
+	return (*p != '\0') ? p + 1 : p;
+}
+
+static char const * _address_comment(char const * p, char const ** start,
+		size_t * len)
+{
+	int depth = 0;
+	char const * end;
+
+	for(*start = ++p; *p != '\0'; p++)
+		if(*p == '\\' && p[1] != '\0')
+			p++;
+		else if(*p == '(')
+			depth++;
+		else if(*p == ')' && depth-- == 0)
+			break;
+	/* trim the contents */
+	for(end = p; end > *start && isspace((unsigned char)end[-1]); end--);
+	for(; *start < end && isspace((unsigned char)**start); (*start)++);
+	*len = end - *start;
+	return (*p != '\0') ? p + 1 : p;
+}
+
+static char const * _address_quoted(char const * p)
+{
+	for(p++; *p != '\0' && *p != '"'; p++)
+		if(*p == '\\' && p[1] != '\0')
+			p++;
+	return (*p != '\0') ? p + 1 : p;
+}
+
+
+/* mailer_helper_get_address_name */
+size_t mailer_helper_get_address_name(MailerHelperAddress const * address,
+		char * buf, size_t size)
+{
+	size_t ret = 0;
+	char const * p = address->name;
+	size_t len = address->name_len;
+	size_t i;
+
+	if(len == 0)
+	{
+		p = address->email;
+		len = address->email_len;
+	}
+	/* remove the quotes and escapes */
+	for(i = 0; i < len; i++)
+	{
+		if(p[i] == '"')
+			continue;
+		if(p[i] == '\\' && i + 1 < len)
+			i++;
+		if(ret + 1 < size)
+			buf[ret] = p[i];
+		ret++;
+	}
+	if(size > 0)
+		buf[(ret < size) ? ret : size - 1] = '\0';
+	return ret;
+}
+
+
 /* mailer_helper_get_date */
-static int _date_do(char const * date, char const * format, struct tm * tm);
+static int _date_parse(char const * date, struct tm * tm, time_t * t);
+static long _date_days(int year, int month, int day);
+static char const * _date_month(char const * p, int * month);
+static char const * _date_number(char const * p, size_t max, int * number,
+		size_t * digits);
+static char const * _date_skip(char const * p);
+static char const * _date_zone(char const * p, long * offset);
 
 time_t mailer_helper_get_date(char const * date, struct tm * tm)
 {
 	time_t t;
 
-	if(date != NULL)
-		/* FIXME check the standard(s) again */
-		if(_date_do(date, "%a, %d %b %Y %T %z (%z)", tm) == 0
-				|| _date_do(date, "%a, %d %b %Y %T %z", tm) == 0
-				|| _date_do(date, "%d %b %Y %T %z", tm) == 0
-				|| _date_do(date, "%d/%m/%Y %T %z", tm) == 0
-				|| _date_do(date, "%d/%m/%Y %T", tm) == 0
-				|| _date_do(date, "%FT%TZ", tm) == 0)
-		{
-			/* fix the date if missing the century */
-			if(tm->tm_year >= -1830 && tm->tm_year < -1800)
-				tm->tm_year += 1900;
-			else if(tm->tm_year >= -1900 && tm->tm_year < -1830)
-				tm->tm_year += 2000;
-			return mktime(tm);
-		}
+	if(date != NULL && _date_parse(date, tm, &t) == 0)
+		return t;
 	/* XXX fallback to the current time and date */
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s(\"%s\")\n", __func__, date);
@@ -70,104 +214,232 @@ time_t mailer_helper_get_date(char const * date, struct tm * tm)
 	return t;
 }
 
-static int _date_do(char const * date, char const * format, struct tm * tm)
+static int _date_parse(char const * date, struct tm * tm, time_t * t)
 {
+	static const int yday[12] = { 0, 31, 59, 90, 120, 151, 181, 212, 243,
+		273, 304, 334 };
 	char const * p;
+	int year;
+	int month;
+	int day;
+	int hour;
+	int minute;
+	int second = 0;
+	long offset = 0;
+	long days;
+	size_t digits;
 
+	/* [day-of-week ","] day month year hour ":" minute [":" second] zone
+	 * as well as "dd/mm/yyyy hh:mm:ss" and "yyyy-mm-ddThh:mm:ssZ" */
+	p = _date_skip(date);
+	if(isalpha((unsigned char)*p))
+	{
+		while(isalpha((unsigned char)*p))
+			p++;
+		if(*(p = _date_skip(p)) == ',')
+			p = _date_skip(p + 1);
+	}
+	if((p = _date_number(p, 4, &day, &digits)) == NULL)
+		return -1;
+	if(digits == 4 && *p == '-')
+	{
+		year = day;
+		if((p = _date_number(p + 1, 2, &month, NULL)) == NULL
+				|| *p != '-'
+				|| (p = _date_number(p + 1, 2, &day, NULL))
+				== NULL || (*p != 'T' && *p != ' '))
+			return -1;
+		p++;
+	}
+	else if(*p == '/')
+	{
+		if((p = _date_number(p + 1, 2, &month, NULL)) == NULL
+				|| *p != '/'
+				|| (p = _date_number(p + 1, 4, &year, &digits))
+				== NULL)
+			return -1;
+	}
+	else if((p = _date_month(_date_skip(p), &month)) == NULL
+			|| (p = _date_number(_date_skip(p), 4, &year, &digits))
+			== NULL)
+		return -1;
+	if(digits == 2)
+		year += (year < 50) ? 2000 : 1900;
+	else if(digits == 3)
+		year += 1900;
+	if((p = _date_number(_date_skip(p), 2, &hour, NULL)) == NULL
+			|| *p != ':'
+			|| (p = _date_number(p + 1, 2, &minute, NULL)) == NULL)
+		return -1;
+	if(*p == ':' && (p = _date_number(p + 1, 2, &second, NULL)) == NULL)
+		return -1;
+	if(month < 1 || month > 12 || day < 1 || day > 31 || hour > 23
+			|| minute > 59 || second > 60)
+		return -1;
+	/* the zone is optional and anything following it is ignored */
+	_date_zone(_date_skip(p), &offset);
+	days = _date_days(year, month, day);
 	memset(tm, 0, sizeof(*tm));
-	if((p = strptime(date, format, tm)) != NULL && *p == '\0')
-		return 0;
-	/* check if we obtained enough information */
-	if(p != NULL && tm->tm_year != 0 && tm->tm_mday != 0)
-		/* XXX _apparently_ yes */
-		return 0;
-	return -1;
+	tm->tm_year = year - 1900;
+	tm->tm_mon = month - 1;
+	tm->tm_mday = day;
+	tm->tm_hour = hour;
+	tm->tm_min = minute;
+	tm->tm_sec = second;
+	/* 01/01/1970 was a Thursday */
+	tm->tm_wday = ((days % 7) + 11) % 7;
+	tm->tm_yday = yday[month - 1] + day - 1;
+	if(month > 2 && (year % 4) == 0 && ((year % 100) != 0
+				|| (year % 400) == 0))
+		tm->tm_yday++;
+	*t = (time_t)days * 86400 + hour * 3600 + minute * 60 + second
+		- offset;
+	return 0;
 }
 
+static long _date_days(int year, int month, int day)
+{
+	long era;
+	long yoe;
+	long doy;
 
-/* mailer_helper_get_email */
-char * mailer_helper_get_email(char const * header)
+	/* days since 01/01/1970, counting years from March */
+	if(month <= 2)
+		year--;
+	era = ((year >= 0) ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (month + ((month > 2) ? -3 : 9)) + 2) / 5 + day - 1;
+	return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+static char const * _date_month(char const * p, int * month)
 {
-	char * ret;
-	size_t len;
-	char * buf = NULL;
+	static char const months[] = "janfebmaraprmayjunjulaugsepoctnovdec";
+	char name[3];
+	size_t i;
+
+	for(i = 0; i < sizeof(name); i++)
+		if(!isalpha((unsigned char)p[i]))
+			return NULL;
+		else
+			name[i] = tolower((unsigned char)p[i]);
+	for(i = 0; i < sizeof(months) - 1; i += sizeof(name))
+		if(memcmp(&months[i], name, sizeof(name)) == 0)
+		{
+			*month = i / sizeof(name) + 1;
+			/* skip the rest of the name if spelled out */
+			for(p += sizeof(name); isalpha((unsigned char)*p); p++);
+			return p;
+		}
+	return NULL;
+}
 
-	if(header == NULL)
+static char const * _date_number(char const * p, size_t max, int * number,
+		size_t * digits)
+{
+	size_t i;
+
+	*number = 0;
+	for(i = 0; i < max && isdigit((unsigned char)p[i]); i++)
+		*number = *number * 10 + p[i] - '0';
+	if(i == 0)
 		return NULL;
-	len = strlen(header);
-	if((ret = malloc(len + 1)) == NULL || (buf = malloc(len + 1)) == NULL)
+	if(digits != NULL)
+		*digits = i;
+	return &p[i];
+}
+
+static char const * _date_skip(char const * p)
+{
+	int depth = 0;
+
+	/* skip whitespace and comments */
+	for(;; p++)
+		if(*p == '(')
+			depth++;
+		else if(*p == ')' && depth > 0)
+			depth--;
+		else if(*p == '\0')
+			return p;
+		else if(depth == 0 && !isspace((unsigned char)*p))
+			return p;
+}
+
+static char const * _date_zone(char const * p, long * offset)
+{
+	static const struct
 	{
-		free(buf);
-		free(ret);
-		return NULL;
-	}
-	if(mailer_helper_is_email(header))
+		char name[4];
+		int offset;
+	} zones[] =
 	{
-		strcpy(ret, header);
-		free(buf);
-		return ret;
-	}
-	if(sscanf(header, "%[^(](%[^)])", ret, buf) == 2
-			|| sscanf(header, "<%[^>]>", ret) == 1
-			|| sscanf(header, "%[^<]<%[^>]>", buf, ret) == 2)
+		{ "UT",	0	}, { "GMT", 0 }, { "Z", 0 },
+		{ "EST", -5	}, { "EDT", -4 },
+		{ "CST", -6	}, { "CDT", -5 },
+		{ "MST", -7	}, { "MDT", -6 },
+		{ "PST", -8	}, { "PDT", -7 }
+	};
+	int sign;
+	int hhmm;
+	size_t digits;
+	size_t len;
+	size_t i;
+
+	*offset = 0;
+	if(*p == '+' || *p == '-')
 	{
-		for(len = strlen(ret); len > 0
-				&& isblank((unsigned char)ret[len - 1]); len--)
-			ret[len - 1] = '\0';
-		if(mailer_helper_is_email(ret))
+		sign = (*p == '-') ? -1 : 1;
+		if(_date_number(p + 1, 4, &hhmm, &digits) == NULL
+				|| digits != 4)
+			return NULL;
+		*offset = sign * ((hhmm / 100) * 3600L + (hhmm % 100) * 60);
+		return p + 5;
+	}
+	for(len = 0; isalpha((unsigned char)p[len]); len++);
+	for(i = 0; i < sizeof(zones) / sizeof(*zones); i++)
+		if(strlen(zones[i].name) == len
+				&& strncasecmp(zones[i].name, p, len) == 0)
 		{
-			free(buf);
-			return ret;
+			*offset = zones[i].offset * 3600L;
+			return p + len;
 		}
-	}
-	free(buf);
-	free(ret);
-	return NULL;
+	/* other zones are considered to be UTC */
+	return (len > 0) ? p + len : NULL;
+}
+
+
+/* mailer_helper_get_email */
+char * mailer_helper_get_email(char const * header)
+{
+	MailerHelperAddress address;
+	char * ret;
+
+	if(header == NULL || mailer_helper_get_address(header, &address)
+			== NULL || address.email == NULL
+			|| memchr(address.email, '@', address.email_len) == NULL)
+		return NULL;
+	if((ret = malloc(address.email_len + 1)) == NULL)
+		return NULL;
+	memcpy(ret, address.email, address.email_len);
+	ret[address.email_len] = '\0';
+	return ret;
 }
 
 
 /* mailer_helper_get_name */
 char * mailer_helper_get_name(char const * header)
 {
+	MailerHelperAddress address;
 	char * ret;
 	size_t len;
-	char * buf = NULL;
-	int c;
 
-	if(header == NULL)
-		return NULL;
-	len = strlen(header);
-	if((ret = malloc(len + 1)) == NULL || (buf = malloc(len + 1)) == NULL)
-	{
-		free(buf);
-		free(ret);
+	if(header == NULL || mailer_helper_get_address(header, &address)
+			== NULL)
 		return NULL;
-	}
-	if(mailer_helper_is_email(header))
-	{
-		strcpy(ret, header);
-		free(buf);
-		return ret;
-	}
-	if(sscanf(header, "%[^(](%[^)])", buf, ret) != 2
-			&& sscanf(header, "<%[^>]>", ret) != 1
-			&& sscanf(header, "%[^<]<%[^>]>", ret, buf) != 2)
-	{
-		free(buf);
-		free(ret);
+	if((len = mailer_helper_get_address_name(&address, NULL, 0)) == 0
+			|| (ret = malloc(len + 1)) == NULL)
 		return NULL;
-	}
-	free(buf);
-	/* right-trim spaces */
-	for(len = strlen(ret); --len > 0
-			&& isspace((unsigned char)ret[len]); ret[len] = '\0');
-	/* remove surrounding quotes */
-	if((len = strlen(ret)) >= 2 && ((c = ret[0]) == '"' || c == '\'')
-			&& ret[len - 1] == c)
-	{
-		memmove(ret, &ret[1], len - 2);
-		ret[len - 2] = '\0';
-	}
+	mailer_helper_get_address_name(&address, ret, len + 1);
 	return ret;
 }
 
@@ -189,3 +461,13 @@ int mailer_helper_is_email(char const * header)
 			return 0;
 	return 1;
 }
+
+
+/* mailer_helper_parse_date */
+int mailer_helper_parse_date(char const * date, struct tm * tm, time_t * t)
+{
+	/* unlike mailer_helper_get_date() there is no fallback */
+	if(date == NULL)
+		return -1;
+	return _date_parse(date, tm, t);
+}
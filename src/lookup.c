@@ -0,0 +1,402 @@
+/* $Id$ */
+/* Copyright (c) 2024 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Desktop Mailer */
+/* All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+
+
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+#include <System.h>
+#include "lookup.h"
+
+
+/* Lookup */
+/* private */
+/* types */
+typedef struct _LookupEntry LookupEntry;
+
+typedef struct _LookupJob
+{
+	Lookup * lookup;		/* NULL if abandoned */
+	LookupEntry * entry;
+
+	char * hostname;
+	uint16_t port;
+
+	/* results */
+	struct addrinfo * ai;
+	char * error;
+} LookupJob;
+
+typedef struct _LookupWaiter
+{
+	unsigned int id;
+	LookupCallback callback;
+	void * data;
+} LookupWaiter;
+
+struct _LookupEntry
+{
+	Lookup * lookup;
+	char * key;
+
+	struct addrinfo * ai;
+	gint64 expires;
+
+	LookupJob * job;
+	GSList * waiters;
+	guint source;
+};
+
+struct _Lookup
+{
+	unsigned int ttl;
+	GHashTable * entries;
+	unsigned int id;
+
+	/* entry being delivered */
+	LookupEntry * current;
+};
+
+
+/* prototypes */
+static LookupEntry * _lookup_entry_new(Lookup * lookup, char const * key);
+static void _lookup_entry_delete(LookupEntry * entry);
+
+static int _lookup_entry_cancel(LookupEntry * entry, unsigned int id);
+static void _lookup_entry_deliver(LookupEntry * entry, char const * error);
+static int _lookup_entry_start(LookupEntry * entry, char const * hostname,
+		uint16_t port);
+
+/* callbacks */
+static gboolean _lookup_on_idle(gpointer data);
+static gboolean _lookup_on_resolved(gpointer data);
+static gpointer _lookup_on_thread(gpointer data);
+
+
+/* public */
+/* functions */
+/* lookup_new */
+Lookup * lookup_new(unsigned int ttl)
+{
+	Lookup * lookup;
+
+	if((lookup = object_new(sizeof(*lookup))) == NULL)
+		return NULL;
+	lookup->ttl = ttl;
+	lookup->entries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+			(GDestroyNotify)_lookup_entry_delete);
+	lookup->id = 0;
+	lookup->current = NULL;
+	return lookup;
+}
+
+
+/* lookup_delete */
+void lookup_delete(Lookup * lookup)
+{
+	g_hash_table_destroy(lookup->entries);
+	object_delete(lookup);
+}
+
+
+/* useful */
+/* lookup_resolve */
+unsigned int lookup_resolve(Lookup * lookup, char const * hostname,
+		uint16_t port, LookupCallback callback, void * data)
+{
+	LookupEntry * entry;
+	LookupWaiter * waiter;
+	gchar * key;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s(\"%s\", %hu)\n", __func__, hostname, port);
+#endif
+	if(hostname == NULL || callback == NULL)
+	{
+		error_set_code(1, "%s", strerror(EINVAL));
+		return 0;
+	}
+	if((waiter = malloc(sizeof(*waiter))) == NULL)
+	{
+		error_set_code(1, "%s", strerror(errno));
+		return 0;
+	}
+	if(++lookup->id == 0)
+		lookup->id++;
+	waiter->id = lookup->id;
+	waiter->callback = callback;
+	waiter->data = data;
+	/* accounts connecting to the same server share the same entry */
+	key = g_strdup_printf("%s:%hu", hostname, port);
+	if((entry = g_hash_table_lookup(lookup->entries, key)) == NULL
+			&& (entry = _lookup_entry_new(lookup, key)) == NULL)
+	{
+		g_free(key);
+		free(waiter);
+		return 0;
+	}
+	g_free(key);
+	entry->waiters = g_slist_append(entry->waiters, waiter);
+	/* the results are always reported asynchronously */
+	if(entry->job != NULL)
+		return waiter->id;
+	if(entry->ai != NULL && entry->expires > g_get_monotonic_time())
+	{
+		if(entry->source == 0)
+			entry->source = g_idle_add(_lookup_on_idle, entry);
+		return waiter->id;
+	}
+	if(_lookup_entry_start(entry, hostname, port) != 0)
+	{
+		_lookup_entry_cancel(entry, waiter->id);
+		return 0;
+	}
+	return waiter->id;
+}
+
+
+/* lookup_cancel */
+void lookup_cancel(Lookup * lookup, unsigned int id)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	if(id == 0)
+		return;
+	if(lookup->current != NULL
+			&& _lookup_entry_cancel(lookup->current, id) == 0)
+		return;
+	g_hash_table_iter_init(&iter, lookup->entries);
+	while(g_hash_table_iter_next(&iter, NULL, &value) == TRUE)
+		if(_lookup_entry_cancel(value, id) == 0)
+			return;
+}
+
+
+/* private */
+/* functions */
+/* lookup_entry_new */
+static LookupEntry * _lookup_entry_new(Lookup * lookup, char const * key)
+{
+	LookupEntry * entry;
+
+	if((entry = object_new(sizeof(*entry))) == NULL)
+		return NULL;
+	entry->lookup = lookup;
+	entry->key = string_new(key);
+	entry->ai = NULL;
+	entry->expires = 0;
+	entry->job = NULL;
+	entry->waiters = NULL;
+	entry->source = 0;
+	if(entry->key == NULL)
+	{
+		_lookup_entry_delete(entry);
+		return NULL;
+	}
+	g_hash_table_insert(lookup->entries, entry->key, entry);
+	return entry;
+}
+
+
+/* lookup_entry_delete */
+static void _lookup_entry_delete(LookupEntry * entry)
+{
+	/* the resolution itself cannot be interrupted */
+	if(entry->job != NULL)
+		entry->job->lookup = NULL;
+	if(entry->source != 0)
+		g_source_remove(entry->source);
+	g_slist_free_full(entry->waiters, free);
+	if(entry->ai != NULL)
+		freeaddrinfo(entry->ai);
+	string_delete(entry->key);
+	object_delete(entry);
+}
+
+
+/* lookup_entry_cancel */
+static int _lookup_entry_cancel(LookupEntry * entry, unsigned int id)
+{
+	GSList * l;
+	LookupWaiter * waiter;
+
+	for(l = entry->waiters; l != NULL; l = l->next)
+	{
+		waiter = l->data;
+		if(waiter->id != id)
+			continue;
+		entry->waiters = g_slist_delete_link(entry->waiters, l);
+		free(waiter);
+		return 0;
+	}
+	return -1;
+}
+
+
+/* lookup_entry_deliver */
+static void _lookup_entry_deliver(LookupEntry * entry, char const * error)
+{
+	Lookup * lookup = entry->lookup;
+	LookupWaiter * waiter;
+
+	/* the callbacks may cancel or request lookups */
+	lookup->current = entry;
+	while(entry->waiters != NULL)
+	{
+		waiter = entry->waiters->data;
+		entry->waiters = g_slist_delete_link(entry->waiters,
+				entry->waiters);
+		waiter->callback((error == NULL) ? entry->ai : NULL, error,
+				waiter->data);
+		free(waiter);
+	}
+	lookup->current = NULL;
+}
+
+
+/* lookup_entry_start */
+static int _lookup_entry_start(LookupEntry * entry, char const * hostname,
+		uint16_t port)
+{
+	LookupJob * job;
+	GThread * thread;
+	GError * error = NULL;
+
+	if((job = object_new(sizeof(*job))) == NULL)
+		return -1;
+	job->lookup = entry->lookup;
+	job->entry = entry;
+	job->hostname = string_new(hostname);
+	job->port = port;
+	job->ai = NULL;
+	job->error = NULL;
+	if(job->hostname == NULL)
+	{
+		object_delete(job);
+		return -1;
+	}
+	if((thread = g_thread_try_new("lookup", _lookup_on_thread, job,
+					&error)) == NULL)
+	{
+		error_set_code(1, "%s", error->message);
+		g_error_free(error);
+		string_delete(job->hostname);
+		object_delete(job);
+		return -1;
+	}
+	g_thread_unref(thread);
+	entry->job = job;
+	return 0;
+}
+
+
+/* callbacks */
+/* lookup_on_idle */
+static gboolean _lookup_on_idle(gpointer data)
+{
+	LookupEntry * entry = data;
+
+	entry->source = 0;
+	_lookup_entry_deliver(entry, NULL);
+	return FALSE;
+}
+
+
+/* lookup_on_resolved */
+static gboolean _lookup_on_resolved(gpointer data)
+{
+	LookupJob * job = data;
+	Lookup * lookup = job->lookup;
+	LookupEntry * entry = job->entry;
+
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s(\"%s\", %hu) %s\n", __func__,
+			job->hostname, job->port, (job->error != NULL)
+			? job->error : "OK");
+#endif
+	if(lookup == NULL)
+	{
+		/* abandoned */
+		if(job->ai != NULL)
+			freeaddrinfo(job->ai);
+	}
+	else if(job->ai != NULL)
+	{
+		entry->job = NULL;
+		if(entry->ai != NULL)
+			freeaddrinfo(entry->ai);
+		entry->ai = job->ai;
+		entry->expires = g_get_monotonic_time()
+			+ (gint64)lookup->ttl * G_USEC_PER_SEC;
+		_lookup_entry_deliver(entry, NULL);
+	}
+	else
+	{
+		/* failures are not cached */
+		entry->job = NULL;
+		g_hash_table_steal(lookup->entries, entry->key);
+		_lookup_entry_deliver(entry, (job->error != NULL)
+				? job->error : "Unknown error");
+		_lookup_entry_delete(entry);
+	}
+	string_delete(job->error);
+	string_delete(job->hostname);
+	object_delete(job);
+	return FALSE;
+}
+
+
+/* lookup_on_thread */
+static gpointer _lookup_on_thread(gpointer data)
+{
+	LookupJob * job = data;
+	struct addrinfo hints;
+	int res;
+	char buf[6];
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	hints.ai_flags = AI_NUMERICSERV;
+	snprintf(buf, sizeof(buf), "%hu", job->port);
+	if((res = getaddrinfo(job->hostname, buf, &hints, &job->ai)) != 0)
+	{
+		job->ai = NULL;
+		job->error = string_new(gai_strerror(res));
+	}
+	/* report back from the main loop */
+	g_idle_add(_lookup_on_resolved, job);
+	return NULL;
+}
@@ -28,6 +28,9 @@
 
 
 
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <dirent.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -113,8 +116,12 @@ struct _Mailer
 	/* configuration */
 	Config * config;
 
+	/* name resolution */
+	Lookup * lookup;
+
 	/* SSL */
 	SSL_CTX * ssl_ctx;
+	GHashTable * ssl_sessions;
 
 	/* widgets */
 	/* folders */
@@ -240,6 +247,11 @@ static const DesktopMenu _menu_message[] =
 	{ N_("_Delete"), G_CALLBACK(on_message_delete), GTK_STOCK_DELETE, 0,
 		GDK_KEY_Delete },
 	{ "", NULL, NULL, 0, 0 },
+	{ N_("Mark as _read"), G_CALLBACK(on_message_mark_read), "mail-read",
+		0, 0 },
+	{ N_("Mark as _unread"), G_CALLBACK(on_message_mark_unread),
+		"mail-unread", 0, 0 },
+	{ "", NULL, NULL, 0, 0 },
 	{ N_("_View source"), G_CALLBACK(on_message_view_source), NULL,
 		GDK_CONTROL_MASK, GDK_KEY_U },
 	{ NULL, NULL, NULL, 0, 0 }
@@ -349,6 +361,7 @@ static void _mailer_update_view(Mailer * mailer);
 /* callbacks */
 static void _mailer_on_online_toggled(gpointer data);
 static void _mailer_on_plugin_combo_changed(gpointer data);
+static int _mailer_on_ssl_session(SSL * ssl, SSL_SESSION * session);
 
 
 /* public */
@@ -399,6 +412,10 @@ Mailer * mailer_new(void)
 	/* plug-ins */
 	mailer->pl_helper.mailer = mailer;
 	mailer->pl_helper.error = mailer_error;
+	mailer->pl_helper.search = mailer_search;
+	/* name resolution */
+	if((mailer->lookup = lookup_new(LOOKUP_TTL)) == NULL)
+		mailer_error(NULL, error_get(NULL), 1);
 	/* ssl */
 	SSL_load_error_strings();
 	SSL_library_init();
@@ -418,6 +435,18 @@ Mailer * mailer_new(void)
 		SSL_CTX_set_verify(mailer->ssl_ctx, SSL_VERIFY_PEER, NULL);
 #endif
 	SSL_CTX_set_options(mailer->ssl_ctx, SSL_OP_NO_SSLv2);
+	/* remember the last session with every host to resume it later */
+	mailer->ssl_sessions = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, (GDestroyNotify)SSL_SESSION_free);
+	if(mailer->ssl_ctx != NULL)
+	{
+		SSL_CTX_set_app_data(mailer->ssl_ctx, mailer);
+		SSL_CTX_set_session_cache_mode(mailer->ssl_ctx,
+				SSL_SESS_CACHE_CLIENT
+				| SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(mailer->ssl_ctx,
+				_mailer_on_ssl_session);
+	}
 	/* widgets */
 	group = gtk_accel_group_new();
 	mailer->fo_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
@@ -822,7 +851,11 @@ static void _on_headers_changed(GtkTreeSelection * selection, gpointer data)
 	gtk_tree_model_get(model, &iter, MHC_DATE_DISPLAY, &p, -1);
 	gtk_label_set_text(GTK_LABEL(mailer->hdr_date), p);
 	g_free(p);
-	message_set_read(message, TRUE);
+	if(mailer->account_cur != NULL && mailer->folder_cur != NULL)
+		account_set_read(mailer->account_cur, mailer->folder_cur,
+				message, TRUE);
+	else
+		message_set_read(message, TRUE);
 	gtk_widget_show(mailer->hdr_vbox);
 	_mailer_update_view(mailer);
 	g_list_foreach(sel, (GFunc)gtk_tree_path_free, NULL);
@@ -854,10 +887,10 @@ static GtkTreeViewColumn * _headers_view_column_text(GtkTreeView * view,
 
 	renderer = gtk_cell_renderer_text_new();
 	g_object_set(G_OBJECT(renderer), "ellipsize", PANGO_ELLIPSIZE_END,
-			NULL);
+			"cell-background", MAILER_SEARCH_COLOR, NULL);
 	column = gtk_tree_view_column_new_with_attributes(title, renderer,
-			"text", id, (weightid >= 0) ? "weight" : NULL, weightid,
-			NULL);
+			"text", id, "cell-background-set", MHC_MATCH,
+			(weightid >= 0) ? "weight" : NULL, weightid, NULL);
 #if GTK_CHECK_VERSION(2, 4, 0)
 	gtk_tree_view_column_set_expand(column, TRUE);
 #endif
@@ -945,6 +978,7 @@ static void _idle_config_load(Mailer * mailer)
 	PangoFontDescription * font;
 	char * p;
 	char * q;
+	unsigned long size;
 
 	mailer->source = 0;
 	if((mailer->config = config_new()) == NULL)
@@ -964,6 +998,11 @@ static void _idle_config_load(Mailer * mailer)
 		mailer_set_online(mailer, TRUE);
 	else
 		mailer_set_online(mailer, FALSE);
+	/* limit the memory used by the bodies of messages (in kilobytes) */
+	if((p = config_get(mailer->config, NULL, "messages_cache_size"))
+			!= NULL && (size = strtoul(p, &q, 10)) > 0
+			&& *q == '\0')
+		message_cache_set_size(size * 1024);
 	/* load accounts */
 	if((value = config_get(mailer->config, NULL, "accounts")) == NULL
 			|| value[0] == '\0')
@@ -1022,6 +1061,7 @@ void mailer_delete(Mailer * mailer)
 	unsigned int i;
 
 	_delete_plugins(mailer);
+	g_hash_table_destroy(mailer->ssl_sessions);
 	if(mailer->ssl_ctx != NULL)
 		SSL_CTX_free(mailer->ssl_ctx);
 	if(mailer->source != 0)
@@ -1032,7 +1072,10 @@ void mailer_delete(Mailer * mailer)
 	for(i = 0; i < mailer->account_cnt; i++)
 		account_delete(mailer->account[i]);
 	free(mailer->account);
+	if(mailer->lookup != NULL)
+		lookup_delete(mailer->lookup);
 	g_object_unref(mailer->pl_store);
+	message_cleanup();
 	object_delete(mailer);
 }
 
@@ -1066,6 +1109,13 @@ char const * mailer_get_config(Mailer * mailer, char const * variable)
 }
 
 
+/* mailer_get_lookup */
+Lookup * mailer_get_lookup(Mailer * mailer)
+{
+	return mailer->lookup;
+}
+
+
 /* mailer_get_ssl_context */
 SSL_CTX * mailer_get_ssl_context(Mailer * mailer)
 {
@@ -1073,6 +1123,15 @@ SSL_CTX * mailer_get_ssl_context(Mailer * mailer)
 }
 
 
+/* mailer_get_ssl_session */
+SSL_SESSION * mailer_get_ssl_session(Mailer * mailer, char const * key)
+{
+	if(key == NULL)
+		return NULL;
+	return g_hash_table_lookup(mailer->ssl_sessions, key);
+}
+
+
 /* mailer_is_online */
 gboolean mailer_is_online(Mailer * mailer)
 {
@@ -1164,6 +1223,15 @@ void mailer_refresh_all(Mailer * mailer)
 }
 
 
+/* mailer_search */
+int mailer_search(Mailer * mailer, char const * text)
+{
+	if(mailer->account_cur == NULL || mailer->folder_cur == NULL)
+		return -mailer_error(mailer, _("No folder selected"), 1);
+	return account_search(mailer->account_cur, mailer->folder_cur, text);
+}
+
+
 /* mailer_account_add */
 int mailer_account_add(Mailer * mailer, Account * account)
 {
@@ -1416,6 +1484,43 @@ int mailer_load(Mailer * mailer, char const * plugin)
 }
 
 
+/* mailer_mark_selected_read */
+void mailer_mark_selected_read(Mailer * mailer, gboolean read)
+{
+	GtkTreeModel * model;
+	GList * selected;
+	GList * s;
+	GtkTreePath * path;
+	GtkTreeIter iter;
+	Message * message;
+
+	if(mailer->account_cur == NULL || mailer->folder_cur == NULL)
+		return;
+	if((model = gtk_tree_view_get_model(GTK_TREE_VIEW(mailer->he_view)))
+			== NULL)
+		return;
+	if((selected = _mailer_get_selected_headers(mailer)) == NULL)
+		return;
+	/* obtain every message first as the rows may be sorted again */
+	for(s = g_list_first(selected); s != NULL; s = g_list_next(s))
+	{
+		if((path = s->data) == NULL)
+			continue;
+		message = NULL;
+		if(gtk_tree_model_get_iter(model, &iter, path) == TRUE)
+			gtk_tree_model_get(model, &iter, MHC_MESSAGE, &message,
+					-1);
+		gtk_tree_path_free(path);
+		s->data = message;
+	}
+	for(s = g_list_first(selected); s != NULL; s = g_list_next(s))
+		if((message = s->data) != NULL)
+			account_set_read(mailer->account_cur,
+					mailer->folder_cur, message, read);
+	g_list_free(selected);
+}
+
+
 /* mailer_open_selected_source */
 static void _open_selected_source(Mailer * mailer, GtkTreeModel * model,
 		GtkTreeIter * iter);
@@ -3480,3 +3585,46 @@ static void _mailer_on_plugin_combo_changed(gpointer data)
 	gtk_widget_show(widget);
 	_mailer_refresh_plugin(mailer);
 }
+
+
+/* mailer_on_ssl_session */
+static int _mailer_on_ssl_session(SSL * ssl, SSL_SESSION * session)
+{
+	Mailer * mailer;
+	char const * hostname;
+	struct sockaddr_storage ss;
+	socklen_t sslen = sizeof(ss);
+	struct sockaddr_in * sin = (struct sockaddr_in *)&ss;
+	struct sockaddr_in6 * sin6 = (struct sockaddr_in6 *)&ss;
+	char buf[INET6_ADDRSTRLEN];
+	char * key;
+
+	if((mailer = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl))) == NULL
+			|| SSL_SESSION_is_resumable(session) != 1
+			|| getpeername(SSL_get_fd(ssl), (struct sockaddr *)&ss,
+				&sslen) != 0)
+		return 0;
+	/* same key as in _common_ssl_setup(): the host name from SNI if
+	 * set, the IP address otherwise, and the port */
+	hostname = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+	if(ss.ss_family == AF_INET)
+		key = g_strdup_printf("%s:%hu", (hostname != NULL) ? hostname
+				: inet_ntop(AF_INET, &sin->sin_addr, buf,
+					sizeof(buf)), ntohs(sin->sin_port));
+	else if(ss.ss_family == AF_INET6)
+		key = (hostname != NULL)
+			? g_strdup_printf("%s:%hu", hostname,
+					ntohs(sin6->sin6_port))
+			: g_strdup_printf("[%s]:%hu", inet_ntop(AF_INET6,
+						&sin6->sin6_addr, buf,
+						sizeof(buf)),
+					ntohs(sin6->sin6_port));
+	else
+		return 0;
+#ifdef DEBUG
+	fprintf(stderr, "DEBUG: %s(\"%s\")\n", __func__, key);
+#endif
+	/* keep the reference to the session */
+	g_hash_table_replace(mailer->ssl_sessions, key, session);
+	return 1;
+}
@@ -35,6 +35,7 @@
 # include <gtk/gtk.h>
 # include "../include/Mailer.h"
 # include "account.h"
+# include "lookup.h"
 
 
 /* Mailer */
@@ -43,6 +44,8 @@
 
 # define MAILER_MESSAGES_FONT	"Monospace 9"
 
+# define MAILER_SEARCH_COLOR	"#fce94f"
+
 
 /* functions */
 Mailer * mailer_new(void);
@@ -50,7 +53,9 @@ void mailer_delete(Mailer * mailer);
 
 /* accessors */
 char const * mailer_get_config(Mailer * mailer, char const * variable);
+Lookup * mailer_get_lookup(Mailer * mailer);
 SSL_CTX * mailer_get_ssl_context(Mailer * mailer);
+SSL_SESSION * mailer_get_ssl_session(Mailer * mailer, char const * key);
 
 gboolean mailer_is_online(Mailer * mailer);
 
@@ -62,6 +67,8 @@ int mailer_error(Mailer * mailer, char const * message, int ret);
 
 void mailer_refresh_all(Mailer * mailer);
 
+int mailer_search(Mailer * mailer, char const * text);
+
 /* accounts */
 int mailer_account_add(Mailer * mailer, Account * account);
 #if 0 /* FIXME deprecate? */
@@ -80,6 +87,8 @@ void mailer_compose(Mailer * mailer);
 /* selection */
 void mailer_delete_selected(Mailer * mailer);
 
+void mailer_mark_selected_read(Mailer * mailer, gboolean read);
+
 void mailer_open_selected_source(Mailer * mailer);
 
 void mailer_reply_selected(Mailer * mailer);
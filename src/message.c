@@ -33,21 +33,108 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
+#include <libintl.h>
 #include <System.h>
 #include "mailer.h"
+#include "body.h"
+#include "codec.h"
+#include "folder.h"
 #include "message.h"
+#include "threads.h"
+#define _(string) gettext(string)
 
 
 /* Message */
 /* private */
 /* types */
+/* interned header names, shared by every message */
+typedef unsigned int MessageAtom;
+
+typedef enum _MessageAtomKnown
+{
+	MA_DATE = 0,
+	MA_FROM,
+	MA_IN_REPLY_TO,
+	MA_MESSAGE_ID,
+	MA_REFERENCES,
+	MA_STATUS,
+	MA_SUBJECT,
+	MA_TO
+} MessageAtomKnown;
+#define MA_LAST MA_TO
+#define MA_COUNT (MA_LAST + 1)
+
 typedef struct _MessageHeader
 {
-	char * header;
-	char * value;
+	MessageAtom atom;
+	size_t value;			/* offset in the arena */
 } MessageHeader;
 
+typedef enum _MessageEncoding
+{
+	ME_IDENTITY = 0,
+	ME_BASE64,
+	ME_QUOTED_PRINTABLE
+} MessageEncoding;
+
+typedef struct _MessagePart
+{
+	size_t parent;			/* position of the parent, plus one */
+	char * type;
+	char * charset;
+	char * boundary;		/* multipart only */
+	char * filename;
+	MessageEncoding encoding;
+	gboolean attachment;
+	/* offsets of the contents in the body */
+	size_t start;
+	size_t end;
+} MessagePart;
+
+/* the decoding state of a text part */
+typedef struct _MessageDecoder
+{
+	CodecState codec;
+	/* the beginning of a character split across lines, at most four bytes
+	 * in UTF-8 and the usual multi-byte charsets */
+	char partial[4];
+	size_t partial_cnt;
+} MessageDecoder;
+
+typedef enum _MessageMimeState
+{
+	MMS_HEADERS = 0,
+	MMS_CONTENTS
+} MessageMimeState;
+
+/* the parts of a message, parsed as the body is received */
+typedef struct _MessageMime
+{
+	MessagePart * parts;
+	size_t parts_cnt;
+	size_t * attachments;
+	size_t attachments_cnt;
+
+	/* parser */
+	MessageMimeState state;
+	size_t current;
+	size_t offset;			/* of the current line */
+	size_t eol;			/* length of the previous end of line */
+	char * line;
+	size_t line_cnt;		/* stored */
+	size_t line_len;		/* received */
+	size_t line_size;
+	size_t line_shown;
+	gboolean line_cr;
+	char * headers;
+	size_t headers_cnt;
+
+	/* decoding of the current part */
+	MessageDecoder decoder;
+} MessageMime;
+
 struct _MailerMessage
 {
 	GtkTreeStore * store;
@@ -57,47 +144,172 @@ struct _MailerMessage
 
 	MessageHeader * headers;
 	size_t headers_cnt;
-
-	char * body;
-	size_t body_cnt;
-
+	/* position of the well-known headers, plus one */
+	size_t headers_known[MA_COUNT];
+
+	/* values of the headers */
+	char * arena;
+	size_t arena_cnt;
+	size_t arena_size;
+	size_t arena_unused;
+
+	Body * body;
+	MessageMime * mime;
+
+	/* position in the cache of bodies */
+	Message * body_prev;
+	Message * body_next;
+	size_t body_size;
+	/* still being received from the account */
+	gboolean body_incomplete;
+
+	/* kept until listed */
+	gboolean match;
+
+	/* parsed once from the header, or MESSAGE_DATE_NONE */
+	time_t date;
+
+	/* keys to sort the list of headers, interned in the folder */
+	char const * key_subject;
+	char const * key_from;
+	char const * key_to;
+	/* rank of the key sorted, as of this serial of the folder */
+	unsigned int sort_rank;
+	unsigned int sort_serial;
+
+	/* only while displayed */
 	GtkTextBuffer * text;
 
-	char ** attachments;
-	size_t attachments_cnt;
-
 	AccountMessage * data;
 };
 
 
+/* constants */
+#define MESSAGE_ADDRESS_MAX	256
+#define MESSAGE_ARENA_SIZE	1024
+#define MESSAGE_BODIES_SIZE	(32 * 1024 * 1024)
+#define MESSAGE_CHARSET_MAX	64
+#define MESSAGE_DATE_NONE	((time_t)-1)
+#define MESSAGE_LINE_MAX	128
+#define MESSAGE_PART_OPEN	((size_t)-1)
+#define MESSAGE_TEXT_MAX	16
+
+
+/* variables */
+/* header names, looked up by case-insensitive hash */
+static GHashTable * _message_atoms_table = NULL;
+static char ** _message_atoms = NULL;
+static size_t _message_atoms_cnt = 0;
+
+/* conversion descriptors to UTF-8, looked up by charset */
+static GHashTable * _message_charsets = NULL;
+
+/* messages with a body, the most recently used last */
+static Message * _message_bodies_first = NULL;
+static Message * _message_bodies_last = NULL;
+static size_t _message_bodies_size = 0;
+static size_t _message_bodies_size_max = MESSAGE_BODIES_SIZE;
+static size_t _message_bodies_hits = 0;
+static size_t _message_bodies_misses = 0;
+static size_t _message_bodies_evictions = 0;
+
+/* messages with a text buffer, the most recently used last */
+static Message * _message_texts[MESSAGE_TEXT_MAX];
+static size_t _message_texts_cnt = 0;
+
+
 /* prototypes */
 /* accessors */
+static Folder * _message_get_folder(Message * message);
+static Threads * _message_get_threads(Message * message);
+
 static gboolean _message_set(Message * message, ...);
+static int _message_set_address(Message * message, char const * value,
+		MailerHeaderColumn name, MailerHeaderColumn email,
+		gboolean list);
 static int _message_set_date(Message * message, char const * date);
+static void _message_set_date_display(Message * message);
 static int _message_set_from(Message * message, char const * from);
+static int _message_set_in_reply_to(Message * message,
+		char const * in_reply_to);
+static int _message_set_message_id(Message * message,
+		char const * message_id);
+static int _message_set_references(Message * message,
+		char const * references);
 static int _message_set_status(Message * message, char const * status);
+static int _message_set_subject(Message * message, char const * subject);
 static int _message_set_to(Message * message, char const * to);
 
 /* useful */
+/* message atoms */
+static int _message_atom_get(char const * header, gboolean create,
+		MessageAtom * atom);
+static gboolean _message_atom_equal(gconstpointer a, gconstpointer b);
+static guint _message_atom_hash(gconstpointer key);
+
+/* message bodies */
+static void _message_body_release(Message * message);
+static void _message_body_unlink(Message * message);
+static void _message_body_use(Message * message);
+static void _message_bodies_evict(Message * keep);
+
+/* message charsets */
+static void _message_charset_close(gpointer data);
+static gchar * _message_charset_convert(char const * charset,
+		char const * buf, size_t cnt, gsize * len);
+static GIConv _message_charset_open(char const * charset);
+static size_t _message_charset_text(char const * charset, char const * buf,
+		size_t cnt, size_t keep, GString * text);
+
 /* message headers */
-static int _message_header_set(MessageHeader * mh, char const * header,
+static int _message_arena_append(Message * message, char const * value,
+		size_t * offset);
+static int _message_header_apply(Message * message, MessageAtom atom,
 		char const * value);
+static gchar * _message_header_decode(char const * value);
+static MessageHeader * _message_header_get(Message * message,
+		MessageAtom atom);
+
+/* message sort keys */
+static char const * _message_sort_key(Folder * folder, char const * string,
+		gboolean subject);
+
+/* message parts */
+static size_t _message_decode(MessageEncoding encoding, CodecState * state,
+		char const * buf, size_t cnt, char * out);
+static MessageMime * _message_mime_new(Message * message);
+static void _message_mime_delete(MessageMime * mime);
+static int _message_mime_feed(Message * message, char const * buf,
+		size_t cnt);
+static void _message_mime_insert(Message * message, MessagePart * part,
+		char const * buf, size_t cnt, MessageDecoder * decoder,
+		gboolean last);
+static gboolean _message_mime_is_text(MessageMime * mime, size_t part,
+		gboolean any);
+static void _message_mime_render(Message * message);
+
+/* message texts */
+static void _message_text_release(Message * message);
+static void _message_text_use(Message * message);
 
 
 /* constants */
+/* indexed by MessageAtomKnown */
 static struct
 {
 	char const * header;
-	MailerHeaderColumn column;
 	int (*callback)(Message * message, char const * value);
 } _message_columns[] =
 {
-	{ "Date",	0,			_message_set_date	},
-	{ "From",	0,			_message_set_from	},
-	{ "Status",	0,			_message_set_status	},
-	{ "Subject",	MHC_SUBJECT,		NULL			},
-	{ "To",		0,			_message_set_to		},
-	{ NULL,		0,			NULL			}
+	{ "Date",		_message_set_date		},
+	{ "From",		_message_set_from		},
+	{ "In-Reply-To",	_message_set_in_reply_to	},
+	{ "Message-ID",		_message_set_message_id		},
+	{ "References",		_message_set_references		},
+	{ "Status",		_message_set_status		},
+	{ "Subject",		_message_set_subject		},
+	{ "To",			_message_set_to			},
+	{ NULL,			NULL				}
 };
 
 
@@ -108,7 +320,6 @@ Message * message_new(AccountMessage * message, GtkTreeStore * store,
 		GtkTreeIter * iter)
 {
 	Message * ret;
-	GtkTreePath * path;
 
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s(%p, %p, %p)\n", __func__, (void *)message,
@@ -116,27 +327,33 @@ Message * message_new(AccountMessage * message, GtkTreeStore * store,
 #endif
 	if((ret = object_new(sizeof(*ret))) == NULL)
 		return NULL;
-	if((ret->store = store) != NULL)
-	{
-		path = gtk_tree_model_get_path(GTK_TREE_MODEL(store), iter);
-		ret->row = gtk_tree_row_reference_new(GTK_TREE_MODEL(store),
-				path);
-		gtk_tree_path_free(path);
-		gtk_tree_store_set(store, iter, MHC_MESSAGE, ret, -1);
-	}
-	else
-		ret->row = NULL;
+	ret->store = NULL;
+	ret->row = NULL;
 	ret->flags = 0;
 	ret->headers = NULL;
 	ret->headers_cnt = 0;
+	memset(ret->headers_known, 0, sizeof(ret->headers_known));
+	ret->arena = NULL;
+	ret->arena_cnt = 0;
+	ret->arena_size = 0;
+	ret->arena_unused = 0;
 	ret->body = NULL;
-	ret->body_cnt = 0;
-	ret->text = gtk_text_buffer_new(NULL);
-	ret->attachments = NULL;
-	ret->attachments_cnt = 0;
+	ret->mime = NULL;
+	ret->body_prev = NULL;
+	ret->body_next = NULL;
+	ret->body_size = 0;
+	ret->body_incomplete = FALSE;
+	ret->match = FALSE;
+	ret->date = MESSAGE_DATE_NONE;
+	ret->key_subject = NULL;
+	ret->key_from = NULL;
+	ret->key_to = NULL;
+	ret->sort_rank = 0;
+	ret->sort_serial = 0;
+	ret->text = NULL;
 	ret->data = message;
-	_message_set_date(ret, NULL);
-	_message_set_status(ret, NULL);
+	if(store != NULL)
+		message_set_store(ret, store, iter);
 	return ret;
 }
 
@@ -184,9 +401,14 @@ void message_delete(Message * message)
 {
 	if(message->row != NULL)
 		gtk_tree_row_reference_free(message->row);
-	g_object_unref(message->text);
-	free(message->body);
+	_message_text_release(message);
+	if(message->mime != NULL)
+		_message_mime_delete(message->mime);
+	_message_body_unlink(message);
+	if(message->body != NULL)
+		body_delete(message->body);
 	free(message->headers);
+	free(message->arena);
 	object_delete(message);
 }
 
@@ -195,10 +417,36 @@ void message_delete(Message * message)
 /* message_get_body */
 GtkTextBuffer * message_get_body(Message * message)
 {
+	if(message->text == NULL)
+	{
+		/* the text buffer is only created once displayed */
+		message->text = gtk_text_buffer_new(NULL);
+		_message_mime_render(message);
+	}
+	_message_text_use(message);
 	return message->text;
 }
 
 
+/* message_get_attachment_name */
+char const * message_get_attachment_name(Message * message, size_t index)
+{
+	MessagePart * part;
+
+	if(message->mime == NULL || index >= message->mime->attachments_cnt)
+		return NULL;
+	part = &message->mime->parts[message->mime->attachments[index]];
+	return part->filename;
+}
+
+
+/* message_get_attachments_count */
+size_t message_get_attachments_count(Message * message)
+{
+	return (message->mime != NULL) ? message->mime->attachments_cnt : 0;
+}
+
+
 /* message_get_data */
 AccountMessage * message_get_data(Message * message)
 {
@@ -216,26 +464,59 @@ int message_get_flags(Message * message)
 /* message_get_header */
 char const * message_get_header(Message * message, char const * header)
 {
-	size_t i;
+	MessageAtom atom;
+	MessageHeader * mh;
 
-	for(i = 0; i < message->headers_cnt; i++)
-		if(strcmp(message->headers[i].header, header) == 0)
-			return message->headers[i].value;
-	return NULL;
+	/* headers never set for any message cannot be found */
+	if(_message_atom_get(header, FALSE, &atom) != 0
+			|| (mh = _message_header_get(message, atom)) == NULL)
+		return NULL;
+	return &message->arena[mh->value];
 }
 
 
 /* message_get_iter */
 gboolean message_get_iter(Message * message, GtkTreeIter * iter)
 {
+	gboolean ret;
 	GtkTreePath * path;
 
 	if(message->row == NULL)
 		return FALSE;
 	if((path = gtk_tree_row_reference_get_path(message->row)) == NULL)
 		return FALSE;
-	return gtk_tree_model_get_iter(GTK_TREE_MODEL(message->store), iter,
+	ret = gtk_tree_model_get_iter(GTK_TREE_MODEL(message->store), iter,
 			path);
+	gtk_tree_path_free(path);
+	return ret;
+}
+
+
+/* message_get_sort_key */
+char const * message_get_sort_key(Message * message,
+		MailerHeaderColumn column)
+{
+	switch(column)
+	{
+		case MHC_SUBJECT:
+			return message->key_subject;
+		case MHC_FROM:
+			return message->key_from;
+		case MHC_TO:
+			return message->key_to;
+		default:
+			return NULL;
+	}
+}
+
+
+/* message_get_sort_rank */
+unsigned int message_get_sort_rank(Message * message, unsigned int serial)
+{
+	/* not ranked since the keys last changed */
+	if(message->sort_serial != serial)
+		return 0;
+	return message->sort_rank;
 }
 
 
@@ -250,31 +531,43 @@ GtkTreeStore * message_get_store(Message * message)
 int message_set_body(Message * message, char const * buf, size_t cnt,
 		gboolean append)
 {
-	char * p;
-	GtkTextIter iter;
-
 	if(buf == NULL)
 		buf = "";
+	/* until told otherwise by the account */
+	message->body_incomplete = TRUE;
 	if(append != TRUE)
 	{
 		/* empty the message body */
-		free(message->body);
-		message->body = NULL;
-		message->body_cnt = 0;
-		gtk_text_buffer_set_text(message->text, "", 0);
+		if(message->mime != NULL)
+			_message_mime_delete(message->mime);
+		message->mime = NULL;
+		if(message->body != NULL)
+			body_reset(message->body);
+		_message_body_unlink(message);
+		if(message->text != NULL)
+			gtk_text_buffer_set_text(message->text, "", 0);
 	}
-	if((p = realloc(message->body, (message->body_cnt + cnt) * sizeof(*p)))
-			== NULL)
+	if(cnt == 0)
+		return 0;
+	if(message->body == NULL && (message->body = body_new()) == NULL)
 		return -1;
-	message->body = p;
-	memcpy(&message->body[message->body_cnt], buf, cnt);
-	message->body_cnt += cnt;
-	/* FIXME:
-	 * - check encoding
-	 * - parse MIME, etc... */
-	gtk_text_buffer_get_end_iter(message->text, &iter);
-	gtk_text_buffer_insert(message->text, &iter, buf, cnt);
-	return 0;
+	if(message->mime == NULL
+			&& (message->mime = _message_mime_new(message)) == NULL)
+		return -1;
+	if(body_append(message->body, buf, cnt) != 0)
+		return -1;
+	_message_body_use(message);
+	/* the parts are displayed as they are received */
+	return _message_mime_feed(message, buf, cnt);
+}
+
+
+/* message_set_body_complete */
+void message_set_body_complete(Message * message)
+{
+	message->body_incomplete = FALSE;
+	/* the body may now be released like the others */
+	_message_bodies_evict(message);
 }
 
 
@@ -297,7 +590,8 @@ int message_set_header(Message * message, char const * header)
 {
 	int ret;
 	size_t i;
-	char * p;
+	char buf[64];
+	char * p = buf;
 
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s(%p, \"%s\")\n", __func__, (void*)message,
@@ -310,11 +604,14 @@ int message_set_header(Message * message, char const * header)
 	if(header[i] == '\0' || header[i + 1] != ' ')
 		/* XXX unstructured headers are not supported */
 		return -1;
-	if((p = malloc(i + 1)) == NULL)
+	/* most header names fit on the stack */
+	if(i >= sizeof(buf) && (p = malloc(i + 1)) == NULL)
 		return -1;
-	snprintf(p, i + 1, "%s", header);
+	memcpy(p, header, i);
+	p[i] = '\0';
 	ret = message_set_header_value(message, p, &header[i + 2]);
-	free(p);
+	if(p != buf)
+		free(p);
 	return ret;
 }
 
@@ -323,49 +620,83 @@ int message_set_header(Message * message, char const * header)
 int message_set_header_value(Message * message, char const * header,
 		char const * value)
 {
-	size_t i;
+	MessageAtom atom;
+	MessageHeader * mh;
 	MessageHeader * p;
-	MailerHeaderColumn column;
+	size_t offset;
+	size_t len;
+	size_t size;
 
 #ifdef DEBUG
 	fprintf(stderr, "DEBUG: %s(%p, \"%s\", \"%s\")\n", __func__,
 			(void *)message, header, value);
 #endif
 	/* FIXME remove the header when value == NULL */
-	for(i = 0; i < message->headers_cnt; i++)
-		if(strcmp(message->headers[i].header, header) == 0)
-			break;
-	if(i == message->headers_cnt)
+	if(value == NULL)
 	{
-		/* the header was not found */
-		if(value == NULL)
+		if(_message_atom_get(header, FALSE, &atom) != 0
+				|| _message_header_get(message, atom) == NULL)
 			return 0;
+	}
+	else if(_message_atom_get(header, TRUE, &atom) != 0)
+		return -1;
+	if((mh = _message_header_get(message, atom)) == NULL)
+	{
 		/* append the header */
 		if((p = realloc(message->headers, sizeof(*p)
 						* (message->headers_cnt + 1)))
 				== NULL)
 			return -1;
 		message->headers = p;
-		p = &message->headers[message->headers_cnt];
-		memset(p, 0, sizeof(*p));
-		if(_message_header_set(p, header, value) != 0)
+		if(_message_arena_append(message, value, &offset) != 0)
 			return -1;
-		message->headers_cnt++;
+		p = &message->headers[message->headers_cnt++];
+		p->atom = atom;
+		p->value = offset;
+		if(atom < MA_COUNT)
+			message->headers_known[atom] = message->headers_cnt;
 	}
-	else if(_message_header_set(&message->headers[i], NULL, value) != 0)
-		return -1;
-	/* FIXME parse/convert input */
-	for(i = 0; _message_columns[i].header != NULL; i++)
+	else if(value != NULL)
 	{
-		if(strcmp(_message_columns[i].header, header) != 0)
-			continue;
-		if((column = _message_columns[i].column) != 0)
-			_message_set(message, column, value, -1);
-		if(_message_columns[i].callback == NULL)
-			return 0;
-		return _message_columns[i].callback(message, value);
+		len = strlen(&message->arena[mh->value]);
+		if((size = strlen(value)) <= len)
+		{
+			/* overwrite the current value */
+			message->arena_unused += len - size;
+			memmove(&message->arena[mh->value], value, size + 1);
+		}
+		else
+		{
+			if(_message_arena_append(message, value, &offset) != 0)
+				return -1;
+			message->arena_unused += len + 1;
+			mh->value = offset;
+		}
 	}
-	return 0;
+	/* FIXME parse/convert input */
+	return _message_header_apply(message, atom, value);
+}
+
+
+/* message_set_iter */
+void message_set_iter(Message * message, GtkTreeIter * iter)
+{
+	GtkTreePath * path;
+
+	if(message->row != NULL)
+		gtk_tree_row_reference_free(message->row);
+	path = gtk_tree_model_get_path(GTK_TREE_MODEL(message->store), iter);
+	message->row = gtk_tree_row_reference_new(GTK_TREE_MODEL(
+				message->store), path);
+	gtk_tree_path_free(path);
+}
+
+
+/* message_set_match */
+void message_set_match(Message * message, gboolean match)
+{
+	message->match = match;
+	_message_set(message, MHC_MATCH, match, -1);
 }
 
 
@@ -404,7 +735,95 @@ void message_set_read(Message * message, gboolean read)
 }
 
 
+/* message_set_sort_rank */
+void message_set_sort_rank(Message * message, unsigned int serial,
+		unsigned int rank)
+{
+	message->sort_rank = rank;
+	message->sort_serial = serial;
+}
+
+
+/* message_set_store */
+void message_set_store(Message * message, GtkTreeStore * store,
+		GtkTreeIter * iter)
+{
+	size_t i;
+	MessageHeader * mh;
+
+	message->store = store;
+	message_set_iter(message, iter);
+	gtk_tree_store_set(store, iter, MHC_MESSAGE, message, MHC_MATCH,
+			message->match, -1);
+	/* the date was parsed already, if any */
+	_message_set_date_display(message);
+	_message_set_status(message, NULL);
+	/* list the headers obtained so far */
+	for(i = 0; i < message->headers_cnt; i++)
+	{
+		mh = &message->headers[i];
+		if(mh->atom != MA_DATE)
+			_message_header_apply(message, mh->atom,
+					&message->arena[mh->value]);
+	}
+}
+
+
 /* useful */
+/* message_cache_get_stats */
+void message_cache_get_stats(size_t * hits, size_t * misses,
+		size_t * evictions)
+{
+	*hits = _message_bodies_hits;
+	*misses = _message_bodies_misses;
+	*evictions = _message_bodies_evictions;
+}
+
+
+/* message_cache_lookup */
+gboolean message_cache_lookup(Message * message)
+{
+	/* the account is asked again for bodies not received entirely */
+	if(message->body == NULL || body_get_size(message->body) == 0
+			|| message->body_incomplete)
+	{
+		_message_bodies_misses++;
+		return FALSE;
+	}
+	_message_bodies_hits++;
+	_message_body_use(message);
+	return TRUE;
+}
+
+
+/* message_cache_set_size */
+void message_cache_set_size(size_t size)
+{
+	_message_bodies_size_max = size;
+	_message_bodies_evict(NULL);
+}
+
+
+/* message_cleanup */
+void message_cleanup(void)
+{
+	/* closes the conversion descriptors */
+	if(_message_charsets != NULL)
+		g_hash_table_destroy(_message_charsets);
+	_message_charsets = NULL;
+}
+
+
+/* message_intern */
+void message_intern(Message * message, Folder * folder)
+{
+	/* the sort keys are stored in the folder again */
+	message->key_subject = folder_intern(folder, message->key_subject);
+	message->key_from = folder_intern(folder, message->key_from);
+	message->key_to = folder_intern(folder, message->key_to);
+}
+
+
 /* message_save
  * XXX may not save the message exactly like the original */
 static int _save_from(MailerMessage * message, FILE * fp);
@@ -447,14 +866,18 @@ static int _save_from(MailerMessage * message, FILE * fp)
 static int _save_headers(MailerMessage * message, FILE * fp)
 {
 	size_t i;
+	MessageHeader * mh;
 
 	/* output the headers */
 	for(i = 0; i < message->headers_cnt; i++)
-		if(fputs(message->headers[i].header, fp) != 0
+	{
+		mh = &message->headers[i];
+		if(fputs(_message_atoms[mh->atom], fp) != 0
 				|| fputs(": ", fp) != 0
-				|| fputs(message->headers[i].value, fp) != 0
+				|| fputs(&message->arena[mh->value], fp) != 0
 				|| fputs("\n", fp) != 0)
 			return -1;
+	}
 	if(fputs("\n", fp) != 0)
 		return -1;
 	return 0;
@@ -462,25 +885,93 @@ static int _save_headers(MailerMessage * message, FILE * fp)
 
 static int _save_body(MailerMessage * message, FILE * fp)
 {
-	GtkTextIter start;
-	GtkTextIter end;
-	gchar * text;
-	int res;
-
 	/* output the body */
 	/* FIXME implement properly */
-	gtk_text_buffer_get_start_iter(message->text, &start);
-	gtk_text_buffer_get_end_iter(message->text, &end);
-	text = gtk_text_buffer_get_text(message->text, &start, &end, TRUE);
-	res = fputs(text, fp);
-	g_free(text);
-	return (res == 0) ? 0 : -1;
+	if(message->body == NULL)
+		return 0;
+	return body_write(message->body, fp);
+}
+
+
+/* message_save_attachment */
+int message_save_attachment(MailerMessage * message, size_t index,
+		char const * filename)
+{
+	int ret = 0;
+	MessagePart * part;
+	char const * p;
+	size_t end;
+	size_t i;
+	size_t cnt;
+	size_t len;
+	CodecState state;
+	char * buf;
+	FILE * fp;
+
+	if(message->mime == NULL || index >= message->mime->attachments_cnt)
+		return -1;
+	part = &message->mime->parts[message->mime->attachments[index]];
+	if(part->start == MESSAGE_PART_OPEN
+			|| (p = body_get_data(message->body)) == NULL)
+		return -1;
+	end = (part->end != MESSAGE_PART_OPEN) ? part->end
+		: message->mime->offset;
+	if((buf = malloc(BUFSIZ)) == NULL)
+		return -1;
+	memset(&state, 0, sizeof(state));
+	if((fp = fopen(filename, "w")) == NULL)
+	{
+		free(buf);
+		return -1;
+	}
+	/* the attachment is only decoded now, by lines */
+	for(i = part->start; ret == 0 && i < end; i += cnt)
+	{
+		if((cnt = end - i) > BUFSIZ)
+		{
+			for(cnt = BUFSIZ; cnt > 0 && p[i + cnt - 1] != '\n';
+					cnt--);
+			if(cnt == 0)
+				cnt = BUFSIZ;
+		}
+		len = _message_decode(part->encoding, &state, &p[i], cnt, buf);
+		if(fwrite(buf, sizeof(*buf), len, fp) != len)
+			ret = -1;
+	}
+	free(buf);
+	if(fclose(fp) != 0)
+		ret = -1;
+	return ret;
 }
 
 
 /* private */
 /* functions */
 /* accessors */
+/* message_get_folder */
+static Folder * _message_get_folder(Message * message)
+{
+	GtkTreeIter iter;
+	Folder * folder = NULL;
+
+	if(message_get_iter(message, &iter) != TRUE)
+		return NULL;
+	gtk_tree_model_get(GTK_TREE_MODEL(message->store), &iter, MHC_FOLDER,
+			&folder, -1);
+	return folder;
+}
+
+
+/* message_get_threads */
+static Threads * _message_get_threads(Message * message)
+{
+	Folder * folder;
+
+	return ((folder = _message_get_folder(message)) != NULL)
+		? folder_get_threads(folder) : NULL;
+}
+
+
 /* message_set */
 static gboolean _message_set(Message * message, ...)
 {
@@ -496,34 +987,162 @@ static gboolean _message_set(Message * message, ...)
 }
 
 
+/* message_set_address */
+static int _message_set_address(Message * message, char const * value,
+		MailerHeaderColumn name, MailerHeaderColumn email,
+		gboolean list)
+{
+	MailerHelperAddress address;
+	char const * p;
+	char names[MESSAGE_ADDRESS_MAX];
+	char buf[MESSAGE_ADDRESS_MAX];
+	size_t len = 0;
+	Folder * folder;
+	gchar * decoded;
+
+	/* keep the first e-mail and the names of the whole list, if asked */
+	buf[0] = '\0';
+	for(p = value; p != NULL
+			&& (p = mailer_helper_get_address(p, &address)) != NULL
+			&& len + 2 < sizeof(names);)
+	{
+		if(address.email_len == 0)
+			continue;
+		if(buf[0] == '\0')
+			snprintf(buf, sizeof(buf), "%.*s",
+					(int)address.email_len, address.email);
+		else if(list)
+		{
+			names[len++] = ',';
+			names[len++] = ' ';
+		}
+		else
+			break;
+		len += mailer_helper_get_address_name(&address, &names[len],
+				sizeof(names) - len);
+	}
+	if(buf[0] == '\0')
+		return -1;
+	names[(len < sizeof(names)) ? len : sizeof(names) - 1] = '\0';
+	if((folder = _message_get_folder(message)) == NULL)
+		/* not listed */
+		return 0;
+	decoded = _message_header_decode(names);
+	p = (decoded != NULL) ? decoded : names;
+	if(name == MHC_FROM)
+		message->key_from = _message_sort_key(folder, p, FALSE);
+	else if(name == MHC_TO)
+		message->key_to = _message_sort_key(folder, p, FALSE);
+	message->sort_serial = 0;
+	_message_set(message, name, p, email, buf, -1);
+	g_free(decoded);
+	return 0;
+}
+
+
 /* message_set_date */
 static int _message_set_date(Message * message, char const * date)
 {
 	struct tm tm;
-	time_t t;
-	char buf[32];
 
-	t = mailer_helper_get_date(date, &tm);
-	strftime(buf, sizeof(buf), "%d/%m/%Y %H:%M:%S", &tm);
-	_message_set(message, MHC_DATE, t, MHC_DATE_DISPLAY, buf, -1);
+	if(mailer_helper_parse_date(date, &tm, &message->date) != 0)
+		message->date = MESSAGE_DATE_NONE;
+	_message_set_date_display(message);
 	return 0;
 }
 
 
+/* message_set_date_display */
+static void _message_set_date_display(Message * message)
+{
+	struct tm tm;
+	char buf[20];
+
+	if(message->store == NULL)
+		/* not listed */
+		return;
+	if(message->date == MESSAGE_DATE_NONE
+			|| localtime_r(&message->date, &tm) == NULL
+			|| tm.tm_year < -1900 || tm.tm_year > 9999 - 1900)
+	{
+		/* sorted as the oldest */
+		_message_set(message, MHC_DATE, 0, MHC_DATE_DISPLAY,
+				_("Unknown"), -1);
+		return;
+	}
+	/* "dd/mm/yyyy hh:mm:ss" */
+	tm.tm_year += 1900;
+	tm.tm_mon++;
+	buf[0] = '0' + tm.tm_mday / 10;
+	buf[1] = '0' + tm.tm_mday % 10;
+	buf[2] = '/';
+	buf[3] = '0' + tm.tm_mon / 10;
+	buf[4] = '0' + tm.tm_mon % 10;
+	buf[5] = '/';
+	buf[6] = '0' + tm.tm_year / 1000;
+	buf[7] = '0' + tm.tm_year / 100 % 10;
+	buf[8] = '0' + tm.tm_year / 10 % 10;
+	buf[9] = '0' + tm.tm_year % 10;
+	buf[10] = ' ';
+	buf[11] = '0' + tm.tm_hour / 10;
+	buf[12] = '0' + tm.tm_hour % 10;
+	buf[13] = ':';
+	buf[14] = '0' + tm.tm_min / 10;
+	buf[15] = '0' + tm.tm_min % 10;
+	buf[16] = ':';
+	buf[17] = '0' + tm.tm_sec / 10;
+	buf[18] = '0' + tm.tm_sec % 10;
+	buf[19] = '\0';
+	_message_set(message, MHC_DATE, message->date, MHC_DATE_DISPLAY, buf,
+			-1);
+}
+
+
 /* message_set_from */
 static int _message_set_from(Message * message, char const * from)
 {
-	char * name;
-	char * email;
+	return _message_set_address(message, from, MHC_FROM, MHC_FROM_EMAIL,
+			FALSE);
+}
 
-	if((email = mailer_helper_get_email(from)) == NULL)
-		return -1;
-	name = mailer_helper_get_name(from);
-	_message_set(message, MHC_FROM, (name != NULL) ? name : email,
-			MHC_FROM_EMAIL, email, -1);
-	free(email);
-	free(name);
-	return 0;
+
+/* message_set_in_reply_to */
+static int _message_set_in_reply_to(Message * message,
+		char const * in_reply_to)
+{
+	Threads * threads;
+
+	if(in_reply_to == NULL || (threads = _message_get_threads(message))
+			== NULL)
+		return 0;
+	return threads_link(threads, message, in_reply_to, FALSE);
+}
+
+
+/* message_set_message_id */
+static int _message_set_message_id(Message * message,
+		char const * message_id)
+{
+	Threads * threads;
+
+	if(message_id == NULL || (threads = _message_get_threads(message))
+			== NULL)
+		return 0;
+	return threads_add(threads, message, message_id);
+}
+
+
+/* message_set_references */
+static int _message_set_references(Message * message,
+		char const * references)
+{
+	Threads * threads;
+
+	/* the references have precedence over In-Reply-To */
+	if(references == NULL || (threads = _message_get_threads(message))
+			== NULL)
+		return 0;
+	return threads_link(threads, message, references, TRUE);
 }
 
 
@@ -545,48 +1164,1101 @@ static int _message_set_status(Message * message, char const * status)
 }
 
 
+/* message_set_subject */
+static int _message_set_subject(Message * message, char const * subject)
+{
+	Folder * folder;
+	gchar * decoded;
+
+	if((folder = _message_get_folder(message)) == NULL)
+		/* not listed */
+		return 0;
+	decoded = (subject != NULL) ? _message_header_decode(subject) : NULL;
+	if(decoded != NULL)
+		subject = decoded;
+	message->key_subject = _message_sort_key(folder, subject, TRUE);
+	message->sort_serial = 0;
+	_message_set(message, MHC_SUBJECT, subject, -1);
+	g_free(decoded);
+	return 0;
+}
+
+
 /* message_set_to */
 static int _message_set_to(Message * message, char const * to)
 {
-	char * name;
-	char * email;
-
-	if((email = mailer_helper_get_email(to)) == NULL)
-		return -1;
-	name = mailer_helper_get_name(to);
-	_message_set(message, MHC_TO, (name != NULL) ? name : email,
-			MHC_TO_EMAIL, email, -1);
-	free(email);
-	free(name);
-	return 0;
+	return _message_set_address(message, to, MHC_TO, MHC_TO_EMAIL, TRUE);
 }
 
 
 /* useful */
-/* message headers */
-/* message_header_set */
-static int _message_header_set(MessageHeader * mh, char const * header,
-		char const * value)
+/* message atoms */
+/* message_atom_get */
+static int _message_atom_get(char const * header, gboolean create,
+		MessageAtom * atom)
 {
-	int ret = 0;
-	char * h = NULL;
-	char * v = NULL;
+	gpointer p;
+	char ** q;
+	size_t i;
 
-	if(header != NULL && (h = strdup(header)) == NULL)
-		ret |= -1;
-	if(value != NULL && (v = strdup(value)) == NULL)
-		ret |= -1;
-	if(ret != 0)
-		return ret;
-	if(h != NULL)
+	if(_message_atoms_table == NULL)
 	{
-		free(mh->header);
-		mh->header = h;
+		if((_message_atoms_table = g_hash_table_new(_message_atom_hash,
+						_message_atom_equal)) == NULL)
+			return -1;
+		/* the well-known headers come first */
+		for(i = 0; _message_columns[i].header != NULL; i++)
+			if(_message_atom_get(_message_columns[i].header, TRUE,
+						atom) != 0)
+				return -1;
 	}
-	if(v != NULL)
+	if((p = g_hash_table_lookup(_message_atoms_table, header)) != NULL)
 	{
-		free(mh->value);
-		mh->value = v;
+		*atom = GPOINTER_TO_UINT(p) - 1;
+		return 0;
 	}
+	if(create != TRUE)
+		return -1;
+	/* intern the header name */
+	if((q = realloc(_message_atoms, sizeof(*q) * (_message_atoms_cnt + 1)))
+			== NULL)
+		return -1;
+	_message_atoms = q;
+	if((q[_message_atoms_cnt] = strdup(header)) == NULL)
+		return -1;
+	g_hash_table_insert(_message_atoms_table, q[_message_atoms_cnt],
+			GUINT_TO_POINTER(_message_atoms_cnt + 1));
+	*atom = _message_atoms_cnt++;
 	return 0;
 }
+
+
+/* message_atom_equal */
+static gboolean _message_atom_equal(gconstpointer a, gconstpointer b)
+{
+	return (strcasecmp(a, b) == 0) ? TRUE : FALSE;
+}
+
+
+/* message_atom_hash */
+static guint _message_atom_hash(gconstpointer key)
+{
+	unsigned char const * s = key;
+	guint ret = 5381;
+
+	/* header names are case-insensitive */
+	for(; *s != '\0'; s++)
+		ret = (ret << 5) + ret + tolower(*s);
+	return ret;
+}
+
+
+/* message bodies */
+/* message_body_release */
+static void _message_body_release(Message * message)
+{
+	_message_body_unlink(message);
+	_message_text_release(message);
+	if(message->mime != NULL)
+		_message_mime_delete(message->mime);
+	message->mime = NULL;
+	if(message->body != NULL)
+		body_delete(message->body);
+	message->body = NULL;
+}
+
+
+/* message_body_unlink */
+static void _message_body_unlink(Message * message)
+{
+	if(message->body_prev != NULL)
+		message->body_prev->body_next = message->body_next;
+	else if(_message_bodies_first == message)
+		_message_bodies_first = message->body_next;
+	else
+		/* not in the cache */
+		return;
+	if(message->body_next != NULL)
+		message->body_next->body_prev = message->body_prev;
+	else
+		_message_bodies_last = message->body_prev;
+	message->body_prev = NULL;
+	message->body_next = NULL;
+	_message_bodies_size -= message->body_size;
+	message->body_size = 0;
+}
+
+
+/* message_body_use */
+static void _message_body_use(Message * message)
+{
+	/* move the message last */
+	_message_body_unlink(message);
+	if((message->body_prev = _message_bodies_last) != NULL)
+		_message_bodies_last->body_next = message;
+	else
+		_message_bodies_first = message;
+	_message_bodies_last = message;
+	message->body_size = body_get_size(message->body);
+	_message_bodies_size += message->body_size;
+	_message_bodies_evict(message);
+}
+
+
+/* message_bodies_evict */
+static void _message_bodies_evict(Message * keep)
+{
+	Message * message;
+	Message * next;
+
+	/* release the least recently used bodies no longer displayed nor
+	 * being received, they are obtained again from the account when
+	 * selected */
+	for(message = _message_bodies_first; message != NULL
+			&& _message_bodies_size > _message_bodies_size_max;
+			message = next)
+	{
+		next = message->body_next;
+		if(message == keep || message->body_incomplete
+				|| (message->text != NULL
+					&& G_OBJECT(message->text)->ref_count
+					> 1))
+			continue;
+		_message_body_release(message);
+		_message_bodies_evictions++;
+	}
+}
+
+
+/* message charsets */
+/* message_charset_close */
+static void _message_charset_close(gpointer data)
+{
+	GIConv cd = data;
+
+	if(cd != (GIConv)-1)
+		g_iconv_close(cd);
+}
+
+
+/* message_charset_convert */
+static gchar * _message_charset_convert(char const * charset,
+		char const * buf, size_t cnt, gsize * len)
+{
+	GIConv cd;
+
+	if((cd = _message_charset_open(charset)) == (GIConv)-1)
+		return NULL;
+	/* the descriptor is reset after each conversion */
+	return g_convert_with_iconv(buf, cnt, cd, NULL, len, NULL);
+}
+
+
+/* message_charset_open */
+static GIConv _message_charset_open(char const * charset)
+{
+	GIConv cd;
+	char name[MESSAGE_CHARSET_MAX];
+	char * p;
+
+	if(strcasecmp(charset, "UTF-8") == 0
+			|| strcasecmp(charset, "US-ASCII") == 0)
+		return (GIConv)-1;
+	if(_message_charsets == NULL
+			&& (_message_charsets = g_hash_table_new_full(
+					_message_atom_hash, _message_atom_equal,
+					g_free, _message_charset_close)) == NULL)
+		return (GIConv)-1;
+	/* the descriptors are opened once per charset and kept */
+	if(!g_hash_table_lookup_extended(_message_charsets, charset, NULL,
+				(gpointer *)&cd))
+	{
+		/* remove the language suffix from RFC 2231 */
+		snprintf(name, sizeof(name), "%s", charset);
+		if((p = strchr(name, '*')) != NULL)
+			*p = '\0';
+		cd = g_iconv_open("UTF-8", name);
+		g_hash_table_insert(_message_charsets, g_strdup(charset), cd);
+	}
+	return cd;
+}
+
+
+/* message_charset_text */
+static size_t _message_charset_text(char const * charset, char const * buf,
+		size_t cnt, size_t keep, GString * text)
+{
+	char const replacement[] = "\xef\xbf\xbd"; /* U+FFFD */
+	GIConv cd;
+	gchar * p;
+	gsize len;
+	gsize read;
+	gchar const * end;
+	size_t i;
+	gboolean partial;
+
+	cd = (charset != NULL) ? _message_charset_open(charset) : (GIConv)-1;
+	for(i = 0; i < cnt; i++)
+	{
+		if(cd == (GIConv)-1)
+		{
+			/* the text is kept as is while valid UTF-8 */
+			g_utf8_validate(&buf[i], cnt - i, &end);
+			g_string_append_len(text, &buf[i], end - &buf[i]);
+			i = end - buf;
+			partial = (i < cnt && g_utf8_get_char_validated(&buf[i],
+						cnt - i) == (gunichar)-2)
+				? TRUE : FALSE;
+		}
+		else if((p = g_convert_with_iconv(&buf[i], cnt - i, cd, &read,
+						&len, NULL)) != NULL)
+		{
+			/* only an incomplete character may be left */
+			g_string_append_len(text, p, len);
+			g_free(p);
+			i += read;
+			partial = TRUE;
+		}
+		else
+		{
+			/* convert up to the invalid sequence */
+			if(read > 0 && (p = g_convert_with_iconv(&buf[i], read,
+							cd, NULL, &len, NULL))
+					!= NULL)
+			{
+				g_string_append_len(text, p, len);
+				g_free(p);
+			}
+			i += read;
+			partial = FALSE;
+		}
+		if(i == cnt)
+			break;
+		/* the end of the character may still be received */
+		if(partial && cnt - i <= keep)
+			return i;
+		g_string_append_len(text, replacement, sizeof(replacement) - 1);
+	}
+	return cnt;
+}
+
+
+/* message headers */
+/* message_arena_append */
+static int _message_arena_append(Message * message, char const * value,
+		size_t * offset)
+{
+	size_t len;
+	size_t size;
+	size_t cnt;
+	size_t i;
+	char * p;
+	char const * v;
+
+	len = strlen(value) + 1;
+	if(message->arena_cnt + len > message->arena_size)
+	{
+		cnt = message->arena_cnt - message->arena_unused;
+		for(size = (message->arena_size > 0) ? message->arena_size
+				: MESSAGE_ARENA_SIZE; size < cnt + len;
+				size <<= 1);
+		if(message->arena_unused == 0)
+		{
+			if((p = realloc(message->arena, size)) == NULL)
+				return -1;
+		}
+		else
+		{
+			/* leave the values replaced behind */
+			if((p = malloc(size)) == NULL)
+				return -1;
+			for(i = 0, cnt = 0; i < message->headers_cnt; i++)
+			{
+				v = &message->arena[message->headers[i].value];
+				message->headers[i].value = cnt;
+				cnt += strlen(v) + 1;
+				memcpy(&p[message->headers[i].value], v,
+						cnt - message->headers[i].value);
+			}
+			free(message->arena);
+			message->arena_cnt = cnt;
+			message->arena_unused = 0;
+		}
+		message->arena = p;
+		message->arena_size = size;
+	}
+	memcpy(&message->arena[message->arena_cnt], value, len);
+	*offset = message->arena_cnt;
+	message->arena_cnt += len;
+	return 0;
+}
+
+
+/* message_header_apply */
+static int _message_header_apply(Message * message, MessageAtom atom,
+		char const * value)
+{
+	/* the columns are set by the callbacks */
+	if(atom >= MA_COUNT)
+		return 0;
+	return _message_columns[atom].callback(message, value);
+}
+
+
+/* message_header_decode */
+static int _header_decode_word(GString * str, char const * word,
+		char const ** end);
+static void _header_decode_text(GString * str, char const * text,
+		size_t cnt);
+
+static gchar * _message_header_decode(char const * value)
+{
+	GString * str;
+	char const * p;
+	char const * q;
+	char const * end;
+	gboolean word = FALSE;
+
+	/* ASCII values without encoded words are used as is */
+	for(p = value; *p != '\0'; p++)
+		if((unsigned char)*p >= 0x80 || (p[0] == '=' && p[1] == '?'))
+			break;
+	if(*p == '\0')
+		return NULL;
+	str = g_string_sized_new(strlen(value));
+	for(p = value; *p != '\0'; p = end)
+	{
+		if((q = strstr(p, "=?")) == NULL)
+			q = p + strlen(p);
+		/* whitespace between encoded words is ignored */
+		if(!word || *q == '\0'
+				|| strspn(p, " \t\r\n") < (size_t)(q - p))
+			_header_decode_text(str, p, q - p);
+		if(*q == '\0')
+			break;
+		if((word = (_header_decode_word(str, q, &end) == 0)) == FALSE)
+		{
+			_header_decode_text(str, q, 2);
+			end = q + 2;
+		}
+	}
+	return g_string_free(str, FALSE);
+}
+
+static int _header_decode_word(GString * str, char const * word,
+		char const ** end)
+{
+	char charset[MESSAGE_CHARSET_MAX];
+	char const * encoding;
+	char const * text;
+	size_t len;
+	char * buf;
+	char * q;
+	size_t i;
+	CodecState state = { 0, 0 };
+	gchar * p;
+	gsize plen;
+
+	/* =?charset?encoding?text?= */
+	if((len = strcspn(&word[2], "?")) == 0 || len >= sizeof(charset))
+		return -1;
+	memcpy(charset, &word[2], len);
+	charset[len] = '\0';
+	encoding = &word[2 + len];
+	if(encoding[0] != '?' || encoding[1] == '\0' || encoding[2] != '?')
+		return -1;
+	text = &encoding[3];
+	len = strcspn(text, "? \t\r\n");
+	if(text[len] != '?' || text[len + 1] != '=')
+		return -1;
+	*end = &text[len + 2];
+	if((buf = malloc(len * 2 + 1)) == NULL)
+		return -1;
+	q = &buf[len];
+	switch(encoding[1])
+	{
+		case 'B':
+		case 'b':
+			len = codec_base64_decode(&state, text, len, buf);
+			break;
+		case 'Q':
+		case 'q':
+			/* underscores stand for spaces */
+			for(i = 0; i < len; i++)
+				q[i] = (text[i] == '_') ? ' ' : text[i];
+			len = codec_qp_decode(q, len, buf);
+			break;
+		default:
+			free(buf);
+			return -1;
+	}
+	if((p = _message_charset_convert(charset, buf, len, &plen)) != NULL)
+	{
+		g_string_append_len(str, p, plen);
+		g_free(p);
+	}
+	else
+		_header_decode_text(str, buf, len);
+	free(buf);
+	return 0;
+}
+
+static void _header_decode_text(GString * str, char const * text,
+		size_t cnt)
+{
+	gchar * p;
+	gsize len;
+
+	/* raw 8-bit text is assumed to be ISO-8859-1 unless valid UTF-8 */
+	if(g_utf8_validate(text, cnt, NULL)
+			|| (p = _message_charset_convert("ISO-8859-1", text,
+					cnt, &len)) == NULL)
+	{
+		g_string_append_len(str, text, cnt);
+		return;
+	}
+	g_string_append_len(str, p, len);
+	g_free(p);
+}
+
+
+/* message_header_get */
+static MessageHeader * _message_header_get(Message * message,
+		MessageAtom atom)
+{
+	size_t i;
+
+	if(atom < MA_COUNT)
+		return (message->headers_known[atom] != 0)
+			? &message->headers[message->headers_known[atom] - 1]
+			: NULL;
+	for(i = 0; i < message->headers_cnt; i++)
+		if(message->headers[i].atom == atom)
+			return &message->headers[i];
+	return NULL;
+}
+
+
+/* message parts */
+/* message_decode */
+static size_t _message_decode(MessageEncoding encoding, CodecState * state,
+		char const * buf, size_t cnt, char * out)
+{
+	switch(encoding)
+	{
+		case ME_BASE64:
+			return codec_base64_decode(state, buf, cnt, out);
+		case ME_QUOTED_PRINTABLE:
+			return codec_qp_decode(buf, cnt, out);
+		case ME_IDENTITY:
+		default:
+			memcpy(out, buf, cnt);
+			return cnt;
+	}
+}
+
+
+/* message_mime_new */
+static int _mime_part_new(MessageMime * mime, size_t parent);
+static void _mime_part_set(MessageMime * mime, size_t part, char const * type,
+		char const * encoding, char const * disposition);
+
+static MessageMime * _message_mime_new(Message * message)
+{
+	MessageMime * mime;
+
+	if((mime = object_new(sizeof(*mime))) == NULL)
+		return NULL;
+	mime->parts = NULL;
+	mime->parts_cnt = 0;
+	mime->attachments = NULL;
+	mime->attachments_cnt = 0;
+	mime->state = MMS_CONTENTS;
+	mime->current = 0;
+	mime->offset = 0;
+	mime->eol = 0;
+	mime->line = NULL;
+	mime->line_cnt = 0;
+	mime->line_len = 0;
+	mime->line_size = 0;
+	mime->line_shown = 0;
+	mime->line_cr = FALSE;
+	mime->headers = NULL;
+	mime->headers_cnt = 0;
+	memset(&mime->decoder, 0, sizeof(mime->decoder));
+	/* the headers of the message are those of the first part */
+	if(_mime_part_new(mime, 0) != 0)
+	{
+		_message_mime_delete(mime);
+		return NULL;
+	}
+	_mime_part_set(mime, 0, message_get_header(message, "Content-Type"),
+			message_get_header(message,
+				"Content-Transfer-Encoding"),
+			message_get_header(message, "Content-Disposition"));
+	mime->parts[0].start = 0;
+	return mime;
+}
+
+static int _mime_part_new(MessageMime * mime, size_t parent)
+{
+	MessagePart * p;
+
+	if((p = realloc(mime->parts, sizeof(*p) * (mime->parts_cnt + 1)))
+			== NULL)
+		return -1;
+	mime->parts = p;
+	p = &mime->parts[mime->parts_cnt];
+	p->parent = parent;
+	p->type = NULL;
+	p->charset = NULL;
+	p->boundary = NULL;
+	p->filename = NULL;
+	p->encoding = ME_IDENTITY;
+	p->attachment = FALSE;
+	p->start = MESSAGE_PART_OPEN;
+	p->end = MESSAGE_PART_OPEN;
+	mime->current = mime->parts_cnt++;
+	return 0;
+}
+
+static char * _part_set_parameter(char const * value, char const * name);
+
+static void _mime_part_set(MessageMime * mime, size_t part, char const * type,
+		char const * encoding, char const * disposition)
+{
+	MessagePart * p = &mime->parts[part];
+	size_t i;
+	size_t * q;
+
+	if(type == NULL)
+		type = "text/plain";
+	for(; isspace((unsigned char)*type); type++);
+	for(i = 0; type[i] != '\0' && type[i] != ';'
+			&& !isspace((unsigned char)type[i]); i++);
+	if((p->type = g_ascii_strdown(type, i)) == NULL)
+		return;
+	if(strncmp(p->type, "multipart/", 10) == 0)
+		p->boundary = _part_set_parameter(type, "boundary");
+	else if(strncmp(p->type, "text/", 5) == 0)
+		p->charset = _part_set_parameter(type, "charset");
+	if(encoding != NULL)
+	{
+		for(; isspace((unsigned char)*encoding); encoding++);
+		if(strncasecmp(encoding, "base64", 6) == 0)
+			p->encoding = ME_BASE64;
+		else if(strncasecmp(encoding, "quoted-printable", 16) == 0)
+			p->encoding = ME_QUOTED_PRINTABLE;
+	}
+	if(disposition != NULL)
+	{
+		for(; isspace((unsigned char)*disposition); disposition++);
+		p->attachment = (strncasecmp(disposition, "attachment", 10)
+				== 0) ? TRUE : FALSE;
+		p->filename = _part_set_parameter(disposition, "filename");
+	}
+	if(p->filename == NULL)
+		p->filename = _part_set_parameter(type, "name");
+	if(p->boundary != NULL || (p->attachment == FALSE
+				&& p->filename == NULL))
+		return;
+	/* remember the attachment */
+	if((q = realloc(mime->attachments, sizeof(*q)
+					* (mime->attachments_cnt + 1))) == NULL)
+		return;
+	mime->attachments = q;
+	mime->attachments[mime->attachments_cnt++] = part;
+}
+
+static char * _part_set_parameter(char const * value, char const * name)
+{
+	size_t len = strlen(name);
+	char const * p;
+	GString * ret;
+
+	for(p = strchr(value, ';'); p != NULL; p = strchr(p, ';'))
+	{
+		for(p++; isspace((unsigned char)*p); p++);
+		if(strncasecmp(p, name, len) != 0)
+			continue;
+		for(p += len; isspace((unsigned char)*p); p++);
+		if(*p != '=')
+			continue;
+		for(p++; isspace((unsigned char)*p); p++);
+		ret = g_string_new(NULL);
+		if(*p != '"')
+			for(; *p != '\0' && *p != ';'
+					&& !isspace((unsigned char)*p); p++)
+				g_string_append_c(ret, *p);
+		else
+			for(p++; *p != '\0' && *p != '"'; p++)
+				g_string_append_c(ret, (*p == '\\'
+							&& p[1] != '\0')
+						? *(++p) : *p);
+		return g_string_free(ret, FALSE);
+	}
+	return NULL;
+}
+
+
+/* message_mime_delete */
+static void _message_mime_delete(MessageMime * mime)
+{
+	size_t i;
+
+	for(i = 0; i < mime->parts_cnt; i++)
+	{
+		g_free(mime->parts[i].type);
+		g_free(mime->parts[i].charset);
+		g_free(mime->parts[i].boundary);
+		g_free(mime->parts[i].filename);
+	}
+	free(mime->parts);
+	free(mime->attachments);
+	free(mime->line);
+	free(mime->headers);
+	object_delete(mime);
+}
+
+
+/* message_mime_feed */
+static int _feed_append(MessageMime * mime, char const * buf, size_t cnt);
+static void _feed_line(Message * message, char const * line, size_t cnt,
+		size_t len, size_t eol);
+static gboolean _feed_line_boundary(Message * message, char const * line,
+		size_t cnt);
+static void _feed_line_headers(MessageMime * mime);
+static void _feed_pending(Message * message, gboolean all);
+static char * _feed_line_headers_get(MessageMime * mime, char const * name);
+static gboolean _headers_get_end(char const * p, char const * end);
+
+static int _message_mime_feed(Message * message, char const * buf,
+		size_t cnt)
+{
+	MessageMime * mime = message->mime;
+	char const * p;
+	size_t len;
+	size_t eol;
+
+	while(cnt > 0)
+	{
+		if((p = memchr(buf, '\n', cnt)) == NULL)
+		{
+			/* keep the beginning of the line for later */
+			if(_feed_append(mime, buf, cnt) != 0)
+				return -1;
+			_feed_pending(message, FALSE);
+			return 0;
+		}
+		len = p - buf + 1;
+		eol = ((len >= 2 && p[-1] == '\r')
+				|| (len == 1 && mime->line_cr)) ? 2 : 1;
+		if(mime->line_len == 0)
+			/* the line is complete */
+			_feed_line(message, buf, len, len, eol);
+		else if(_feed_append(mime, buf, len) != 0)
+			return -1;
+		else
+			_feed_line(message, mime->line, mime->line_cnt,
+					mime->line_len, eol);
+		mime->line_cnt = 0;
+		mime->line_len = 0;
+		mime->line_shown = 0;
+		buf += len;
+		cnt -= len;
+	}
+	return 0;
+}
+
+static int _feed_append(MessageMime * mime, char const * buf, size_t cnt)
+{
+	size_t len = cnt;
+	size_t size;
+	char * p;
+
+	mime->line_len += cnt;
+	mime->line_cr = (buf[cnt - 1] == '\r') ? TRUE : FALSE;
+	/* only boundaries matter within the contents of most parts */
+	if(mime->state == MMS_CONTENTS
+			&& !_message_mime_is_text(mime, mime->current, FALSE))
+	{
+		if(mime->line_cnt >= MESSAGE_LINE_MAX)
+			return 0;
+		if(mime->line_cnt + len > MESSAGE_LINE_MAX)
+			len = MESSAGE_LINE_MAX - mime->line_cnt;
+	}
+	if(mime->line_cnt + len > mime->line_size)
+	{
+		for(size = (mime->line_size > 0) ? mime->line_size
+				: MESSAGE_LINE_MAX; size < mime->line_cnt + len;
+				size <<= 1);
+		if((p = realloc(mime->line, size)) == NULL)
+			return -1;
+		mime->line = p;
+		mime->line_size = size;
+	}
+	memcpy(&mime->line[mime->line_cnt], buf, len);
+	mime->line_cnt += len;
+	return 0;
+}
+
+static void _feed_line(Message * message, char const * line, size_t cnt,
+		size_t len, size_t eol)
+{
+	MessageMime * mime = message->mime;
+	char * p;
+
+	if(_feed_line_boundary(message, line, (cnt == len) ? cnt - eol : cnt)
+			!= TRUE)
+	{
+		if(mime->state == MMS_CONTENTS)
+		{
+			if(message->text != NULL && _message_mime_is_text(mime,
+						mime->current, FALSE))
+				_message_mime_insert(message,
+						&mime->parts[mime->current],
+						&line[mime->line_shown],
+						cnt - mime->line_shown,
+						&mime->decoder, FALSE);
+		}
+		else if(cnt == eol)
+		{
+			/* the contents of the part start after this line */
+			_feed_line_headers(mime);
+			mime->parts[mime->current].start = mime->offset + len;
+			mime->state = MMS_CONTENTS;
+			memset(&mime->decoder, 0, sizeof(mime->decoder));
+		}
+		else if((p = realloc(mime->headers, mime->headers_cnt + cnt))
+				!= NULL)
+		{
+			mime->headers = p;
+			memcpy(&mime->headers[mime->headers_cnt], line, cnt);
+			mime->headers_cnt += cnt;
+		}
+	}
+	mime->offset += len;
+	mime->eol = eol;
+}
+
+static gboolean _feed_line_boundary(Message * message, char const * line,
+		size_t cnt)
+{
+	MessageMime * mime = message->mime;
+	MessagePart * part;
+	size_t i;
+	size_t j;
+	size_t len;
+	gboolean close;
+
+	if(cnt < 2 || line[0] != '-' || line[1] != '-')
+		return FALSE;
+	/* look for the boundary of the enclosing multiparts */
+	for(i = mime->current + 1; i != 0; i = part->parent)
+	{
+		part = &mime->parts[i - 1];
+		if(part->boundary == NULL || part->start == MESSAGE_PART_OPEN)
+			continue;
+		len = strlen(part->boundary);
+		if(cnt < len + 2 || memcmp(&line[2], part->boundary, len) != 0)
+			continue;
+		j = len + 2;
+		if((close = (cnt >= j + 2 && line[j] == '-'
+						&& line[j + 1] == '-')))
+			j += 2;
+		for(; j < cnt && isspace((unsigned char)line[j]); j++);
+		if(j == cnt)
+			break;
+	}
+	if(i == 0)
+		return FALSE;
+	/* the end of an incomplete character is not coming anymore */
+	if(message->text != NULL && mime->state == MMS_CONTENTS
+			&& mime->decoder.partial_cnt > 0
+			&& _message_mime_is_text(mime, mime->current, FALSE))
+		_message_mime_insert(message, &mime->parts[mime->current],
+				NULL, 0, &mime->decoder, TRUE);
+	/* the parts within end before the boundary */
+	for(j = mime->current + 1; j != i; j = mime->parts[j - 1].parent)
+	{
+		part = &mime->parts[j - 1];
+		if(part->start == MESSAGE_PART_OPEN)
+			part->start = mime->offset;
+		if(part->end == MESSAGE_PART_OPEN)
+			part->end = (mime->offset - mime->eol > part->start)
+				? mime->offset - mime->eol : part->start;
+	}
+	mime->current = i - 1;
+	mime->state = MMS_CONTENTS;
+	if(close)
+		return TRUE;
+	/* a new part starts */
+	if(_mime_part_new(mime, i) == 0)
+	{
+		mime->state = MMS_HEADERS;
+		mime->headers_cnt = 0;
+	}
+	return TRUE;
+}
+
+static void _feed_line_headers(MessageMime * mime)
+{
+	char * type;
+	char * encoding;
+	char * disposition;
+
+	type = _feed_line_headers_get(mime, "Content-Type");
+	encoding = _feed_line_headers_get(mime, "Content-Transfer-Encoding");
+	disposition = _feed_line_headers_get(mime, "Content-Disposition");
+	_mime_part_set(mime, mime->current, type, encoding, disposition);
+	g_free(type);
+	g_free(encoding);
+	g_free(disposition);
+}
+
+static char * _feed_line_headers_get(MessageMime * mime, char const * name)
+{
+	size_t len = strlen(name);
+	char const * p = mime->headers;
+	char const * end = &mime->headers[mime->headers_cnt];
+	GString * ret;
+
+	for(; p < end; p++)
+	{
+		if((size_t)(end - p) > len && p[len] == ':'
+				&& strncasecmp(p, name, len) == 0)
+		{
+			/* unfold the value */
+			ret = g_string_new(NULL);
+			for(p += len + 1; p < end && !_headers_get_end(p, end);
+					p++)
+				if(*p != '\r' && *p != '\n')
+					g_string_append_c(ret, *p);
+			return g_string_free(ret, FALSE);
+		}
+		/* skip to the next header */
+		for(; p < end && !_headers_get_end(p, end); p++);
+	}
+	return NULL;
+}
+
+static gboolean _headers_get_end(char const * p, char const * end)
+{
+	/* the header continues on lines starting with white-space */
+	return (*p == '\n' && (p + 1 == end || (p[1] != ' ' && p[1] != '\t')))
+		? TRUE : FALSE;
+}
+
+static void _feed_pending(Message * message, gboolean all)
+{
+	MessageMime * mime = message->mime;
+	MessagePart * part = &mime->parts[mime->current];
+
+	/* display the beginning of the current line if possible */
+	if(message->text == NULL || mime->state != MMS_CONTENTS
+			|| !_message_mime_is_text(mime, mime->current, FALSE)
+			|| mime->line_shown >= mime->line_cnt)
+		return;
+	/* it may still be a boundary or an escaped character */
+	if(mime->line[0] == '-' || (all == FALSE
+				&& part->encoding == ME_QUOTED_PRINTABLE))
+		return;
+	_message_mime_insert(message, part, &mime->line[mime->line_shown],
+			mime->line_cnt - mime->line_shown, &mime->decoder,
+			FALSE);
+	mime->line_shown = mime->line_cnt;
+}
+
+
+/* message_mime_insert */
+static void _message_mime_insert(Message * message, MessagePart * part,
+		char const * buf, size_t cnt, MessageDecoder * decoder,
+		gboolean last)
+{
+	char * p;
+	size_t len;
+	size_t i;
+	GString * text;
+	GtkTextIter iter;
+
+	if((len = decoder->partial_cnt + cnt) == 0
+			|| (p = malloc(len)) == NULL)
+		return;
+	/* complete the character left over previously */
+	memcpy(p, decoder->partial, decoder->partial_cnt);
+	len = decoder->partial_cnt;
+	if(cnt > 0)
+		len += _message_decode(part->encoding, &decoder->codec, buf,
+				cnt, &p[len]);
+	/* the text buffer only accepts valid UTF-8 */
+	text = g_string_sized_new(len);
+	i = _message_charset_text(part->charset, p, len, last ? 0
+			: sizeof(decoder->partial), text);
+	decoder->partial_cnt = len - i;
+	memcpy(decoder->partial, &p[i], decoder->partial_cnt);
+	if(text->len > 0)
+	{
+		gtk_text_buffer_get_end_iter(message->text, &iter);
+		gtk_text_buffer_insert(message->text, &iter, text->str,
+				text->len);
+	}
+	g_string_free(text, TRUE);
+	free(p);
+}
+
+
+/* message_mime_is_text */
+static gboolean _message_mime_is_text(MessageMime * mime, size_t part,
+		gboolean any)
+{
+	MessagePart * p = &mime->parts[part];
+
+	if(p->type == NULL || p->boundary != NULL || p->attachment)
+		return FALSE;
+	if(any)
+		return (strncmp(p->type, "text/", 5) == 0) ? TRUE : FALSE;
+	return (strcmp(p->type, "text/plain") == 0) ? TRUE : FALSE;
+}
+
+
+/* message_mime_render */
+static gboolean _render_part(Message * message, char const * data,
+		size_t part, gboolean any);
+
+static void _message_mime_render(Message * message)
+{
+	char const * data;
+	size_t i;
+	gboolean found = FALSE;
+
+	if(message->mime == NULL
+			|| (data = body_get_data(message->body)) == NULL)
+		return;
+	for(i = 0; i < message->mime->parts_cnt; i++)
+		found |= _render_part(message, data, i, FALSE);
+	/* otherwise display the first text part found */
+	for(i = 0; found == FALSE && i < message->mime->parts_cnt; i++)
+		found = _render_part(message, data, i, TRUE);
+}
+
+static gboolean _render_part(Message * message, char const * data,
+		size_t part, gboolean any)
+{
+	MessageMime * mime = message->mime;
+	MessagePart * p = &mime->parts[part];
+	size_t end;
+	MessageDecoder decoder;
+
+	if(p->start == MESSAGE_PART_OPEN
+			|| !_message_mime_is_text(mime, part, any))
+		return FALSE;
+	end = (p->end != MESSAGE_PART_OPEN) ? p->end : mime->offset;
+	if(part == mime->current)
+	{
+		/* the current part is completed as it is received */
+		memset(&mime->decoder, 0, sizeof(mime->decoder));
+		mime->line_shown = 0;
+		if(end > p->start)
+			_message_mime_insert(message, p, &data[p->start],
+					end - p->start, &mime->decoder, FALSE);
+		_feed_pending(message, TRUE);
+	}
+	else if(end > p->start)
+	{
+		memset(&decoder, 0, sizeof(decoder));
+		_message_mime_insert(message, p, &data[p->start],
+				end - p->start, &decoder, TRUE);
+	}
+	return TRUE;
+}
+
+
+/* message sort keys */
+/* message_sort_key */
+static char const * _message_sort_key(Folder * folder, char const * string,
+		gboolean subject)
+{
+	char const * prefixes[] = { "Re:", "Fwd:", "Fw:" };
+	char const * ret;
+	size_t i;
+	gchar * p;
+	gchar * q;
+
+	if(string == NULL)
+		return NULL;
+	/* replies and forwards are sorted along with the original subject */
+	while(subject)
+	{
+		while(isspace((unsigned char)*string))
+			string++;
+		for(i = 0; i < sizeof(prefixes) / sizeof(*prefixes); i++)
+			if(strncasecmp(string, prefixes[i], strlen(prefixes[i]))
+					== 0)
+				break;
+		if(i == sizeof(prefixes) / sizeof(*prefixes))
+			break;
+		string += strlen(prefixes[i]);
+	}
+	/* collate once here instead of for every comparison */
+	if((p = g_utf8_casefold(string, -1)) == NULL)
+		return NULL;
+	q = g_utf8_collate_key(p, -1);
+	g_free(p);
+	ret = folder_intern(folder, q);
+	g_free(q);
+	return ret;
+}
+
+
+/* message texts */
+/* message_text_release */
+static void _message_text_release(Message * message)
+{
+	size_t i;
+
+	if(message->text == NULL)
+		return;
+	for(i = 0; i < _message_texts_cnt; i++)
+		if(_message_texts[i] == message)
+		{
+			memmove(&_message_texts[i], &_message_texts[i + 1],
+					sizeof(*_message_texts)
+					* (--_message_texts_cnt - i));
+			break;
+		}
+	g_object_unref(message->text);
+	message->text = NULL;
+}
+
+
+/* message_text_use */
+static void _message_text_use(Message * message)
+{
+	size_t i;
+
+	for(i = 0; i < _message_texts_cnt; i++)
+		if(_message_texts[i] == message)
+			break;
+	if(i < _message_texts_cnt)
+		/* move the message last */
+		memmove(&_message_texts[i], &_message_texts[i + 1],
+				sizeof(*_message_texts)
+				* (--_message_texts_cnt - i));
+	else if(_message_texts_cnt == MESSAGE_TEXT_MAX)
+	{
+		/* release the least recently used text no longer displayed
+		 * (the body of the message is kept to re-create it) */
+		for(i = 0; i < _message_texts_cnt; i++)
+			if(G_OBJECT(_message_texts[i]->text)->ref_count == 1)
+				break;
+		if(i < _message_texts_cnt)
+			_message_text_release(_message_texts[i]);
+		else
+			/* every text is displayed: only stop tracking the
+			 * oldest, it is released along with its body */
+			memmove(&_message_texts[0], &_message_texts[1],
+					sizeof(*_message_texts)
+					* --_message_texts_cnt);
+	}
+	_message_texts[_message_texts_cnt++] = message;
+}
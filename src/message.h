@@ -49,13 +49,31 @@ void message_delete(Message * message);
 GtkTextBuffer * message_get_body(Message * message);
 AccountMessage * message_get_data(Message * message);
 gboolean message_get_iter(Message * message, GtkTreeIter * iter);
+char const * message_get_sort_key(Message * message,
+		MailerHeaderColumn column);
+unsigned int message_get_sort_rank(Message * message, unsigned int serial);
 GtkTreeStore * message_get_store(Message * message);
 
 int message_set_body(Message * message, char const * buf, size_t cnt,
 		gboolean append);
+void message_set_body_complete(Message * message);
 int message_set_header(Message * message, char const * header);
 int message_set_header_value(Message * message, char const * header,
 		char const * value);
+void message_set_iter(Message * message, GtkTreeIter * iter);
+void message_set_match(Message * message, gboolean match);
 void message_set_read(Message * message, gboolean read);
+void message_set_sort_rank(Message * message, unsigned int serial,
+		unsigned int rank);
+void message_set_store(Message * message, GtkTreeStore * store,
+		GtkTreeIter * iter);
+
+/* useful */
+void message_cache_get_stats(size_t * hits, size_t * misses,
+		size_t * evictions);
+gboolean message_cache_lookup(Message * message);
+void message_cache_set_size(size_t size);
+void message_cleanup(void);
+void message_intern(Message * message, Folder * folder);
 
 #endif /* !MAILER_SRC_MAILER_H */
@@ -33,7 +33,35 @@
 
 
 /* Search */
+/* private */
+/* types */
+typedef struct _MailerPlugin Search;
+
+struct _MailerPlugin
+{
+	MailerPluginHelper * helper;
+
+	/* widgets */
+	GtkWidget * widget;
+	GtkWidget * entry;
+	GtkWidget * button;
+};
+
+
 /* protected */
+/* prototypes */
+/* plug-in */
+static MailerPlugin * _search_init(MailerPluginHelper * helper);
+static void _search_destroy(Search * search);
+static GtkWidget * _search_get_widget(Search * search);
+static void _search_refresh(Search * search, MailerFolder * folder,
+		MailerMessage * message);
+
+/* callbacks */
+static void _search_on_search(gpointer data);
+
+
+/* public */
 /* variables */
 /* plug-in */
 MailerPluginDefinition plugin =
@@ -41,8 +69,79 @@ MailerPluginDefinition plugin =
 	"Search",
 	"search",
 	"Search inside messages",
-	NULL,
-	NULL,
-	NULL,
-	NULL
+	_search_init,
+	_search_destroy,
+	_search_get_widget,
+	_search_refresh
 };
+
+
+/* protected */
+/* functions */
+/* plug-in */
+/* search_init */
+static MailerPlugin * _search_init(MailerPluginHelper * helper)
+{
+	Search * search;
+	GtkWidget * hbox;
+
+	if((search = malloc(sizeof(*search))) == NULL)
+		return NULL;
+	search->helper = helper;
+	/* widgets */
+#if GTK_CHECK_VERSION(3, 0, 0)
+	search->widget = gtk_box_new(GTK_ORIENTATION_VERTICAL, 4);
+	hbox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 4);
+#else
+	search->widget = gtk_vbox_new(FALSE, 4);
+	hbox = gtk_hbox_new(FALSE, 4);
+#endif
+	search->entry = gtk_entry_new();
+	g_signal_connect_swapped(search->entry, "activate", G_CALLBACK(
+				_search_on_search), search);
+	gtk_box_pack_start(GTK_BOX(hbox), search->entry, TRUE, TRUE, 0);
+	search->button = gtk_button_new_from_stock(GTK_STOCK_FIND);
+	g_signal_connect_swapped(search->button, "clicked", G_CALLBACK(
+				_search_on_search), search);
+	gtk_box_pack_start(GTK_BOX(hbox), search->button, FALSE, TRUE, 0);
+	gtk_box_pack_start(GTK_BOX(search->widget), hbox, FALSE, TRUE, 0);
+	gtk_widget_show_all(hbox);
+	return search;
+}
+
+
+/* search_destroy */
+static void _search_destroy(Search * search)
+{
+	free(search);
+}
+
+
+/* search_get_widget */
+static GtkWidget * _search_get_widget(Search * search)
+{
+	return search->widget;
+}
+
+
+/* search_refresh */
+static void _search_refresh(Search * search, MailerFolder * folder,
+		MailerMessage * message)
+{
+	gboolean sensitive = (folder != NULL) ? TRUE : FALSE;
+
+	gtk_widget_set_sensitive(search->entry, sensitive);
+	gtk_widget_set_sensitive(search->button, sensitive);
+}
+
+
+/* callbacks */
+/* search_on_search */
+static void _search_on_search(gpointer data)
+{
+	Search * search = data;
+	MailerPluginHelper * helper = search->helper;
+
+	helper->search(helper->mailer, gtk_entry_get_text(GTK_ENTRY(
+					search->entry)));
+}
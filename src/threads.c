@@ -0,0 +1,427 @@
+/* $Id$ */
+/* Copyright (c) 2024 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Desktop Mailer */
+/* All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <System.h>
+#include "message.h"
+#include "threads.h"
+
+
+/* Threads */
+/* private */
+/* types */
+/* containers are identified by their position + 1, 0 meaning none */
+typedef struct _ThreadsContainer
+{
+	Message * message;
+	char const * id;
+	size_t parent;
+	size_t child;
+	size_t next;
+} ThreadsContainer;
+
+struct _Threads
+{
+	GtkTreeStore * store;
+
+	ThreadsContainer * containers;
+	size_t containers_cnt;
+	size_t containers_size;
+
+	/* containers by Message-ID and by message */
+	GHashTable * ids;
+	GHashTable * messages;
+};
+
+
+/* constants */
+#define THREADS_CONTAINERS_SIZE	1024
+
+
+/* prototypes */
+static int _threads_container_get(Threads * threads, char const * id,
+		size_t len, size_t * container);
+static int _threads_container_new(Threads * threads, size_t * container);
+#define _threads_container(threads, container) \
+	(&(threads)->containers[(container) - 1])
+
+static char const * _threads_id(char const * references, char const ** id,
+		size_t * len);
+static int _threads_parent(Threads * threads, size_t container,
+		size_t parent);
+static void _threads_place(Threads * threads, size_t container);
+
+
+/* public */
+/* functions */
+/* threads_new */
+Threads * threads_new(GtkTreeStore * store)
+{
+	Threads * threads;
+
+	if((threads = object_new(sizeof(*threads))) == NULL)
+		return NULL;
+	threads->store = store;
+	threads->containers = NULL;
+	threads->containers_cnt = 0;
+	threads->containers_size = 0;
+	threads->ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+			NULL);
+	threads->messages = g_hash_table_new(g_direct_hash, g_direct_equal);
+	if(threads->ids == NULL || threads->messages == NULL)
+	{
+		threads_delete(threads);
+		return NULL;
+	}
+	return threads;
+}
+
+
+/* threads_delete */
+void threads_delete(Threads * threads)
+{
+	if(threads->messages != NULL)
+		g_hash_table_destroy(threads->messages);
+	if(threads->ids != NULL)
+		g_hash_table_destroy(threads->ids);
+	free(threads->containers);
+	object_delete(threads);
+}
+
+
+/* useful */
+/* threads_add */
+int threads_add(Threads * threads, Message * message, char const * id)
+{
+	size_t len;
+	size_t c;
+	size_t p;
+	size_t q;
+	ThreadsContainer * tc;
+	ThreadsContainer * pc;
+
+	if(_threads_id(id, &id, &len) == NULL)
+		return 0;
+	c = GPOINTER_TO_SIZE(g_hash_table_lookup(threads->messages, message));
+	if(c != 0 && _threads_container(threads, c)->id != NULL)
+		/* the message was already identified */
+		return 0;
+	if(_threads_container_get(threads, id, len, &p) != 0)
+		return -1;
+	pc = _threads_container(threads, p);
+	if(pc->message != NULL)
+		/* XXX duplicate Message-ID, keep the message unidentified */
+		return 0;
+	if(c == 0)
+	{
+		/* claim the placeholder */
+		pc->message = message;
+		g_hash_table_insert(threads->messages, message,
+				GSIZE_TO_POINTER(p));
+		c = p;
+	}
+	else
+	{
+		/* the message was linked first: take over the identifier, the
+		 * parent and the children of the placeholder */
+		tc = _threads_container(threads, c);
+		tc->id = pc->id;
+		pc->id = NULL;
+		g_hash_table_steal(threads->ids, tc->id);
+		g_hash_table_insert(threads->ids, (char *)tc->id,
+				GSIZE_TO_POINTER(c));
+		while((q = pc->child) != 0)
+			if(_threads_parent(threads, q, c) != 0)
+				_threads_parent(threads, q, 0);
+		if((q = pc->parent) != 0)
+		{
+			_threads_parent(threads, p, 0);
+			if(tc->parent == 0)
+				_threads_parent(threads, c, q);
+		}
+	}
+	_threads_place(threads, c);
+	return 0;
+}
+
+
+/* threads_link */
+int threads_link(Threads * threads, Message * message,
+		char const * references, gboolean replace)
+{
+	char const * id;
+	size_t len;
+	size_t c;
+	size_t p;
+	size_t previous = 0;
+
+	if((c = GPOINTER_TO_SIZE(g_hash_table_lookup(threads->messages,
+						message))) == 0)
+	{
+		if(_threads_container_new(threads, &c) != 0)
+			return -1;
+		_threads_container(threads, c)->message = message;
+		g_hash_table_insert(threads->messages, message,
+				GSIZE_TO_POINTER(c));
+	}
+	if(!replace && _threads_container(threads, c)->parent != 0)
+		return 0;
+	/* link the references together, from the oldest */
+	while((references = _threads_id(references, &id, &len)) != NULL)
+	{
+		if(_threads_container_get(threads, id, len, &p) != 0)
+			return -1;
+		if(p == c)
+			/* XXX the message references itself */
+			break;
+		if(previous != 0 && _threads_container(threads, p)->parent
+				== 0 && _threads_parent(threads, p, previous)
+				== 0)
+			_threads_place(threads, p);
+		previous = p;
+	}
+	if(previous == 0 || _threads_container(threads, c)->parent == previous
+			|| _threads_parent(threads, c, previous) != 0)
+		return 0;
+	_threads_place(threads, c);
+	return 0;
+}
+
+
+/* threads_remove */
+void threads_remove(Threads * threads, Message * message)
+{
+	size_t c;
+	size_t p;
+	ThreadsContainer * tc;
+
+	if((c = GPOINTER_TO_SIZE(g_hash_table_lookup(threads->messages,
+						message))) == 0)
+		return;
+	g_hash_table_remove(threads->messages, message);
+	/* keep the container to hold the thread together */
+	tc = _threads_container(threads, c);
+	tc->message = NULL;
+	/* move the replies out of the row before it is removed */
+	for(p = tc->child; p != 0; p = _threads_container(threads, p)->next)
+		_threads_place(threads, p);
+}
+
+
+/* private */
+/* functions */
+/* threads_container_get */
+static int _threads_container_get(Threads * threads, char const * id,
+		size_t len, size_t * container)
+{
+	char buf[256];
+	char * key = buf;
+	gpointer p;
+
+	if(len < sizeof(buf))
+	{
+		memcpy(buf, id, len);
+		buf[len] = '\0';
+	}
+	else if((key = g_strndup(id, len)) == NULL)
+		return -1;
+	if((p = g_hash_table_lookup(threads->ids, key)) != NULL)
+	{
+		if(key != buf)
+			g_free(key);
+		*container = GPOINTER_TO_SIZE(p);
+		return 0;
+	}
+	if(key == buf && (key = g_strdup(buf)) == NULL)
+		return -1;
+	if(_threads_container_new(threads, container) != 0)
+	{
+		g_free(key);
+		return -1;
+	}
+	_threads_container(threads, *container)->id = key;
+	g_hash_table_insert(threads->ids, key, GSIZE_TO_POINTER(*container));
+	return 0;
+}
+
+
+/* threads_container_new */
+static int _threads_container_new(Threads * threads, size_t * container)
+{
+	ThreadsContainer * p;
+	size_t size;
+
+	if(threads->containers_cnt == threads->containers_size)
+	{
+		size = (threads->containers_size > 0)
+			? threads->containers_size * 2
+			: THREADS_CONTAINERS_SIZE;
+		if((p = realloc(threads->containers, sizeof(*p) * size))
+				== NULL)
+			return -1;
+		threads->containers = p;
+		threads->containers_size = size;
+	}
+	p = &threads->containers[threads->containers_cnt++];
+	p->message = NULL;
+	p->id = NULL;
+	p->parent = 0;
+	p->child = 0;
+	p->next = 0;
+	*container = threads->containers_cnt;
+	return 0;
+}
+
+
+/* threads_id */
+static char const * _threads_id(char const * references, char const ** id,
+		size_t * len)
+{
+	char const * p;
+	char const * q;
+
+	/* "<id>", or the next word when not bracketed at all */
+	if(references == NULL)
+		return NULL;
+	if((p = strchr(references, '<')) != NULL)
+	{
+		if((q = strchr(++p, '>')) == NULL || q == p)
+			return NULL;
+		*id = p;
+		*len = q - p;
+		return q + 1;
+	}
+	p = references + strspn(references, " \t\r\n");
+	if((*len = strcspn(p, " \t\r\n")) == 0)
+		return NULL;
+	*id = p;
+	return p + *len;
+}
+
+
+/* threads_parent */
+static int _threads_parent(Threads * threads, size_t container,
+		size_t parent)
+{
+	ThreadsContainer * tc = _threads_container(threads, container);
+	ThreadsContainer * pc;
+	size_t * p;
+	size_t q;
+
+	/* do not create loops */
+	for(q = parent; q != 0; q = _threads_container(threads, q)->parent)
+		if(q == container)
+			return -1;
+	if(tc->parent != 0)
+	{
+		pc = _threads_container(threads, tc->parent);
+		for(p = &pc->child; *p != container;
+				p = &_threads_container(threads, *p)->next);
+		*p = tc->next;
+		tc->next = 0;
+	}
+	if((tc->parent = parent) != 0)
+	{
+		pc = _threads_container(threads, parent);
+		tc->next = pc->child;
+		pc->child = container;
+	}
+	return 0;
+}
+
+
+/* threads_place */
+static void _threads_move(Threads * threads, GtkTreeIter * iter,
+		GtkTreeIter * parent);
+
+static void _threads_place(Threads * threads, size_t container)
+{
+	GtkTreeModel * model = GTK_TREE_MODEL(threads->store);
+	ThreadsContainer * tc = _threads_container(threads, container);
+	ThreadsContainer * pc = NULL;
+	size_t p;
+	GtkTreeIter iter;
+	GtkTreeIter parent;
+	GtkTreeIter current;
+	Message * message = NULL;
+
+	if(tc->message != NULL && message_get_iter(tc->message, &iter))
+	{
+		/* display the row under the closest ancestor displayed */
+		for(p = tc->parent; p != 0; p = pc->parent)
+			if((pc = _threads_container(threads, p))->message
+					!= NULL && message_get_iter(
+						pc->message, &parent))
+				break;
+		if(gtk_tree_model_iter_parent(model, &current, &iter))
+			gtk_tree_model_get(model, &current, MHC_MESSAGE,
+					&message, -1);
+		if(p == 0 && message != NULL)
+			_threads_move(threads, &iter, NULL);
+		else if(p != 0 && message != pc->message
+				&& !gtk_tree_store_is_ancestor(threads->store,
+					&iter, &parent))
+			_threads_move(threads, &iter, &parent);
+	}
+	/* the rows of new replies may still be elsewhere */
+	for(p = tc->child; p != 0; p = _threads_container(threads, p)->next)
+		_threads_place(threads, p);
+}
+
+static void _threads_move(Threads * threads, GtkTreeIter * iter,
+		GtkTreeIter * parent)
+{
+	GtkTreeModel * model = GTK_TREE_MODEL(threads->store);
+	gint columns[MHC_COUNT];
+	GValue values[MHC_COUNT];
+	GtkTreeIter row;
+	GtkTreeIter child;
+	Message * message;
+	gint i;
+
+	/* copy the row, as GtkTreeStore cannot change the parent of rows */
+	memset(values, 0, sizeof(values));
+	for(i = 0; i < MHC_COUNT; i++)
+	{
+		columns[i] = i;
+		gtk_tree_model_get_value(model, iter, i, &values[i]);
+	}
+	gtk_tree_store_insert_with_valuesv(threads->store, &row, parent, -1,
+			columns, values, MHC_COUNT);
+	for(i = 0; i < MHC_COUNT; i++)
+		g_value_unset(&values[i]);
+	while(gtk_tree_model_iter_children(model, &child, iter))
+		_threads_move(threads, &child, &row);
+	gtk_tree_model_get(model, &row, MHC_MESSAGE, &message, -1);
+	if(message != NULL)
+		message_set_iter(message, &row);
+	gtk_tree_store_remove(threads->store, iter);
+}
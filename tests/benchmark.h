@@ -0,0 +1,61 @@
+/* $Id$ */
+/* Copyright (c) 2024 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Desktop Mailer */
+/* All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+
+#ifndef MAILER_TESTS_BENCHMARK_H
+# define MAILER_TESTS_BENCHMARK_H
+
+# include <stdlib.h>
+# include <string.h>
+# include <time.h>
+
+
+/* benchmark */
+/* functions */
+/* benchmark_elapsed */
+static double _benchmark_elapsed(struct timespec * before)
+{
+	struct timespec after;
+
+	clock_gettime(CLOCK_MONOTONIC, &after);
+	return (after.tv_sec - before->tv_sec)
+		+ (after.tv_nsec - before->tv_nsec) / 1000000000.0;
+}
+
+
+/* benchmark_enabled
+ * the benchmarks only run when asked to, with "-b" or MAILER_BENCHMARK set */
+static int _benchmark_enabled(int argc, char * argv[])
+{
+	if(argc > 1 && strcmp(argv[1], "-b") == 0)
+		return 1;
+	return getenv("MAILER_BENCHMARK") != NULL;
+}
+
+#endif /* !MAILER_TESTS_BENCHMARK_H */
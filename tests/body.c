@@ -0,0 +1,163 @@
+/* $Id$ */
+/* Copyright (c) 2024 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Desktop Mailer */
+/* All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "../src/body.c"
+#include "benchmark.h"
+
+
+/* constants */
+#define BODY_BENCHMARK_SIZE	(10 * 1024 * 1024)
+
+
+/* body */
+static int _body(char const * progname)
+{
+	int ret = 0;
+	Body * body;
+	char buf[4096];
+	char * expected;
+	size_t i;
+	size_t j;
+	size_t cnt = 0;
+	FILE * fp;
+
+	printf("%s: Testing appends\n", progname);
+	if((body = body_new()) == NULL
+			|| (expected = malloc(sizeof(buf) * 64)) == NULL)
+		return 2;
+	for(i = 0; i < sizeof(buf); i++)
+		buf[i] = 'a' + (i % 26);
+	/* append slices of varying size, across reallocations */
+	for(i = 0, j = 0; cnt + j < sizeof(buf) * 64; i++, j = (i * 37) % 4096)
+	{
+		memcpy(&expected[cnt], buf, j);
+		cnt += j;
+		if(body_append(body, buf, j) != 0)
+			ret = 1;
+		if(i % 50 == 0 && (body_get_size(body) != cnt
+					|| memcmp(body_get_data(body), expected,
+						cnt) != 0))
+			ret = 1;
+	}
+	if(body_get_size(body) != cnt
+			|| memcmp(body_get_data(body), expected, cnt) != 0
+			|| body_get_data(body)[cnt] != '\0')
+		ret = 1;
+	/* write the data */
+	if((fp = tmpfile()) == NULL)
+		ret = 1;
+	else
+	{
+		body_append(body, "end", 3);
+		memcpy(&expected[cnt], "end", 3);
+		if(body_write(body, fp) != 0 || fseek(fp, 0, SEEK_SET) != 0)
+			ret = 1;
+		for(i = 0; ret == 0 && i < cnt + 3; i += j)
+			if((j = fread(buf, 1, sizeof(buf), fp)) == 0
+					|| memcmp(buf, &expected[i], j) != 0)
+				ret = 1;
+		fclose(fp);
+	}
+	body_reset(body);
+	if(body_get_size(body) != 0 || strcmp(body_get_data(body), "") != 0)
+		ret = 1;
+	if(ret != 0)
+		fprintf(stderr, "%s: %s\n", progname,
+				"Does not match the data appended");
+	free(expected);
+	body_delete(body);
+	return ret;
+}
+
+
+/* benchmark */
+static int _benchmark(char const * progname)
+{
+	Body * body;
+	char const line[] = "Lorem ipsum dolor sit amet, consectetur adipiscing"
+		" elit, sed do eiusmod tempor";
+	size_t len = sizeof(line) - 1;
+	size_t i;
+	struct timespec before;
+	double elapsed;
+	char * p = NULL;
+	char * q;
+	size_t cnt = 0;
+
+	/* as done by the account plugins: a line, then its end */
+	printf("%s: Appending %u MB in lines\n", progname,
+			BODY_BENCHMARK_SIZE / 1024 / 1024);
+	if((body = body_new()) == NULL)
+		return 2;
+	clock_gettime(CLOCK_MONOTONIC, &before);
+	for(i = 0; i < BODY_BENCHMARK_SIZE; i += len + 2)
+		if(body_append(body, line, len) != 0
+				|| body_append(body, "\r\n", 2) != 0)
+			break;
+	body_get_data(body);
+	elapsed = _benchmark_elapsed(&before);
+	printf("%s: doubling: %.3f s (%.1f MB/s)\n", progname, elapsed,
+			BODY_BENCHMARK_SIZE / elapsed / 1024 / 1024);
+	body_delete(body);
+	/* with a reallocation for every append */
+	clock_gettime(CLOCK_MONOTONIC, &before);
+	for(i = 0; i < BODY_BENCHMARK_SIZE; i += len + 2)
+	{
+		if((q = realloc(p, cnt + len)) == NULL)
+			break;
+		memcpy(&(p = q)[cnt], line, len);
+		cnt += len;
+		if((q = realloc(p, cnt + 2)) == NULL)
+			break;
+		memcpy(&(p = q)[cnt], "\r\n", 2);
+		cnt += 2;
+	}
+	elapsed = _benchmark_elapsed(&before);
+	printf("%s: realloc: %.3f s (%.1f MB/s)\n", progname, elapsed,
+			BODY_BENCHMARK_SIZE / elapsed / 1024 / 1024);
+	free(p);
+	return 0;
+}
+
+
+/* main */
+int main(int argc, char * argv[])
+{
+	int ret = 0;
+
+	ret += _body(argv[0]);
+	if(_benchmark_enabled(argc, argv))
+		ret += _benchmark(argv[0]);
+	return (ret == 0) ? 0 : ret + 1;
+}
@@ -0,0 +1,298 @@
+/* $Id$ */
+/* Copyright (c) 2024 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Desktop Mailer */
+/* All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "../src/codec.c"
+#include "benchmark.h"
+
+
+/* constants */
+#define CODEC_BENCHMARK_SIZE	(16 * 1024 * 1024)
+#define CODEC_FUZZ_COUNT	2000
+#define CODEC_FUZZ_SIZE		4096
+
+
+/* variables */
+static struct
+{
+	char const * name;
+	CodecBase64Decode * decode;
+	CodecBase64Encode * encode;
+	int supported;
+} _implementations[] =
+{
+	{ "scalar", _codec_base64_decode_scalar, _codec_base64_encode_scalar,
+		1 },
+#ifdef CODEC_X86
+	{ "ssse3", _codec_base64_decode_ssse3, _codec_base64_encode_ssse3, 0 },
+	{ "avx2", _codec_base64_decode_avx2, _codec_base64_encode_avx2, 0 },
+#endif
+	{ NULL, NULL, NULL, 0 }
+};
+
+
+/* reference */
+/* a straightforward implementation, to compare against */
+static size_t _reference_decode(char const * buf, size_t cnt, char * out)
+{
+	size_t ret = 0;
+	size_t i;
+	char const * p;
+	unsigned int bits = 0;
+	unsigned int bits_cnt = 0;
+
+	for(i = 0; i < cnt; i++)
+	{
+		if(buf[i] == '\0' || (p = strchr(_codec_base64, buf[i])) == NULL)
+			continue;
+		bits = (bits << 6) | (p - _codec_base64);
+		if((bits_cnt += 6) >= 8)
+		{
+			bits_cnt -= 8;
+			out[ret++] = (bits >> bits_cnt) & 0xff;
+		}
+	}
+	return ret;
+}
+
+
+/* fuzz */
+static int _fuzz_base64(char const * progname, char * buf, char * enc,
+		char * dec, size_t cnt);
+static int _fuzz_qp(char const * progname, char * buf, char * enc, char * dec,
+		size_t cnt);
+
+static int _fuzz(char const * progname)
+{
+	int ret = 0;
+	char * buf;
+	char * enc;
+	char * dec;
+	size_t i;
+	size_t j;
+	size_t cnt;
+
+	printf("%s: Comparing %u random buffers\n", progname,
+			CODEC_FUZZ_COUNT);
+	buf = malloc(CODEC_FUZZ_SIZE);
+	enc = malloc(codec_qp_encode_size(CODEC_FUZZ_SIZE) + 64);
+	dec = malloc(codec_qp_encode_size(CODEC_FUZZ_SIZE) + 64);
+	if(buf == NULL || enc == NULL || dec == NULL)
+		return 2;
+	srand(time(NULL));
+	for(i = 0; ret == 0 && i < CODEC_FUZZ_COUNT; i++)
+	{
+		cnt = rand() % CODEC_FUZZ_SIZE;
+		for(j = 0; j < cnt; j++)
+			buf[j] = rand();
+		ret |= _fuzz_base64(progname, buf, enc, dec, cnt);
+		ret |= _fuzz_qp(progname, buf, enc, dec, cnt);
+	}
+	free(buf);
+	free(enc);
+	free(dec);
+	return ret;
+}
+
+static int _fuzz_base64(char const * progname, char * buf, char * enc,
+		char * dec, size_t cnt)
+{
+	size_t i;
+	size_t len;
+	size_t ref;
+	size_t split;
+	size_t size;
+	CodecState state;
+
+	size = codec_base64_encode_size(cnt);
+	len = _codec_base64_encode_scalar(buf, cnt, enc);
+	if(len != size || _reference_decode(enc, len, dec) != cnt
+			|| memcmp(buf, dec, cnt) != 0)
+	{
+		fprintf(stderr, "%s: %s\n", progname,
+				"The scalar encoding differs from the reference");
+		return 1;
+	}
+	for(i = 0; _implementations[i].name != NULL; i++)
+	{
+		if(!_implementations[i].supported)
+			continue;
+		/* encode, then compare with the scalar output */
+		memset(dec, 0, size);
+		if(_implementations[i].encode(buf, cnt, dec) != len
+				|| memcmp(enc, dec, len) != 0)
+		{
+			fprintf(stderr, "%s: %s: %s\n", progname,
+					_implementations[i].name,
+					"The encoding differs");
+			return 1;
+		}
+		/* decode in two parts */
+		split = (len > 0) ? rand() % len : 0;
+		memset(&state, 0, sizeof(state));
+		ref = _implementations[i].decode(&state, enc, split, dec);
+		ref += _implementations[i].decode(&state, &enc[split],
+				len - split, &dec[ref]);
+		if(ref != cnt || memcmp(buf, dec, cnt) != 0)
+		{
+			fprintf(stderr, "%s: %s: %s\n", progname,
+					_implementations[i].name,
+					"The decoding differs");
+			return 1;
+		}
+	}
+	/* with characters out of the alphabet */
+	for(i = 0; len > 0 && i < 8; i++)
+		enc[rand() % len] = "\t\r\n =-!\xff"[i];
+	ref = _reference_decode(enc, len, buf);
+	for(i = 0; _implementations[i].name != NULL; i++)
+	{
+		if(!_implementations[i].supported)
+			continue;
+		memset(&state, 0, sizeof(state));
+		if(_implementations[i].decode(&state, enc, len, dec) != ref
+				|| memcmp(buf, dec, ref) != 0)
+		{
+			fprintf(stderr, "%s: %s: %s\n", progname,
+					_implementations[i].name,
+					"The decoding of invalid data differs");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int _fuzz_qp(char const * progname, char * buf, char * enc, char * dec,
+		size_t cnt)
+{
+	size_t i;
+	size_t j;
+	size_t len;
+
+	/* line endings are converted to CRLF */
+	for(i = 0; i < cnt; i++)
+		if(buf[i] == '\n' && (i == 0 || buf[i - 1] != '\r'))
+			buf[i] = ' ';
+	len = codec_qp_encode(buf, cnt, enc);
+	for(i = 0, j = 0; i < len; i++)
+		if(enc[i] == '\n')
+			j = 0;
+		else if(++j > 77)
+			break;
+	if(len > codec_qp_encode_size(cnt) || i != len
+			|| codec_qp_decode(enc, len, dec) != cnt
+			|| memcmp(buf, dec, cnt) != 0)
+	{
+		fprintf(stderr, "%s: %s\n", progname,
+				"The quoted-printable encoding differs");
+		return 1;
+	}
+	return 0;
+}
+
+
+/* benchmark */
+static int _benchmark(char const * progname)
+{
+	char * buf;
+	char * enc;
+	char * dec;
+	size_t i;
+	size_t len = 0;
+	struct timespec before;
+	double elapsed;
+	CodecState state;
+
+	buf = malloc(CODEC_BENCHMARK_SIZE);
+	enc = malloc(codec_base64_encode_size(CODEC_BENCHMARK_SIZE));
+	dec = malloc(codec_base64_encode_size(CODEC_BENCHMARK_SIZE));
+	if(buf == NULL || enc == NULL || dec == NULL)
+		return 2;
+	for(i = 0; i < CODEC_BENCHMARK_SIZE; i++)
+		buf[i] = rand();
+	printf("%s: Encoding and decoding %u MB\n", progname,
+			CODEC_BENCHMARK_SIZE / 1024 / 1024);
+	for(i = 0; _implementations[i].name != NULL; i++)
+	{
+		if(!_implementations[i].supported)
+			continue;
+		clock_gettime(CLOCK_MONOTONIC, &before);
+		len = _implementations[i].encode(buf, CODEC_BENCHMARK_SIZE,
+				enc);
+		elapsed = _benchmark_elapsed(&before);
+		printf("%s: %s: encoding: %.2f GB/s\n", progname,
+				_implementations[i].name, len / elapsed / 1e9);
+		memset(&state, 0, sizeof(state));
+		clock_gettime(CLOCK_MONOTONIC, &before);
+		_implementations[i].decode(&state, enc, len, dec);
+		elapsed = _benchmark_elapsed(&before);
+		printf("%s: %s: decoding: %.2f GB/s\n", progname,
+				_implementations[i].name, len / elapsed / 1e9);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &before);
+	_reference_decode(enc, len, dec);
+	elapsed = _benchmark_elapsed(&before);
+	printf("%s: reference: decoding: %.2f GB/s\n", progname,
+			len / elapsed / 1e9);
+	clock_gettime(CLOCK_MONOTONIC, &before);
+	len = codec_qp_encode(buf, CODEC_BENCHMARK_SIZE / 4, dec);
+	elapsed = _benchmark_elapsed(&before);
+	printf("%s: quoted-printable: encoding: %.2f GB/s\n", progname,
+			len / elapsed / 1e9);
+	clock_gettime(CLOCK_MONOTONIC, &before);
+	codec_qp_decode(dec, len, enc);
+	elapsed = _benchmark_elapsed(&before);
+	printf("%s: quoted-printable: decoding: %.2f GB/s\n", progname,
+			len / elapsed / 1e9);
+	free(buf);
+	free(enc);
+	free(dec);
+	return 0;
+}
+
+
+/* main */
+int main(int argc, char * argv[])
+{
+	int ret = 0;
+
+#ifdef CODEC_X86
+	__builtin_cpu_init();
+	_implementations[1].supported = __builtin_cpu_supports("ssse3");
+	_implementations[2].supported = __builtin_cpu_supports("avx2");
+#endif
+	ret += _fuzz(argv[0]);
+	if(_benchmark_enabled(argc, argv))
+		ret += _benchmark(argv[0]);
+	return (ret == 0) ? 0 : ret + 1;
+}
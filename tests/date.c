@@ -30,9 +30,82 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include "../src/helper.c"
+#include "benchmark.h"
 
 
+/* constants */
+#define DATE_BENCHMARK_COUNT	200000
+
+
+/* variables */
+static char const * _dates[] =
+{
+	"Thu, 10 Nov 2011 10:11:12 -0000 (CET)",
+	"Mon, 3 Feb 2020 08:00:01 +0100",
+	"21 Jun 1999 23:59:59 GMT",
+	"Sat, 29 Feb 2020 12:00 -0800",
+	"10/11/2011 10:11:12"
+};
+
+
+/* reference */
+/* the former implementation, to compare against */
+static int _reference_do(char const * date, char const * format, struct tm * tm)
+{
+	char const * p;
+
+	memset(tm, 0, sizeof(*tm));
+	if((p = strptime(date, format, tm)) != NULL && *p == '\0')
+		return 0;
+	if(p != NULL && tm->tm_year != 0 && tm->tm_mday != 0)
+		return 0;
+	return -1;
+}
+
+static time_t _reference_get_date(char const * date, struct tm * tm)
+{
+	if(_reference_do(date, "%a, %d %b %Y %T %z (%z)", tm) == 0
+			|| _reference_do(date, "%a, %d %b %Y %T %z", tm) == 0
+			|| _reference_do(date, "%d %b %Y %T %z", tm) == 0
+			|| _reference_do(date, "%d/%m/%Y %T %z", tm) == 0
+			|| _reference_do(date, "%d/%m/%Y %T", tm) == 0
+			|| _reference_do(date, "%FT%TZ", tm) == 0)
+		return mktime(tm);
+	return -1;
+}
+
+
+/* benchmark */
+static int _benchmark(char const * progname)
+{
+	struct timespec before;
+	double elapsed;
+	struct tm tm;
+	char buf[32];
+	size_t i;
+	size_t count = sizeof(_dates) / sizeof(*_dates);
+
+	printf("%s: Parsing %u dates\n", progname, DATE_BENCHMARK_COUNT);
+	clock_gettime(CLOCK_MONOTONIC, &before);
+	for(i = 0; i < DATE_BENCHMARK_COUNT; i++)
+		mailer_helper_get_date(_dates[i % count], &tm);
+	elapsed = _benchmark_elapsed(&before);
+	printf("%s: parser: %.0f dates/s\n", progname,
+			DATE_BENCHMARK_COUNT / elapsed);
+	clock_gettime(CLOCK_MONOTONIC, &before);
+	for(i = 0; i < DATE_BENCHMARK_COUNT; i++)
+	{
+		_reference_get_date(_dates[i % count], &tm);
+		strftime(buf, sizeof(buf), "%d/%m/%Y %H:%M:%S", &tm);
+	}
+	elapsed = _benchmark_elapsed(&before);
+	printf("%s: reference: %.0f dates/s\n", progname,
+			DATE_BENCHMARK_COUNT / elapsed);
+	return 0;
+}
+
 /* date */
 static int _date(char const * progname, char const * expected, char const * str)
 {
@@ -54,6 +127,41 @@ static int _date(char const * progname, char const * expected, char const * str)
 }
 
 
+/* date_time */
+static int _date_time(char const * progname, time_t expected,
+		char const * str)
+{
+	struct tm tm;
+	time_t t;
+
+	printf("%s: Testing \"%s\"\n", progname, str);
+	if((t = mailer_helper_get_date(str, &tm)) != expected)
+	{
+		fprintf(stderr, "%s: %ld: %s\n", progname, (long)t,
+				"Does not match the expected time");
+		return 1;
+	}
+	return 0;
+}
+
+
+/* date_none */
+static int _date_none(char const * progname, char const * str)
+{
+	struct tm tm;
+	time_t t;
+
+	printf("%s: Testing \"%s\"\n", progname, (str != NULL) ? str : "");
+	if(mailer_helper_parse_date(str, &tm, &t) == 0)
+	{
+		fprintf(stderr, "%s: %ld: %s\n", progname, (long)t,
+				"Parsed an invalid date");
+		return 1;
+	}
+	return 0;
+}
+
+
 /* main */
 int main(int argc, char * argv[])
 {
@@ -66,7 +174,25 @@ int main(int argc, char * argv[])
 			"Thu, 10 Nov 2011 10:11:12 -0000 (CET)");
 	ret += _date(argv[0], expected,
 			"Thu, 10 Nov 2011 10:11:12 +0000");
+	ret += _date(argv[0], expected, "2011-11-10T10:11:12Z");
+	ret += _date(argv[0], expected, "thu,10 nov 11 10:11:12 EST");
+	ret += _date(argv[0], "29/02/2020 12:00:00",
+			"Sat, 29 Feb 2020 12:00 -0800");
 	ret += _date(argv[0], NULL, "");
 	ret += _date(argv[0], NULL, NULL);
+	ret += _date_time(argv[0], 1320919872,
+			"Thu, 10 Nov 2011 10:11:12 +0000");
+	ret += _date_time(argv[0], 1320919872,
+			"Thu, 10 Nov 2011 11:11:12 +0100 (CET)");
+	ret += _date_time(argv[0], 1320919872,
+			"Thu, 10 Nov 2011 05:11:12 EST");
+	ret += _date_time(argv[0], 951825600, "29 Feb 2000 12:00:00 GMT");
+	ret += _date_time(argv[0], -86400, "31 Dec 1969 00:00:00 UT");
+	ret += _date_none(argv[0], "");
+	ret += _date_none(argv[0], NULL);
+	ret += _date_none(argv[0], "yesterday");
+	ret += _date_none(argv[0], "31 Foo 2011 10:11:12");
+	if(_benchmark_enabled(argc, argv))
+		ret += _benchmark(argv[0]);
 	return (ret == 0) ? 0 : ret + 1;
 }
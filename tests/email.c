@@ -28,11 +28,117 @@
 
 
 
+#include <ctype.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include "Mailer.h"
+#include "benchmark.h"
 
 
+/* constants */
+#define EMAIL_BENCHMARK_COUNT	200000
+
+
+/* variables */
+static char const * _headers[] =
+{
+	"John Doe <john@doe.com>",
+	"\"Doe, John\" <john@doe.com>",
+	"john@doe.com (John Doe)",
+	"john@doe.com"
+};
+
+
+/* reference */
+/* the former implementation, to compare against */
+static char * _reference_get_email(char const * header)
+{
+	char * ret;
+	size_t len;
+	char * buf = NULL;
+
+	len = strlen(header);
+	if((ret = malloc(len + 1)) == NULL || (buf = malloc(len + 1)) == NULL)
+	{
+		free(buf);
+		free(ret);
+		return NULL;
+	}
+	if(sscanf(header, "%[^(](%[^)])", ret, buf) == 2
+			|| sscanf(header, "<%[^>]>", ret) == 1
+			|| sscanf(header, "%[^<]<%[^>]>", buf, ret) == 2)
+	{
+		for(len = strlen(ret); len > 0
+				&& isblank((unsigned char)ret[len - 1]); len--)
+			ret[len - 1] = '\0';
+		free(buf);
+		return ret;
+	}
+	free(buf);
+	free(ret);
+	return NULL;
+}
+
+static char * _reference_get_name(char const * header)
+{
+	char * ret;
+	size_t len;
+	char * buf = NULL;
+
+	len = strlen(header);
+	if((ret = malloc(len + 1)) == NULL || (buf = malloc(len + 1)) == NULL)
+	{
+		free(buf);
+		free(ret);
+		return NULL;
+	}
+	if(sscanf(header, "%[^(](%[^)])", buf, ret) != 2
+			&& sscanf(header, "<%[^>]>", ret) != 1
+			&& sscanf(header, "%[^<]<%[^>]>", ret, buf) != 2)
+	{
+		free(buf);
+		free(ret);
+		return NULL;
+	}
+	free(buf);
+	return ret;
+}
+
+
+/* benchmark */
+static int _benchmark(char const * progname)
+{
+	struct timespec before;
+	double elapsed;
+	MailerHelperAddress address;
+	char buf[256];
+	size_t i;
+	size_t count = sizeof(_headers) / sizeof(*_headers);
+
+	printf("%s: Parsing %u addresses\n", progname, EMAIL_BENCHMARK_COUNT);
+	clock_gettime(CLOCK_MONOTONIC, &before);
+	for(i = 0; i < EMAIL_BENCHMARK_COUNT; i++)
+		if(mailer_helper_get_address(_headers[i % count], &address)
+				!= NULL)
+			mailer_helper_get_address_name(&address, buf,
+					sizeof(buf));
+	elapsed = _benchmark_elapsed(&before);
+	printf("%s: tokenizer: %.0f addresses/s\n", progname,
+			EMAIL_BENCHMARK_COUNT / elapsed);
+	clock_gettime(CLOCK_MONOTONIC, &before);
+	for(i = 0; i < EMAIL_BENCHMARK_COUNT; i++)
+	{
+		free(_reference_get_email(_headers[i % count]));
+		free(_reference_get_name(_headers[i % count]));
+	}
+	elapsed = _benchmark_elapsed(&before);
+	printf("%s: reference: %.0f addresses/s\n", progname,
+			EMAIL_BENCHMARK_COUNT / elapsed);
+	return 0;
+}
+
 /* email */
 static int _email(char const * progname, char const * name, char const * email,
 		char const * str)
@@ -62,6 +168,54 @@ static int _email(char const * progname, char const * name, char const * email,
 }
 
 
+/* email_none */
+static int _email_none(char const * progname, char const * str)
+{
+	char * e;
+
+	printf("%s: Testing \"%s\"\n", progname, str);
+	if((e = mailer_helper_get_email(str)) == NULL)
+		return 0;
+	fprintf(stderr, "%s: %s: %s\n", progname, e,
+			"Unexpected e-mail");
+	free(e);
+	return 1;
+}
+
+
+/* list */
+static int _list(char const * progname, char const * expected,
+		char const * str)
+{
+	MailerHelperAddress address;
+	char buf[256];
+	char const * p;
+	size_t len = 0;
+
+	/* the names and e-mails, as "name <email>" separated with "|" */
+	printf("%s: Testing \"%s\"\n", progname, str);
+	buf[0] = '\0';
+	for(p = str; (p = mailer_helper_get_address(p, &address)) != NULL;)
+	{
+		if(address.email_len == 0)
+			continue;
+		if(len > 0)
+			len += snprintf(&buf[len], sizeof(buf) - len, "|");
+		len += mailer_helper_get_address_name(&address, &buf[len],
+				sizeof(buf) - len);
+		len += snprintf(&buf[len], sizeof(buf) - len, " <%.*s>",
+				(int)address.email_len, address.email);
+	}
+	if(strcmp(buf, expected) != 0)
+	{
+		fprintf(stderr, "%s: %s: %s\n", progname, buf,
+				"Does not match the addresses");
+		return 1;
+	}
+	return 0;
+}
+
+
 /* main */
 int main(int argc, char * argv[])
 {
@@ -78,5 +232,26 @@ int main(int argc, char * argv[])
 			"\"John Doe\" <john@doe.com>");
 	ret += _email(argv[0], "John Doe", "john@doe.com",
 			"'John Doe' <john@doe.com>");
+	ret += _email(argv[0], "Doe, John", "john@doe.com",
+			"\"Doe, John\" <john@doe.com>");
+	ret += _email(argv[0], "John \"JD\" Doe", "john@doe.com",
+			"\"John \\\"JD\\\" Doe\" <john@doe.com>");
+	ret += _email(argv[0], "John Doe", "john-doe+list@doe.com",
+			"John Doe (work) <john-doe+list@doe.com>");
+	ret += _email(argv[0], "John (the) Doe", "john@doe.com",
+			"  john@doe.com  ( John (the) Doe )  ");
+	ret += _email(argv[0], "John Doe", "john@doe.com",
+			"John Doe <@relay.com:john@doe.com>");
+	ret += _email_none(argv[0], ", a@b");
+	ret += _email_none(argv[0], "John Doe");
+	ret += _list(argv[0], "Doe, John <john@doe.com>|jane@doe.com"
+			" <jane@doe.com>", "\"Doe, John\" <john@doe.com>,"
+			" jane@doe.com");
+	ret += _list(argv[0], "a@b.c <a@b.c>|b@b.c <b@b.c>|Carol <c@b.c>",
+			"Team: a@b.c, <b@b.c>;, Carol <c@b.c>");
+	ret += _list(argv[0], "", "undisclosed-recipients:;");
+	ret += _list(argv[0], "", "");
+	if(_benchmark_enabled(argc, argv))
+		ret += _benchmark(argv[0]);
 	return ret;
 }
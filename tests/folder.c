@@ -0,0 +1,223 @@
+/* $Id$ */
+/* Copyright (c) 2024 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Desktop Mailer */
+/* All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "../src/folder.c"
+#include "benchmark.h"
+
+
+/* constants */
+#define FOLDER_BENCHMARK_COUNT	100000
+
+
+/* prototypes */
+static int _folder_benchmark(char const * progname, Folder * folder);
+static int _folder_sort(char const * progname, Folder * folder);
+static int _folder_sorted(char const * progname, Folder * folder,
+		MailerHeaderColumn column);
+
+
+/* functions */
+/* folder_benchmark */
+static int _folder_benchmark(char const * progname, Folder * folder)
+{
+	int ret = 0;
+	GtkTreeStore * store = folder_get_messages(folder);
+	GtkTreeSortable * sortable = GTK_TREE_SORTABLE(store);
+	struct
+	{
+		MailerHeaderColumn column;
+		char const * name;
+	} columns[] =
+	{
+		{ MHC_SUBJECT,	"subject"	},
+		{ MHC_FROM,	"sender"	},
+		{ MHC_DATE,	"date"		}
+	};
+	Message ** messages;
+	struct timespec before;
+	double elapsed;
+	GtkTreeIter iter;
+	char buf[80];
+	unsigned long i;
+	unsigned long j;
+
+	if((messages = malloc(sizeof(*messages) * FOLDER_BENCHMARK_COUNT))
+			== NULL)
+		return -1;
+	printf("%s: Loading %u messages\n", progname, FOLDER_BENCHMARK_COUNT);
+	clock_gettime(CLOCK_MONOTONIC, &before);
+	for(i = 0; i < FOLDER_BENCHMARK_COUNT; i++)
+	{
+		/* as added by the accounts */
+		folder_sort_suspend(folder);
+		gtk_tree_store_insert_with_values(store, &iter, NULL, 0,
+				MHC_FOLDER, folder, -1);
+		if((messages[i] = message_new(NULL, store, &iter)) == NULL)
+			break;
+		/* threads of four messages, from 5000 correspondents */
+		j = (i * 7919) % FOLDER_BENCHMARK_COUNT;
+		snprintf(buf, sizeof(buf), "%s%lu", "Subject: Re: topic ",
+				j / 4);
+		message_set_header(messages[i], buf);
+		snprintf(buf, sizeof(buf), "%s%lu%s%lu%s",
+				"From: Correspondent ", j % 5000, " <c",
+				j % 5000, "@example.org>");
+		message_set_header(messages[i], buf);
+		snprintf(buf, sizeof(buf), "%s%lu%s%02lu:%02lu:%02lu%s",
+				"Date: ", j % 28 + 1, " Feb 2020 ",
+				j / 3600 % 24, j / 60 % 60, j % 60, " +0100");
+		message_set_header(messages[i], buf);
+	}
+	/* once done loading */
+	while(folder->sort_source != 0)
+		g_main_context_iteration(NULL, TRUE);
+	elapsed = _benchmark_elapsed(&before);
+	printf("%s: load: %.0f ms\n", progname, elapsed * 1000.0);
+	/* the target is under 100 ms for each */
+	for(j = 0; i == FOLDER_BENCHMARK_COUNT
+			&& j < sizeof(columns) / sizeof(*columns); j++)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &before);
+		gtk_tree_sortable_set_sort_column_id(sortable,
+				columns[j].column, GTK_SORT_ASCENDING);
+		elapsed = _benchmark_elapsed(&before);
+		printf("%s: sort by %s: %.0f ms\n", progname, columns[j].name,
+				elapsed * 1000.0);
+		ret |= _folder_sorted(progname, folder, columns[j].column);
+	}
+	if(i != FOLDER_BENCHMARK_COUNT)
+		ret = -error_set_print(progname, 1, "%s", error_get(NULL));
+	gtk_tree_store_clear(store);
+	while(i-- > 0)
+		message_delete(messages[i]);
+	free(messages);
+	return ret;
+}
+
+
+/* folder_sort */
+static int _folder_sort(char const * progname, Folder * folder)
+{
+	GtkTreeSortable * sortable = GTK_TREE_SORTABLE(
+			folder_get_messages(folder));
+	guint source;
+	gint column;
+	GtkSortType order;
+
+	printf("%s: Testing %s\n", progname, "sort suspension");
+	folder_sort_suspend(folder);
+	source = folder->sort_source;
+	/* the sorting is delayed as long as messages are added */
+	folder_sort_suspend(folder);
+	if(source == 0 || folder->sort_source == 0
+			|| folder->sort_source == source
+			|| gtk_tree_sortable_get_sort_column_id(sortable,
+				&column, &order) == TRUE)
+		return -error_set_print(progname, 1, "%s",
+				"Sorting not suspended");
+	/* sorted otherwise in the meantime */
+	gtk_tree_sortable_set_sort_column_id(sortable, MHC_SUBJECT,
+			GTK_SORT_ASCENDING);
+	folder_sort_suspend(folder);
+	if(gtk_tree_sortable_get_sort_column_id(sortable, &column, &order)
+			== TRUE)
+		return -error_set_print(progname, 1, "%s",
+				"Sorting not suspended again");
+	while(folder->sort_source != 0)
+		g_main_context_iteration(NULL, TRUE);
+	if(gtk_tree_sortable_get_sort_column_id(sortable, &column, &order)
+			!= TRUE || column != MHC_SUBJECT
+			|| order != GTK_SORT_ASCENDING)
+		return -error_set_print(progname, 1, "%s",
+				"Sorting not resumed");
+	gtk_tree_sortable_set_sort_column_id(sortable, MHC_DATE,
+			GTK_SORT_DESCENDING);
+	return 0;
+}
+
+
+/* folder_sorted */
+static int _folder_sorted(char const * progname, Folder * folder,
+		MailerHeaderColumn column)
+{
+	GtkTreeModel * model = GTK_TREE_MODEL(folder_get_messages(folder));
+	GtkTreeIter iter;
+	gboolean valid;
+	Message * message;
+	char const * p;
+	char const * q = NULL;
+
+	if(column != MHC_SUBJECT && column != MHC_FROM)
+		return 0;
+	/* the keys must not decrease along the threads */
+	for(valid = gtk_tree_model_get_iter_first(model, &iter); valid;
+			valid = gtk_tree_model_iter_next(model, &iter))
+	{
+		gtk_tree_model_get(model, &iter, MHC_MESSAGE, &message, -1);
+		if(message == NULL)
+			continue;
+		p = message_get_sort_key(message, column);
+		if(q != NULL && p != NULL && strcmp(q, p) > 0)
+			return -error_set_print(progname, 1, "%s: %s", p,
+					"Not sorted");
+		q = p;
+	}
+	return 0;
+}
+
+
+/* main */
+int main(int argc, char * argv[])
+{
+	int ret = 0;
+	GtkTreeStore * store;
+	GtkTreeIter iter;
+	Folder * folder;
+
+	store = gtk_tree_store_new(MFC_COUNT, G_TYPE_POINTER, G_TYPE_BOOLEAN,
+			G_TYPE_BOOLEAN, G_TYPE_POINTER, GDK_TYPE_PIXBUF,
+			G_TYPE_STRING);
+	gtk_tree_store_append(store, &iter, NULL);
+	if((folder = folder_new(NULL, FT_FOLDER, "folder", store, &iter))
+			== NULL)
+	{
+		g_object_unref(store);
+		return 2;
+	}
+	ret |= _folder_sort(argv[0], folder);
+	if(_benchmark_enabled(argc, argv))
+		ret |= _folder_benchmark(argv[0], folder);
+	folder_delete(folder);
+	g_object_unref(store);
+	return (ret == 0) ? 0 : 2;
+}
@@ -36,23 +36,40 @@
 #include "../src/account/imap4.c"
 
 
+/* variables */
+static unsigned int _helper_matches;
+static char _helper_message; /* opaque, only its address is used */
+
+
 /* prototypes */
 static int _imap4_fetch(char const * progname, char const * title,
 		IMAP4 * imap4, unsigned int id, char const * fetch,
 		unsigned int size);
 static int _imap4_flags(char const * progname, char const * title,
 		IMAP4 * imap4, unsigned int id, char const * flags);
+static int _imap4_journal(char const * progname, char const * title,
+		IMAP4 * imap4, char const * expected);
+static int _imap4_journal_failure(char const * progname, char const * title,
+		IMAP4 * imap4);
 static int _imap4_list(char const * progname, char const * title,
 		IMAP4 * imap4, char const * list);
+static int _imap4_search_literal(char const * progname, char const * title,
+		IMAP4 * imap4, IMAP4Capability capabilities,
+		char const * text, char const * expected);
+static int _imap4_search_results(char const * progname, char const * title,
+		IMAP4 * imap4, char const * search, unsigned int matches);
 static int _imap4_status(char const * progname, char const * title,
 		IMAP4 * imap4, char const * status);
 
 /* helpers */
+static int _helper_error(Account * account, char const * message, int ret);
 static void _helper_event(Account * account, AccountEvent * event);
 static Folder * _helper_folder_new(Account * account, AccountFolder * folder,
 		Folder * parent, FolderType type, char const * name);
 static Message * _helper_message_new(Account * account, Folder * folder,
 		AccountMessage * message);
+static void _helper_message_set_match(Message * message, int match);
+static int _helper_message_set_header(Message * message, char const * header);
 
 
 /* functions */
@@ -116,6 +133,121 @@ static int _imap4_flags(char const * progname, char const * title,
 }
 
 
+/* imap4_journal */
+static int _imap4_journal(char const * progname, char const * title,
+		IMAP4 * imap4, char const * expected)
+{
+	int ret = 0;
+	AccountFolder folder;
+	AccountMessage messages[8];
+	unsigned int uids[8] = { 1, 2, 3, 5, 7, 8, 9, 12 };
+	size_t i;
+	char * p;
+
+	printf("%s: Testing %s\n", progname, title);
+	memset(&folder, 0, sizeof(folder));
+	folder.name = "INBOX";
+	imap4->channel = (GIOChannel *)-1; /* XXX */
+	imap4->wr_source = 1; /* XXX do not send anything */
+	for(i = 0; i < sizeof(messages) / sizeof(*messages); i++)
+	{
+		memset(&messages[i], 0, sizeof(messages[i]));
+		messages[i].uid = uids[i];
+		ret |= _imap4_set_flag(imap4, &folder, &messages[i], MMF_READ,
+				1);
+	}
+	/* cancel one of the changes */
+	ret |= _imap4_set_flag(imap4, &folder, &messages[3], MMF_READ, 0);
+	ret |= _imap4_journal_flush(imap4);
+	/* expect SELECT then a UID STORE command without the change
+	 * cancelled */
+	if(ret == 0 && (imap4->queue_cnt != 2
+				|| (p = strchr(imap4->queue[1].buf, ' '))
+				== NULL || strcmp(++p, expected) != 0))
+		ret = -error_set_print(progname, 1, "%s",
+				"Unexpected UID STORE command");
+	/* the folder is selected already */
+	while(imap4->queue_cnt > 0)
+		_imap4_queue_pop(imap4);
+	imap4->selected = &folder;
+	imap4->selected_writable = TRUE;
+	ret |= _imap4_set_flag(imap4, &folder, &messages[0], MMF_READ, 0);
+	ret |= _imap4_journal_flush(imap4);
+	if(ret == 0 && (imap4->queue_cnt != 1
+				|| imap4->queue[0].context != I4C_STORE))
+		ret = -error_set_print(progname, 1, "%s",
+				"Unexpected SELECT command");
+	imap4->wr_source = 0;
+	imap4->channel = NULL;
+	_imap4_stop(imap4);
+	return ret;
+}
+
+
+/* imap4_journal_failure */
+static int _imap4_journal_failure(char const * progname, char const * title,
+		IMAP4 * imap4)
+{
+	int ret = 0;
+	AccountFolder folder;
+	AccountMessage messages[4];
+	AccountMessage * p[4];
+	size_t i;
+
+	printf("%s: Testing %s\n", progname, title);
+	memset(&folder, 0, sizeof(folder));
+	folder.name = "INBOX";
+	for(i = 0; i < sizeof(messages) / sizeof(*messages); i++)
+	{
+		memset(&messages[i], 0, sizeof(messages[i]));
+		messages[i].message = (Message *)&_helper_message;
+		messages[i].uid = i + 1;
+		p[i] = &messages[i];
+	}
+	folder.messages = p;
+	folder.messages_cnt = i;
+	imap4->channel = (GIOChannel *)-1; /* XXX */
+	imap4->wr_source = 1; /* XXX do not send anything */
+	for(i = 0; i < sizeof(messages) / sizeof(*messages); i++)
+		ret |= _imap4_set_flag(imap4, &folder, &messages[i], MMF_READ,
+				1);
+	ret |= _imap4_journal_flush(imap4);
+	/* the server refuses the changes */
+	if(ret == 0 && imap4->queue_cnt == 2)
+	{
+		_imap4_queue_pop(imap4);
+		imap4->queue[0].status = I4CS_PARSING;
+		_context_store(imap4, "NO [CANNOT] Permission denied");
+		for(i = 0; i < sizeof(messages) / sizeof(*messages); i++)
+			if(messages[i].flags & MMF_READ)
+				ret = -error_set_print(progname, 1, "%s",
+						"The flags were not reverted");
+		_imap4_queue_pop(imap4);
+	}
+	else
+		ret = -error_set_print(progname, 1, "%s",
+				"Unexpected UID STORE command");
+	/* the connection is lost before the changes are confirmed */
+	ret |= _imap4_set_flag(imap4, &folder, &messages[0], MMF_READ, 1);
+	ret |= _imap4_set_flag(imap4, &folder, &messages[1], MMF_READ, 1);
+	ret |= _imap4_journal_flush(imap4);
+	ret |= _imap4_set_flag(imap4, &folder, &messages[1], MMF_READ, 0);
+	imap4->wr_source = 0;
+	imap4->channel = NULL;
+	_imap4_stop(imap4);
+	if(ret == 0 && (imap4->journal_cnt != 3
+				|| imap4->journal[0].serial != 0
+				|| imap4->journal[2].uid != 2
+				|| imap4->journal[2].set != FALSE))
+		ret = -error_set_print(progname, 1, "%s",
+				"The changes were not kept");
+	free(imap4->journal);
+	imap4->journal = NULL;
+	imap4->journal_cnt = 0;
+	return ret;
+}
+
+
 /* imap4_list */
 static int _imap4_list(char const * progname, char const * title,
 		IMAP4 * imap4, char const * list)
@@ -141,6 +273,102 @@ static int _imap4_list(char const * progname, char const * title,
 }
 
 
+/* imap4_search_literal */
+static int _imap4_search_literal(char const * progname, char const * title,
+		IMAP4 * imap4, IMAP4Capability capabilities,
+		char const * text, char const * expected)
+{
+	int ret = 0;
+	AccountFolder folder;
+	GString * str;
+	char * p;
+
+	printf("%s: Testing %s\n", progname, title);
+	memset(&folder, 0, sizeof(folder));
+	folder.name = "INBOX";
+	imap4->channel = (GIOChannel *)-1; /* XXX */
+	imap4->wr_source = 1; /* XXX do not send anything */
+	imap4->capabilities = capabilities;
+	imap4->selected = &folder;
+	if(_imap4_search(imap4, &folder, text) != 0 || imap4->queue_cnt != 1)
+		ret = -error_set_print(progname, 1, "%s",
+				"Could not queue the search");
+	else
+	{
+		/* collect what is sent until the command is complete */
+		str = g_string_new(NULL);
+		g_string_append_len(str, imap4->queue[0].buf,
+				imap4->queue[0].buf_cnt);
+		imap4->queue[0].status = I4CS_SENT;
+		if(imap4->queue[0].literal != NULL)
+		{
+			imap4->rd_buf = strdup("+ Ready\r\n");
+			imap4->rd_buf_cnt = strlen(imap4->rd_buf);
+			_imap4_parse(imap4);
+			free(imap4->rd_buf);
+			imap4->rd_buf = NULL;
+			if(imap4->queue[0].status != I4CS_QUEUED)
+				ret = -error_set_print(progname, 1, "%s",
+						"Literal not sent");
+			g_string_append_len(str, imap4->queue[0].buf,
+					imap4->queue[0].buf_cnt);
+		}
+		if(ret == 0 && ((p = strchr(str->str, ' ')) == NULL
+					|| strcmp(++p, expected) != 0))
+			ret = -error_set_print(progname, 1, "%s",
+					"Unexpected UID SEARCH command");
+		g_string_free(str, TRUE);
+	}
+	imap4->wr_source = 0;
+	imap4->channel = NULL;
+	_imap4_stop(imap4);
+	return ret;
+}
+
+
+/* imap4_search_results */
+static int _imap4_search_results(char const * progname, char const * title,
+		IMAP4 * imap4, char const * search, unsigned int matches)
+{
+	int ret;
+	IMAP4Command * cmd;
+	AccountFolder folder;
+	AccountMessage messages[8];
+	AccountMessage * p[8];
+	size_t i;
+
+	printf("%s: Testing %s\n", progname, title);
+	if((cmd = malloc(sizeof(*cmd))) == NULL)
+		return -1;
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->context = I4C_SEARCH;
+	cmd->status = I4CS_SENT;
+	cmd->data.search.folder = &folder;
+	memset(&folder, 0, sizeof(folder));
+	for(i = 0; i < sizeof(messages) / sizeof(*messages); i++)
+	{
+		memset(&messages[i], 0, sizeof(messages[i]));
+		messages[i].message = (Message *)&_helper_message;
+		messages[i].id = i + 1;
+		messages[i].uid = (i + 1) * 2;
+		p[i] = &messages[i];
+	}
+	folder.messages = p;
+	folder.messages_cnt = i;
+	_helper_matches = 0;
+	imap4->channel = (GIOChannel *)-1; /* XXX */
+	imap4->queue = cmd;
+	imap4->queue_cnt = 1;
+	if((ret = _parse_context(imap4, search)) == 0)
+		ret = (_helper_matches == matches) ? 0
+			: -error_set_print(progname, 1, "%s",
+					"Wrong number of matches");
+	imap4->channel = NULL;
+	_imap4_stop(imap4);
+	return ret;
+}
+
+
 /* imap4_status */
 static int _imap4_status(char const * progname, char const * title,
 		IMAP4 * imap4, char const * status)
@@ -151,9 +379,20 @@ static int _imap4_status(char const * progname, char const * title,
 
 
 /* helpers */
+/* helper_error */
+static int _helper_error(Account * account, char const * message, int ret)
+{
+	(void)account;
+	(void)message;
+	return ret;
+}
+
+
 /* helper_event */
 static void _helper_event(Account * account, AccountEvent * event)
 {
+	(void)account;
+	(void)event;
 }
 
 
@@ -163,25 +402,63 @@ static Folder * _helper_folder_new(Account * account, AccountFolder * folder,
 {
 	static AccountFolder af;
 
+	(void)account;
+	(void)folder;
+	(void)parent;
+	(void)type;
+	(void)name;
 	memset(&af, 0, sizeof(af));
 	return &af;
 }
 
 
+/* helper_folder_set_count */
+static void _helper_folder_set_count(Folder * folder, unsigned int total,
+		unsigned int unread)
+{
+	(void)folder;
+	(void)total;
+	(void)unread;
+}
+
+
 /* helper_message_new */
 static Message * _helper_message_new(Account * account, Folder * folder,
 		AccountMessage * message)
 {
 	static AccountMessage am;
 
+	(void)account;
+	(void)folder;
+	(void)message;
 	memset(&am, 0, sizeof(am));
 	return &am;
 }
 
 
+/* helper_message_set_match */
+static void _helper_message_set_match(Message * message, int match)
+{
+	(void)message;
+	if(match)
+		_helper_matches++;
+}
+
+
+/* helper_message_set_header */
+static int _helper_message_set_header(Message * message, char const * header)
+{
+	(void)message;
+	(void)header;
+	return 0;
+}
+
+
 /* helper_message_set_flag */
 static void _helper_message_set_flag(Message * message, MailerMessageFlag flag)
 {
+	(void)message;
+	(void)flag;
 }
 
 
@@ -199,11 +476,19 @@ int main(int argc, char * argv[])
 	unsigned int fetch_size = 1024;
 	unsigned int flags_id = 12;
 	char const flags[] = "FLAGS (\\Seen \\Answered))";
+	char const search[] = "SEARCH 2 4 5 16";
+	char const esearch[] = "ESEARCH (TAG \"a0001\") UID ALL 1:6,12,20:14";
+	char const store[] = "UID STORE 1:3,7:9,12 +FLAGS.SILENT (\\Seen)\r\n";
+	char const text[] = "caf\xc3\xa9";
 
 	memset(&helper, 0, sizeof(helper));
+	helper.error = _helper_error;
 	helper.event = _helper_event;
 	helper.folder_new = _helper_folder_new;
+	helper.folder_set_count = _helper_folder_set_count;
 	helper.message_new = _helper_message_new;
+	helper.message_set_match = _helper_message_set_match;
+	helper.message_set_header = _helper_message_set_header;
 	helper.message_set_flag = _helper_message_set_flag;
 	memset(&imap4, 0, sizeof(imap4));
 	imap4.helper = &helper;
@@ -215,5 +500,24 @@ int main(int argc, char * argv[])
 	ret |= _imap4_fetch(argv[0], "FETCH (1/1)", &imap4, fetch_id, fetch,
 			fetch_size);
 	ret |= _imap4_flags(argv[0], "FLAGS (1/1)", &imap4, flags_id, flags);
+	ret |= _imap4_search_results(argv[0], "SEARCH (1/3)", &imap4, search,
+			3);
+	ret |= _imap4_search_results(argv[0], "SEARCH (2/3)", &imap4, esearch,
+			6);
+	ret |= _imap4_search_results(argv[0], "SEARCH (3/3)", &imap4,
+			"ESEARCH (TAG \"a0001\") UID", 0);
+	ret |= _imap4_search_literal(argv[0], "SEARCH literal (1/3)", &imap4,
+			I4CAP_NONE, "cafe", "UID SEARCH TEXT \"cafe\"\r\n");
+	ret |= _imap4_search_literal(argv[0], "SEARCH literal (2/3)", &imap4,
+			I4CAP_NONE, text, "UID SEARCH CHARSET UTF-8 TEXT {5}\r\n"
+			"caf\xc3\xa9\r\n");
+	ret |= _imap4_search_literal(argv[0], "SEARCH literal (3/3)", &imap4,
+			I4CAP_LITERALPLUS, text, "UID SEARCH CHARSET UTF-8 TEXT"
+			" {5+}\r\ncaf\xc3\xa9\r\n");
+	ret |= _imap4_journal(argv[0], "STORE (1/2)", &imap4, store);
+	free(imap4.journal);
+	imap4.journal = NULL;
+	imap4.journal_cnt = 0;
+	ret |= _imap4_journal_failure(argv[0], "STORE (2/2)", &imap4);
 	return (ret == 0) ? 0 : 2;
 }
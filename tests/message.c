@@ -0,0 +1,231 @@
+/* $Id$ */
+/* Copyright (c) 2024 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Desktop Mailer */
+/* All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../src/message.c"
+
+
+/* prototypes */
+static int _message_cache(char const * progname);
+static int _message_stream(char const * progname, char const * title,
+		char const * charset, char const * encoding, char const * text,
+		char const * expected);
+static int _message_text(char const * progname);
+
+static gchar * _stream_text(GtkTextBuffer * buffer);
+
+
+/* functions */
+/* message_cache */
+static int _message_cache(char const * progname)
+{
+	int ret = 0;
+	char const body[] = "Subject: cache\r\n\r\n0123456789abcdef\r\n";
+	Message * a;
+	Message * b;
+
+	printf("%s: Testing %s\n", progname, "cache");
+	if((a = message_new(NULL, NULL, NULL)) == NULL)
+		return -1;
+	if((b = message_new(NULL, NULL, NULL)) == NULL)
+	{
+		message_delete(a);
+		return -1;
+	}
+	message_cache_set_size(sizeof(body));
+	/* the first body is still being received when the second is */
+	message_set_body(a, body, sizeof(body) - 1, FALSE);
+	message_set_body(b, body, sizeof(body) - 1, FALSE);
+	message_set_body_complete(b);
+	if(a->body == NULL || body_get_size(a->body) == 0)
+		ret = -error_set_print(progname, 1, "%s",
+				"Body evicted while received");
+	else if(message_cache_lookup(a) != FALSE)
+		ret = -error_set_print(progname, 1, "%s",
+				"Body served while received");
+	else
+	{
+		/* the least recently used body is now released */
+		message_set_body_complete(a);
+		if(b->body != NULL && body_get_size(b->body) != 0)
+			ret = -error_set_print(progname, 1, "%s",
+					"Body not evicted");
+		else if(message_cache_lookup(a) != TRUE)
+			ret = -error_set_print(progname, 1, "%s",
+					"Body not served");
+	}
+	message_cache_set_size(MESSAGE_BODIES_SIZE);
+	message_delete(b);
+	message_delete(a);
+	return ret;
+}
+
+
+/* message_stream */
+static int _message_stream(char const * progname, char const * title,
+		char const * charset, char const * encoding, char const * text,
+		char const * expected)
+{
+	int ret = 0;
+	size_t len = strlen(text);
+	Message * message;
+	char * body;
+	size_t cnt = 0;
+	size_t i;
+	char const * p;
+	char const * q;
+	gchar * header;
+	gchar * streamed;
+	gchar * rendered;
+
+	printf("%s: Testing %s\n", progname, title);
+	/* encode the text as a sender would */
+	if((body = malloc(codec_base64_encode_size(len)
+					+ codec_qp_encode_size(len))) == NULL)
+		return -1;
+	if(strcmp(encoding, "base64") == 0)
+		for(i = 0; i < len; i += CODEC_BASE64_LINE)
+			cnt += codec_base64_encode(&text[i],
+					(len - i < CODEC_BASE64_LINE) ? len - i
+					: CODEC_BASE64_LINE, &body[cnt]);
+	else
+		cnt = codec_qp_encode(text, len, body);
+	if((message = message_new(NULL, NULL, NULL)) == NULL)
+	{
+		free(body);
+		return -1;
+	}
+	header = g_strdup_printf("%s%s", "Content-Type: text/plain; charset=",
+			charset);
+	message_set_header(message, header);
+	g_free(header);
+	header = g_strdup_printf("%s%s", "Content-Transfer-Encoding: ",
+			encoding);
+	message_set_header(message, header);
+	g_free(header);
+	/* the message is displayed while received, one line at a time */
+	message_get_body(message);
+	message_set_body(message, NULL, 0, FALSE);
+	for(p = body; p < &body[cnt]; p = q)
+	{
+		q = memchr(p, '\n', &body[cnt] - p);
+		q = (q != NULL) ? q + 1 : &body[cnt];
+		message_set_body(message, p, q - p, TRUE);
+	}
+	streamed = _stream_text(message_get_body(message));
+	/* display the message again, once received */
+	_message_text_release(message);
+	rendered = _stream_text(message_get_body(message));
+	if(strcmp(streamed, rendered) != 0)
+		ret = -error_set_print(progname, 1, "%s: \"%s\"",
+				"Unexpected text while streaming", streamed);
+	else if(strcmp(rendered, expected) != 0)
+		ret = -error_set_print(progname, 1, "%s: \"%s\"",
+				"Unexpected text", rendered);
+	g_free(rendered);
+	g_free(streamed);
+	message_delete(message);
+	free(body);
+	return ret;
+}
+
+static gchar * _stream_text(GtkTextBuffer * buffer)
+{
+	GtkTextIter start;
+	GtkTextIter end;
+
+	gtk_text_buffer_get_bounds(buffer, &start, &end);
+	return gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
+}
+
+
+/* message_text */
+static int _message_text(char const * progname)
+{
+	int ret = 0;
+	Message * messages[MESSAGE_TEXT_MAX + 1];
+	GtkTextBuffer * buffers[MESSAGE_TEXT_MAX];
+	size_t i;
+
+	printf("%s: Testing %s\n", progname, "texts");
+	for(i = 0; i < sizeof(messages) / sizeof(*messages); i++)
+		if((messages[i] = message_new(NULL, NULL, NULL)) == NULL)
+		{
+			while(i > 0)
+				message_delete(messages[--i]);
+			return -1;
+		}
+	/* every text is displayed, as if in as many windows */
+	for(i = 0; i < MESSAGE_TEXT_MAX; i++)
+		buffers[i] = g_object_ref(message_get_body(messages[i]));
+	message_get_body(messages[MESSAGE_TEXT_MAX]);
+	for(i = 0; i < MESSAGE_TEXT_MAX; i++)
+		if(messages[i]->text != buffers[i])
+			ret = -error_set_print(progname, 1, "%s",
+					"Text released while displayed");
+	for(i = 0; i < MESSAGE_TEXT_MAX; i++)
+		g_object_unref(buffers[i]);
+	for(i = 0; i < sizeof(messages) / sizeof(*messages); i++)
+		message_delete(messages[i]);
+	return ret;
+}
+
+
+/* main */
+int main(int argc, char * argv[])
+{
+	int ret = 0;
+	/* characters of two, three and four bytes across the lines */
+	char const text[] = "Voil\xc3\xa0 l'\xc3\xa9t\xc3\xa9, d\xc3\xa9j\xc3\xa0"
+		" \xe2\x80\xa6 \xc3\xa0 la plage \xf0\x9f\x8c\x9e sans cr\xc3"
+		"\xa8me \xe2\x82\xac ni parasol \xe2\x98\x82 ; ma\xc3\xaft"
+		"rise du fran\xc3\xa7" "ais \xc3\xa0 l'\xc3\xa9" "crit, "
+		"\xc3\xa9l\xc3\xa8ve \xc3\xa9m\xc3\xa9rite.\r\n";
+	char const invalid[] = "caf\xe9 cr\xe8me\r\n";
+	char const replaced[] = "caf\xef\xbf\xbd cr\xef\xbf\xbdme\r\n";
+	char const latin1[] = "caf\xe9 cr\xe8me br\xfbl\xe9" "e\r\n";
+	char const converted[] = "caf\xc3\xa9 cr\xc3\xa8me br\xc3\xbbl\xc3\xa9"
+		"e\r\n";
+
+	ret |= _message_cache(argv[0]);
+	ret |= _message_text(argv[0]);
+	ret |= _message_stream(argv[0], "base64 (1/3)", "UTF-8", "base64",
+			text, text);
+	ret |= _message_stream(argv[0], "base64 (2/3)", "UTF-8", "base64",
+			invalid, replaced);
+	ret |= _message_stream(argv[0], "base64 (3/3)", "ISO-8859-1",
+			"base64", latin1, converted);
+	ret |= _message_stream(argv[0], "quoted-printable", "UTF-8",
+			"quoted-printable", text, text);
+	message_cleanup();
+	return (ret == 0) ? 0 : 2;
+}
@@ -0,0 +1,464 @@
+/* $Id$ */
+/* Copyright (c) 2024 Pierre Pronchery <khorben@defora.org> */
+/* This file is part of DeforaOS Desktop Mailer */
+/* All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ * IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#define _AccountFolder _MailerFolder
+#define _AccountMessage _MailerMessage
+#include "../src/account/pop3.c"
+
+
+/* variables */
+static unsigned int _helper_completed;
+static unsigned int _helper_errors;
+static GString * _helper_messages[4];
+
+
+/* prototypes */
+static int _pop3_dele(char const * progname, char const * title,
+		POP3 * pop3, char const * answer, unsigned int id,
+		size_t deleted);
+static int _pop3_feed(POP3 * pop3, char const * buf, size_t cnt);
+static int _pop3_pipelining(char const * progname, char const * title,
+		POP3 * pop3, POP3Capability capabilities, POP3Context context,
+		int expected);
+static void _pop3_reset(POP3 * pop3);
+static int _pop3_state(char const * progname, char const * title,
+		POP3 * pop3);
+static int _pop3_transaction(char const * progname, char const * title,
+		POP3 * pop3, POP3Context context, char const * answer,
+		unsigned int errors, char const * expected[3]);
+
+/* helpers */
+static int _helper_error(Account * account, char const * message, int ret);
+static void _helper_event(Account * account, AccountEvent * event);
+static void _helper_message_delete(Message * message);
+static Message * _helper_message_new(Account * account, Folder * folder,
+		AccountMessage * message);
+static int _helper_message_set_body(Message * message, char const * buf,
+		size_t cnt, int append);
+static void _helper_message_set_body_complete(Message * message);
+static int _helper_message_set_header(Message * message, char const * header);
+
+
+/* functions */
+/* pop3_dele */
+static int _pop3_dele(char const * progname, char const * title,
+		POP3 * pop3, char const * answer, unsigned int id,
+		size_t deleted)
+{
+	int ret;
+	POP3Command * cmd;
+	AccountMessage * message;
+
+	printf("%s: Testing %s\n", progname, title);
+	if((message = _pop3_message_new(pop3, &pop3->inbox, 0)) == NULL
+			|| (cmd = _pop3_command(pop3, P3C_TRANSACTION_DELE,
+					"DELE 1")) == NULL)
+		return -1;
+	cmd->status = P3CS_SENT;
+	cmd->data.transaction_dele.id = 1;
+	cmd->data.transaction_dele.message = message;
+	if((ret = _pop3_feed(pop3, answer, strlen(answer))) == 0
+			&& (pop3->queue_cnt != 0 || message->id != id
+				|| pop3->deleted != deleted))
+		ret = -error_set_print(progname, 1, "%s",
+				"Unexpected deletion");
+	_pop3_reset(pop3);
+	pop3->deleted = 0;
+	return ret;
+}
+
+
+/* pop3_feed */
+static int _pop3_feed(POP3 * pop3, char const * buf, size_t cnt)
+{
+	char * p;
+
+	if((p = realloc(pop3->rd_buf, pop3->rd_buf_cnt + cnt)) == NULL)
+		return -1;
+	pop3->rd_buf = p;
+	memcpy(&pop3->rd_buf[pop3->rd_buf_cnt], buf, cnt);
+	pop3->rd_buf_cnt += cnt;
+	return _pop3_parse(pop3);
+}
+
+
+/* pop3_pipelining */
+static int _pop3_pipelining(char const * progname, char const * title,
+		POP3 * pop3, POP3Capability capabilities, POP3Context context,
+		int expected)
+{
+	int ret = 0;
+	POP3Command * cmd;
+
+	printf("%s: Testing %s\n", progname, title);
+	pop3->capabilities = capabilities;
+	if((cmd = _pop3_command(pop3, context,
+					(context == P3C_TRANSACTION_STAT)
+					? "STAT" : "RETR 2")) == NULL)
+		return -1;
+	cmd->status = P3CS_SENT;
+	if(_pop3_command(pop3, P3C_TRANSACTION_RETR, "RETR 1") == NULL
+			|| _pop3_command(pop3, P3C_TRANSACTION_DELE, "DELE 1")
+			== NULL)
+		ret = -1;
+	/* only the first command may be sent without pipelining */
+	else if((_pop3_queue_next(pop3) == &pop3->queue[1]) != expected)
+		ret = -error_set_print(progname, 1, "%s",
+				"Unexpected pipelining");
+	_pop3_reset(pop3);
+	pop3->capabilities = P3CAP_NONE;
+	return ret;
+}
+
+
+/* pop3_reset */
+static void _pop3_reset(POP3 * pop3)
+{
+	size_t i;
+
+	while(pop3->queue_cnt > 0)
+		_pop3_queue_pop(pop3);
+	free(pop3->rd_buf);
+	pop3->rd_buf = NULL;
+	pop3->rd_buf_cnt = 0;
+	g_hash_table_remove_all(pop3->uids);
+	for(i = 0; i < pop3->inbox.messages_cnt; i++)
+		_pop3_message_delete(pop3, pop3->inbox.messages[i]);
+	free(pop3->inbox.messages);
+	pop3->inbox.messages = NULL;
+	pop3->inbox.messages_cnt = 0;
+	if(pop3->state != NULL)
+		g_hash_table_remove_all(pop3->state);
+	pop3->state_pending = 0;
+	for(i = 0; i < sizeof(_helper_messages) / sizeof(*_helper_messages);
+			i++)
+		g_string_truncate(_helper_messages[i], 0);
+	_helper_completed = 0;
+	_helper_errors = 0;
+}
+
+
+/* pop3_state */
+static int _pop3_state(char const * progname, char const * title,
+		POP3 * pop3)
+{
+	int ret = 0;
+	char const * uids[] = { "uid1", "uid2", "uid3" };
+	char const headers[] = "Subject: 1\nFrom: test@example.com\n";
+	AccountMessage * message;
+	POP3State * state;
+	size_t i;
+	gchar * dirname;
+	gchar * basename;
+
+	printf("%s: Testing %s\n", progname, title);
+	g_hash_table_destroy(pop3->state);
+	if(_pop3_state_load(pop3, "test@example.com") != 0)
+		return -error_set_print(progname, 1, "%s", error_get(NULL));
+	for(i = 0; i < sizeof(uids) / sizeof(*uids); i++)
+	{
+		if((message = _pop3_message_new(pop3, &pop3->inbox, i + 1))
+				== NULL || (message->uid = strdup(uids[i]))
+				== NULL)
+			return -1;
+		g_hash_table_insert(pop3->uids, message->uid, message);
+	}
+	/* the third message is not known, and the fourth not listed */
+	if(_pop3_state_set(pop3, uids[0], 0x1234, headers, 0, NULL) != 0
+			|| _pop3_state_set(pop3, uids[1], 0xfedcba9876543210ULL,
+				"", 1234567890, "1024+2048") != 0
+			|| _pop3_state_set(pop3, "uid4", 1, headers, 0, NULL)
+			!= 0
+			|| _pop3_state_save(pop3) != 0)
+		return -error_set_print(progname, 1, "%s", error_get(NULL));
+	/* obtain the state again */
+	g_hash_table_destroy(pop3->state);
+	g_free(pop3->state_filename);
+	if(_pop3_state_load(pop3, "test@example.com") != 0)
+		ret = -error_set_print(progname, 1, "%s", error_get(NULL));
+	else if(g_hash_table_size(pop3->state) != 2
+			|| (state = g_hash_table_lookup(pop3->state, uids[0]))
+			== NULL || state->hash != 0x1234
+			|| state->stored != 0 || state->location != NULL
+			|| strcmp(state->headers, headers) != 0
+			|| (state = g_hash_table_lookup(pop3->state, uids[1]))
+			== NULL || state->hash != 0xfedcba9876543210ULL
+			|| state->stored != 1234567890
+			|| state->location == NULL
+			|| strcmp(state->location, "1024+2048") != 0
+			|| strcmp(state->headers, "") != 0)
+		ret = -error_set_print(progname, 1, "%s",
+				"Unexpected state");
+	unlink(pop3->state_filename);
+	/* the state is kept in its own directory */
+	dirname = g_path_get_dirname(pop3->state_filename);
+	rmdir(dirname);
+	rmdir(basename = g_path_get_dirname(dirname));
+	g_free(basename);
+	g_free(dirname);
+	_pop3_reset(pop3);
+	return ret;
+}
+
+
+/* pop3_transaction */
+static int _transaction_queue(POP3 * pop3, POP3Context context);
+
+static int _pop3_transaction(char const * progname, char const * title,
+		POP3 * pop3, POP3Context context, char const * answer,
+		unsigned int errors, char const * expected[3])
+{
+	int ret = 0;
+	size_t len = strlen(answer);
+	size_t i;
+	size_t j;
+	unsigned int completed = 0;
+	char uid[16];
+
+	printf("%s: Testing %s\n", progname, title);
+	/* only the bodies retrieved are complete */
+	for(j = 0; context == P3C_TRANSACTION_RETR && j < 3; j++)
+		if(expected[j][0] != '\0')
+			completed++;
+	/* split the answer at every position, then read it byte by byte */
+	for(i = 1; ret == 0 && i <= len; i++)
+	{
+		if(_transaction_queue(pop3, context) != 0)
+			return -1;
+		if(i < len)
+		{
+			ret |= _pop3_feed(pop3, answer, i);
+			ret |= _pop3_feed(pop3, &answer[i], len - i);
+		}
+		else
+			for(j = 0; j < len; j++)
+				ret |= _pop3_feed(pop3, &answer[j], 1);
+		if(ret != 0)
+			ret = -error_set_print(progname, 1, "%s (%lu)",
+					"Could not parse", (unsigned long)i);
+		else if(pop3->queue_cnt != 0 || pop3->rd_buf_cnt != 0)
+			ret = -error_set_print(progname, 1, "%s (%lu)",
+					"Incomplete answer", (unsigned long)i);
+		else if(_helper_errors != errors)
+			ret = -error_set_print(progname, 1, "%s (%lu)",
+					"Unexpected errors", (unsigned long)i);
+		else if(_helper_completed != completed)
+			ret = -error_set_print(progname, 1, "%s (%lu)",
+					"Unexpected bodies", (unsigned long)i);
+		for(j = 0; ret == 0 && j < 3; j++)
+			if(strcmp(_helper_messages[j + 1]->str, expected[j])
+					!= 0)
+				ret = -error_set_print(progname, 1,
+						"%s %lu (%lu)",
+						"Unexpected message",
+						(unsigned long)j + 1,
+						(unsigned long)i);
+		/* only the messages listed are remembered */
+		for(j = 0; ret == 0 && context == P3C_TRANSACTION_TOP && j < 3;
+				j++)
+		{
+			snprintf(uid, sizeof(uid), "uid%lu", (unsigned long)j
+					+ 1);
+			if((g_hash_table_lookup(pop3->state, uid) != NULL)
+					!= (expected[j][0] != '\0'))
+				ret = -error_set_print(progname, 1, "%s (%lu)",
+						"Unexpected state",
+						(unsigned long)i);
+		}
+		if(ret == 0 && pop3->state_pending != 0)
+			ret = -error_set_print(progname, 1, "%s (%lu)",
+					"Pending messages", (unsigned long)i);
+		_pop3_reset(pop3);
+	}
+	return ret;
+}
+
+static int _transaction_queue(POP3 * pop3, POP3Context context)
+{
+	POP3Command * cmd;
+	unsigned int id;
+	char buf[32];
+
+	/* every command is sent at once */
+	for(id = 1; id <= 3; id++)
+	{
+		if(context == P3C_TRANSACTION_TOP)
+			snprintf(buf, sizeof(buf), "%s %u 0", "TOP", id);
+		else
+			snprintf(buf, sizeof(buf), "%s %u", "RETR", id);
+		if((cmd = _pop3_command(pop3, context, buf)) == NULL)
+			return -1;
+		cmd->status = P3CS_SENT;
+		cmd->data.transaction_retr.id = id;
+		if(context != P3C_TRANSACTION_TOP)
+			continue;
+		/* new messages */
+		snprintf(buf, sizeof(buf), "uid%u", id);
+		cmd->data.transaction_top.uid = strdup(buf);
+		cmd->data.transaction_top.contents = g_string_new(NULL);
+		pop3->state_pending++;
+	}
+	return 0;
+}
+
+
+/* helpers */
+/* helper_error */
+static int _helper_error(Account * account, char const * message, int ret)
+{
+	_helper_errors++;
+	return ret;
+}
+
+
+/* helper_event */
+static void _helper_event(Account * account, AccountEvent * event)
+{
+}
+
+
+/* helper_message_delete */
+static void _helper_message_delete(Message * message)
+{
+}
+
+
+/* helper_message_new */
+static Message * _helper_message_new(Account * account, Folder * folder,
+		AccountMessage * message)
+{
+	return message;
+}
+
+
+/* helper_message_set_body */
+static int _helper_message_set_body(Message * message, char const * buf,
+		size_t cnt, int append)
+{
+	if(message->id < 1 || message->id > 3)
+		return -1;
+	g_string_append_len(_helper_messages[message->id], buf, cnt);
+	return 0;
+}
+
+
+/* helper_message_set_body_complete */
+static void _helper_message_set_body_complete(Message * message)
+{
+	_helper_completed++;
+}
+
+
+/* helper_message_set_header */
+static int _helper_message_set_header(Message * message, char const * header)
+{
+	if(message->id < 1 || message->id > 3)
+		return -1;
+	g_string_append(_helper_messages[message->id], header);
+	g_string_append_c(_helper_messages[message->id], '\n');
+	return 0;
+}
+
+
+/* main */
+int main(int argc, char * argv[])
+{
+	int ret = 0;
+	AccountPluginHelper helper;
+	POP3 pop3;
+	size_t i;
+	gchar * dirname;
+	char const retr[] = "+OK\r\nSubject: 1\r\n\r\n..\r\n...dots\r\n"
+		"bare\n.LF\r\n.x\r\n\r\n.\r\n"
+		"-ERR no such message\r\n"
+		"+OK 12 octets\r\nSubject: 3\r\n\r\nthree\r\n.\r\n";
+	char const * retr_expected[3] = { "Subject: 1\n.\r\n..dots\r\n"
+		"bare\n.LF\r\nx\r\n\r\n", "", "Subject: 3\nthree\r\n" };
+	char const top[] = "-ERR no such message\r\n"
+		"+OK\r\nSubject: 2\r\nTo: .\r\n\r\n.\r\n"
+		"+OK\r\nSubject: 3\r\n\r\n.\r\n";
+	char const * top_expected[3] = { "", "Subject: 2\nTo: .\n",
+		"Subject: 3\n" };
+
+	/* keep the state of the tests apart */
+	if((dirname = g_dir_make_tmp("pop3-XXXXXX", NULL)) == NULL)
+		return 2;
+	g_setenv("XDG_CACHE_HOME", dirname, TRUE);
+	memset(&helper, 0, sizeof(helper));
+	helper.error = _helper_error;
+	helper.event = _helper_event;
+	helper.message_delete = _helper_message_delete;
+	helper.message_new = _helper_message_new;
+	helper.message_set_body = _helper_message_set_body;
+	helper.message_set_body_complete = _helper_message_set_body_complete;
+	helper.message_set_header = _helper_message_set_header;
+	for(i = 0; i < sizeof(_helper_messages) / sizeof(*_helper_messages);
+			i++)
+		_helper_messages[i] = g_string_new(NULL);
+	memset(&pop3, 0, sizeof(pop3));
+	pop3.helper = &helper;
+	pop3.config = _pop3_config;
+	pop3.fd = -1;
+	pop3.uids = g_hash_table_new(g_str_hash, g_str_equal);
+	pop3.state = g_hash_table_new_full(g_str_hash, g_str_equal, free,
+			(GDestroyNotify)_pop3_state_delete);
+	pop3.channel = (GIOChannel *)-1; /* XXX */
+	pop3.wr_source = 1; /* XXX do not send anything */
+	ret |= _pop3_transaction(argv[0], "RETR", &pop3, P3C_TRANSACTION_RETR,
+			retr, 1, retr_expected);
+	ret |= _pop3_transaction(argv[0], "TOP", &pop3, P3C_TRANSACTION_TOP,
+			top, 1, top_expected);
+	ret |= _pop3_pipelining(argv[0], "PIPELINING (1/3)", &pop3,
+			P3CAP_NONE, P3C_TRANSACTION_RETR, 0);
+	ret |= _pop3_pipelining(argv[0], "PIPELINING (2/3)", &pop3,
+			P3CAP_PIPELINING, P3C_TRANSACTION_RETR, 1);
+	ret |= _pop3_pipelining(argv[0], "PIPELINING (3/3)", &pop3,
+			P3CAP_PIPELINING, P3C_TRANSACTION_STAT, 0);
+	ret |= _pop3_dele(argv[0], "DELE (1/2)", &pop3, "+OK\r\n", 0, 1);
+	ret |= _pop3_dele(argv[0], "DELE (2/2)", &pop3, "-ERR locked\r\n", 1,
+			0);
+	ret |= _pop3_state(argv[0], "state", &pop3);
+	pop3.wr_source = 0;
+	pop3.channel = NULL;
+	_pop3_reset(&pop3);
+	g_hash_table_destroy(pop3.state);
+	g_free(pop3.state_filename);
+	g_hash_table_destroy(pop3.uids);
+	free(pop3.queue);
+	for(i = 0; i < sizeof(_helper_messages) / sizeof(*_helper_messages);
+			i++)
+		g_string_free(_helper_messages[i], TRUE);
+	rmdir(dirname);
+	g_free(dirname);
+	return (ret == 0) ? 0 : 2;
+}
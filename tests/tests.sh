@@ -111,11 +111,16 @@ target="$1"
 $DATE > "$target"
 FAILED=
 echo "Performing tests:" 1>&2
+_test "body"
+_test "codec"
 _test "date"
 _test "email"
+_test "folder"
 _test "imap4"
+_test "message"
 _test "pkgconfig.sh"
 _test "plugins"
+_test "pop3"
 echo "Expected failures:" 1>&2
 if [ -n "$FAILED" ]; then
 	echo "Failed tests:$FAILED" 1>&2